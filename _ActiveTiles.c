@@ -0,0 +1,108 @@
+#include "_ActiveTiles.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// @brief Creates the tiles of a matrix, all of them active for the first step
+/// @param X number of lines of the matrix
+/// @param Y number of columns of the matrix
+/// @param tile_size side of the tiles in cells
+/// @param epsilon change below which a tile and its neighbours are skipped
+/// @return the tiles, NULL if error
+ActiveTiles *active_tiles_create(int X, int Y, int tile_size, double epsilon)
+{
+	ActiveTiles *self = (ActiveTiles *)calloc(1, sizeof(ActiveTiles));
+	if (self == NULL)
+	{
+		perror("Error allocating memory for 'ActiveTiles'\n");
+		return NULL;
+	}
+	self->X = X;
+	self->Y = Y;
+	self->tile_size = tile_size;
+	self->epsilon = epsilon;
+	self->tile_lines = (X + tile_size - 1) / tile_size;
+	self->tile_columns = (Y + tile_size - 1) / tile_size;
+	self->tile_count = self->tile_lines * self->tile_columns;
+
+	self->changes = (double *)calloc(self->tile_count + 1, sizeof(double));
+	self->active = (int *)malloc(sizeof(int) * (self->tile_count + 1));
+	self->retired = (int *)malloc(sizeof(int) * (self->tile_count + 1));
+	if (self->changes == NULL || self->active == NULL || self->retired == NULL)
+	{
+		perror("Error allocating memory for the active tiles\n");
+		active_tiles_free(self);
+		return NULL;
+	}
+	for (int tile = 0; tile < self->tile_count; tile++)
+		self->active[tile] = tile;
+	self->active_count = self->tile_count;
+	return self;
+}
+
+/// @brief Returns the cells [first_line, stop_line) x [first_column, stop_column) of a tile
+void active_tiles_bounds(ActiveTiles *self, int tile, int *first_line, int *stop_line, int *first_column,
+						 int *stop_column)
+{
+	*first_line = tile / self->tile_columns * self->tile_size;
+	*first_column = tile % self->tile_columns * self->tile_size;
+	*stop_line = *first_line + self->tile_size < self->X ? *first_line + self->tile_size : self->X;
+	*stop_column = *first_column + self->tile_size < self->Y ? *first_column + self->tile_size : self->Y;
+}
+
+/// @brief Lists the tiles of the next step from the changes of the step just computed, like the
+// temperature_active_tiles kernel, with the tiles computed by that step that the next one retires,
+// then clears the changes for the next step
+void active_tiles_update(ActiveTiles *self)
+{
+	self->computed_tiles += self->active_count;
+	self->steps++;
+
+	self->active_count = 0;
+	self->retired_count = 0;
+	for (int tile_line = 0; tile_line < self->tile_lines; tile_line++)
+	{
+		for (int tile_column = 0; tile_column < self->tile_columns; tile_column++)
+		{
+			double change = 0.0;
+			for (int i = tile_line - 1; i <= tile_line + 1; i++)
+			{
+				if (i < 0 || i >= self->tile_lines)
+					continue;
+				for (int j = tile_column - 1; j <= tile_column + 1; j++)
+				{
+					if (j < 0 || j >= self->tile_columns)
+						continue;
+					double neighbour_change = self->changes[i * self->tile_columns + j];
+					change = neighbour_change > change ? neighbour_change : change;
+				}
+			}
+			int tile = tile_line * self->tile_columns + tile_column;
+			if (change >= self->epsilon)
+				self->active[self->active_count++] = tile;
+			else if (self->changes[tile] >= 0.0)
+				self->retired[self->retired_count++] = tile;
+		}
+	}
+	for (int tile = 0; tile < self->tile_count; tile++)
+		self->changes[tile] = -1.0;
+}
+
+/// @brief Returns the largest difference of a fluid cell from a full computation after
+// iterations steps with tiles skipped below epsilon, see _ActiveTiles.h
+double active_tiles_error_bound(double epsilon, int iterations)
+{
+	return epsilon * iterations;
+}
+
+/// @brief Frees the tiles
+void active_tiles_free(ActiveTiles *self)
+{
+	if (self == NULL)
+		return;
+	free(self->changes);
+	free(self->active);
+	free(self->retired);
+	free(self);
+}
@@ -0,0 +1,51 @@
+#ifndef ACTIVE_TILES_H
+#define ACTIVE_TILES_H
+
+/* Side of the square tiles and change below which a tile is skipped, by default */
+#define ACTIVE_TILES_DEFAULT_SIZE 16
+#define ACTIVE_TILES_DEFAULT_EPSILON 1e-9
+
+/* Activity of the square tiles of a matrix, for grids where only a small region still changes.
+A step only computes the active tiles. After a step a tile stays active if the largest change of
+its fluid cells or of those of one of its 8 neighbour tiles is at least epsilon, so a skipped tile
+is woken up as soon as a change crossing the threshold reaches a neighbour. The two matrices swap
+roles every step, so a tile that stops being computed holds its last values in one and those of
+the step before in the other: the first step that skips it copies it over, and from then on it
+keeps its values in both matrices.
+
+Error bound: a step averages the 3x3 neighbourhood of a cell and scales it by 1 - decay_rate, so
+the change of a cell over a step is at most the largest change of its neighbourhood over the
+previous step, and two matrices that differ by at most e still differ by at most e after a step.
+A skipped cell therefore lags the full computation by less than epsilon per skipped step and the
+lag is never amplified: after n iterations the fluid cells are within n * epsilon of a full
+computation, see active_tiles_error_bound() */
+typedef struct ActiveTiles
+{
+	int X, Y;
+	int tile_size;
+	// Tiles over the lines and over the columns, those of the last line and column may be cut
+	int tile_lines, tile_columns;
+	int tile_count;
+	double epsilon;
+	// Largest change of a fluid cell of every tile over the last step, -1 for the skipped tiles
+	double *changes;
+	// Tiles computed by the next step, active_count of them in increasing order
+	int *active;
+	int active_count;
+	// Tiles computed by the last step and skipped by the next one, which copies them into its
+	// destination matrix
+	int *retired;
+	int retired_count;
+	// Sum of active_count over the steps, to report the work saved
+	long computed_tiles;
+	int steps;
+} ActiveTiles;
+
+ActiveTiles *active_tiles_create(int X, int Y, int tile_size, double epsilon);
+void active_tiles_bounds(ActiveTiles *self, int tile, int *first_line, int *stop_line, int *first_column,
+						 int *stop_column);
+void active_tiles_update(ActiveTiles *self);
+double active_tiles_error_bound(double epsilon, int iterations);
+void active_tiles_free(ActiveTiles *self);
+
+#endif
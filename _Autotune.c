@@ -0,0 +1,275 @@
+#include "_Autotune.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "_Precision.h"
+
+static const char *kernel_names[] = {"linear", "tiled", "temporal"};
+
+// Shapes tried by the sweep, the temporal kernel also tries each of its steps per launch
+static const size_t linear_groups[] = {32, 64, 128, 256};
+static const size_t linear_waves[] = {2, 8, 32};
+static const size_t tiled_shapes[][2] = {{8, 8}, {16, 8}, {16, 16}, {32, 4}, {32, 8}, {32, 16}, {64, 4}};
+static const size_t temporal_shapes[][2] = {{16, 16}, {32, 8}, {32, 16}};
+static const int temporal_steps[] = {2, 4, 8};
+
+#define COUNT(array) (sizeof(array) / sizeof(array[0]))
+
+/// @brief Returns the name of a kernel variant in the profile file
+const char *autotune_kernel_name(int kernel_variant)
+{
+	return kernel_names[kernel_variant];
+}
+
+/// @brief Returns the class of a grid size, grids of the same class share a profile
+int autotune_size_class(int X, int Y)
+{
+	return (int)floor(log2(fmax(1.0, (double)X * Y)));
+}
+
+/// @brief Writes the key of a device in the profile file, its name and driver version
+void autotune_device_key(cl_device_id deviceid, char *key, size_t size)
+{
+	char name[256], driver[256];
+	int rc = clGetDeviceInfo(deviceid, CL_DEVICE_NAME, sizeof(name), name, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clGetDeviceInfo(deviceid, CL_DRIVER_VERSION, sizeof(driver), driver, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	snprintf(key, size, "%s|%s", name, driver);
+}
+
+/// @brief Returns the workers of the linear kernel of a profile over a grid: one per cell up to
+// AUTOTUNE_DEFAULT_MAX_WORKERS, or worker_waves groups per compute unit but no more than that
+/// @param compute_units compute units of the device, unused for one worker per cell
+size_t autotune_worker_count(LaunchProfile *profile, int X, int Y, cl_uint compute_units)
+{
+	size_t group = profile->worker_group_size;
+	size_t cells = fmin((double)X * Y, AUTOTUNE_DEFAULT_MAX_WORKERS);
+	size_t count = (cells + group - 1) / group * group;
+	if (profile->worker_waves > 0 && compute_units * group * profile->worker_waves < count)
+		count = compute_units * group * profile->worker_waves;
+	return count;
+}
+
+/// @brief Fills in the geometry of an untuned run: the linear kernel with one worker per cell
+void autotune_default_profile(int X, int Y, size_t max_work_group_size, LaunchProfile *profile)
+{
+	memset(profile, 0, sizeof(*profile));
+	profile->kernel_variant = AUTOTUNE_KERNEL_LINEAR;
+	profile->worker_group_size = fmin(AUTOTUNE_DEFAULT_GROUP, max_work_group_size);
+	profile->worker_waves = 0;
+	profile->worker_count = autotune_worker_count(profile, X, Y, 0);
+	profile->tile_width = 16;
+	profile->tile_height = 16;
+	profile->steps_per_launch = 1;
+}
+
+/// @brief Appends a candidate to the sweep
+/// @return 1 if error, 0 if no error
+static int add_candidate(LaunchProfile **candidates, int *count, LaunchProfile *candidate)
+{
+	LaunchProfile *grown = (LaunchProfile *)realloc(*candidates, sizeof(LaunchProfile) * (*count + 1));
+	if (grown == NULL)
+	{
+		perror("Error allocating memory for the autotune candidates\n");
+		return 1;
+	}
+	*candidates = grown;
+	(*candidates)[(*count)++] = *candidate;
+	return 0;
+}
+
+/// @brief Lists the launch geometries of the sweep that the device can run: group sizes and
+// worker counts of the linear kernel, work group shapes of the tiled kernel and shapes and steps
+// per launch of the temporal kernel, within the work group and local memory limits
+/// @param real_bytes size of the values the kernels compute with, see precision_real_bytes()
+/// @param candidates allocated and filled in
+/// @return the number of candidates, -1 if error
+int autotune_candidates(cl_device_id deviceid, int X, int Y, size_t real_bytes, LaunchProfile **candidates)
+{
+	size_t max_work_group_size;
+	cl_ulong local_memory;
+	cl_uint compute_units;
+	int rc = clGetDeviceInfo(deviceid, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(max_work_group_size), &max_work_group_size, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clGetDeviceInfo(deviceid, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(local_memory), &local_memory, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clGetDeviceInfo(deviceid, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(compute_units), &compute_units, NULL);
+	handleError(rc, __LINE__, __FILE__);
+
+	*candidates = NULL;
+	int count = 0;
+	size_t cells = (size_t)X * Y;
+	LaunchProfile candidate;
+	autotune_default_profile(X, Y, max_work_group_size, &candidate);
+
+	for (size_t g = 0; g < COUNT(linear_groups); g++)
+	{
+		size_t group = linear_groups[g];
+		if (group > max_work_group_size)
+			continue;
+		candidate.worker_group_size = group;
+		// One worker per cell, then a few waves of groups per compute unit striding over the cells
+		candidate.worker_waves = 0;
+		candidate.worker_count = autotune_worker_count(&candidate, X, Y, compute_units);
+		if (add_candidate(candidates, &count, &candidate))
+			return -1;
+		for (size_t w = 0; w < COUNT(linear_waves); w++)
+		{
+			candidate.worker_waves = linear_waves[w];
+			candidate.worker_count = autotune_worker_count(&candidate, X, Y, compute_units);
+			if (compute_units * group * linear_waves[w] < cells && add_candidate(candidates, &count, &candidate))
+				return -1;
+		}
+	}
+
+	autotune_default_profile(X, Y, max_work_group_size, &candidate);
+	candidate.kernel_variant = AUTOTUNE_KERNEL_TILED;
+	for (size_t s = 0; s < COUNT(tiled_shapes); s++)
+	{
+		size_t width = tiled_shapes[s][0], height = tiled_shapes[s][1];
+		size_t tile_bytes = (real_bytes + sizeof(char)) * (width + 2) * (height + 2);
+		if (width * height > max_work_group_size || tile_bytes > local_memory)
+			continue;
+		candidate.tile_width = width;
+		candidate.tile_height = height;
+		if (add_candidate(candidates, &count, &candidate))
+			return -1;
+	}
+
+	candidate.kernel_variant = AUTOTUNE_KERNEL_TEMPORAL;
+	for (size_t s = 0; s < COUNT(temporal_shapes); s++)
+	{
+		for (size_t k = 0; k < COUNT(temporal_steps); k++)
+		{
+			size_t width = temporal_shapes[s][0], height = temporal_shapes[s][1];
+			size_t halo = 2 * temporal_steps[k];
+			size_t tile_bytes = (2 * real_bytes + sizeof(char)) * (width + halo) * (height + halo);
+			if (width * height > max_work_group_size || tile_bytes > local_memory)
+				continue;
+			candidate.tile_width = width;
+			candidate.tile_height = height;
+			candidate.steps_per_launch = temporal_steps[k];
+			if (add_candidate(candidates, &count, &candidate))
+				return -1;
+		}
+	}
+	return count;
+}
+
+/// @brief Parses a line of the profile file, the worker count is left to autotune_worker_count()
+/// @return 1 if the line is not a profile, 0 if no error
+static int parse_profile(char *line, int *size_class, int *precision, char **device_key, LaunchProfile *profile)
+{
+	char precision_text[16], kernel_text[16], workers_text[16];
+	int key_offset;
+	memset(profile, 0, sizeof(*profile));
+	if (sscanf(line, "%d %15s %15s %15s %zu %zux%zu %d %lf %n", size_class, precision_text, kernel_text, workers_text,
+			   &profile->worker_group_size, &profile->tile_width, &profile->tile_height, &profile->steps_per_launch,
+			   &profile->cells_per_second, &key_offset) != 9)
+		return 1;
+	// Profiles of older versions stored an absolute worker count and are skipped
+	int workers_length = 0;
+	if (strcmp(workers_text, "cells") != 0 &&
+		(sscanf(workers_text, "%zuw%n", &profile->worker_waves, &workers_length) != 1 ||
+		 workers_length != (int)strlen(workers_text) || profile->worker_waves == 0))
+		return 1;
+	*precision = precision_parse(precision_text);
+	profile->kernel_variant = -1;
+	for (int k = 0; k < (int)COUNT(kernel_names); k++)
+		if (strcmp(kernel_text, kernel_names[k]) == 0)
+			profile->kernel_variant = k;
+	if (*precision < 0 || profile->kernel_variant < 0 || profile->worker_group_size == 0 || profile->tile_width == 0 ||
+		profile->tile_height == 0 || profile->steps_per_launch < 1)
+		return 1;
+	*device_key = line + key_offset;
+	(*device_key)[strcspn(*device_key, "\r\n")] = '\0';
+	return 0;
+}
+
+/// @brief Writes a profile as a line of the profile file
+static void write_profile(FILE *fptr, int size_class, int precision, char *device_key, LaunchProfile *profile)
+{
+	char workers_text[32] = "cells";
+	if (profile->worker_waves > 0)
+		snprintf(workers_text, sizeof(workers_text), "%zuw", profile->worker_waves);
+	fprintf(fptr, "%d %s %s %s %zu %zux%zu %d %.6e %s\n", size_class, precision_name(precision),
+			kernel_names[profile->kernel_variant], workers_text, profile->worker_group_size, profile->tile_width,
+			profile->tile_height, profile->steps_per_launch, profile->cells_per_second, device_key);
+}
+
+/// @brief Looks up the profile of a device and precision with the size class closest to
+// size_class, the larger class on a tie
+/// @return 1 if there is none, 0 if found
+int autotune_load(char *file_name, char *device_key, int precision, int size_class, LaunchProfile *profile)
+{
+	FILE *fptr = fopen(file_name, "r");
+	if (fptr == NULL)
+		return 1;
+
+	char line[AUTOTUNE_LINE_LENGTH];
+	int best_distance = -1, best_class = 0;
+	while (fgets(line, sizeof(line), fptr) != NULL)
+	{
+		int line_class, line_precision;
+		char *line_key;
+		LaunchProfile line_profile;
+		if (parse_profile(line, &line_class, &line_precision, &line_key, &line_profile) ||
+			line_precision != precision || strcmp(line_key, device_key) != 0)
+			continue;
+		int distance = abs(line_class - size_class);
+		if (best_distance < 0 || distance < best_distance || (distance == best_distance && line_class > best_class))
+		{
+			best_distance = distance;
+			best_class = line_class;
+			*profile = line_profile;
+		}
+	}
+	fclose(fptr);
+	return best_distance < 0;
+}
+
+/// @brief Stores the profile of a device, precision and size class, replacing an earlier one. The
+// file is written aside and renamed so that concurrent runs never read half of it
+/// @return 1 if error, 0 if no error
+int autotune_store(char *file_name, char *device_key, int precision, int size_class, LaunchProfile *profile)
+{
+	char tmp_name[4096];
+	snprintf(tmp_name, sizeof(tmp_name), "%s.%ld.tmp", file_name, (long)getpid());
+	FILE *out = fopen(tmp_name, "w");
+	if (out == NULL)
+	{
+		perror("Error opening the profile file!\n");
+		return 1;
+	}
+
+	FILE *in = fopen(file_name, "r");
+	if (in != NULL)
+	{
+		char line[AUTOTUNE_LINE_LENGTH], parsed[AUTOTUNE_LINE_LENGTH];
+		while (fgets(line, sizeof(line), in) != NULL)
+		{
+			int line_class, line_precision;
+			char *line_key;
+			LaunchProfile line_profile;
+			strcpy(parsed, line);
+			if (parse_profile(parsed, &line_class, &line_precision, &line_key, &line_profile) == 0 &&
+				line_class == size_class && line_precision == precision && strcmp(line_key, device_key) == 0)
+				continue;
+			fputs(line, out);
+		}
+		fclose(in);
+	}
+	write_profile(out, size_class, precision, device_key, profile);
+	if (fclose(out) != 0 || rename(tmp_name, file_name) != 0)
+	{
+		perror("Error writing the profile file!\n");
+		remove(tmp_name);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,55 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <stddef.h>
+
+#include "_OpenCLUtil.h"
+
+/* Launch profiles: the fastest launch geometry found by `benchmark --autotune` for a device, a
+precision and a class of grid sizes, read back by homework when no geometry is given.
+
+The profile file holds one profile per line:
+size_class precision kernel workers worker_group_size WxH steps_per_launch cells_per_second device
+where the size class is floor(log2(X * Y)) and the device is its name and driver version, to the
+end of the line. A run takes the profile of its device and precision with the closest size
+class. Storing a profile replaces the one of the same device, precision and class.
+
+The workers of the linear kernel are stored relative to the device, since the run may be several
+size classes away from the tuning grid: `cells` for one worker per cell, or Nw for N groups per
+compute unit. autotune_worker_count() turns them into a count for the grid of the run */
+#define AUTOTUNE_DEFAULT_PROFILE ".launch_profiles"
+#define AUTOTUNE_LINE_LENGTH 1024
+
+#define AUTOTUNE_KERNEL_LINEAR 0
+#define AUTOTUNE_KERNEL_TILED 1
+#define AUTOTUNE_KERNEL_TEMPORAL 2
+
+// Geometry of untuned runs: groups of AUTOTUNE_DEFAULT_GROUP, one worker per cell up to
+// AUTOTUNE_DEFAULT_MAX_WORKERS
+#define AUTOTUNE_DEFAULT_GROUP 64
+#define AUTOTUNE_DEFAULT_MAX_WORKERS (1 << 20)
+
+typedef struct LaunchProfile
+{
+	int kernel_variant;
+	// Groups per compute unit of the linear kernel, 0 for one worker per cell
+	size_t worker_waves;
+	// Range of the linear kernel over the grid the profile is used on, see autotune_worker_count()
+	size_t worker_count, worker_group_size;
+	// Work group of the tiled and temporal kernels, over the columns and over the lines
+	size_t tile_width, tile_height;
+	int steps_per_launch;
+	// Measured on the tuning grid
+	double cells_per_second;
+} LaunchProfile;
+
+const char *autotune_kernel_name(int kernel_variant);
+int autotune_size_class(int X, int Y);
+void autotune_device_key(cl_device_id deviceid, char *key, size_t size);
+size_t autotune_worker_count(LaunchProfile *profile, int X, int Y, cl_uint compute_units);
+void autotune_default_profile(int X, int Y, size_t max_work_group_size, LaunchProfile *profile);
+int autotune_candidates(cl_device_id deviceid, int X, int Y, size_t real_bytes, LaunchProfile **candidates);
+int autotune_load(char *file_name, char *device_key, int precision, int size_class, LaunchProfile *profile);
+int autotune_store(char *file_name, char *device_key, int precision, int size_class, LaunchProfile *profile);
+
+#endif
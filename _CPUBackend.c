@@ -0,0 +1,618 @@
+#include "_CPUBackend.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPU_BACKEND_X86
+#endif
+
+/* A band of rows computed by one thread of the pool */
+typedef struct CPUWorker
+{
+	CPUBackend *backend;
+	pthread_t thread;
+	// First row of the band
+	int start_row;
+	// One past the last row of the band
+	int stop_row;
+	// Range of the fluid index computed in sparse mode
+	int start_cell, stop_cell;
+	// Vertical sums of the current row, Y + 2 values with a zero column on each side
+	double *column_sums;
+	// Lines of the fluid mask expanded to 1.0 for fluid cells and 0.0 for the rest, line i in
+	// slot i % 3 so that the three lines of a row are there together
+	double *mask_lines;
+	int mask_line_index[3];
+	// Statistics of the band, see _Statistics.h
+	double statistics[STATISTICS_FIELDS];
+} CPUWorker;
+
+#define CPU_JOB_STEP 0		 // compute an iteration from src_matrix into dst_matrix
+#define CPU_JOB_STATISTICS 1 // reduce the statistics of src_matrix
+#define CPU_JOB_STEP_LINES 2 // compute the lines [first_line, stop_line) from src_matrix into dst_matrix
+#define CPU_JOB_CHANGE 3	 // reduce the statistics of the change from dst_matrix to src_matrix
+
+typedef void (*ComputeRowFunction)(CPUBackend *self, CPUWorker *worker, int line_index);
+
+struct CPUBackend
+{
+	// Matrix dimensions, X lines of Y columns
+	int X, Y;
+	// Fluid mask of the matrix, see _TypeMask.h, only fluid cells are updated
+	uint32_t *fluid_bits;
+	double decay_rate;
+
+	// The geometry never changes, so this is computed once:
+	// (1 - decay_rate) / number of fluid neighbours for fluid cells, 0.0 for the rest
+	double *cell_scale;
+	// A row of zeros standing for the lines outside the matrix
+	double *zero_row;
+	// compute_row_scalar or compute_row_avx2, picked with CPUID
+	ComputeRowFunction compute_row;
+	// When set, only the listed fluid cells are computed
+	FluidIndex *fluid_index;
+	// When set, only the active tiles are computed
+	ActiveTiles *active_tiles;
+
+	// Job run by the pool, CPU_JOB_STEP or CPU_JOB_STATISTICS, and its matrices
+	int job;
+	double *src_matrix;
+	double *dst_matrix;
+	// Lines of CPU_JOB_STEP_LINES, split evenly between the threads
+	int first_line, stop_line;
+
+	// Thread pool, worker 0 is run by the calling thread
+	int thread_count;
+	// Allocated workers, more than thread_count if a thread could not be started
+	int worker_capacity;
+	CPUWorker *workers;
+	pthread_mutex_t lock;
+	pthread_cond_t start_cond;
+	pthread_cond_t done_cond;
+	// Incremented for every step, workers wait for it to change
+	unsigned long generation;
+	// Workers that still have to finish the current step
+	int pending;
+	int shutdown;
+};
+
+/// @brief Returns the number of online processor cores
+int cpu_core_count()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (int)count : 1;
+#endif
+}
+
+/// @brief Counts the fluid cells of the 3x3 neighbourhood, the cell itself included, like
+// calculate_temperature() from homework.cl does on every iteration
+static int count_fluid_neighbours(CPUBackend *self, int line_index, int column_index)
+{
+	int sum_counter = 0;
+
+	for (int i = line_index - 1; i <= line_index + 1; i++)
+	{
+		if (i < 0 || i >= self->X)
+			continue;
+		for (int j = column_index - 1; j <= column_index + 1; j++)
+		{
+			if (j < 0 || j >= self->Y)
+				continue;
+			if (TYPE_MASK_IS_FLUID(self->fluid_bits, i * self->Y + j))
+				sum_counter++;
+		}
+	}
+	return sum_counter;
+}
+
+/// @brief Fills cell_scale from the fluid mask
+static void precompute_geometry(CPUBackend *self)
+{
+	for (int i = 0; i < self->X; i++)
+	{
+		for (int j = 0; j < self->Y; j++)
+		{
+			int temp_index = i * self->Y + j;
+			if (!TYPE_MASK_IS_FLUID(self->fluid_bits, temp_index))
+			{
+				self->cell_scale[temp_index] = 0.0;
+				continue;
+			}
+			self->cell_scale[temp_index] = (1.0 - self->decay_rate) / count_fluid_neighbours(self, i, j);
+		}
+	}
+}
+
+/// @brief Returns the offset of a line of the matrix, or of the zero row if outside of it
+static double *line_or_zero(CPUBackend *self, double *values, int line_index)
+{
+	if (line_index < 0 || line_index >= self->X)
+		return self->zero_row;
+	return values + (long)line_index * self->Y;
+}
+
+/// @brief Returns a line of the fluid mask expanded to doubles, from the cache of the worker, or
+// the zero row if outside of the matrix
+static double *mask_line(CPUBackend *self, CPUWorker *worker, int line_index)
+{
+	if (line_index < 0 || line_index >= self->X)
+		return self->zero_row;
+	int slot = line_index % 3;
+	double *line = worker->mask_lines + (long)slot * self->Y;
+	if (worker->mask_line_index[slot] != line_index)
+	{
+		long first = (long)line_index * self->Y;
+		for (int j = 0; j < self->Y; j++)
+			line[j] = TYPE_MASK_IS_FLUID(self->fluid_bits, first + j) ? 1.0 : 0.0;
+		worker->mask_line_index[slot] = line_index;
+	}
+	return line;
+}
+
+/// @brief Computes one line without branches: the masked values of the three lines are summed
+// vertically into column_sums, then three neighbouring column sums give the sum of the 3x3
+// neighbourhood. Non-fluid cells have a zero scale and keep their value
+static void compute_row_scalar(CPUBackend *self, CPUWorker *worker, int line_index)
+{
+	int Y = self->Y;
+	double *src_up = line_or_zero(self, self->src_matrix, line_index - 1);
+	double *src_mid = line_or_zero(self, self->src_matrix, line_index);
+	double *src_down = line_or_zero(self, self->src_matrix, line_index + 1);
+	double *mask_up = mask_line(self, worker, line_index - 1);
+	double *mask_mid = mask_line(self, worker, line_index);
+	double *mask_down = mask_line(self, worker, line_index + 1);
+	double *scale = self->cell_scale + (long)line_index * Y;
+	double *dst = self->dst_matrix + (long)line_index * Y;
+	double *column_sums = worker->column_sums + 1;
+
+	for (int j = 0; j < Y; j++)
+		column_sums[j] = mask_up[j] * src_up[j] + mask_mid[j] * src_mid[j] + mask_down[j] * src_down[j];
+
+	for (int j = 0; j < Y; j++)
+	{
+		double temp_sum = column_sums[j - 1] + column_sums[j] + column_sums[j + 1];
+		dst[j] = temp_sum * scale[j] + src_mid[j] * (1.0 - mask_mid[j]);
+	}
+}
+
+#ifdef CPU_BACKEND_X86
+/// @brief AVX2 version of compute_row_scalar(), four cells per instruction
+__attribute__((target("avx2,fma"))) static void compute_row_avx2(CPUBackend *self, CPUWorker *worker, int line_index)
+{
+	int Y = self->Y;
+	double *src_up = line_or_zero(self, self->src_matrix, line_index - 1);
+	double *src_mid = line_or_zero(self, self->src_matrix, line_index);
+	double *src_down = line_or_zero(self, self->src_matrix, line_index + 1);
+	double *mask_up = mask_line(self, worker, line_index - 1);
+	double *mask_mid = mask_line(self, worker, line_index);
+	double *mask_down = mask_line(self, worker, line_index + 1);
+	double *scale = self->cell_scale + (long)line_index * Y;
+	double *dst = self->dst_matrix + (long)line_index * Y;
+	double *column_sums = worker->column_sums + 1;
+	__m256d one = _mm256_set1_pd(1.0);
+	int j;
+
+	for (j = 0; j + 4 <= Y; j += 4)
+	{
+		__m256d sum = _mm256_mul_pd(_mm256_loadu_pd(mask_up + j), _mm256_loadu_pd(src_up + j));
+		sum = _mm256_fmadd_pd(_mm256_loadu_pd(mask_mid + j), _mm256_loadu_pd(src_mid + j), sum);
+		sum = _mm256_fmadd_pd(_mm256_loadu_pd(mask_down + j), _mm256_loadu_pd(src_down + j), sum);
+		_mm256_storeu_pd(column_sums + j, sum);
+	}
+	for (; j < Y; j++)
+		column_sums[j] = mask_up[j] * src_up[j] + mask_mid[j] * src_mid[j] + mask_down[j] * src_down[j];
+
+	for (j = 0; j + 4 <= Y; j += 4)
+	{
+		__m256d sum = _mm256_add_pd(_mm256_loadu_pd(column_sums + j - 1), _mm256_loadu_pd(column_sums + j));
+		sum = _mm256_add_pd(sum, _mm256_loadu_pd(column_sums + j + 1));
+		__m256d keep = _mm256_mul_pd(_mm256_loadu_pd(src_mid + j), _mm256_sub_pd(one, _mm256_loadu_pd(mask_mid + j)));
+		_mm256_storeu_pd(dst + j, _mm256_fmadd_pd(sum, _mm256_loadu_pd(scale + j), keep));
+	}
+	for (; j < Y; j++)
+	{
+		double temp_sum = column_sums[j - 1] + column_sums[j] + column_sums[j + 1];
+		dst[j] = temp_sum * scale[j] + src_mid[j] * (1.0 - mask_mid[j]);
+	}
+}
+#endif
+
+/// @brief Computes a range of the fluid index, like temperature_step_sparse()
+static void compute_fluid_cells(CPUBackend *self, CPUWorker *worker)
+{
+	FluidIndex *index = self->fluid_index;
+	for (int k = worker->start_cell; k < worker->stop_cell; k++)
+	{
+		int start = index->neighbour_offsets[k];
+		int stop = index->neighbour_offsets[k + 1];
+
+		double temp_sum = 0.0;
+		for (int n = start; n < stop; n++)
+			temp_sum += self->src_matrix[index->neighbour_cells[n]];
+
+		double new_value = temp_sum / (stop - start);
+		self->dst_matrix[index->fluid_cells[k]] = new_value - new_value * self->decay_rate;
+	}
+}
+
+/// @brief Computes the active tiles of the worker, taken in turn by the threads, and records the
+// largest change of a fluid cell of each of them. The retired tiles are copied instead, see
+// _ActiveTiles.h
+static void compute_active_tiles(CPUBackend *self, CPUWorker *worker)
+{
+	ActiveTiles *tiles = self->active_tiles;
+	int Y = self->Y;
+	for (int k = (int)(worker - self->workers); k < tiles->retired_count; k += self->thread_count)
+	{
+		int first_line, stop_line, first_column, stop_column;
+		active_tiles_bounds(tiles, tiles->retired[k], &first_line, &stop_line, &first_column, &stop_column);
+		for (int i = first_line; i < stop_line; i++)
+			memcpy(self->dst_matrix + (long)i * Y + first_column, self->src_matrix + (long)i * Y + first_column,
+				   sizeof(double) * (stop_column - first_column));
+	}
+	for (int k = (int)(worker - self->workers); k < tiles->active_count; k += self->thread_count)
+	{
+		int tile = tiles->active[k];
+		int first_line, stop_line, first_column, stop_column;
+		active_tiles_bounds(tiles, tile, &first_line, &stop_line, &first_column, &stop_column);
+
+		double change = 0.0;
+		for (int i = first_line; i < stop_line; i++)
+		{
+			double *src_up = line_or_zero(self, self->src_matrix, i - 1);
+			double *src_mid = line_or_zero(self, self->src_matrix, i);
+			double *src_down = line_or_zero(self, self->src_matrix, i + 1);
+			double *mask_up = mask_line(self, worker, i - 1);
+			double *mask_mid = mask_line(self, worker, i);
+			double *mask_down = mask_line(self, worker, i + 1);
+			for (int j = first_column; j < stop_column; j++)
+			{
+				if (mask_mid[j] == 0.0)
+					continue;
+				double temp_sum = 0.0;
+				for (int dj = j > 0 ? -1 : 0; dj <= (j + 1 < Y ? 1 : 0); dj++)
+					temp_sum += mask_up[j + dj] * src_up[j + dj] + mask_mid[j + dj] * src_mid[j + dj] +
+								mask_down[j + dj] * src_down[j + dj];
+				double new_value = temp_sum * self->cell_scale[(long)i * Y + j];
+				double cell_change = new_value > src_mid[j] ? new_value - src_mid[j] : src_mid[j] - new_value;
+				change = cell_change > change ? cell_change : change;
+				self->dst_matrix[(long)i * Y + j] = new_value;
+			}
+		}
+		tiles->changes[tile] = change;
+	}
+}
+
+/// @brief Reduces the statistics of the fluid cells of one band, like temperature_statistics()
+static void reduce_band(CPUBackend *self, CPUWorker *worker)
+{
+	statistics_reset(worker->statistics);
+	if (self->job == CPU_JOB_CHANGE && self->fluid_index != NULL)
+		statistics_accumulate_change_cells(worker->statistics, self->src_matrix, self->dst_matrix,
+										   self->fluid_index->fluid_cells, worker->start_cell, worker->stop_cell);
+	else if (self->job == CPU_JOB_CHANGE)
+		statistics_accumulate_change(worker->statistics, self->src_matrix, self->dst_matrix, self->fluid_bits,
+									 (long)worker->start_row * self->Y, (long)worker->stop_row * self->Y);
+	else if (self->fluid_index != NULL)
+		statistics_accumulate_cells(worker->statistics, self->src_matrix, self->fluid_index->fluid_cells,
+									worker->start_cell, worker->stop_cell);
+	else
+		statistics_accumulate(worker->statistics, self->src_matrix, self->fluid_bits,
+							  (long)worker->start_row * self->Y, (long)worker->stop_row * self->Y);
+}
+
+/// @brief Runs the job of the pool on one band: computes its rows, with the decay applied like
+// temperature_step(), or reduces their statistics
+static void compute_band(CPUBackend *self, CPUWorker *worker)
+{
+	if (self->job == CPU_JOB_STATISTICS || self->job == CPU_JOB_CHANGE)
+	{
+		reduce_band(self, worker);
+		return;
+	}
+	if (self->job == CPU_JOB_STEP_LINES)
+	{
+		long t = worker - self->workers;
+		long line_count = self->stop_line - self->first_line;
+		int stop_line = self->first_line + (int)(line_count * (t + 1) / self->thread_count);
+		for (int i = self->first_line + (int)(line_count * t / self->thread_count); i < stop_line; i++)
+			self->compute_row(self, worker, i);
+		return;
+	}
+	if (self->active_tiles != NULL)
+	{
+		compute_active_tiles(self, worker);
+		return;
+	}
+	if (self->fluid_index != NULL)
+	{
+		compute_fluid_cells(self, worker);
+		return;
+	}
+	for (int i = worker->start_row; i < worker->stop_row; i++)
+		self->compute_row(self, worker, i);
+}
+
+/// @brief Returns the name of the computation in use: sparse, or the row kernel picked for this processor
+const char *cpu_backend_simd_name(CPUBackend *self)
+{
+	if (self->active_tiles != NULL)
+		return "active tiles";
+	if (self->fluid_index != NULL)
+		return "sparse";
+#ifdef CPU_BACKEND_X86
+	if (self->compute_row == compute_row_avx2)
+		return "avx2";
+#endif
+	return "scalar";
+}
+
+static void *worker_main(void *arg)
+{
+	CPUWorker *worker = (CPUWorker *)arg;
+	CPUBackend *self = worker->backend;
+	unsigned long seen_generation = 0;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&self->lock);
+		while (self->generation == seen_generation && !self->shutdown)
+			pthread_cond_wait(&self->start_cond, &self->lock);
+		if (self->shutdown)
+		{
+			pthread_mutex_unlock(&self->lock);
+			return NULL;
+		}
+		seen_generation = self->generation;
+		pthread_mutex_unlock(&self->lock);
+
+		compute_band(self, worker);
+
+		pthread_mutex_lock(&self->lock);
+		if (--self->pending == 0)
+			pthread_cond_signal(&self->done_cond);
+		pthread_mutex_unlock(&self->lock);
+	}
+}
+
+/// @brief Frees the memory of the backend, the threads must already be stopped
+static void free_backend(CPUBackend *self)
+{
+	for (int t = 0; t < self->worker_capacity; t++)
+	{
+		free(self->workers[t].column_sums);
+		free(self->workers[t].mask_lines);
+	}
+	free(self->workers);
+	free(self->cell_scale);
+	free(self->zero_row);
+	free(self);
+}
+
+/// @brief Creates the CPU backend and starts its thread pool
+/// @param X number of lines of the matrix
+/// @param Y number of columns of the matrix
+/// @param fluid_bits fluid mask of the matrix, see _TypeMask.h, kept by reference
+/// @param decay_rate percent at which the temperature decays per iteration
+/// @param thread_count number of threads, 0 to use all cores
+/// @return the backend, NULL if error
+CPUBackend *cpu_backend_create(int X, int Y, uint32_t *fluid_bits, double decay_rate, int thread_count)
+{
+	CPUBackend *self = (CPUBackend *)calloc(1, sizeof(CPUBackend));
+	if (self == NULL)
+	{
+		perror("Error allocating memory for 'CPUBackend'\n");
+		return NULL;
+	}
+	self->X = X;
+	self->Y = Y;
+	self->fluid_bits = fluid_bits;
+	self->decay_rate = decay_rate;
+
+	self->cell_scale = (double *)malloc(sizeof(double) * X * Y);
+	self->zero_row = (double *)calloc(Y, sizeof(double));
+	if (self->cell_scale == NULL || self->zero_row == NULL)
+	{
+		perror("Error allocating memory for the CPU backend geometry\n");
+		free_backend(self);
+		return NULL;
+	}
+	precompute_geometry(self);
+
+	self->compute_row = compute_row_scalar;
+#ifdef CPU_BACKEND_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		self->compute_row = compute_row_avx2;
+#endif
+
+	if (thread_count <= 0)
+		thread_count = cpu_core_count();
+	// No point in bands thinner than a row
+	if (thread_count > X)
+		thread_count = X > 0 ? X : 1;
+	self->thread_count = thread_count;
+
+	self->workers = (CPUWorker *)calloc(thread_count, sizeof(CPUWorker));
+	if (self->workers == NULL)
+	{
+		perror("Error allocating memory for 'CPUWorker'\n");
+		free_backend(self);
+		return NULL;
+	}
+	self->worker_capacity = thread_count;
+	for (int t = 0; t < thread_count; t++)
+	{
+		self->workers[t].column_sums = (double *)calloc(Y + 2, sizeof(double));
+		self->workers[t].mask_lines = (double *)malloc(sizeof(double) * 3 * Y);
+		if (self->workers[t].column_sums == NULL || self->workers[t].mask_lines == NULL)
+		{
+			perror("Error allocating memory for 'column_sums'\n");
+			free_backend(self);
+			return NULL;
+		}
+		for (int slot = 0; slot < 3; slot++)
+			self->workers[t].mask_line_index[slot] = -1;
+	}
+
+	pthread_mutex_init(&self->lock, NULL);
+	pthread_cond_init(&self->start_cond, NULL);
+	pthread_cond_init(&self->done_cond, NULL);
+
+	for (int t = 0; t < thread_count; t++)
+	{
+		CPUWorker *worker = &self->workers[t];
+		worker->backend = self;
+		worker->start_row = (int)((long)X * t / thread_count);
+		worker->stop_row = (int)((long)X * (t + 1) / thread_count);
+		if (t > 0 && pthread_create(&worker->thread, NULL, worker_main, worker) != 0)
+		{
+			perror("Error creating CPU backend thread\n");
+			// The previous band takes over the remaining rows
+			self->workers[t - 1].stop_row = X;
+			self->thread_count = t;
+			break;
+		}
+	}
+	return self;
+}
+
+/// @brief Switches the backend to iterate over the fluid cells of index only, split evenly
+// between the threads. Non-fluid cells of the destination matrix are no longer written, they
+// must already hold their values
+/// @param index fluid index of the same matrix, kept by reference
+void cpu_backend_use_fluid_index(CPUBackend *self, FluidIndex *index)
+{
+	self->fluid_index = index;
+	for (int t = 0; t < self->thread_count; t++)
+	{
+		self->workers[t].start_cell = (int)((long)index->fluid_count * t / self->thread_count);
+		self->workers[t].stop_cell = (int)((long)index->fluid_count * (t + 1) / self->thread_count);
+	}
+}
+
+/// @brief Switches the backend to compute the active tiles only and to update their activity
+// after every step. The tiles skipped since the step that retired them are not written, so both
+// matrices must start equal
+/// @param tiles tiles of the same matrix, kept by reference
+void cpu_backend_use_active_tiles(CPUBackend *self, ActiveTiles *tiles)
+{
+	self->active_tiles = tiles;
+}
+
+/// @brief Runs the current job on all the threads and waits for it
+static void run_job(CPUBackend *self)
+{
+	pthread_mutex_lock(&self->lock);
+	self->pending = self->thread_count - 1;
+	self->generation++;
+	pthread_cond_broadcast(&self->start_cond);
+	pthread_mutex_unlock(&self->lock);
+
+	compute_band(self, &self->workers[0]);
+
+	pthread_mutex_lock(&self->lock);
+	while (self->pending > 0)
+		pthread_cond_wait(&self->done_cond, &self->lock);
+	pthread_mutex_unlock(&self->lock);
+}
+
+/// @brief Computes one iteration from src_matrix into dst_matrix on all the threads, and the
+// tiles of the next one if active tiles are in use
+void cpu_backend_step(CPUBackend *self, double *src_matrix, double *dst_matrix)
+{
+	self->job = CPU_JOB_STEP;
+	self->src_matrix = src_matrix;
+	self->dst_matrix = dst_matrix;
+	run_job(self);
+	if (self->active_tiles != NULL)
+		active_tiles_update(self->active_tiles);
+}
+
+/// @brief Computes the lines [first_line, stop_line) of one iteration from src_matrix into
+// dst_matrix on all the threads, row by row even if a fluid index is in use. The other lines of
+// dst_matrix are left as they are
+void cpu_backend_step_lines(CPUBackend *self, double *src_matrix, double *dst_matrix, int first_line, int stop_line)
+{
+	self->job = CPU_JOB_STEP_LINES;
+	self->src_matrix = src_matrix;
+	self->dst_matrix = dst_matrix;
+	self->first_line = first_line;
+	self->stop_line = stop_line;
+	run_job(self);
+}
+
+/// @brief Combines the statistics reduced by the bands in order, so the result does not depend
+// on the timing of the threads
+static void merge_bands(CPUBackend *self, int iteration, FieldStatistics *statistics)
+{
+	double partial[STATISTICS_FIELDS];
+	statistics_reset(partial);
+	for (int t = 0; t < self->thread_count; t++)
+		statistics_merge(partial, self->workers[t].statistics);
+	statistics_finish(partial, iteration, statistics);
+}
+
+/// @brief Computes the statistics of the fluid cells of a matrix on all the threads
+/// @param values matrix to reduce
+/// @param iteration iteration the matrix belongs to
+/// @param statistics filled in with the result
+void cpu_backend_statistics(CPUBackend *self, double *values, int iteration, FieldStatistics *statistics)
+{
+	self->job = CPU_JOB_STATISTICS;
+	self->src_matrix = values;
+	run_job(self);
+	merge_bands(self, iteration, statistics);
+}
+
+/// @brief Computes the statistics of the change of the fluid cells from previous to values on
+// all the threads, like the temperature_change kernel
+/// @param iteration iteration values belongs to
+void cpu_backend_change(CPUBackend *self, double *values, double *previous, int iteration, FieldStatistics *statistics)
+{
+	self->job = CPU_JOB_CHANGE;
+	self->src_matrix = values;
+	self->dst_matrix = previous;
+	run_job(self);
+	merge_bands(self, iteration, statistics);
+}
+
+int cpu_backend_thread_count(CPUBackend *self)
+{
+	return self->thread_count;
+}
+
+/// @brief Stops the thread pool and frees the backend
+void cpu_backend_destroy(CPUBackend *self)
+{
+	if (self == NULL)
+		return;
+
+	pthread_mutex_lock(&self->lock);
+	self->shutdown = 1;
+	pthread_cond_broadcast(&self->start_cond);
+	pthread_mutex_unlock(&self->lock);
+
+	for (int t = 1; t < self->thread_count; t++)
+		pthread_join(self->workers[t].thread, NULL);
+
+	pthread_mutex_destroy(&self->lock);
+	pthread_cond_destroy(&self->start_cond);
+	pthread_cond_destroy(&self->done_cond);
+	free_backend(self);
+}
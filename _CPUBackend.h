@@ -0,0 +1,27 @@
+#ifndef CPU_BACKEND_H
+#define CPU_BACKEND_H
+
+#include "_ActiveTiles.h"
+#include "_FluidIndex.h"
+#include "_Statistics.h"
+
+/* Largest difference accepted between the CPU backend and the OpenCL kernel, relative to the
+largest temperature of the reference matrix. Both compute in double precision, the only
+differences come from the device contracting or reordering floating point operations */
+#define CPU_BACKEND_TOLERANCE 1e-9
+
+typedef struct CPUBackend CPUBackend;
+
+CPUBackend *cpu_backend_create(int X, int Y, uint32_t *fluid_bits, double decay_rate, int thread_count);
+void cpu_backend_use_fluid_index(CPUBackend *self, FluidIndex *index);
+void cpu_backend_use_active_tiles(CPUBackend *self, ActiveTiles *tiles);
+void cpu_backend_step(CPUBackend *self, double *src_matrix, double *dst_matrix);
+void cpu_backend_step_lines(CPUBackend *self, double *src_matrix, double *dst_matrix, int first_line, int stop_line);
+void cpu_backend_statistics(CPUBackend *self, double *values, int iteration, FieldStatistics *statistics);
+void cpu_backend_change(CPUBackend *self, double *values, double *previous, int iteration, FieldStatistics *statistics);
+int cpu_backend_thread_count(CPUBackend *self);
+const char *cpu_backend_simd_name(CPUBackend *self);
+void cpu_backend_destroy(CPUBackend *self);
+int cpu_core_count();
+
+#endif
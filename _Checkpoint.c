@@ -0,0 +1,509 @@
+#include "_Checkpoint.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "_TypeMask.h"
+#include "_WriterRing.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+// Bytes before the encoded change of a tile in a delta record, its index and its byte count
+#define TILE_HEADER_BYTES (sizeof(int32_t) + sizeof(uint32_t))
+// Longest run of a control byte, see _Checkpoint.h
+#define MAX_RUN 128
+
+struct CheckpointWriter
+{
+	FILE *file_fptr;
+	// Header of every record, the kind, iteration, colors, payload size and checksum change
+	CheckpointRecordHeader header;
+	size_t total_size;
+	size_t cell_bytes;
+	size_t frame_bytes;
+	uint32_t *fluid_bits;
+	int full_every;
+
+	// Matrix of the last record written, the deltas are taken against it
+	unsigned char *reference;
+	int records_since_full;
+	// Payload of a delta record, given up for a full record once it grows past frame_bytes
+	unsigned char *payload;
+	// Change of one tile with its bytes regrouped, and its encoding
+	unsigned char *tile_change;
+	unsigned char *tile_encoded;
+	// The matrix in double, for its color thresholds
+	double *values;
+	int tiles_across, tile_count;
+
+	int full_count, delta_count;
+	uint64_t bytes_written;
+
+	// Buffers of X * Y values of header.dtype, written by write_record()
+	WriterRing *ring;
+};
+
+/// @brief FNV-1a hash of bytes, continued from hash
+static uint64_t hash_bytes(const void *bytes, size_t count, uint64_t hash)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		hash ^= ((const unsigned char *)bytes)[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+/// @brief Returns the checksum of a record, over its header with the checksum zeroed and its payload
+static uint64_t record_checksum(CheckpointRecordHeader *header, const void *payload)
+{
+	CheckpointRecordHeader zeroed = *header;
+	zeroed.checksum = 0;
+	return hash_bytes(payload, header->payload_bytes, hash_bytes(&zeroed, sizeof(zeroed), FNV_OFFSET_BASIS));
+}
+
+/// @brief Returns the first line, the first column and the size of a tile
+static void tile_bounds(int *dim, int tile_size, int tile, int *first_line, int *first_column, int *lines, int *columns)
+{
+	int tiles_across = (dim[1] + tile_size - 1) / tile_size;
+	*first_line = tile / tiles_across * tile_size;
+	*first_column = tile % tiles_across * tile_size;
+	*lines = dim[0] - *first_line < tile_size ? dim[0] - *first_line : tile_size;
+	*columns = dim[1] - *first_column < tile_size ? dim[1] - *first_column : tile_size;
+}
+
+/// @brief Encodes the runs of zero bytes of count bytes, see _Checkpoint.h
+/// @param encoded at least count + count / MAX_RUN + 1 bytes
+/// @return bytes of the encoding
+static size_t encode_runs(unsigned char *bytes, size_t count, unsigned char *encoded)
+{
+	size_t length = 0;
+	size_t i = 0;
+	while (i < count)
+	{
+		size_t run = 0;
+		while (i + run < count && run < MAX_RUN && bytes[i + run] == 0)
+			run++;
+		if (run > 0)
+		{
+			encoded[length++] = (unsigned char)(0x7f + run);
+			i += run;
+			continue;
+		}
+		// A literal run stops before two zeros, a single one is cheaper to copy
+		while (i + run < count && run < MAX_RUN &&
+			   !(bytes[i + run] == 0 && (i + run + 1 == count || bytes[i + run + 1] == 0)))
+			run++;
+		encoded[length++] = (unsigned char)(run - 1);
+		memcpy(encoded + length, bytes + i, run);
+		length += run;
+		i += run;
+	}
+	return length;
+}
+
+/// @brief Decodes the output of encode_runs()
+/// @return 1 if the encoding does not give exactly count bytes, 0 if no error
+static int decode_runs(unsigned char *encoded, size_t length, unsigned char *bytes, size_t count)
+{
+	size_t i = 0;
+	size_t position = 0;
+	while (position < length)
+	{
+		unsigned char control = encoded[position++];
+		size_t run = control < 0x80 ? (size_t)control + 1 : (size_t)control - 0x7f;
+		if (i + run > count || (control < 0x80 && position + run > length))
+			return 1;
+		if (control < 0x80)
+		{
+			memcpy(bytes + i, encoded + position, run);
+			position += run;
+		}
+		else
+			memset(bytes + i, 0, run);
+		i += run;
+	}
+	return i != count;
+}
+
+/// @brief Writes the change of a tile from reference to cells in tile_change, byte k of every
+// value of the tile together
+/// @return 1 if the tile changed, 0 otherwise
+static int tile_difference(CheckpointWriter *self, int tile, unsigned char *cells)
+{
+	int first_line, first_column, lines, columns;
+	tile_bounds(self->header.dim, self->header.tile_size, tile, &first_line, &first_column, &lines, &columns);
+	size_t line_offset = self->cell_bytes * ((size_t)first_line * self->header.dim[1] + first_column);
+	size_t line_bytes = self->cell_bytes * self->header.dim[1];
+	int changed = 0;
+	for (int i = 0; i < lines && !changed; i++)
+		changed = memcmp(cells + line_offset + line_bytes * i, self->reference + line_offset + line_bytes * i,
+						 self->cell_bytes * columns) != 0;
+	if (!changed)
+		return 0;
+
+	size_t tile_cells = (size_t)lines * columns;
+	for (int i = 0; i < lines; i++)
+		for (int j = 0; j < columns; j++)
+		{
+			size_t value = (size_t)i * columns + j;
+			size_t offset = line_offset + line_bytes * i + self->cell_bytes * j;
+			for (size_t k = 0; k < self->cell_bytes; k++)
+				self->tile_change[k * tile_cells + value] = cells[offset + k] ^ self->reference[offset + k];
+		}
+	return 1;
+}
+
+/// @brief Applies the change of a tile decoded by decode_runs() to a matrix
+static void apply_tile(int *dim, int tile_size, size_t cell_bytes, int tile, unsigned char *change, unsigned char *cells)
+{
+	int first_line, first_column, lines, columns;
+	tile_bounds(dim, tile_size, tile, &first_line, &first_column, &lines, &columns);
+	size_t tile_cells = (size_t)lines * columns;
+	for (int i = 0; i < lines; i++)
+		for (int j = 0; j < columns; j++)
+		{
+			size_t value = (size_t)i * columns + j;
+			size_t offset = cell_bytes * (((size_t)first_line + i) * dim[1] + first_column + j);
+			for (size_t k = 0; k < cell_bytes; k++)
+				cells[offset + k] ^= change[k * tile_cells + value];
+		}
+}
+
+/// @brief Builds the payload of a delta record against the previous record
+/// @return bytes of the payload, 0 if it would not be smaller than a full record
+static size_t build_delta(CheckpointWriter *self, unsigned char *cells)
+{
+	size_t length = 0;
+	for (int tile = 0; tile < self->tile_count; tile++)
+	{
+		if (!tile_difference(self, tile, cells))
+			continue;
+		int first_line, first_column, lines, columns;
+		tile_bounds(self->header.dim, self->header.tile_size, tile, &first_line, &first_column, &lines, &columns);
+		uint32_t encoded_bytes = (uint32_t)encode_runs(self->tile_change, self->cell_bytes * lines * columns,
+													   self->tile_encoded);
+		if (length + TILE_HEADER_BYTES + encoded_bytes >= self->frame_bytes)
+			return 0;
+		int32_t index = tile;
+		memcpy(self->payload + length, &index, sizeof(index));
+		memcpy(self->payload + length + sizeof(index), &encoded_bytes, sizeof(encoded_bytes));
+		memcpy(self->payload + length + TILE_HEADER_BYTES, self->tile_encoded, encoded_bytes);
+		length += TILE_HEADER_BYTES + encoded_bytes;
+	}
+	return length;
+}
+
+/// @brief Appends a record of a matrix to the file and makes it durable, a delta when the
+// previous records allow it, called from the thread of the ring
+/// @return 1 if error, 0 if no error
+static int write_record(void *owner, int iteration, void *matrix)
+{
+	CheckpointWriter *self = (CheckpointWriter *)owner;
+	unsigned char *cells = (unsigned char *)matrix;
+	CheckpointRecordHeader *header = &self->header;
+
+	double partial[STATISTICS_FIELDS];
+	FieldStatistics statistics;
+	precision_unpack(header->dtype, cells, self->values, self->total_size);
+	statistics_reset(partial);
+	statistics_accumulate(partial, self->values, self->fluid_bits, 0, self->total_size);
+	statistics_finish(partial, iteration, &statistics);
+	color_thresholds(&statistics, &header->colors);
+
+	header->iteration = iteration;
+	header->kind = CHECKPOINT_FULL;
+	header->payload_bytes = self->frame_bytes;
+	void *payload = cells;
+	if (self->records_since_full > 0 && self->records_since_full < self->full_every)
+	{
+		size_t delta_bytes = build_delta(self, cells);
+		if (delta_bytes > 0)
+		{
+			header->kind = CHECKPOINT_DELTA;
+			header->payload_bytes = delta_bytes;
+			payload = self->payload;
+		}
+	}
+	header->checksum = record_checksum(header, payload);
+
+	if (fwrite(header, sizeof(*header), 1, self->file_fptr) != 1 ||
+		fwrite(payload, 1, header->payload_bytes, self->file_fptr) != header->payload_bytes ||
+		fflush(self->file_fptr) != 0)
+		return 1;
+	// Resuming trusts every record that checks out, so it has to be on the disk before the next one
+#ifdef _WIN32
+	if (_commit(_fileno(self->file_fptr)) != 0)
+		return 1;
+#else
+	if (fsync(fileno(self->file_fptr)) != 0)
+		return 1;
+#endif
+
+	memcpy(self->reference, cells, self->frame_bytes);
+	if (header->kind == CHECKPOINT_FULL)
+	{
+		self->full_count++;
+		self->records_since_full = 1;
+	}
+	else
+	{
+		self->delta_count++;
+		self->records_since_full++;
+	}
+	self->bytes_written += sizeof(*header) + header->payload_bytes;
+	return 0;
+}
+
+/// @brief Frees the buffers of a writer, the file and the ring are handled by the caller
+static void free_writer(CheckpointWriter *self)
+{
+	free(self->reference);
+	free(self->payload);
+	free(self->tile_change);
+	free(self->tile_encoded);
+	free(self->values);
+	free(self);
+}
+
+/// @brief Opens the checkpoint file and starts the writer thread
+/// @param file_name name of the checkpoint file
+/// @param dim matrix dimensions
+/// @param dtype precision the matrices are stored in, the buffers hold values of this precision
+/// @param decay_rate decay rate of the run, a resumed run must have the same
+/// @param fluid_bits fluid mask of the matrix, kept by reference for the color thresholds
+/// @param full_every a full record every full_every records, the others are deltas
+/// @param buffer_count number of host buffers in the ring
+/// @param append_offset valid bytes of the file a resumed run keeps, the rest is cut off, 0 to
+// start a new file
+/// @return the writer, NULL if error
+CheckpointWriter *checkpoint_writer_open(char *file_name, int *dim, int dtype, double decay_rate, uint32_t *fluid_bits,
+										 int full_every, int buffer_count, uint64_t append_offset)
+{
+	CheckpointWriter *self = (CheckpointWriter *)calloc(1, sizeof(CheckpointWriter));
+	if (self == NULL)
+	{
+		perror("Error allocating memory for 'CheckpointWriter'\n");
+		return NULL;
+	}
+	memcpy(self->header.magic, CHECKPOINT_MAGIC, sizeof(self->header.magic));
+	self->header.version = CHECKPOINT_VERSION;
+	self->header.dtype = dtype;
+	self->header.dim[0] = dim[0];
+	self->header.dim[1] = dim[1];
+	self->header.tile_size = CHECKPOINT_DEFAULT_TILE;
+	self->header.decay_rate = decay_rate;
+
+	self->total_size = (size_t)dim[0] * dim[1];
+	self->cell_bytes = precision_cell_bytes(dtype);
+	self->frame_bytes = self->cell_bytes * self->total_size;
+	self->fluid_bits = fluid_bits;
+	self->full_every = full_every > 0 ? full_every : CHECKPOINT_DEFAULT_FULL_EVERY;
+	self->tiles_across = (dim[1] + CHECKPOINT_DEFAULT_TILE - 1) / CHECKPOINT_DEFAULT_TILE;
+	self->tile_count = (dim[0] + CHECKPOINT_DEFAULT_TILE - 1) / CHECKPOINT_DEFAULT_TILE * self->tiles_across;
+	size_t tile_bytes = self->cell_bytes * CHECKPOINT_DEFAULT_TILE * CHECKPOINT_DEFAULT_TILE;
+
+	self->reference = (unsigned char *)malloc(self->frame_bytes);
+	self->payload = (unsigned char *)malloc(self->frame_bytes);
+	self->tile_change = (unsigned char *)malloc(tile_bytes);
+	self->tile_encoded = (unsigned char *)malloc(tile_bytes + tile_bytes / MAX_RUN + 1);
+	self->values = (double *)malloc(sizeof(double) * self->total_size);
+	int failed = self->reference == NULL || self->payload == NULL || self->tile_change == NULL ||
+				 self->tile_encoded == NULL || self->values == NULL;
+	if (failed)
+	{
+		perror("Error allocating memory for the checkpoint buffers\n");
+		free_writer(self);
+		return NULL;
+	}
+
+	// A resumed run drops the records past the one it resumed from, they belong to the run that died
+	self->file_fptr = fopen(file_name, append_offset > 0 ? "r+b" : "wb");
+	failed = self->file_fptr == NULL;
+	if (!failed && append_offset > 0)
+	{
+#ifdef _WIN32
+		failed = _chsize_s(_fileno(self->file_fptr), append_offset) != 0;
+#else
+		failed = ftruncate(fileno(self->file_fptr), append_offset) != 0;
+#endif
+		failed |= fseek(self->file_fptr, 0, SEEK_END) != 0;
+	}
+	if (failed)
+	{
+		perror("Error opening the checkpoint file!\n");
+		if (self->file_fptr != NULL)
+			fclose(self->file_fptr);
+		free_writer(self);
+		return NULL;
+	}
+
+	self->ring = writer_ring_create(buffer_count > 0 ? buffer_count : CHECKPOINT_DEFAULT_BUFFERS, self->frame_bytes,
+									write_record, self, "Error writing the checkpoint file!\n");
+	if (self->ring == NULL)
+	{
+		fclose(self->file_fptr);
+		free_writer(self);
+		return NULL;
+	}
+	return self;
+}
+
+/// @brief Returns the next host buffer to read a matrix into, waits only if every buffer of the
+// ring is still queued for writing
+/// @param iteration iteration the matrix belongs to
+/// @return a buffer of X * Y values of the dtype given to checkpoint_writer_open()
+void *checkpoint_acquire(CheckpointWriter *self, int iteration)
+{
+	return writer_ring_acquire(self->ring, iteration);
+}
+
+/// @brief Queues the buffer returned by the last checkpoint_acquire() for writing
+/// @param read_event event of the non-blocking read filling the buffer, owned by the writer from
+// now on, or NULL if the buffer is already filled
+void checkpoint_submit(CheckpointWriter *self, cl_event read_event)
+{
+	writer_ring_submit(self->ring, read_event);
+}
+
+/// @brief Waits for the queued records and closes the file
+/// @return 1 if error, 0 if no error
+int checkpoint_writer_close(CheckpointWriter *self)
+{
+	int failed = writer_ring_close(self->ring);
+	failed |= fclose(self->file_fptr) != 0;
+	if (failed)
+		perror("Error writing the checkpoint file!\n");
+	else
+		printf("Wrote %d checkpoints, %d full and %d deltas, %.1f MB\n", self->full_count + self->delta_count,
+			   self->full_count, self->delta_count, self->bytes_written / 1e6);
+
+	free_writer(self);
+	return failed;
+}
+
+/// @brief Applies the tiles of a delta record to a matrix
+/// @param change scratch of a tile, cell_bytes * tile_size * tile_size bytes
+/// @return 1 if the payload is malformed, 0 if no error
+static int apply_delta(CheckpointRecordHeader *header, unsigned char *payload, unsigned char *change, unsigned char *cells)
+{
+	int tiles_across = (header->dim[1] + header->tile_size - 1) / header->tile_size;
+	int tile_count = (header->dim[0] + header->tile_size - 1) / header->tile_size * tiles_across;
+	size_t cell_bytes = precision_cell_bytes(header->dtype);
+	uint64_t position = 0;
+	while (position < header->payload_bytes)
+	{
+		int32_t tile;
+		uint32_t encoded_bytes;
+		if (position + TILE_HEADER_BYTES > header->payload_bytes)
+			return 1;
+		memcpy(&tile, payload + position, sizeof(tile));
+		memcpy(&encoded_bytes, payload + position + sizeof(tile), sizeof(encoded_bytes));
+		position += TILE_HEADER_BYTES;
+		if (tile < 0 || tile >= tile_count || position + encoded_bytes > header->payload_bytes)
+			return 1;
+		int first_line, first_column, lines, columns;
+		tile_bounds(header->dim, header->tile_size, tile, &first_line, &first_column, &lines, &columns);
+		if (decode_runs(payload + position, encoded_bytes, change, cell_bytes * lines * columns))
+			return 1;
+		apply_tile(header->dim, header->tile_size, cell_bytes, tile, change, cells);
+		position += encoded_bytes;
+	}
+	return 0;
+}
+
+/// @brief Replays a checkpoint file up to its last valid record: the last full record and the
+// deltas after it, loading stops at the first record that does not check out
+/// @param dim matrix dimensions of the run
+/// @param dtype precision of the run
+/// @param decay_rate decay rate of the run
+/// @param cells filled in with the X * Y values of the last valid record, in dtype
+/// @param info filled in with the state of the last valid record, its iteration is -1 if the file
+// does not exist or holds no valid record
+/// @return 1 if error, or if the file belongs to another grid or run, 0 if no error
+int checkpoint_load(char *file_name, int *dim, int dtype, double decay_rate, void *cells, CheckpointInfo *info)
+{
+	info->iteration = -1;
+	info->record_count = 0;
+	info->valid_bytes = 0;
+	FILE *file_fptr = fopen(file_name, "rb");
+	if (file_fptr == NULL)
+		return 0;
+
+	size_t cell_bytes = precision_cell_bytes(dtype);
+	size_t frame_bytes = cell_bytes * dim[0] * dim[1];
+	// Records are replayed into field, cells only receives the ones that check out
+	unsigned char *field = (unsigned char *)malloc(frame_bytes);
+	unsigned char *payload = (unsigned char *)malloc(frame_bytes);
+	unsigned char *change = NULL;
+	if (field == NULL || payload == NULL)
+	{
+		perror("Error allocating memory for the checkpoint\n");
+		free(field);
+		free(payload);
+		fclose(file_fptr);
+		return 1;
+	}
+
+	int failed = 0;
+	int has_full = 0;
+	CheckpointRecordHeader header;
+	while (fread(&header, sizeof(header), 1, file_fptr) == 1)
+	{
+		if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 || header.version != CHECKPOINT_VERSION)
+			break;
+		int foreign = header.dim[0] != dim[0] || header.dim[1] != dim[1] || header.dtype != (uint32_t)dtype ||
+					  header.decay_rate != decay_rate;
+		// Past the first record a header that does not match is a damaged one
+		if (foreign && info->iteration < 0)
+		{
+			fprintf(stderr, "The checkpoint file %s belongs to another grid, precision or decay rate\n", file_name);
+			failed = 1;
+			break;
+		}
+		if (foreign || header.payload_bytes > frame_bytes ||
+			fread(payload, 1, header.payload_bytes, file_fptr) != header.payload_bytes ||
+			record_checksum(&header, payload) != header.checksum || header.iteration <= info->iteration)
+			break;
+
+		if (header.kind == CHECKPOINT_FULL && header.payload_bytes == frame_bytes)
+		{
+			memcpy(field, payload, frame_bytes);
+			has_full = 1;
+			info->record_count = 0;
+		}
+		else if (header.kind == CHECKPOINT_DELTA && has_full && header.tile_size > 0)
+		{
+			free(change);
+			change = (unsigned char *)malloc(cell_bytes * header.tile_size * header.tile_size);
+			if (change == NULL)
+			{
+				perror("Error allocating memory for the checkpoint\n");
+				failed = 1;
+				break;
+			}
+			if (apply_delta(&header, payload, change, field))
+				break;
+		}
+		else
+			break;
+
+		memcpy(cells, field, frame_bytes);
+		info->iteration = (int)header.iteration;
+		info->colors = header.colors;
+		info->record_count++;
+		info->valid_bytes += sizeof(header) + header.payload_bytes;
+	}
+
+	free(field);
+	free(payload);
+	free(change);
+	fclose(file_fptr);
+	return failed;
+}
@@ -0,0 +1,73 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+
+#include "_OpenCLUtil.h"
+#include "_Precision.h"
+#include "_Renderer.h"
+
+/* Checkpoint file, an append-only log of records, each one a CheckpointRecordHeader followed by
+payload_bytes of payload:
+- a full record holds the X * Y temperatures of the matrix in dtype, one of the PRECISION_ codes
+- a delta record only holds the tiles of tile_size x tile_size cells that changed since the
+  previous record, each one as an int32 tile index, a uint32 byte count and its encoded change
+
+The change of a tile is the XOR of its new and previous values, with the bytes regrouped by
+their position in a value so that the sign, exponent and high mantissa bytes, which seldom
+change, end up in long runs of zeros. The runs are then encoded with one control byte each:
+below 0x80 it is followed by control + 1 literal bytes, from 0x80 it stands for control - 0x7f
+zero bytes.
+
+The checksum covers the header, with the checksum itself zeroed, and the payload. A run killed
+while writing leaves a record that does not check out, loading stops there and resumes from the
+last record before it. Every full_every-th record is a full one, which bounds the records
+replayed when resuming */
+#define CHECKPOINT_MAGIC "TTCKPT\r\n"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_FULL 1
+#define CHECKPOINT_DELTA 2
+#define CHECKPOINT_DEFAULT_BUFFERS 2
+#define CHECKPOINT_DEFAULT_FULL_EVERY 8
+#define CHECKPOINT_DEFAULT_TILE 32
+
+typedef struct CheckpointRecordHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t kind;
+	uint32_t dtype;
+	// Matrix dimensions, X lines of Y columns
+	int32_t dim[2];
+	int32_t tile_size;
+	// Iterations the matrix of the record went through
+	int64_t iteration;
+	double decay_rate;
+	// Color thresholds of the matrix of the record
+	TemperatureColorArray colors;
+	uint64_t payload_bytes;
+	uint64_t checksum;
+} CheckpointRecordHeader;
+
+/* State replayed from a checkpoint file */
+typedef struct CheckpointInfo
+{
+	// Iteration of the last valid record, -1 if the file holds none
+	int iteration;
+	TemperatureColorArray colors;
+	// Records replayed, from the last full record
+	int record_count;
+	// Offset past the last valid record, the writer of a resumed run appends from there
+	uint64_t valid_bytes;
+} CheckpointInfo;
+
+typedef struct CheckpointWriter CheckpointWriter;
+
+int checkpoint_load(char *file_name, int *dim, int dtype, double decay_rate, void *cells, CheckpointInfo *info);
+CheckpointWriter *checkpoint_writer_open(char *file_name, int *dim, int dtype, double decay_rate, uint32_t *fluid_bits,
+										 int full_every, int buffer_count, uint64_t append_offset);
+void *checkpoint_acquire(CheckpointWriter *self, int iteration);
+void checkpoint_submit(CheckpointWriter *self, cl_event read_event);
+int checkpoint_writer_close(CheckpointWriter *self);
+
+#endif
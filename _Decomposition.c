@@ -0,0 +1,325 @@
+#include "_Decomposition.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "_TypeMask.h"
+
+/// @brief Copies the fluid mask of the stored lines of a slab, which seldom start on a word
+/// @return type_mask_words() of the stored cells, NULL if error
+static uint32_t *slab_fluid_bits(Decomposition *self, DeviceSlab *slab, uint32_t *fluid_bits)
+{
+	size_t stored_cells = (size_t)slab->stored_count * self->Y;
+	uint32_t *slab_bits = (uint32_t *)malloc(sizeof(uint32_t) * type_mask_words(stored_cells));
+	if (slab_bits == NULL)
+	{
+		perror("Error allocating memory for the fluid mask of a slab\n");
+		return NULL;
+	}
+	type_mask_extract(fluid_bits, (size_t)slab->stored_first * self->Y, stored_cells, slab_bits);
+	return slab_bits;
+}
+
+/// @brief Splits the lines of the matrix between the slabs in proportion to the compute units
+// of their devices
+/// @return 1 if a slab gets fewer lines than the halo, 0 if no error
+static int split_lines(Decomposition *self)
+{
+	cl_int rc;
+	double total_units = 0;
+	double *units = (double *)malloc(sizeof(double) * self->slab_count);
+	if (units == NULL)
+	{
+		perror("Error allocating memory for the compute units\n");
+		return 1;
+	}
+	for (int s = 0; s < self->slab_count; s++)
+	{
+		cl_uint compute_units;
+		rc = clGetDeviceInfo(self->slabs[s].device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(compute_units), &compute_units, NULL);
+		handleError(rc, __LINE__, __FILE__);
+		units[s] = compute_units > 0 ? compute_units : 1;
+		total_units += units[s];
+	}
+
+	double cumulated_units = 0;
+	int first_line = 0;
+	for (int s = 0; s < self->slab_count; s++)
+	{
+		cumulated_units += units[s];
+		int stop_line = s == self->slab_count - 1 ? self->X : (int)(self->X * cumulated_units / total_units + 0.5);
+		self->slabs[s].first_line = first_line;
+		self->slabs[s].line_count = stop_line - first_line;
+		first_line = stop_line;
+	}
+	free(units);
+
+	// A halo has to come from a single neighbour
+	for (int s = 0; s < self->slab_count; s++)
+	{
+		if (self->slabs[s].line_count < self->halo || self->slabs[s].line_count < 1)
+		{
+			fprintf(stderr, "The %d lines of the grid are too few for %d slabs with a halo of %d lines\n", self->X,
+					self->slab_count, self->halo);
+			return 1;
+		}
+		DeviceSlab *slab = &self->slabs[s];
+		slab->stored_first = s == 0 ? 0 : slab->first_line - self->halo;
+		int stored_stop = s == self->slab_count - 1 ? self->X : slab->first_line + slab->line_count + self->halo;
+		slab->stored_count = stored_stop - slab->stored_first;
+	}
+	return 0;
+}
+
+/// @brief Splits a matrix in row slabs, one per device, and creates their queues and buffers
+/// @param devices devices of context, the slabs follow their order from the first lines
+/// @param halo lines exchanged on each side of a boundary, at least the iterations run between
+// two exchanges
+/// @param cell_bytes size of a temperature on the devices
+/// @return the decomposition, NULL if error
+Decomposition *decomposition_create(cl_context context, cl_device_id *devices, int device_count, int X, int Y, int halo,
+									size_t cell_bytes)
+{
+	cl_int rc;
+	Decomposition *self = (Decomposition *)calloc(1, sizeof(Decomposition));
+	if (self == NULL)
+	{
+		perror("Error allocating memory for 'Decomposition'\n");
+		return NULL;
+	}
+	self->X = X;
+	self->Y = Y;
+	self->halo = halo;
+	self->cell_bytes = cell_bytes;
+	self->slab_count = device_count;
+	self->slabs = (DeviceSlab *)calloc(device_count, sizeof(DeviceSlab));
+	// Two directions per boundary, at most two per slab
+	self->halo_buffers = (unsigned char *)malloc(cell_bytes * Y * halo * 2 * device_count);
+	self->read_events = (cl_event *)calloc(2 * device_count, sizeof(cl_event));
+	self->write_events = (cl_event *)calloc(2 * device_count, sizeof(cl_event));
+	if (self->slabs == NULL || self->halo_buffers == NULL || self->read_events == NULL || self->write_events == NULL)
+	{
+		perror("Error allocating memory for the slabs\n");
+		free(self->slabs);
+		free(self->halo_buffers);
+		free(self->read_events);
+		free(self->write_events);
+		free(self);
+		return NULL;
+	}
+
+	for (int s = 0; s < device_count; s++)
+		self->slabs[s].device = devices[s];
+	if (split_lines(self))
+	{
+		free(self->slabs);
+		free(self->halo_buffers);
+		free(self->read_events);
+		free(self->write_events);
+		free(self);
+		return NULL;
+	}
+
+	for (int s = 0; s < device_count; s++)
+	{
+		DeviceSlab *slab = &self->slabs[s];
+		size_t stored_cells = (size_t)slab->stored_count * Y;
+		slab->queue = clCreateCommandQueue(context, slab->device, CL_QUEUE_PROFILING_ENABLE, &rc);
+		handleError(rc, __LINE__, __FILE__);
+		for (int m = 0; m < 2; m++)
+		{
+			slab->matrix_cl[m] = clCreateBuffer(context, CL_MEM_READ_WRITE, cell_bytes * stored_cells, NULL, &rc);
+			handleError(rc, __LINE__, __FILE__);
+		}
+		slab->type_matrix_cl = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(uint32_t) * type_mask_words(stored_cells), NULL,
+											&rc);
+		handleError(rc, __LINE__, __FILE__);
+		slab->dim_cl = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(int) * 2, NULL, &rc);
+		handleError(rc, __LINE__, __FILE__);
+		printf("Slab %d owns lines %d to %d, stores %d lines from %d\n", s, slab->first_line,
+			   slab->first_line + slab->line_count - 1, slab->stored_count, slab->stored_first);
+	}
+	return self;
+}
+
+/// @brief Builds the list of fluid cells of every slab for the sparse kernel, in the indices of
+// the stored lines, and creates their buffers. decomposition_upload() copies them to the devices
+/// @return 1 if error, 0 if no error
+int decomposition_use_fluid_index(Decomposition *self, cl_context context, uint32_t *fluid_bits)
+{
+	cl_int rc;
+	for (int s = 0; s < self->slab_count; s++)
+	{
+		DeviceSlab *slab = &self->slabs[s];
+		uint32_t *slab_bits = slab_fluid_bits(self, slab, fluid_bits);
+		if (slab_bits == NULL)
+		{
+			return 1;
+		}
+		slab->fluid_index = fluid_index_build(slab->stored_count, self->Y, slab_bits);
+		free(slab_bits);
+		if (slab->fluid_index == NULL)
+		{
+			return 1;
+		}
+		int fluid_count = slab->fluid_index->fluid_count;
+		int neighbour_count = slab->fluid_index->neighbour_offsets[fluid_count];
+		slab->fluid_cells_cl = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(int) * (fluid_count + 1), NULL, &rc);
+		handleError(rc, __LINE__, __FILE__);
+		slab->neighbour_offsets_cl = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(int) * (fluid_count + 1), NULL, &rc);
+		handleError(rc, __LINE__, __FILE__);
+		slab->neighbour_cells_cl = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(int) * (neighbour_count + 1), NULL, &rc);
+		handleError(rc, __LINE__, __FILE__);
+	}
+	return 0;
+}
+
+/// @brief Copies the stored lines of the matrix to both matrices of every slab, with the cell
+// fluid mask, the slab dimensions and the fluid index, and waits for the copies
+/// @param cells temperatures of the whole matrix in the device precision
+/// @param fluid_bits fluid mask of the whole matrix
+void decomposition_upload(Decomposition *self, void *cells, uint32_t *fluid_bits)
+{
+	cl_int rc;
+	for (int s = 0; s < self->slab_count; s++)
+	{
+		DeviceSlab *slab = &self->slabs[s];
+		size_t stored_cells = (size_t)slab->stored_count * self->Y;
+		unsigned char *slab_cells = (unsigned char *)cells + self->cell_bytes * slab->stored_first * self->Y;
+		int dim[2] = {slab->stored_count, self->Y};
+
+		for (int m = 0; m < 2; m++)
+		{
+			rc = clEnqueueWriteBuffer(slab->queue, slab->matrix_cl[m], CL_FALSE, 0, self->cell_bytes * stored_cells, slab_cells, 0, NULL, NULL);
+			handleError(rc, __LINE__, __FILE__);
+		}
+		uint32_t *slab_bits = slab_fluid_bits(self, slab, fluid_bits);
+		if (slab_bits == NULL)
+			exit(1);
+		rc = clEnqueueWriteBuffer(slab->queue, slab->type_matrix_cl, CL_FALSE, 0,
+								  sizeof(uint32_t) * type_mask_words(stored_cells), slab_bits, 0, NULL, NULL);
+		handleError(rc, __LINE__, __FILE__);
+		rc = clEnqueueWriteBuffer(slab->queue, slab->dim_cl, CL_FALSE, 0, sizeof(dim), dim, 0, NULL, NULL);
+		handleError(rc, __LINE__, __FILE__);
+
+		if (slab->fluid_index != NULL)
+		{
+			int fluid_count = slab->fluid_index->fluid_count;
+			int neighbour_count = slab->fluid_index->neighbour_offsets[fluid_count];
+			rc = clEnqueueWriteBuffer(slab->queue, slab->fluid_cells_cl, CL_FALSE, 0, sizeof(int) * (fluid_count + 1), slab->fluid_index->fluid_cells, 0, NULL, NULL);
+			handleError(rc, __LINE__, __FILE__);
+			rc = clEnqueueWriteBuffer(slab->queue, slab->neighbour_offsets_cl, CL_FALSE, 0, sizeof(int) * (fluid_count + 1), slab->fluid_index->neighbour_offsets, 0, NULL, NULL);
+			handleError(rc, __LINE__, __FILE__);
+			rc = clEnqueueWriteBuffer(slab->queue, slab->neighbour_cells_cl, CL_FALSE, 0, sizeof(int) * (neighbour_count + 1), slab->fluid_index->neighbour_cells, 0, NULL, NULL);
+			handleError(rc, __LINE__, __FILE__);
+		}
+		// dim is on the stack, every copy has to be done before returning
+		rc = clFinish(slab->queue);
+		handleError(rc, __LINE__, __FILE__);
+		free(slab_bits);
+	}
+}
+
+/// @brief Queues a copy of lines from a slab to the halo of another through a host buffer, the
+// read waits for the previous write out of the same buffer and the write for the read
+static void copy_lines(Decomposition *self, int direction, DeviceSlab *from, DeviceSlab *to, int first_line, int current)
+{
+	cl_int rc;
+	size_t line_bytes = self->cell_bytes * self->Y;
+	size_t bytes = line_bytes * self->halo;
+	unsigned char *buffer = self->halo_buffers + bytes * direction;
+	cl_event *previous_write = &self->write_events[direction];
+	cl_event *read_event = &self->read_events[direction];
+
+	if (*read_event != NULL)
+		clReleaseEvent(*read_event);
+	rc = clEnqueueReadBuffer(from->queue, from->matrix_cl[current], CL_FALSE, line_bytes * (first_line - from->stored_first), bytes, buffer,
+							 *previous_write != NULL ? 1 : 0, *previous_write != NULL ? previous_write : NULL, read_event);
+	handleError(rc, __LINE__, __FILE__);
+	if (*previous_write != NULL)
+		clReleaseEvent(*previous_write);
+	rc = clEnqueueWriteBuffer(to->queue, to->matrix_cl[current], CL_FALSE, line_bytes * (first_line - to->stored_first), bytes, buffer,
+							  1, read_event, previous_write);
+	handleError(rc, __LINE__, __FILE__);
+}
+
+/// @brief Queues the exchange of the halos of every boundary without waiting for it: each slab
+// sends its first and last halo owned lines to its neighbours. The launches queued afterwards on a
+// slab run once its halos arrived
+/// @param current matrix holding the latest iteration
+void decomposition_exchange(Decomposition *self, int current)
+{
+	for (int b = 0; b < self->slab_count - 1; b++)
+	{
+		DeviceSlab *upper = &self->slabs[b];
+		DeviceSlab *lower = &self->slabs[b + 1];
+		copy_lines(self, 2 * b, upper, lower, lower->first_line - self->halo, current);
+		copy_lines(self, 2 * b + 1, lower, upper, lower->first_line, current);
+	}
+	for (int s = 0; s < self->slab_count; s++)
+		clFlush(self->slabs[s].queue);
+}
+
+/// @brief Reads the owned lines of every slab into a host matrix and waits for them
+/// @param current matrix holding the latest iteration
+/// @param cells whole matrix in the device precision
+void decomposition_gather(Decomposition *self, int current, void *cells)
+{
+	cl_int rc;
+	size_t line_bytes = self->cell_bytes * self->Y;
+	for (int s = 0; s < self->slab_count; s++)
+	{
+		DeviceSlab *slab = &self->slabs[s];
+		rc = clEnqueueReadBuffer(slab->queue, slab->matrix_cl[current], CL_FALSE, line_bytes * (slab->first_line - slab->stored_first),
+								 line_bytes * slab->line_count, (unsigned char *)cells + line_bytes * slab->first_line, 0, NULL, NULL);
+		handleError(rc, __LINE__, __FILE__);
+		clFlush(slab->queue);
+	}
+	for (int s = 0; s < self->slab_count; s++)
+	{
+		rc = clFinish(self->slabs[s].queue);
+		handleError(rc, __LINE__, __FILE__);
+	}
+}
+
+/// @brief Waits for the queues and frees the slabs, their programs and kernels included
+void decomposition_destroy(Decomposition *self)
+{
+	if (self == NULL)
+		return;
+	for (int s = 0; s < self->slab_count; s++)
+		clFinish(self->slabs[s].queue);
+	for (int e = 0; e < 2 * self->slab_count; e++)
+	{
+		if (self->read_events[e] != NULL)
+			clReleaseEvent(self->read_events[e]);
+		if (self->write_events[e] != NULL)
+			clReleaseEvent(self->write_events[e]);
+	}
+	for (int s = 0; s < self->slab_count; s++)
+	{
+		DeviceSlab *slab = &self->slabs[s];
+		clReleaseMemObject(slab->matrix_cl[0]);
+		clReleaseMemObject(slab->matrix_cl[1]);
+		clReleaseMemObject(slab->type_matrix_cl);
+		clReleaseMemObject(slab->dim_cl);
+		if (slab->fluid_index != NULL)
+		{
+			clReleaseMemObject(slab->fluid_cells_cl);
+			clReleaseMemObject(slab->neighbour_offsets_cl);
+			clReleaseMemObject(slab->neighbour_cells_cl);
+			fluid_index_free(slab->fluid_index);
+		}
+		if (slab->kernel != NULL)
+			clReleaseKernel(slab->kernel);
+		if (slab->program != NULL)
+			clReleaseProgram(slab->program);
+		clReleaseCommandQueue(slab->queue);
+	}
+	free(self->slabs);
+	free(self->halo_buffers);
+	free(self->read_events);
+	free(self->write_events);
+	free(self);
+}
@@ -0,0 +1,62 @@
+#ifndef DECOMPOSITION_H
+#define DECOMPOSITION_H
+
+#include "_FluidIndex.h"
+#include "_OpenCLUtil.h"
+
+/* Row slab of the matrix computed by one device. The slab owns the lines
+[first_line, first_line + line_count) and also stores the halo lines of its neighbours, so its
+buffers hold stored_count lines from stored_first. The kernels compute the stored lines as if
+they were a whole matrix: the halo lines go stale by one line per iteration from the outer edge,
+which never reaches the owned lines before the next exchange */
+typedef struct DeviceSlab
+{
+	cl_device_id device;
+	cl_command_queue queue;
+	// Built by the caller for the device, with the size of the slab
+	cl_program program;
+	cl_kernel kernel;
+
+	int first_line, line_count;
+	int stored_first, stored_count;
+	// The matrices swap roles between launches like in the resident mode
+	cl_mem matrix_cl[2];
+	// Fluid mask of the stored lines, see _TypeMask.h
+	cl_mem type_matrix_cl;
+	cl_mem dim_cl;
+	// Fluid cells of the stored lines, only built for the sparse kernel
+	FluidIndex *fluid_index;
+	cl_mem fluid_cells_cl;
+	cl_mem neighbour_offsets_cl;
+	cl_mem neighbour_cells_cl;
+
+	// Launch geometry of kernel, filled in by the caller
+	cl_uint work_dim;
+	size_t global_size[2];
+	size_t local_size[2];
+} DeviceSlab;
+
+/* Row slabs of a matrix over several devices of one context */
+typedef struct Decomposition
+{
+	int X, Y;
+	// Lines exchanged on each side of a boundary, the slabs can run this many iterations apart
+	int halo;
+	size_t cell_bytes;
+	int slab_count;
+	DeviceSlab *slabs;
+	// Host copies of the lines crossing the boundaries, two directions per boundary
+	unsigned char *halo_buffers;
+	cl_event *read_events;
+	cl_event *write_events;
+} Decomposition;
+
+Decomposition *decomposition_create(cl_context context, cl_device_id *devices, int device_count, int X, int Y, int halo,
+									size_t cell_bytes);
+int decomposition_use_fluid_index(Decomposition *self, cl_context context, uint32_t *fluid_bits);
+void decomposition_upload(Decomposition *self, void *cells, uint32_t *fluid_bits);
+void decomposition_exchange(Decomposition *self, int current);
+void decomposition_gather(Decomposition *self, int current, void *cells);
+void decomposition_destroy(Decomposition *self);
+
+#endif
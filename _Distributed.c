@@ -0,0 +1,291 @@
+#include "_Distributed.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "_GridIO.h"
+#include "_TypeMask.h"
+
+// Text grids have no decay rate, the same default as homework
+#define DEFAULT_DECAY_RATE 0.02
+
+// Direction the lines of a message travel in, towards the higher or the lower ranks
+#define TAG_DOWN 1
+#define TAG_UP 2
+
+/// @brief Returns the first line owned by a rank, the lines are split evenly in rank order
+static int slab_first_line(int X, int rank, int rank_count)
+{
+	return (int)((long)X * rank / rank_count);
+}
+
+/// @brief Frees a slab, the line types must be committed or null
+static void free_slab(RankSlab *self)
+{
+	free(self->matrix[0]);
+	free(self->matrix[1]);
+	free(self->type_matrix);
+	free(self->fluid_bits);
+	if (self->line_type != MPI_DATATYPE_NULL)
+		MPI_Type_free(&self->line_type);
+	if (self->type_line_type != MPI_DATATYPE_NULL)
+		MPI_Type_free(&self->type_line_type);
+	free(self);
+}
+
+/// @brief Loads the slab of the calling rank from a grid file every rank can read. A binary grid
+// is mapped and only the stored lines are read from it, a text grid is parsed whole by every rank
+/// @param comm communicator of the ranks sharing the grid, the slabs follow the rank order
+/// @param halo ghost lines stored on each internal side, at least the iterations run between two
+// exchanges
+/// @param replicas number of copies of the grid stacked over the lines, more than 1 to grow the
+// grid with the number of ranks
+/// @return the slab, NULL if error
+RankSlab *rank_slab_load(MPI_Comm comm, char *file_name, int halo, int replicas)
+{
+	int dim[2];
+	int iterations;
+	double decay_rate;
+	GridMapping *mapping = NULL;
+	double *text_temperature = NULL;
+	char *text_type = NULL;
+
+	if (grid_is_binary(file_name))
+	{
+		mapping = grid_map_binary(file_name);
+		if (mapping == NULL)
+		{
+			return NULL;
+		}
+		dim[0] = mapping->header->dim[0];
+		dim[1] = mapping->header->dim[1];
+		iterations = mapping->header->iterations;
+		decay_rate = mapping->header->decay_rate;
+	}
+	else
+	{
+		if (grid_read_text(file_name, dim, &iterations, &text_temperature, &text_type))
+		{
+			return NULL;
+		}
+		decay_rate = DEFAULT_DECAY_RATE;
+	}
+
+	RankSlab *self = (RankSlab *)calloc(1, sizeof(RankSlab));
+	if (self == NULL)
+	{
+		perror("Error allocating memory for 'RankSlab'\n");
+		grid_unmap(mapping);
+		free(text_temperature);
+		free(text_type);
+		return NULL;
+	}
+	self->line_type = MPI_DATATYPE_NULL;
+	self->type_line_type = MPI_DATATYPE_NULL;
+	self->comm = comm;
+	MPI_Comm_rank(comm, &self->rank);
+	MPI_Comm_size(comm, &self->rank_count);
+	self->above = self->rank > 0 ? self->rank - 1 : MPI_PROC_NULL;
+	self->below = self->rank < self->rank_count - 1 ? self->rank + 1 : MPI_PROC_NULL;
+	self->X = dim[0] * replicas;
+	self->Y = dim[1];
+	self->iterations = iterations;
+	self->decay_rate = decay_rate;
+	self->halo = halo;
+
+	// Every rank checks the same split, so they all fail together. A halo has to come from a
+	// single neighbour
+	for (int r = 0; r < self->rank_count; r++)
+	{
+		int line_count = slab_first_line(self->X, r + 1, self->rank_count) - slab_first_line(self->X, r, self->rank_count);
+		if (line_count < halo || line_count < 1)
+		{
+			if (self->rank == 0)
+				fprintf(stderr, "The %d lines of the grid are too few for %d ranks with a halo of %d lines\n", self->X,
+						self->rank_count, halo);
+			// Lets rank 0 report it before a failing rank stops the job
+			MPI_Barrier(comm);
+			grid_unmap(mapping);
+			free(text_temperature);
+			free(text_type);
+			free_slab(self);
+			return NULL;
+		}
+	}
+	self->first_line = slab_first_line(self->X, self->rank, self->rank_count);
+	self->line_count = slab_first_line(self->X, self->rank + 1, self->rank_count) - self->first_line;
+	self->ghosts_above = self->above == MPI_PROC_NULL ? 0 : halo;
+	self->ghosts_below = self->below == MPI_PROC_NULL ? 0 : halo;
+	self->stored_first = self->first_line - self->ghosts_above;
+	self->stored_count = self->ghosts_above + self->line_count + self->ghosts_below;
+
+	size_t stored_cells = (size_t)self->stored_count * self->Y;
+	self->matrix[0] = (double *)malloc(sizeof(double) * stored_cells);
+	self->matrix[1] = (double *)malloc(sizeof(double) * stored_cells);
+	self->type_matrix = (char *)malloc(sizeof(char) * stored_cells);
+	self->fluid_bits = (uint32_t *)malloc(sizeof(uint32_t) * type_mask_words(stored_cells));
+	if (self->matrix[0] == NULL || self->matrix[1] == NULL || self->type_matrix == NULL || self->fluid_bits == NULL)
+	{
+		perror("Error allocating memory for the slab\n");
+		grid_unmap(mapping);
+		free(text_temperature);
+		free(text_type);
+		free_slab(self);
+		return NULL;
+	}
+
+	// Only the pages of the stored lines of a mapped grid are ever read from the file
+	size_t line_bytes = mapping != NULL ? precision_cell_bytes(mapping->header->dtype) * self->Y : 0;
+	for (int i = 0; i < self->stored_count; i++)
+	{
+		long source_line = (self->stored_first + i) % dim[0];
+		double *values = self->matrix[0] + (long)i * self->Y;
+		char *types = self->type_matrix + (long)i * self->Y;
+		if (mapping != NULL)
+		{
+			precision_unpack(mapping->header->dtype, (char *)mapping->temperature + source_line * line_bytes, values, self->Y);
+			memcpy(types, mapping->type + source_line * self->Y, self->Y);
+		}
+		else
+		{
+			memcpy(values, text_temperature + source_line * self->Y, sizeof(double) * self->Y);
+			memcpy(types, text_type + source_line * self->Y, self->Y);
+		}
+	}
+	// Non-fluid cells are never written, start them equal in both matrices
+	memcpy(self->matrix[1], self->matrix[0], sizeof(double) * stored_cells);
+	type_mask_pack_bits(self->type_matrix, stored_cells, self->fluid_bits);
+	grid_unmap(mapping);
+	free(text_temperature);
+	free(text_type);
+
+	MPI_Type_contiguous(self->Y, MPI_DOUBLE, &self->line_type);
+	MPI_Type_commit(&self->line_type);
+	MPI_Type_contiguous(self->Y, MPI_CHAR, &self->type_line_type);
+	MPI_Type_commit(&self->type_line_type);
+	return self;
+}
+
+/// @brief Starts exchanging the ghost lines with the neighbours without waiting: the ghost lines
+// of lines are received from them and the halo lines of each end of the owned lines are sent to
+// them. The owned lines can be read but not written and the ghost lines neither read nor written
+// until rank_slab_finish_exchange()
+/// @param lines stored lines of the slab, one of its matrices or a host copy of them
+void rank_slab_begin_exchange(RankSlab *self, double *lines)
+{
+	double *owned = lines + (long)self->ghosts_above * self->Y;
+	double *ghosts_below = owned + (long)self->line_count * self->Y;
+
+	// Messages to and from MPI_PROC_NULL complete at once, the edges of the grid need no special case
+	MPI_Irecv(lines, self->ghosts_above, self->line_type, self->above, TAG_DOWN, self->comm, &self->requests[0]);
+	MPI_Irecv(ghosts_below, self->ghosts_below, self->line_type, self->below, TAG_UP, self->comm, &self->requests[1]);
+	MPI_Isend(owned, self->halo, self->line_type, self->above, TAG_UP, self->comm, &self->requests[2]);
+	MPI_Isend(ghosts_below - (long)self->halo * self->Y, self->halo, self->line_type, self->below, TAG_DOWN, self->comm,
+			  &self->requests[3]);
+}
+
+/// @brief Waits for the exchange started by rank_slab_begin_exchange()
+void rank_slab_finish_exchange(RankSlab *self)
+{
+	MPI_Waitall(4, self->requests, MPI_STATUSES_IGNORE);
+}
+
+/// @brief Writes the owned lines of every rank to a binary grid in parallel, rank 0 adds the header
+/// @return 1 if error on this rank, 0 if no error
+static int write_binary(RankSlab *self, double *owned, char *owned_types, char *file_name)
+{
+	int dim[2] = {self->X, self->Y};
+	GridFileHeader header;
+	grid_header_init(&header, dim, self->iterations, self->decay_rate, GRID_DTYPE_F64);
+
+	MPI_File file;
+	if (MPI_File_open(self->comm, file_name, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS)
+	{
+		fprintf(stderr, "Error opening the output file %s!\n", file_name);
+		return 1;
+	}
+	// Truncates what an earlier run left, the padding between the sections reads as zeros. The
+	// collective calls are made by every rank even after an error
+	int failed = MPI_File_set_size(file, header.type_offset + header.type_bytes) != MPI_SUCCESS;
+	if (self->rank == 0)
+		failed |= MPI_File_write_at(file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE) != MPI_SUCCESS;
+	MPI_Offset line_offset = (MPI_Offset)self->first_line * self->Y;
+	failed |= MPI_File_write_at_all(file, header.temperature_offset + line_offset * sizeof(double), owned,
+									self->line_count, self->line_type, MPI_STATUS_IGNORE) != MPI_SUCCESS;
+	failed |= MPI_File_write_at_all(file, header.type_offset + line_offset, owned_types, self->line_count,
+									self->type_line_type, MPI_STATUS_IGNORE) != MPI_SUCCESS;
+	failed |= MPI_File_close(&file) != MPI_SUCCESS;
+	if (failed)
+		fprintf(stderr, "Error writing the output file %s!\n", file_name);
+	return failed;
+}
+
+/// @brief Gathers the owned lines of every rank on rank 0, which writes them as a text grid
+/// @return 1 if error on this rank, 0 if no error
+static int write_text(RankSlab *self, double *owned, char *owned_types, char *file_name)
+{
+	double *temperature = NULL;
+	char *type = NULL;
+	int *counts = NULL, *displacements = NULL;
+	int failed = 0;
+
+	if (self->rank == 0)
+	{
+		temperature = (double *)malloc(sizeof(double) * self->X * self->Y);
+		type = (char *)malloc(sizeof(char) * self->X * self->Y);
+		counts = (int *)malloc(sizeof(int) * self->rank_count);
+		displacements = (int *)malloc(sizeof(int) * self->rank_count);
+		if (temperature == NULL || type == NULL || counts == NULL || displacements == NULL)
+		{
+			perror("Error allocating memory for the gathered grid\n");
+			failed = 1;
+		}
+		for (int r = 0; !failed && r < self->rank_count; r++)
+		{
+			displacements[r] = slab_first_line(self->X, r, self->rank_count);
+			counts[r] = slab_first_line(self->X, r + 1, self->rank_count) - displacements[r];
+		}
+	}
+	// The other ranks must not block in the gather if rank 0 has nowhere to put the lines
+	MPI_Bcast(&failed, 1, MPI_INT, 0, self->comm);
+	if (!failed)
+	{
+		MPI_Gatherv(owned, self->line_count, self->line_type, temperature, counts, displacements, self->line_type, 0,
+					self->comm);
+		MPI_Gatherv(owned_types, self->line_count, self->type_line_type, type, counts, displacements,
+					self->type_line_type, 0, self->comm);
+		if (self->rank == 0)
+		{
+			int dim[2] = {self->X, self->Y};
+			failed = grid_write_text(file_name, dim, temperature, type, -1);
+		}
+	}
+	free(temperature);
+	free(type);
+	free(counts);
+	free(displacements);
+	return failed;
+}
+
+/// @brief Stores the grid of all the ranks, in the binary format written in parallel if the name
+// ends with GRID_EXTENSION, else gathered on rank 0 as text. Called by every rank of the slab
+/// @param lines stored lines of the slab to write
+/// @return 1 if error on any rank, 0 if no error
+int rank_slab_write(RankSlab *self, double *lines, char *file_name)
+{
+	double *owned = lines + (long)self->ghosts_above * self->Y;
+	char *owned_types = self->type_matrix + (long)self->ghosts_above * self->Y;
+	int failed = grid_has_binary_extension(file_name) ? write_binary(self, owned, owned_types, file_name)
+													  : write_text(self, owned, owned_types, file_name);
+	int any_failed;
+	MPI_Allreduce(&failed, &any_failed, 1, MPI_INT, MPI_MAX, self->comm);
+	return any_failed;
+}
+
+void rank_slab_destroy(RankSlab *self)
+{
+	if (self == NULL)
+		return;
+	free_slab(self);
+}
@@ -0,0 +1,47 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <mpi.h>
+#include <stdint.h>
+
+/* Row slab of a grid owned by one MPI rank. The ranks of the communicator own consecutive lines
+in rank order, rank r owns [first_line, first_line + line_count). Each slab also stores halo ghost
+lines of its neighbours on its internal sides, so its matrices hold stored_count lines from
+stored_first. Like the device slabs of _Decomposition.h, the ghost lines go stale by one line
+per iteration from their outer edge and are exchanged every halo iterations */
+typedef struct RankSlab
+{
+	MPI_Comm comm;
+	int rank, rank_count;
+	// Neighbour ranks owning the lines above and below, MPI_PROC_NULL on the edges of the grid
+	int above, below;
+
+	// Whole grid, X lines of Y columns, with the iterations and decay rate of its file
+	int X, Y;
+	int iterations;
+	double decay_rate;
+
+	int halo;
+	int first_line, line_count;
+	int stored_first, stored_count;
+	// Ghost lines stored above and below the owned lines, 0 on the edges of the grid
+	int ghosts_above, ghosts_below;
+	// The matrices swap roles between iterations, the non-fluid cells are equal in both
+	double *matrix[2];
+	// Cell types of the stored lines, kept for the output files, and their fluid mask, see _TypeMask.h
+	char *type_matrix;
+	uint32_t *fluid_bits;
+
+	// One line of temperatures and one of cell types, so counts stay small for wide grids
+	MPI_Datatype line_type, type_line_type;
+	// Receives of the ghost lines and sends of the boundary lines of an exchange in flight
+	MPI_Request requests[4];
+} RankSlab;
+
+RankSlab *rank_slab_load(MPI_Comm comm, char *file_name, int halo, int replicas);
+void rank_slab_begin_exchange(RankSlab *self, double *lines);
+void rank_slab_finish_exchange(RankSlab *self);
+int rank_slab_write(RankSlab *self, double *lines, char *file_name);
+void rank_slab_destroy(RankSlab *self);
+
+#endif
@@ -0,0 +1,81 @@
+#include "_FluidIndex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "_TypeMask.h"
+
+/// @brief Returns the fraction of the cells of the matrix that are fluid
+double fluid_fraction(int X, int Y, uint32_t *fluid_bits)
+{
+	long fluid_count = type_mask_count(fluid_bits, (size_t)X * Y);
+	return X * Y > 0 ? (double)fluid_count / ((double)X * Y) : 0.0;
+}
+
+/// @brief Builds the list of fluid cells and of their fluid neighbours
+/// @param X number of lines of the matrix
+/// @param Y number of columns of the matrix
+/// @param fluid_bits fluid mask of the matrix, see _TypeMask.h, only the fluid cells are listed
+/// @return the index, NULL if error
+FluidIndex *fluid_index_build(int X, int Y, uint32_t *fluid_bits)
+{
+	FluidIndex *self = (FluidIndex *)calloc(1, sizeof(FluidIndex));
+	if (self == NULL)
+	{
+		perror("Error allocating memory for 'FluidIndex'\n");
+		return NULL;
+	}
+
+	self->fluid_count = type_mask_count(fluid_bits, (size_t)X * Y);
+
+	// Every fluid cell has at most 9 fluid neighbours, itself included
+	self->fluid_cells = (int *)malloc(sizeof(int) * (self->fluid_count + 1));
+	self->neighbour_offsets = (int *)malloc(sizeof(int) * (self->fluid_count + 1));
+	self->neighbour_cells = (int *)calloc(9 * (long)self->fluid_count + 1, sizeof(int));
+	if (self->fluid_cells == NULL || self->neighbour_offsets == NULL || self->neighbour_cells == NULL)
+	{
+		perror("Error allocating memory for the fluid index\n");
+		fluid_index_free(self);
+		return NULL;
+	}
+
+	int k = 0, neighbour_count = 0;
+	for (int line_index = 0; line_index < X; line_index++)
+	{
+		for (int column_index = 0; column_index < Y; column_index++)
+		{
+			int cell_index = line_index * Y + column_index;
+			if (!TYPE_MASK_IS_FLUID(fluid_bits, cell_index))
+				continue;
+
+			self->fluid_cells[k] = cell_index;
+			self->neighbour_offsets[k] = neighbour_count;
+			for (int i = line_index - 1; i <= line_index + 1; i++)
+			{
+				if (i < 0 || i >= X)
+					continue;
+				for (int j = column_index - 1; j <= column_index + 1; j++)
+				{
+					if (j < 0 || j >= Y)
+						continue;
+					if (TYPE_MASK_IS_FLUID(fluid_bits, i * Y + j))
+						self->neighbour_cells[neighbour_count++] = i * Y + j;
+				}
+			}
+			k++;
+		}
+	}
+	self->neighbour_offsets[k] = neighbour_count;
+	return self;
+}
+
+/// @brief Frees the fluid index
+void fluid_index_free(FluidIndex *self)
+{
+	if (self == NULL)
+		return;
+	free(self->fluid_cells);
+	free(self->neighbour_offsets);
+	free(self->neighbour_cells);
+	free(self);
+}
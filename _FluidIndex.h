@@ -0,0 +1,24 @@
+#ifndef FLUID_INDEX_H
+#define FLUID_INDEX_H
+
+#include <stdint.h>
+
+/* Below this fraction of fluid cells the simulation iterates over the fluid cells only */
+#define FLUID_INDEX_DEFAULT_THRESHOLD 0.3
+
+/* Compact list of the fluid cells with their fluid neighbours in CSR form. The neighbours of
+fluid_cells[k] are neighbour_cells[neighbour_offsets[k]] to neighbour_cells[neighbour_offsets[k + 1] - 1],
+the cell itself included, so the number of neighbours is the divisor of the average */
+typedef struct FluidIndex
+{
+	int fluid_count;
+	int *fluid_cells;
+	int *neighbour_offsets;
+	int *neighbour_cells;
+} FluidIndex;
+
+double fluid_fraction(int X, int Y, uint32_t *fluid_bits);
+FluidIndex *fluid_index_build(int X, int Y, uint32_t *fluid_bits);
+void fluid_index_free(FluidIndex *self);
+
+#endif
@@ -0,0 +1,742 @@
+#include "_GridIO.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/// @brief Rounds offset up to the next GRID_ALIGNMENT boundary
+static uint64_t align_offset(uint64_t offset)
+{
+	return (offset + GRID_ALIGNMENT - 1) / GRID_ALIGNMENT * GRID_ALIGNMENT;
+}
+
+/// @brief Checks whether a file starts with the binary grid magic
+/// @return 1 if binary, 0 otherwise
+int grid_is_binary(char *file_name)
+{
+	char magic[8];
+	FILE *file_fptr = fopen(file_name, "rb");
+	if (file_fptr == NULL)
+		return 0;
+	size_t read = fread(magic, 1, sizeof(magic), file_fptr);
+	fclose(file_fptr);
+	return read == sizeof(magic) && memcmp(magic, GRID_MAGIC, sizeof(magic)) == 0;
+}
+
+/// @brief Checks whether a file name ends with GRID_EXTENSION
+int grid_has_binary_extension(char *file_name)
+{
+	size_t length = strlen(file_name);
+	size_t extension_length = strlen(GRID_EXTENSION);
+	return length >= extension_length && strcmp(file_name + length - extension_length, GRID_EXTENSION) == 0;
+}
+
+/// @brief Checks the header of a mapped file against its size
+/// @return 1 if error, 0 if no error
+static int validate_header(GridMapping *self, char *file_name)
+{
+	GridFileHeader *header = self->header;
+	uint64_t cells = (uint64_t)header->dim[0] * (uint64_t)header->dim[1];
+
+	if (self->size < sizeof(GridFileHeader) || memcmp(header->magic, GRID_MAGIC, sizeof(header->magic)) != 0)
+	{
+		fprintf(stderr, "%s is not a binary grid file\n", file_name);
+		return 1;
+	}
+	if (header->version != GRID_VERSION)
+	{
+		fprintf(stderr, "%s has version %u, only version %u is supported\n", file_name, header->version, GRID_VERSION);
+		return 1;
+	}
+	if (header->dtype < GRID_DTYPE_F64 || header->dtype > GRID_DTYPE_F16)
+	{
+		fprintf(stderr, "%s has an unsupported dtype %u\n", file_name, header->dtype);
+		return 1;
+	}
+	if (header->dim[0] <= 0 || header->dim[1] <= 0 ||
+		header->temperature_bytes != cells * precision_cell_bytes(header->dtype) || header->type_bytes != cells ||
+		header->temperature_offset % GRID_ALIGNMENT != 0 || header->type_offset % GRID_ALIGNMENT != 0 ||
+		header->temperature_offset + header->temperature_bytes > self->size ||
+		header->type_offset + header->type_bytes > self->size)
+	{
+		fprintf(stderr, "%s has inconsistent sections\n", file_name);
+		return 1;
+	}
+	return 0;
+}
+
+/// @brief Maps a whole file in memory, privately so that writes never reach the file
+/// @param file_name name of the file
+/// @param size filled in with the size of the file
+/// @return the start of the mapping, NULL if error
+static void *map_file(char *file_name, size_t *size)
+{
+	void *base;
+#ifdef _WIN32
+	// No mmap, read the whole file into an aligned buffer instead
+	FILE *file_fptr = fopen(file_name, "rb");
+	if (file_fptr == NULL)
+	{
+		perror("Error opening the input file!\n");
+		return NULL;
+	}
+	fseek(file_fptr, 0, SEEK_END);
+	*size = ftell(file_fptr);
+	fseek(file_fptr, 0, SEEK_SET);
+	base = _aligned_malloc(*size, GRID_ALIGNMENT);
+	if (base == NULL || fread(base, 1, *size, file_fptr) != *size)
+	{
+		perror("Error reading the input file!\n");
+		fclose(file_fptr);
+		_aligned_free(base);
+		return NULL;
+	}
+	fclose(file_fptr);
+#else
+	int fd = open(file_name, O_RDONLY);
+	if (fd < 0)
+	{
+		perror("Error opening the input file!\n");
+		return NULL;
+	}
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0)
+	{
+		fprintf(stderr, "%s is empty\n", file_name);
+		close(fd);
+		return NULL;
+	}
+	*size = file_stat.st_size;
+	base = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+	{
+		perror("Error mapping the input file!\n");
+		return NULL;
+	}
+	// Files are read front to back
+	madvise(base, *size, MADV_WILLNEED);
+#endif
+	return base;
+}
+
+/// @brief Releases a mapping made by map_file()
+static void unmap_file(void *base, size_t size)
+{
+#ifdef _WIN32
+	_aligned_free(base);
+#else
+	munmap(base, size);
+#endif
+}
+
+/// @brief Maps a binary grid file in memory. The mapping is private: the host may modify the
+// matrices in place without changing the file
+/// @param file_name name of the binary grid file
+/// @return the mapping, NULL if error
+GridMapping *grid_map_binary(char *file_name)
+{
+	GridMapping *self = (GridMapping *)calloc(1, sizeof(GridMapping));
+	if (self == NULL)
+	{
+		perror("Error allocating memory for 'GridMapping'\n");
+		return NULL;
+	}
+
+	self->base = map_file(file_name, &self->size);
+	if (self->base == NULL)
+	{
+		free(self);
+		return NULL;
+	}
+	if (self->size < sizeof(GridFileHeader))
+	{
+		fprintf(stderr, "%s is not a binary grid file\n", file_name);
+		grid_unmap(self);
+		return NULL;
+	}
+
+	self->header = (GridFileHeader *)self->base;
+	if (validate_header(self, file_name))
+	{
+		grid_unmap(self);
+		return NULL;
+	}
+	self->temperature = (char *)self->base + self->header->temperature_offset;
+	self->type = (char *)self->base + self->header->type_offset;
+	return self;
+}
+
+/// @brief Checks whether ptr points inside the mapping, so it must not be freed
+int grid_is_mapped(GridMapping *self, void *ptr)
+{
+	if (self == NULL)
+		return 0;
+	return (char *)ptr >= (char *)self->base && (char *)ptr < (char *)self->base + self->size;
+}
+
+/// @brief Unmaps the file and frees the mapping
+void grid_unmap(GridMapping *self)
+{
+	if (self == NULL)
+		return;
+	unmap_file(self->base, self->size);
+	free(self);
+}
+
+/// @brief Writes the padding up to offset
+/// @return 1 if error, 0 if no error
+static int write_padding(FILE *file_fptr, uint64_t offset)
+{
+	static const char zeros[GRID_ALIGNMENT];
+	long position = ftell(file_fptr);
+	if (position < 0)
+		return 1;
+	uint64_t padding = offset - (uint64_t)position;
+	return fwrite(zeros, 1, padding, file_fptr) != padding;
+}
+
+/// @brief Fills in the header of a binary grid and the aligned offsets of its sections, for
+// writers that place the sections themselves
+void grid_header_init(GridFileHeader *header, int *dim, int iterations, double decay_rate, int dtype)
+{
+	uint64_t cells = (uint64_t)dim[0] * (uint64_t)dim[1];
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, GRID_MAGIC, sizeof(header->magic));
+	header->version = GRID_VERSION;
+	header->dtype = dtype;
+	header->dim[0] = dim[0];
+	header->dim[1] = dim[1];
+	header->iterations = iterations;
+	header->decay_rate = decay_rate;
+	header->temperature_offset = align_offset(sizeof(GridFileHeader));
+	header->temperature_bytes = cells * precision_cell_bytes(dtype);
+	header->type_offset = align_offset(header->temperature_offset + header->temperature_bytes);
+	header->type_bytes = cells;
+}
+
+/// @brief Creates a binary grid file of the given size and maps it shared and writable, so that
+// the matrices written through the mapping end up in the file. The sections are left zeroed
+/// @param file_name name of the file, replaced if it exists
+/// @return the mapping, NULL if error
+GridMapping *grid_create_binary(char *file_name, int *dim, int iterations, double decay_rate, int dtype)
+{
+#ifdef _WIN32
+	fprintf(stderr, "Writable grid mappings are not supported on Windows\n");
+	return NULL;
+#else
+	GridMapping *self = (GridMapping *)calloc(1, sizeof(GridMapping));
+	if (self == NULL)
+	{
+		perror("Error allocating memory for 'GridMapping'\n");
+		return NULL;
+	}
+	GridFileHeader header;
+	grid_header_init(&header, dim, iterations, decay_rate, dtype);
+	self->size = header.type_offset + header.type_bytes;
+
+	int fd = open(file_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		perror("Error opening the output file!\n");
+		free(self);
+		return NULL;
+	}
+	if (ftruncate(fd, self->size) != 0 || pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+	{
+		perror("Error writing the output file!\n");
+		close(fd);
+		free(self);
+		return NULL;
+	}
+	self->base = mmap(NULL, self->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (self->base == MAP_FAILED)
+	{
+		perror("Error mapping the output file!\n");
+		free(self);
+		return NULL;
+	}
+	self->header = (GridFileHeader *)self->base;
+	self->temperature = (char *)self->base + header.temperature_offset;
+	self->type = (char *)self->base + header.type_offset;
+	return self;
+#endif
+}
+
+/// @brief Writes a binary grid file
+/// @param file_name name of the output file
+/// @param dim matrix dimensions
+/// @param iterations number of iterations stored in the header
+/// @param decay_rate decay rate stored in the header
+/// @param temperature temperature matrix
+/// @param type cell type matrix
+/// @param dtype precision the temperatures are stored in, GRID_DTYPE_F64 keeps them exact
+/// @return 1 if error, 0 if no error
+int grid_write_binary(char *file_name, int *dim, int iterations, double decay_rate, double *temperature, char *type,
+					  int dtype)
+{
+	uint64_t cells = (uint64_t)dim[0] * (uint64_t)dim[1];
+	GridFileHeader header;
+	grid_header_init(&header, dim, iterations, decay_rate, dtype);
+
+	// Narrower types are converted in a copy, doubles are written as they are
+	void *values = temperature;
+	if (dtype != GRID_DTYPE_F64)
+	{
+		values = malloc(header.temperature_bytes);
+		if (values == NULL)
+		{
+			perror("Error allocating memory for the converted temperatures\n");
+			return 1;
+		}
+		precision_pack(dtype, temperature, values, cells);
+	}
+
+	FILE *file_fptr = fopen(file_name, "wb");
+	if (file_fptr == NULL)
+	{
+		perror("Error opening the output file!\n");
+		if (values != temperature)
+			free(values);
+		return 1;
+	}
+	int failed = fwrite(&header, sizeof(header), 1, file_fptr) != 1 ||
+				 write_padding(file_fptr, header.temperature_offset) ||
+				 fwrite(values, 1, header.temperature_bytes, file_fptr) != header.temperature_bytes ||
+				 write_padding(file_fptr, header.type_offset) ||
+				 fwrite(type, 1, cells, file_fptr) != cells;
+	if (values != temperature)
+		free(values);
+	if (fclose(file_fptr) != 0 || failed)
+	{
+		perror("Error writing the output file!\n");
+		return 1;
+	}
+	return 0;
+}
+
+/// @brief Returns the number of online processor cores
+static int online_cores()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (int)count : 1;
+#endif
+}
+
+/* Line aligned part of a text grid, parsed by one thread */
+typedef struct TextChunk
+{
+	const char *start, *stop;
+	// Counting pass: lines holding something, and all lines
+	long value_lines, physical_lines;
+	// Parsing pass: ordinal of the first value line after the dimensions, line number of the first line
+	long first_value, first_line;
+
+	// Shared by all the chunks
+	int *dim;
+	double *temperature;
+	char *type;
+	int *iterations;
+	int found_iterations;
+	long total_size;
+
+	// First malformed line of the chunk, 0 if none
+	long error_line;
+	const char *error_message;
+} TextChunk;
+
+static int is_blank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static const char *skip_blanks(const char *p, const char *end)
+{
+	while (p < end && is_blank(*p))
+		p++;
+	return p;
+}
+
+/// @brief Parses a decimal floating point number without going through the locale. Numbers with
+// at most 19 significant digits and a power of ten of at most 22 are exact in a double, so they
+// are rounded correctly with a single multiplication or division; the rest go through strtod
+/// @return the first character after the number, NULL if there is no number
+static const char *parse_double(const char *p, const char *end, double *value)
+{
+	static const double powers_of_ten[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+										   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+	const char *start = p;
+	int negative = 0, any_digit = 0, significant_digits = 0, truncated = 0, exponent = 0;
+	unsigned long long mantissa = 0;
+
+	if (p < end && (*p == '+' || *p == '-'))
+	{
+		negative = *p == '-';
+		p++;
+	}
+	for (; p < end && *p >= '0' && *p <= '9'; p++)
+	{
+		any_digit = 1;
+		if (significant_digits < 19)
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			significant_digits += mantissa != 0;
+		}
+		else
+		{
+			truncated |= *p != '0';
+			exponent++;
+		}
+	}
+	if (p < end && *p == '.')
+	{
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++)
+		{
+			any_digit = 1;
+			if (significant_digits < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				significant_digits += mantissa != 0;
+				exponent--;
+			}
+			else
+				truncated |= *p != '0';
+		}
+	}
+	if (!any_digit)
+		return NULL;
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char *q = p + 1;
+		int exponent_negative = 0, exponent_value = 0;
+		if (q < end && (*q == '+' || *q == '-'))
+		{
+			exponent_negative = *q == '-';
+			q++;
+		}
+		if (q == end || *q < '0' || *q > '9')
+			return NULL;
+		for (; q < end && *q >= '0' && *q <= '9'; q++)
+			if (exponent_value < 100000)
+				exponent_value = exponent_value * 10 + (*q - '0');
+		exponent += exponent_negative ? -exponent_value : exponent_value;
+		p = q;
+	}
+
+	if (!truncated && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22)
+	{
+		double result = (double)mantissa;
+		result = exponent < 0 ? result / powers_of_ten[-exponent] : result * powers_of_ten[exponent];
+		*value = negative ? -result : result;
+		return p;
+	}
+
+	// Rare slow path, the program never changes the "C" locale
+	char buffer[512];
+	size_t length = p - start;
+	if (length >= sizeof(buffer))
+		return NULL;
+	memcpy(buffer, start, length);
+	buffer[length] = '\0';
+	*value = strtod(buffer, NULL);
+	return p;
+}
+
+/// @brief Parses a non-negative decimal integer
+/// @return the first character after the number, NULL if there is no number
+static const char *parse_int(const char *p, const char *end, int *value)
+{
+	long result = 0;
+	if (p == end || *p < '0' || *p > '9')
+		return NULL;
+	for (; p < end && *p >= '0' && *p <= '9'; p++)
+	{
+		result = result * 10 + (*p - '0');
+		if (result > 0x7fffffff)
+			return NULL;
+	}
+	*value = (int)result;
+	return p;
+}
+
+/// @brief Counts the lines of a chunk, the ones holding something and all of them
+static void count_chunk(TextChunk *chunk)
+{
+	for (const char *p = chunk->start; p < chunk->stop;)
+	{
+		const char *line_end = memchr(p, '\n', chunk->stop - p);
+		if (line_end == NULL)
+			line_end = chunk->stop;
+		if (skip_blanks(p, line_end) < line_end)
+			chunk->value_lines++;
+		chunk->physical_lines++;
+		p = line_end + 1;
+	}
+}
+
+/// @brief Parses the lines of a chunk. The n-th cell line belongs to line n % X and column n / X,
+// the line after the last cell holds the number of iterations
+static void parse_chunk(TextChunk *chunk)
+{
+	int X = chunk->dim[0];
+	int Y = chunk->dim[1];
+	long value_index = chunk->first_value;
+	long line_number = chunk->first_line;
+
+	for (const char *p = chunk->start; p < chunk->stop; line_number++)
+	{
+		const char *line_end = memchr(p, '\n', chunk->stop - p);
+		if (line_end == NULL)
+			line_end = chunk->stop;
+		const char *q = skip_blanks(p, line_end);
+		p = line_end + 1;
+		if (q == line_end)
+			continue;
+
+		if (value_index < chunk->total_size)
+		{
+			long temp_index = (value_index % X) * Y + value_index / X;
+			char cell_type = *q;
+			double value;
+			q = parse_double(skip_blanks(q + 1, line_end), line_end, &value);
+			if (q == NULL || skip_blanks(q, line_end) != line_end)
+			{
+				chunk->error_line = line_number;
+				chunk->error_message = "expected a cell type followed by a temperature";
+				return;
+			}
+			chunk->type[temp_index] = cell_type;
+			chunk->temperature[temp_index] = value;
+		}
+		else if (value_index == chunk->total_size)
+		{
+			q = parse_int(q, line_end, chunk->iterations);
+			if (q == NULL || skip_blanks(q, line_end) != line_end)
+			{
+				chunk->error_line = line_number;
+				chunk->error_message = "expected the number of iterations";
+				return;
+			}
+			chunk->found_iterations = 1;
+		}
+		else
+		{
+			chunk->error_line = line_number;
+			chunk->error_message = "unexpected line after the number of iterations";
+			return;
+		}
+		value_index++;
+	}
+}
+
+static void *count_chunk_main(void *arg)
+{
+	count_chunk((TextChunk *)arg);
+	return NULL;
+}
+
+static void *parse_chunk_main(void *arg)
+{
+	parse_chunk((TextChunk *)arg);
+	return NULL;
+}
+
+/// @brief Runs function on every chunk, one thread per chunk
+static void run_chunks(TextChunk *chunks, int chunk_count, void *(*function)(void *))
+{
+	pthread_t threads[GRID_TEXT_MAX_THREADS];
+	int started[GRID_TEXT_MAX_THREADS];
+
+	for (int t = 1; t < chunk_count; t++)
+		started[t] = pthread_create(&threads[t], NULL, function, &chunks[t]) == 0;
+	function(&chunks[0]);
+	for (int t = 1; t < chunk_count; t++)
+	{
+		if (started[t])
+			pthread_join(threads[t], NULL);
+		else
+			function(&chunks[t]);
+	}
+}
+
+/// @brief Loads a text grid: the dimensions, one "type temperature" line per cell with the
+// lines index changing fastest, then the number of iterations. The file is mapped and split into
+// line aligned chunks parsed in parallel: a first pass counts the lines of every chunk so that
+// each one knows the cells it holds, the second pass parses them in place. Blank lines are
+// skipped like fscanf() does
+/// @param file_name name of the input file
+/// @param dim matrix dimensions, filled in
+/// @param iterations filled in with the number of iterations
+/// @param temperature allocated and filled in with the temperature matrix
+/// @param type allocated and filled in with the cell type matrix
+/// @return 1 if error, 0 if no error
+int grid_read_text(char *file_name, int *dim, int *iterations, double **temperature, char **type)
+{
+	size_t size;
+	char *base = (char *)map_file(file_name, &size);
+	if (base == NULL)
+	{
+		return 1;
+	}
+	const char *end = base + size;
+
+	// The dimensions, on the first line holding something
+	const char *p = base;
+	long line_number = 1;
+	while (p < end && (is_blank(*p) || *p == '\n'))
+		line_number += *p++ == '\n';
+	const char *line_end = memchr(p, '\n', end - p);
+	if (line_end == NULL)
+		line_end = end;
+	p = parse_int(p, line_end, &dim[0]);
+	if (p != NULL && p < line_end && is_blank(*p))
+		p = parse_int(skip_blanks(p, line_end), line_end, &dim[1]);
+	else
+		p = NULL;
+	if (p == NULL || skip_blanks(p, line_end) != line_end || dim[0] <= 0 || dim[1] <= 0)
+	{
+		fprintf(stderr, "%s:%ld: expected the matrix dimensions\n", file_name, line_number);
+		unmap_file(base, size);
+		return 1;
+	}
+
+	long total_size = (long)dim[0] * dim[1];
+	*temperature = (double *)malloc(sizeof(double) * total_size);
+	*type = (char *)malloc(sizeof(char) * total_size);
+	if (*temperature == NULL || *type == NULL)
+	{
+		perror("Error allocating memory for the matrices\n");
+		free(*temperature);
+		free(*type);
+		unmap_file(base, size);
+		return 1;
+	}
+
+	// Split the rest in line aligned chunks, small files are not worth the threads
+	const char *body = line_end < end ? line_end + 1 : end;
+	int chunk_count = (int)((end - body) / GRID_TEXT_MIN_CHUNK) + 1;
+	if (chunk_count > online_cores())
+		chunk_count = online_cores();
+	if (chunk_count > GRID_TEXT_MAX_THREADS)
+		chunk_count = GRID_TEXT_MAX_THREADS;
+
+	TextChunk chunks[GRID_TEXT_MAX_THREADS];
+	memset(chunks, 0, sizeof(chunks));
+	const char *chunk_start = body;
+	for (int t = 0; t < chunk_count; t++)
+	{
+		const char *chunk_stop = t == chunk_count - 1 ? end : body + (end - body) * (t + 1) / chunk_count;
+		if (chunk_stop < chunk_start)
+			chunk_stop = chunk_start;
+		const char *newline = chunk_stop < end ? memchr(chunk_stop, '\n', end - chunk_stop) : NULL;
+		if (t < chunk_count - 1)
+			chunk_stop = newline != NULL ? newline + 1 : end;
+
+		chunks[t].start = chunk_start;
+		chunks[t].stop = chunk_stop;
+		chunks[t].dim = dim;
+		chunks[t].temperature = *temperature;
+		chunks[t].type = *type;
+		chunks[t].iterations = iterations;
+		chunks[t].total_size = total_size;
+		chunk_start = chunk_stop;
+	}
+
+	run_chunks(chunks, chunk_count, count_chunk_main);
+
+	long value_lines = 0;
+	long first_line = line_number + 1;
+	for (int t = 0; t < chunk_count; t++)
+	{
+		chunks[t].first_value = value_lines;
+		chunks[t].first_line = first_line;
+		value_lines += chunks[t].value_lines;
+		first_line += chunks[t].physical_lines;
+	}
+
+	int rc = 0;
+	if (value_lines < total_size)
+	{
+		fprintf(stderr, "%s: expected %ld cells, found %ld\n", file_name, total_size, value_lines);
+		rc = 1;
+	}
+	else
+	{
+		run_chunks(chunks, chunk_count, parse_chunk_main);
+
+		int found_iterations = 0;
+		for (int t = 0; t < chunk_count; t++)
+		{
+			found_iterations |= chunks[t].found_iterations;
+			// Chunks are in file order, the first error is the earliest one
+			if (chunks[t].error_line != 0)
+			{
+				fprintf(stderr, "%s:%ld: %s\n", file_name, chunks[t].error_line, chunks[t].error_message);
+				rc = 1;
+				break;
+			}
+		}
+		if (!rc && !found_iterations)
+		{
+			fprintf(stderr, "%s: no number of iterations after the cells, running none\n", file_name);
+			*iterations = 0;
+		}
+	}
+
+	unmap_file(base, size);
+	if (rc)
+	{
+		free(*temperature);
+		free(*type);
+		*temperature = NULL;
+		*type = NULL;
+	}
+	return rc;
+}
+
+/// @brief Stores a text grid in the format read by grid_read_text()
+/// @param iterations number of iterations written on the last line, omitted if negative as in the
+// result files
+/// @return 1 if error, 0 if no error
+int grid_write_text(char *file_name, int *dim, double *temperature, char *type, int iterations)
+{
+	FILE *file_fptr = fopen(file_name, "w");
+
+	if (file_fptr == NULL)
+	{
+		perror("Error opening the output file!\n");
+		return 1;
+	}
+
+	fprintf(file_fptr, "%d %d\n", dim[0], dim[1]);
+
+	for (int j = 0; j < dim[1]; j++)
+	{
+		for (int i = 0; i < dim[0]; i++)
+		{
+			int temp_index = i * dim[1] + j;
+			fprintf(file_fptr, "%c %lf\n", type[temp_index], temperature[temp_index]);
+		}
+	}
+	if (iterations >= 0)
+		fprintf(file_fptr, "%d", iterations);
+	fclose(file_fptr);
+	return 0;
+}
@@ -0,0 +1,67 @@
+#ifndef GRID_IO_H
+#define GRID_IO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "_Precision.h"
+
+/* Binary grid container, version 1:
+- GridFileHeader at offset 0
+- temperature section, X * Y values of type dtype in the same line-major order as the matrices,
+  dtype is one of the PRECISION_ codes
+- cell type section, X * Y bytes holding the cell type characters
+Sections start on GRID_ALIGNMENT boundaries so a mapped file can back device buffers directly */
+#define GRID_MAGIC "TTGRID\r\n"
+#define GRID_VERSION 1
+#define GRID_ALIGNMENT 4096
+#define GRID_EXTENSION ".ttg"
+
+#define GRID_DTYPE_F64 PRECISION_FP64
+#define GRID_DTYPE_F32 PRECISION_FP32
+#define GRID_DTYPE_F16 PRECISION_FP16
+
+/* Text grids are parsed in chunks of at least GRID_TEXT_MIN_CHUNK bytes, one thread per chunk */
+#define GRID_TEXT_MIN_CHUNK (1 << 20)
+#define GRID_TEXT_MAX_THREADS 64
+
+typedef struct GridFileHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t dtype;
+	// Matrix dimensions, X lines of Y columns
+	int32_t dim[2];
+	int32_t iterations;
+	uint32_t reserved;
+	double decay_rate;
+	uint64_t temperature_offset, temperature_bytes;
+	uint64_t type_offset, type_bytes;
+} GridFileHeader;
+
+/* A binary grid file mapped in memory, copy-on-write so the file is never modified, except for the
+files made by grid_create_binary() which are mapped shared */
+typedef struct GridMapping
+{
+	void *base;
+	size_t size;
+	GridFileHeader *header;
+	// Temperatures as stored, header->dtype values
+	void *temperature;
+	char *type;
+} GridMapping;
+
+int grid_is_binary(char *file_name);
+int grid_has_binary_extension(char *file_name);
+GridMapping *grid_map_binary(char *file_name);
+int grid_is_mapped(GridMapping *self, void *ptr);
+void grid_unmap(GridMapping *self);
+void grid_header_init(GridFileHeader *header, int *dim, int iterations, double decay_rate, int dtype);
+GridMapping *grid_create_binary(char *file_name, int *dim, int iterations, double decay_rate, int dtype);
+int grid_write_binary(char *file_name, int *dim, int iterations, double decay_rate, double *temperature, char *type,
+					  int dtype);
+
+int grid_read_text(char *file_name, int *dim, int *iterations, double **temperature, char **type);
+int grid_write_text(char *file_name, int *dim, double *temperature, char *type, int iterations);
+
+#endif
@@ -0,0 +1,129 @@
+#include "_JobProtocol.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/// @brief Fills the address of a Unix domain socket
+/// @return 1 if the path is too long, 0 if no error
+static int socket_address(char *socket_file, struct sockaddr_un *address)
+{
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+	if (strlen(socket_file) >= sizeof(address->sun_path))
+	{
+		fprintf(stderr, "Socket path '%s' is too long\n", socket_file);
+		return 1;
+	}
+	strcpy(address->sun_path, socket_file);
+	return 0;
+}
+
+/// @brief Connects to the server listening on socket_file
+/// @return the connected socket, -1 if error
+int job_connect(char *socket_file)
+{
+	struct sockaddr_un address;
+	if (socket_address(socket_file, &address))
+	{
+		return -1;
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+	{
+		perror("Error creating the socket\n");
+		return -1;
+	}
+	if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+	{
+		perror("Error connecting to the server\n");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/// @brief Listens on socket_file, replacing a socket left by a previous server
+/// @return the listening socket, -1 if error
+int job_listen(char *socket_file, int backlog)
+{
+	struct sockaddr_un address;
+	if (socket_address(socket_file, &address))
+	{
+		return -1;
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+	{
+		perror("Error creating the socket\n");
+		return -1;
+	}
+	unlink(socket_file);
+	if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, backlog) != 0)
+	{
+		perror("Error listening on the socket\n");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/// @brief Writes size bytes, through short writes and interruptions
+/// @return 1 if error, 0 if no error
+int job_write_all(int fd, const void *buffer, size_t size)
+{
+	const char *bytes = (const char *)buffer;
+	while (size > 0)
+	{
+		ssize_t written = send(fd, bytes, size, MSG_NOSIGNAL);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return 1;
+		bytes += written;
+		size -= written;
+	}
+	return 0;
+}
+
+/// @brief Reads exactly size bytes
+/// @return 1 if error or end of stream, 0 if no error
+int job_read_all(int fd, void *buffer, size_t size)
+{
+	char *bytes = (char *)buffer;
+	while (size > 0)
+	{
+		ssize_t got = read(fd, bytes, size);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0)
+			return 1;
+		bytes += got;
+		size -= got;
+	}
+	return 0;
+}
+
+/// @brief Reads a line without its newline. Bytes are read one at a time so that the binary data
+// following a line stays in the socket
+/// @return 1 if error, end of stream or line longer than size, 0 if no error
+int job_read_line(int fd, char *line, size_t size)
+{
+	size_t length = 0;
+	while (length + 1 < size)
+	{
+		char c;
+		if (job_read_all(fd, &c, 1))
+			return 1;
+		if (c == '\n')
+		{
+			line[length] = '\0';
+			return 0;
+		}
+		line[length++] = c;
+	}
+	return 1;
+}
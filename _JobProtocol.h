@@ -0,0 +1,34 @@
+#ifndef JOB_PROTOCOL_H
+#define JOB_PROTOCOL_H
+
+#include <stddef.h>
+
+/* Protocol of the simulation server, text lines over a Unix domain socket. A client sends any
+number of requests on a connection without waiting for the replies, which come back in the order
+the jobs finish and carry the tag of their request:
+
+JOB tag priority iterations decay_rate input_file [output_file]
+  Simulates the grid of input_file, in either format, read by the server. Higher priorities run
+  first, a negative decay rate takes the one of a binary grid or the default one
+SHUTDOWN
+  Stops the server once the queued jobs are done, replied with BYE
+
+DONE tag queue_ms run_ms batch_count
+  The result was written by the server to output_file, in the binary format if its name ends
+  with .ttg. batch_count is the number of jobs computed together with this one
+RESULT tag X Y queue_ms run_ms batch_count
+  Without output_file, followed by the X * Y result temperatures as native doubles
+ERROR tag message
+  The job failed, the message runs to the end of the line
+
+Tags and file names cannot contain spaces */
+#define JOB_LINE_LENGTH 4352
+#define JOB_TAG_LENGTH 64
+
+int job_connect(char *socket_file);
+int job_listen(char *socket_file, int backlog);
+int job_write_all(int fd, const void *buffer, size_t size);
+int job_read_all(int fd, void *buffer, size_t size);
+int job_read_line(int fd, char *line, size_t size);
+
+#endif
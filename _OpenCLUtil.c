@@ -1,11 +1,28 @@
 #include "_OpenCLUtil.h"
 
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #define SELECTED_PLATFORM -1
 #define SELECTED_DEVICE -1
 
+// First bytes of the files of the kernel cache
+#define KERNEL_CACHE_MAGIC "TTKBIN1\n"
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define MKDIR(path) _mkdir(path)
+#define getpid _getpid
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#define MKDIR(path) mkdir(path, 0755)
+#endif
+
 #define CaseReturnString(x) \
 	case x:                 \
 		return #x;
@@ -181,19 +198,16 @@ cl_device_id initOpenCL(cl_context *context, cl_command_queue *commandQueue)
 	*context = clCreateContext(0, 1, &device_ids[selectedDevice], NULL, NULL, &ret);
 	handleError(ret, __LINE__, __FILE__);
 
-	*commandQueue = clCreateCommandQueue(*context, device_ids[selectedDevice], 0, &ret);
+	// Profiling lets the benchmark time every command on the device, its cost is a couple of timestamps per command
+	*commandQueue = clCreateCommandQueue(*context, device_ids[selectedDevice], CL_QUEUE_PROFILING_ENABLE, &ret);
 	handleError(ret, __LINE__, __FILE__);
 	return device_ids[selectedDevice];
 }
 
-cl_kernel getAndCompileKernel(char *fileName, char *kernelName, cl_context context, cl_device_id deviceid)
+/// @brief Builds a program for deviceid, prints the build log and exits if it fails
+static void buildProgram(cl_program program, cl_device_id deviceid, char *buildOptions)
 {
-	cl_int ret;
-	char *KernelSource = readKernel(fileName);
-	cl_program program = clCreateProgramWithSource(context, 1, (const char **)&KernelSource, NULL, &ret);
-	handleError(ret, __LINE__, __FILE__);
-
-	ret = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
+	cl_int ret = clBuildProgram(program, 1, &deviceid, buildOptions, NULL, NULL);
 	if (ret != CL_SUCCESS) {
 		size_t len;
 		char buffer[20480];
@@ -205,9 +219,304 @@ cl_kernel getAndCompileKernel(char *fileName, char *kernelName, cl_context conte
 			printf("%c", buffer[i]);
 		exit(1);
 	}
+}
+
+cl_program getAndCompileProgram(char *fileName, cl_context context, cl_device_id deviceid)
+{
+	cl_int ret;
+	char *KernelSource = readKernel(fileName);
+	cl_program program = clCreateProgramWithSource(context, 1, (const char **)&KernelSource, NULL, &ret);
+	handleError(ret, __LINE__, __FILE__);
+	free(KernelSource);
+
+	buildProgram(program, deviceid, NULL);
+	return program;
+}
+
+/// @brief FNV-1a hash of a string, names the cache files
+static unsigned long long hashString(const char *text, unsigned long long hash)
+{
+	for (; *text != '\0'; text++) {
+		hash ^= (unsigned char)*text;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static char *getDeviceString(cl_device_id deviceid, cl_device_info param)
+{
+	size_t size;
+	cl_int ret = clGetDeviceInfo(deviceid, param, 0, NULL, &size);
+	handleError(ret, __LINE__, __FILE__);
+	char *value = malloc(size);
+	ret = clGetDeviceInfo(deviceid, param, size, value, NULL);
+	handleError(ret, __LINE__, __FILE__);
+	return value;
+}
+
+/// @brief Reads the binary cached under key, NULL if there is none or it belongs to another key
+static unsigned char *readCachedBinary(char *path, char *key, size_t *size)
+{
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL)
+		return NULL;
+
+	char magic[sizeof(KERNEL_CACHE_MAGIC) - 1];
+	unsigned int keyLength;
+	unsigned long long binarySize;
+	unsigned char *binary = NULL;
+	char *storedKey = NULL;
+	if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) || memcmp(magic, KERNEL_CACHE_MAGIC, sizeof(magic)) != 0)
+		goto done;
+	if (fread(&keyLength, sizeof(keyLength), 1, fp) != 1 || keyLength != strlen(key))
+		goto done;
+	storedKey = malloc(keyLength);
+	// Two keys can share a file name, the full key tells them apart
+	if (fread(storedKey, 1, keyLength, fp) != keyLength || memcmp(storedKey, key, keyLength) != 0)
+		goto done;
+	if (fread(&binarySize, sizeof(binarySize), 1, fp) != 1 || binarySize == 0)
+		goto done;
+	binary = malloc(binarySize);
+	if (binary == NULL || fread(binary, 1, binarySize, fp) != binarySize) {
+		free(binary);
+		binary = NULL;
+		goto done;
+	}
+	*size = binarySize;
+
+done:
+	free(storedKey);
+	fclose(fp);
+	return binary;
+}
+
+/// @brief Returns the binary of a program for one of its devices, NULL if it has none. A program
+// created in the context of initOpenCLDevices() holds every device of the context, only the
+// entry of deviceid is read back
+static unsigned char *getProgramBinary(cl_program program, cl_device_id deviceid, size_t *size)
+{
+	cl_uint deviceCount;
+	cl_int ret = clGetProgramInfo(program, CL_PROGRAM_NUM_DEVICES, sizeof(deviceCount), &deviceCount, NULL);
+	if (ret != CL_SUCCESS || deviceCount == 0)
+		return NULL;
+	cl_device_id *devices = malloc(deviceCount * sizeof(cl_device_id));
+	size_t *binarySizes = malloc(deviceCount * sizeof(size_t));
+	unsigned char **binaries = calloc(deviceCount, sizeof(unsigned char *));
+	unsigned char *binary = NULL;
+	ret = clGetProgramInfo(program, CL_PROGRAM_DEVICES, deviceCount * sizeof(cl_device_id), devices, NULL);
+	if (ret == CL_SUCCESS)
+		ret = clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, deviceCount * sizeof(size_t), binarySizes, NULL);
+	if (ret != CL_SUCCESS)
+		goto done;
+
+	cl_uint index = 0;
+	while (index < deviceCount && devices[index] != deviceid)
+		index++;
+	if (index == deviceCount || binarySizes[index] == 0)
+		goto done;
+	// The entries left NULL are skipped by the driver
+	binaries[index] = malloc(binarySizes[index]);
+	ret = clGetProgramInfo(program, CL_PROGRAM_BINARIES, deviceCount * sizeof(unsigned char *), binaries, NULL);
+	if (ret != CL_SUCCESS) {
+		free(binaries[index]);
+		goto done;
+	}
+	binary = binaries[index];
+	*size = binarySizes[index];
+
+done:
+	free(devices);
+	free(binarySizes);
+	free(binaries);
+	return binary;
+}
+
+/// @brief Stores the binary of a built program for deviceid under key. The file is written aside
+// and renamed so that concurrent runs never read half a binary
+static void writeCachedBinary(char *cacheDir, char *path, char *key, cl_program program, cl_device_id deviceid)
+{
+	size_t binarySize;
+	unsigned char *binary = getProgramBinary(program, deviceid, &binarySize);
+	if (binary == NULL)
+		return;
+
+	MKDIR(cacheDir);
+	char tmpPath[4096 + 32];
+	snprintf(tmpPath, sizeof(tmpPath), "%s.%ld.tmp", path, (long)getpid());
+	FILE *fp = fopen(tmpPath, "wb");
+	if (fp == NULL) {
+		printf("DEBUG: Cannot write the kernel cache %s: %s\n", tmpPath, strerror(errno));
+		free(binary);
+		return;
+	}
+	unsigned int keyLength = (unsigned int)strlen(key);
+	unsigned long long size = binarySize;
+	int ok = fwrite(KERNEL_CACHE_MAGIC, 1, sizeof(KERNEL_CACHE_MAGIC) - 1, fp) == sizeof(KERNEL_CACHE_MAGIC) - 1 &&
+			 fwrite(&keyLength, sizeof(keyLength), 1, fp) == 1 && fwrite(key, 1, keyLength, fp) == keyLength &&
+			 fwrite(&size, sizeof(size), 1, fp) == 1 && fwrite(binary, 1, binarySize, fp) == binarySize;
+	ok = fclose(fp) == 0 && ok;
+	if (ok && rename(tmpPath, path) == 0)
+		printf("DEBUG: Stored %zu bytes of kernel binary in %s\n", binarySize, path);
+	else
+		remove(tmpPath);
+	free(binary);
+}
+
+/// @brief Builds a program with options, reusing the binary of an earlier build when the source,
+// the device, its driver and the options are the same
+/// @param buildOptions options given to the compiler, NULL for none
+/// @param cacheDir directory of the cached binaries, NULL to always build from source
+cl_program getCachedProgram(char *fileName, char *buildOptions, char *cacheDir, cl_context context, cl_device_id deviceid)
+{
+	cl_int ret;
+	char *KernelSource = readKernel(fileName);
+	if (buildOptions == NULL)
+		buildOptions = "";
+
+	char path[4096];
+	char *key = NULL;
+	if (cacheDir != NULL) {
+		char *deviceName = getDeviceString(deviceid, CL_DEVICE_NAME);
+		char *driverVersion = getDeviceString(deviceid, CL_DRIVER_VERSION);
+		size_t keySize = strlen(deviceName) + strlen(driverVersion) + strlen(buildOptions) + 32;
+		key = malloc(keySize);
+		snprintf(key, keySize, "%016llx|%s|%s|%s", hashString(KernelSource, FNV_OFFSET_BASIS), deviceName, driverVersion, buildOptions);
+		snprintf(path, sizeof(path), "%s/%016llx.bin", cacheDir, hashString(key, FNV_OFFSET_BASIS));
+		free(deviceName);
+		free(driverVersion);
+
+		size_t binarySize;
+		const unsigned char *binary = readCachedBinary(path, key, &binarySize);
+		if (binary != NULL) {
+			cl_int binaryStatus;
+			cl_program program = clCreateProgramWithBinary(context, 1, &deviceid, &binarySize, &binary, &binaryStatus, &ret);
+			free((void *)binary);
+			if (ret == CL_SUCCESS && binaryStatus == CL_SUCCESS &&
+				clBuildProgram(program, 1, &deviceid, buildOptions, NULL, NULL) == CL_SUCCESS) {
+				printf("DEBUG: Loaded the kernels of %s from %s\n", fileName, path);
+				free(KernelSource);
+				free(key);
+				return program;
+			}
+			// A binary the driver refuses is rebuilt from source and overwritten
+			printf("DEBUG: Ignoring the kernel cache %s, the driver rejected it\n", path);
+			if (ret == CL_SUCCESS)
+				clReleaseProgram(program);
+		}
+	}
+
+	cl_program program = clCreateProgramWithSource(context, 1, (const char **)&KernelSource, NULL, &ret);
+	handleError(ret, __LINE__, __FILE__);
+	free(KernelSource);
+	buildProgram(program, deviceid, buildOptions);
+
+	if (key != NULL) {
+		writeCachedBinary(cacheDir, path, key, program, deviceid);
+		free(key);
+	}
+	return program;
+}
+
+cl_kernel getAndCompileKernel(char *fileName, char *kernelName, cl_context context, cl_device_id deviceid)
+{
+	cl_int ret;
+	cl_program program = getAndCompileProgram(fileName, context, deviceid);
 
 	// Create the compute kernel in the program we wish to run
 	cl_kernel kernel = clCreateKernel(program, kernelName, &ret);
 	handleError(ret, __LINE__, __FILE__);
 	return kernel;
-}
\ No newline at end of file
+}
+
+/// @brief Selects several devices of the platform initOpenCL() would pick and creates a single
+// context over all of them, each device gets its own command queue from the caller
+/// @param deviceCount number of devices to use from the first one, 0 for all of them
+/// @param subDevices splits each device in this many sub-devices of equal compute units, 0 to
+// use the devices as they are. A CPU device split this way stands in for several accelerators
+/// @param count filled in with the number of devices returned
+/// @return the devices, to free by the caller
+cl_device_id *initOpenCLDevices(cl_context *context, int deviceCount, int subDevices, int *count)
+{
+	cl_uint num_platforms;
+	cl_int ret;
+	ret = clGetPlatformIDs(0, NULL, &num_platforms);
+	handleError(ret, __LINE__, __FILE__);
+	cl_platform_id *platform_ids = malloc(sizeof(cl_platform_id) * num_platforms);
+	ret = clGetPlatformIDs(num_platforms, platform_ids, &num_platforms);
+	handleError(ret, __LINE__, __FILE__);
+
+	int selectedPlatform = 0;
+	for (int i = 0; i < num_platforms; i++) {
+		char platformName[256];
+		ret = clGetPlatformInfo(platform_ids[i], CL_PLATFORM_NAME, sizeof(platformName), platformName, NULL);
+		handleError(ret, __LINE__, __FILE__);
+		if (strncmp(platformName, "NVIDIA", 6) == 0)
+			selectedPlatform = i;
+	}
+	selectedPlatform = SELECTED_PLATFORM >= 0 ? SELECTED_PLATFORM : selectedPlatform;
+	cl_platform_id platform = platform_ids[selectedPlatform];
+	free(platform_ids);
+
+	cl_uint num_devices;
+	ret = clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 0, NULL, &num_devices);
+	handleError(ret, __LINE__, __FILE__);
+	cl_device_id *device_ids = malloc(sizeof(cl_device_id) * num_devices);
+	ret = clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, num_devices, device_ids, &num_devices);
+	handleError(ret, __LINE__, __FILE__);
+
+	// The devices are taken in order from the one initOpenCL() would select
+	int firstDevice = SELECTED_DEVICE >= 0 ? SELECTED_DEVICE : 0;
+	int available = (int)num_devices - firstDevice;
+	if (deviceCount == 0)
+		deviceCount = available;
+	if (deviceCount > available) {
+		printf("ERROR: %d devices requested, platform %i only has %d from device %d\n", deviceCount, selectedPlatform, available, firstDevice);
+		exit(1);
+	}
+
+	cl_device_id *devices;
+	if (subDevices > 0) {
+		devices = malloc(sizeof(cl_device_id) * deviceCount * subDevices);
+		*count = 0;
+		for (int i = 0; i < deviceCount; i++) {
+			cl_uint computeUnits;
+			ret = clGetDeviceInfo(device_ids[firstDevice + i], CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(computeUnits), &computeUnits, NULL);
+			handleError(ret, __LINE__, __FILE__);
+			if (computeUnits < subDevices) {
+				printf("ERROR: Device %d has %u compute units, it cannot be split in %d sub-devices\n", firstDevice + i, computeUnits, subDevices);
+				exit(1);
+			}
+			cl_device_partition_property properties[] = {CL_DEVICE_PARTITION_EQUALLY, computeUnits / subDevices, 0};
+			cl_uint created;
+			ret = clCreateSubDevices(device_ids[firstDevice + i], properties, 0, NULL, &created);
+			handleError(ret, __LINE__, __FILE__);
+			// Compute units that do not divide evenly make an extra, smaller sub-device, left unused
+			cl_device_id *parts = malloc(sizeof(cl_device_id) * created);
+			ret = clCreateSubDevices(device_ids[firstDevice + i], properties, created, parts, NULL);
+			handleError(ret, __LINE__, __FILE__);
+			for (int j = 0; j < created; j++) {
+				if (j < subDevices)
+					devices[(*count)++] = parts[j];
+				else
+					clReleaseDevice(parts[j]);
+			}
+			free(parts);
+			printf("DEBUG: Split device %d in %d sub-devices of %u compute units\n", firstDevice + i, subDevices, computeUnits / subDevices);
+		}
+	} else {
+		devices = malloc(sizeof(cl_device_id) * deviceCount);
+		memcpy(devices, device_ids + firstDevice, sizeof(cl_device_id) * deviceCount);
+		*count = deviceCount;
+	}
+	free(device_ids);
+
+	for (int i = 0; i < *count; i++) {
+		char *deviceName = getDeviceString(devices[i], CL_DEVICE_NAME);
+		printf("DEBUG: Slab device %i is %s\n", i, deviceName);
+		free(deviceName);
+	}
+
+	*context = clCreateContext(0, *count, devices, NULL, NULL, &ret);
+	handleError(ret, __LINE__, __FILE__);
+	return devices;
+}
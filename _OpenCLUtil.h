@@ -7,4 +7,7 @@
 
 void handleError(cl_int returnValue, int lineNumber, char *fileName);
 cl_device_id initOpenCL(cl_context *context, cl_command_queue *commandQueue);
+cl_device_id *initOpenCLDevices(cl_context *context, int deviceCount, int subDevices, int *count);
+cl_program getAndCompileProgram(char *fileName, cl_context context, cl_device_id deviceid);
+cl_program getCachedProgram(char *fileName, char *buildOptions, char *cacheDir, cl_context context, cl_device_id deviceid);
 cl_kernel getAndCompileKernel(char *fileName, char *kernelName, cl_context context, cl_device_id deviceid);
\ No newline at end of file
@@ -0,0 +1,185 @@
+#include "_Precision.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "_TypeMask.h"
+
+static const char *precision_names[] = {"fp64", "fp32", "fp16"};
+
+/// @brief Returns the precision called name, -1 if there is none
+int precision_parse(char *name)
+{
+	for (int p = PRECISION_FP64; p <= PRECISION_FP16; p++)
+		if (strcmp(name, precision_names[p - PRECISION_FP64]) == 0)
+			return p;
+	return -1;
+}
+
+const char *precision_name(int precision)
+{
+	return precision_names[precision - PRECISION_FP64];
+}
+
+/// @brief Returns the size of a stored temperature
+size_t precision_cell_bytes(int precision)
+{
+	if (precision == PRECISION_FP16)
+		return sizeof(uint16_t);
+	if (precision == PRECISION_FP32)
+		return sizeof(float);
+	return sizeof(double);
+}
+
+/// @brief Returns the size of the values the kernels compute with, the decay rate argument and
+// the local buffers have this size
+size_t precision_real_bytes(int precision)
+{
+	return precision == PRECISION_FP64 ? sizeof(double) : sizeof(float);
+}
+
+/// @brief Returns the compiler option that selects the precision in homework.cl
+const char *precision_build_option(int precision)
+{
+	if (precision == PRECISION_FP16)
+		return "-D STORAGE_FP16";
+	if (precision == PRECISION_FP32)
+		return "-D STORAGE_FP32";
+	return "";
+}
+
+/// @brief Writes value as an OpenCL C literal of the type the kernels compute with, a float
+// literal rounded like the float arguments unless in fp64, so that it does not promote the
+// arithmetic of the reduced precisions to double
+void precision_real_literal(int precision, double value, char *literal, size_t size)
+{
+	if (precision == PRECISION_FP64)
+		snprintf(literal, size, "%.17g", value);
+	else
+		snprintf(literal, size, "%.9gf", (float)value);
+}
+
+/// @brief Rounds a float to the nearest half float, ties to even like vstore_half_rte
+uint16_t precision_float_to_half(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint16_t sign = (bits >> 16) & 0x8000;
+	int32_t exponent = (int32_t)((bits >> 23) & 0xff) - 127 + 15;
+	uint32_t mantissa = bits & 0x7fffff;
+
+	if (((bits >> 23) & 0xff) == 0xff)
+		return sign | 0x7c00 | (mantissa ? 0x200 : 0); // infinity or NaN
+	if (exponent >= 31)
+		return sign | 0x7c00; // too large, infinity
+	if (exponent <= 0)
+	{
+		// Subnormal half or zero, the implicit bit becomes explicit
+		if (exponent < -10)
+			return sign;
+		mantissa |= 0x800000;
+		int shift = 14 - exponent;
+		uint32_t half_mantissa = mantissa >> shift;
+		uint32_t rest = mantissa & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+		if (rest > halfway || (rest == halfway && (half_mantissa & 1)))
+			half_mantissa++;
+		return sign | half_mantissa;
+	}
+
+	uint16_t half = sign | (exponent << 10) | (mantissa >> 13);
+	uint32_t rest = mantissa & 0x1fff;
+	// A carry out of the mantissa correctly moves to the exponent, up to infinity
+	if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+		half++;
+	return half;
+}
+
+float precision_half_to_float(uint16_t value)
+{
+	uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+	uint32_t exponent = (value >> 10) & 0x1f;
+	uint32_t mantissa = value & 0x3ff;
+	uint32_t bits;
+
+	if (exponent == 0x1f)
+		bits = sign | 0x7f800000 | (mantissa << 13);
+	else if (exponent != 0)
+		bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+	else if (mantissa == 0)
+		bits = sign;
+	else
+	{
+		// Subnormal half, normalise it
+		exponent = 127 - 15 + 1;
+		while (!(mantissa & 0x400))
+		{
+			mantissa <<= 1;
+			exponent--;
+		}
+		bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+	}
+	float result;
+	memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+
+/// @brief Converts count temperatures to the stored precision
+/// @param cells count values of precision_cell_bytes() bytes
+void precision_pack(int precision, double *values, void *cells, size_t count)
+{
+	if (precision == PRECISION_FP16)
+	{
+		uint16_t *halves = (uint16_t *)cells;
+		for (size_t i = 0; i < count; i++)
+			halves[i] = precision_float_to_half((float)values[i]);
+	}
+	else if (precision == PRECISION_FP32)
+	{
+		float *floats = (float *)cells;
+		for (size_t i = 0; i < count; i++)
+			floats[i] = (float)values[i];
+	}
+	else if ((void *)values != cells)
+		memcpy(cells, values, sizeof(double) * count);
+}
+
+/// @brief Converts count stored temperatures back to doubles
+void precision_unpack(int precision, void *cells, double *values, size_t count)
+{
+	if (precision == PRECISION_FP16)
+	{
+		uint16_t *halves = (uint16_t *)cells;
+		for (size_t i = 0; i < count; i++)
+			values[i] = precision_half_to_float(halves[i]);
+	}
+	else if (precision == PRECISION_FP32)
+	{
+		float *floats = (float *)cells;
+		for (size_t i = 0; i < count; i++)
+			values[i] = floats[i];
+	}
+	else if ((void *)values != cells)
+		memcpy(values, cells, sizeof(double) * count);
+}
+
+/// @brief Measures the error of the fluid cells of values against reference
+void precision_compare(double *reference, double *values, uint32_t *fluid_bits, size_t count, PrecisionError *error)
+{
+	double squares = 0.0;
+	error->scale = 1.0;
+	error->max_error = 0.0;
+	error->cell_count = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (!TYPE_MASK_IS_FLUID(fluid_bits, i))
+			continue;
+		double difference = fabs(reference[i] - values[i]);
+		error->scale = fmax(error->scale, fabs(reference[i]));
+		error->max_error = fmax(error->max_error, difference);
+		squares += difference * difference;
+		error->cell_count++;
+	}
+	error->rms_error = error->cell_count > 0 ? sqrt(squares / error->cell_count) : 0.0;
+}
@@ -0,0 +1,41 @@
+#ifndef PRECISION_H
+#define PRECISION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Precision of the temperatures stored on the device. The codes are also the dtype of the binary
+grid and snapshot files. FP16 only stores half floats, the kernels compute in float */
+#define PRECISION_FP64 1
+#define PRECISION_FP32 2
+#define PRECISION_FP16 3
+
+/* Largest error of a reduced precision run against a double run, relative to the largest
+temperature. Rounding errors of the stored values add up over the iterations, the diffusion
+averages most of them out */
+#define PRECISION_FP32_TOLERANCE 1e-5
+#define PRECISION_FP16_TOLERANCE 5e-3
+
+/* Error of the fluid cells of a matrix against a reference matrix */
+typedef struct PrecisionError
+{
+	// Largest absolute temperature of the reference, at least 1
+	double scale;
+	double max_error, rms_error;
+	long cell_count;
+} PrecisionError;
+
+int precision_parse(char *name);
+const char *precision_name(int precision);
+size_t precision_cell_bytes(int precision);
+size_t precision_real_bytes(int precision);
+const char *precision_build_option(int precision);
+void precision_real_literal(int precision, double value, char *literal, size_t size);
+
+uint16_t precision_float_to_half(float value);
+float precision_half_to_float(uint16_t value);
+void precision_pack(int precision, double *values, void *cells, size_t count);
+void precision_unpack(int precision, void *cells, double *values, size_t count);
+void precision_compare(double *reference, double *values, uint32_t *fluid_bits, size_t count, PrecisionError *error);
+
+#endif
@@ -0,0 +1,303 @@
+#include "_Renderer.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define SAMPLE_WANTED 0	 // the renderer waits for the simulation to publish a state
+#define SAMPLE_FILLING 1 // the simulation is copying a state into the sample
+#define SAMPLE_READY 2	 // the sample holds a state the renderer has not drawn yet
+
+// Bucket of the cells that were never drawn, forces the first frame to draw everything
+#define NOT_DRAWN -128
+
+// Longest output of one cell: cursor position, color and the cell itself
+#define CELL_BYTES 48
+
+/* Screen layout of the original output: the columns of the matrix are the lines of the screen,
+one blank line apart, and the cells of a line are one tab apart */
+#define FIRST_ROW 3
+#define ROW_STEP 2
+#define COLUMN_STEP 8
+
+struct Renderer
+{
+	int X, Y;
+	size_t total_size;
+	// Thresholds and statistics of the latest reduction, updated while the simulation runs
+	TemperatureColorArray colors;
+	FieldStatistics statistics;
+	int has_statistics;
+	// Time between two frames, in milliseconds
+	long frame_interval;
+
+	// Latest state published by the simulation
+	double *sample;
+	int sample_iteration;
+	int sample_state;
+
+	// Color bucket of every cell as it is on the screen
+	signed char *drawn;
+	// Escape sequences of a frame, written at once
+	char *frame;
+	size_t frame_size;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t sample_ready;
+	int closing;
+};
+
+static const char *color_codes[] = {
+	"\033[38;5;92m", // VERY_COLD
+	"\033[1;34m",	 // COLD
+	"\033[1;36m",	 // CHILLY
+	"\033[38;5;7m",	 // NEUTRAL
+	"\033[1;33m",	 // WARM
+	"\033[38;2;216;128;0m", // HOT
+	"\033[1;31m",	 // VERY_HOT
+};
+
+/// @brief Returns the color of a temperature, from VERY_COLD to VERY_HOT
+/// @param colors thresholds computed from the latest statistics
+int color_bucket(TemperatureColorArray *colors, double value)
+{
+	if (value >= -0.000001 && value <= 0.000001)
+		return NEUTRAL;
+	if (value > colors->orange_th)
+		return VERY_HOT;
+	if (value > colors->yellow_th)
+		return HOT;
+	if (value > 0)
+		return WARM;
+	if (value > colors->cyan_th)
+		return CHILLY;
+	if (value > colors->blue_th)
+		return COLD;
+	return VERY_COLD;
+}
+
+/// @brief Splits the range of temperatures of the fluid cells in color thresholds
+void color_thresholds(FieldStatistics *statistics, TemperatureColorArray *colors)
+{
+	double min = statistics->min_value;
+	double max = statistics->max_value;
+	colors->orange_th = max * 2 / 3;
+	colors->yellow_th = max * 1 / 3;
+	colors->cyan_th = min * 1 / 3;
+	colors->blue_th = min * 2 / 3;
+	colors->min_value = min;
+	colors->max_value = max;
+}
+
+static void sleep_ms(long milliseconds)
+{
+#ifdef _WIN32
+	Sleep(milliseconds);
+#else
+	struct timespec duration = {milliseconds / 1000, (milliseconds % 1000) * 1000000};
+	nanosleep(&duration, NULL);
+#endif
+}
+
+/// @brief Appends text to the frame, which is large enough for every cell plus the status line
+static void append(Renderer *self, const char *text)
+{
+	size_t length = strlen(text);
+	memcpy(self->frame + self->frame_size, text, length);
+	self->frame_size += length;
+}
+
+/// @brief Draws the cells whose color changed since the last frame, in a single write
+static void draw(Renderer *self, int iteration, double *values)
+{
+	char escape[CELL_BYTES * 4];
+	int last_color = NOT_DRAWN;
+
+	pthread_mutex_lock(&self->lock);
+	TemperatureColorArray colors = self->colors;
+	FieldStatistics statistics = self->statistics;
+	int has_statistics = self->has_statistics;
+	pthread_mutex_unlock(&self->lock);
+
+	self->frame_size = 0;
+	if (self->drawn[0] == NOT_DRAWN)
+		append(self, "\033[2J");
+	if (has_statistics)
+		snprintf(escape, sizeof(escape), "\033[1;1H\033[0mIteration %d: min %g max %g mean %g energy %g (iteration %d)\033[K",
+				 iteration, statistics.min_value, statistics.max_value, statistics.mean, statistics.sum, statistics.iteration);
+	else
+		snprintf(escape, sizeof(escape), "\033[1;1H\033[0mIteration %d:\033[K", iteration);
+	append(self, escape);
+
+	// Lines of the screen first so that neighbouring changes are written in order
+	for (int j = 0; j < self->Y; j++)
+	{
+		for (int i = 0; i < self->X; i++)
+		{
+			size_t temp_index = (size_t)i * self->Y + j;
+			int color = color_bucket(&colors, values[temp_index]);
+			if (color == self->drawn[temp_index])
+				continue;
+			self->drawn[temp_index] = color;
+
+			snprintf(escape, sizeof(escape), "\033[%d;%dH", FIRST_ROW + ROW_STEP * j, 1 + COLUMN_STEP * i);
+			append(self, escape);
+			if (color != last_color)
+			{
+				append(self, color_codes[color - VERY_COLD]);
+				last_color = color;
+			}
+			append(self, "#");
+		}
+	}
+
+	snprintf(escape, sizeof(escape), "\033[0m\033[%d;1H", FIRST_ROW + ROW_STEP * self->Y);
+	append(self, escape);
+	fwrite(self->frame, 1, self->frame_size, stdout);
+	fflush(stdout);
+}
+
+/// @brief Renderer thread: asks for a state, draws it when it is published, then waits for the
+// next frame
+static void *renderer_main(void *arg)
+{
+	Renderer *self = (Renderer *)arg;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&self->lock);
+		while (self->sample_state != SAMPLE_READY && !self->closing)
+			pthread_cond_wait(&self->sample_ready, &self->lock);
+		if (self->sample_state != SAMPLE_READY)
+		{
+			pthread_mutex_unlock(&self->lock);
+			return NULL;
+		}
+		pthread_mutex_unlock(&self->lock);
+
+		// The simulation does not touch a ready sample, no need to hold the lock while drawing
+		draw(self, self->sample_iteration, self->sample);
+		sleep_ms(self->frame_interval);
+
+		pthread_mutex_lock(&self->lock);
+		self->sample_state = SAMPLE_WANTED;
+		pthread_mutex_unlock(&self->lock);
+	}
+}
+
+/// @brief Starts the renderer thread
+/// @param X lines of the matrix
+/// @param Y columns of the matrix
+/// @param colors color thresholds, copied
+/// @param fps maximum frames per second
+/// @return the renderer, NULL if error
+Renderer *renderer_create(int X, int Y, TemperatureColorArray *colors, double fps)
+{
+	Renderer *self = (Renderer *)calloc(1, sizeof(Renderer));
+	if (self == NULL)
+	{
+		perror("Error allocating memory for 'Renderer'\n");
+		return NULL;
+	}
+	self->X = X;
+	self->Y = Y;
+	self->total_size = (size_t)X * Y;
+	self->colors = *colors;
+	self->frame_interval = fps > 0 ? (long)(1000 / fps) : (long)(1000 / RENDERER_DEFAULT_FPS);
+	self->sample_state = SAMPLE_WANTED;
+
+	self->sample = (double *)malloc(sizeof(double) * self->total_size);
+	self->drawn = (signed char *)malloc(sizeof(signed char) * self->total_size);
+	self->frame = (char *)malloc(CELL_BYTES * (self->total_size + 8));
+	if (self->sample == NULL || self->drawn == NULL || self->frame == NULL)
+	{
+		perror("Error allocating memory for the renderer buffers\n");
+		free(self->sample);
+		free(self->drawn);
+		free(self->frame);
+		free(self);
+		return NULL;
+	}
+	memset(self->drawn, NOT_DRAWN, sizeof(signed char) * self->total_size);
+
+	pthread_mutex_init(&self->lock, NULL);
+	pthread_cond_init(&self->sample_ready, NULL);
+	if (pthread_create(&self->thread, NULL, renderer_main, self) != 0)
+	{
+		perror("Error creating the renderer thread\n");
+		free(self->sample);
+		free(self->drawn);
+		free(self->frame);
+		free(self);
+		return NULL;
+	}
+	return self;
+}
+
+/// @brief Returns the buffer to copy the current state into if the renderer is waiting for
+// one, NULL otherwise. Never blocks, the caller skips the frame when it gets NULL
+double *renderer_begin_publish(Renderer *self)
+{
+	double *sample = NULL;
+	if (pthread_mutex_trylock(&self->lock) != 0)
+		return NULL;
+	if (self->sample_state == SAMPLE_WANTED)
+	{
+		self->sample_state = SAMPLE_FILLING;
+		sample = self->sample;
+	}
+	pthread_mutex_unlock(&self->lock);
+	return sample;
+}
+
+/// @brief Hands the buffer filled after renderer_begin_publish() to the renderer
+/// @param iteration iteration the state belongs to
+void renderer_end_publish(Renderer *self, int iteration)
+{
+	pthread_mutex_lock(&self->lock);
+	self->sample_iteration = iteration;
+	self->sample_state = SAMPLE_READY;
+	pthread_cond_signal(&self->sample_ready);
+	pthread_mutex_unlock(&self->lock);
+}
+
+/// @brief Recomputes the color thresholds from new statistics, the next frames recolor the cells
+// whose bucket changed
+void renderer_set_statistics(Renderer *self, FieldStatistics *statistics)
+{
+	pthread_mutex_lock(&self->lock);
+	self->statistics = *statistics;
+	self->has_statistics = 1;
+	color_thresholds(statistics, &self->colors);
+	pthread_mutex_unlock(&self->lock);
+}
+
+/// @brief Stops the renderer thread, draws the final state and frees the renderer
+/// @param iteration last iteration
+/// @param values final matrix
+void renderer_finish(Renderer *self, int iteration, double *values)
+{
+	pthread_mutex_lock(&self->lock);
+	self->closing = 1;
+	pthread_cond_signal(&self->sample_ready);
+	pthread_mutex_unlock(&self->lock);
+	pthread_join(self->thread, NULL);
+
+	draw(self, iteration, values);
+	printf("\n");
+
+	pthread_mutex_destroy(&self->lock);
+	pthread_cond_destroy(&self->sample_ready);
+	free(self->sample);
+	free(self->drawn);
+	free(self->frame);
+	free(self);
+}
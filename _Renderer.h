@@ -0,0 +1,34 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include "_Statistics.h"
+
+#define VERY_HOT 3	 // RED
+#define HOT 2		 // ORANGE
+#define WARM 1		 // YELLOW
+#define NEUTRAL 0	 // GRAY
+#define CHILLY -1	 // CYAN
+#define COLD -2		 // BLUE
+#define VERY_COLD -3 // PURPLE
+
+#define RENDERER_DEFAULT_FPS 10.0
+
+typedef struct TemperatureColorArray
+{
+	double min_value, max_value;
+	// Color thresholding
+	double orange_th, yellow_th, cyan_th, blue_th;
+} TemperatureColorArray;
+
+typedef struct Renderer Renderer;
+
+int color_bucket(TemperatureColorArray *colors, double value);
+void color_thresholds(FieldStatistics *statistics, TemperatureColorArray *colors);
+
+Renderer *renderer_create(int X, int Y, TemperatureColorArray *colors, double fps);
+double *renderer_begin_publish(Renderer *self);
+void renderer_end_publish(Renderer *self, int iteration);
+void renderer_set_statistics(Renderer *self, FieldStatistics *statistics);
+void renderer_finish(Renderer *self, int iteration, double *values);
+
+#endif
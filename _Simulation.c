@@ -0,0 +1,633 @@
+#include "_Simulation.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "_CPUBackend.h"
+#include "_GridIO.h"
+#include "_OpenCLUtil.h"
+#include "_Precision.h"
+#include "_TypeMask.h"
+
+struct SimulationDevice
+{
+	int backend;
+	int precision;
+	int cpu_threads;
+	cl_context context;
+	cl_device_id deviceid;
+	// Compiled without the grid size or the decay rate, shared by all the simulations
+	cl_program program;
+	// Queue created by initOpenCL(), the simulations have their own
+	cl_command_queue commandQueue;
+
+	// Simulations created on the device and not destroyed yet, and the pools
+	pthread_mutex_t lock;
+	int simulation_count;
+	// Buffers of destroyed simulations, bucket b holds buffers of SIMULATION_POOL_MIN_BYTES << b bytes
+	cl_mem pool[SIMULATION_POOL_BUCKETS][SIMULATION_POOL_DEPTH];
+	int pool_count[SIMULATION_POOL_BUCKETS];
+	// Queues of destroyed simulations, idle
+	cl_command_queue queues[SIMULATION_POOL_DEPTH];
+	int queue_count;
+	long pool_hits, pool_misses;
+};
+
+struct Simulation
+{
+	SimulationDevice *device;
+	pthread_mutex_t lock;
+	int X, Y;
+	int total_size;
+	// Matrices of the batch, stacked one after the other on the device
+	int batch_count;
+	int iteration;
+	double decay_rate;
+	// Fluid mask of the cell types, see _TypeMask.h
+	uint32_t *fluid_bits;
+
+	// CPU backend, both matrices and the one holding the current temperatures
+	CPUBackend *backend;
+	double *matrix[2];
+
+	// OpenCL backend, both matrices and the one holding the current temperatures. The buffers
+	// come from the pool of the device, their size rounded up to a bucket
+	cl_command_queue commandQueue;
+	cl_kernel kernel;
+	cl_mem matrix_cl[2];
+	cl_mem type_matrix_cl;
+	cl_mem dim_cl;
+	cl_mem decay_rates_cl;
+	size_t matrix_bytes, type_bytes, dim_bytes, decay_rates_bytes;
+	// Created by the first simulation_statistics()
+	DeviceStatistics *statistics;
+	size_t global_size, local_size;
+	// Temperatures as stored on the device, the matrices themselves in fp64
+	void *cells;
+
+	int current;
+};
+
+/// @brief Creates the state shared by simulations: an OpenCL context and the program compiled for
+// any grid size, or only the thread count with the CPU backend
+/// @param backend SIMULATION_BACKEND_OPENCL or SIMULATION_BACKEND_CPU
+/// @param precision precision of the temperatures on the device, PRECISION_FP64 with the CPU backend
+/// @param cpu_threads threads of every CPU simulation, 0 for one per core
+/// @param kernel_cache directory of the compiled programs, NULL to always compile
+/// @return the device, NULL if error
+SimulationDevice *simulation_device_create(int backend, int precision, int cpu_threads, char *kernel_cache)
+{
+	if (backend == SIMULATION_BACKEND_CPU && precision != PRECISION_FP64)
+	{
+		fprintf(stderr, "The CPU backend only runs in fp64\n");
+		return NULL;
+	}
+	SimulationDevice *device = (SimulationDevice *)calloc(1, sizeof(SimulationDevice));
+	if (device == NULL)
+	{
+		perror("Error allocating memory for 'SimulationDevice'\n");
+		return NULL;
+	}
+	device->backend = backend;
+	device->precision = precision;
+	device->cpu_threads = cpu_threads;
+	pthread_mutex_init(&device->lock, NULL);
+	if (backend == SIMULATION_BACKEND_CPU)
+		return device;
+
+	device->deviceid = initOpenCL(&device->context, &device->commandQueue);
+	device->program = getCachedProgram("homework.cl", (char *)precision_build_option(precision), kernel_cache,
+									   device->context, device->deviceid);
+	return device;
+}
+
+/// @brief Releases the pooled buffers and queues of a device
+static void drain_pool(SimulationDevice *device)
+{
+	pthread_mutex_lock(&device->lock);
+	for (int b = 0; b < SIMULATION_POOL_BUCKETS; b++)
+	{
+		for (int i = 0; i < device->pool_count[b]; i++)
+			clReleaseMemObject(device->pool[b][i]);
+		device->pool_count[b] = 0;
+	}
+	for (int i = 0; i < device->queue_count; i++)
+		clReleaseCommandQueue(device->queues[i]);
+	device->queue_count = 0;
+	pthread_mutex_unlock(&device->lock);
+}
+
+/// @brief Destroys a device, once all its simulations are destroyed
+/// @return 1 if simulations still use the device, 0 if it was destroyed
+int simulation_device_destroy(SimulationDevice *device)
+{
+	if (device == NULL)
+		return 0;
+	pthread_mutex_lock(&device->lock);
+	int simulation_count = device->simulation_count;
+	pthread_mutex_unlock(&device->lock);
+	if (simulation_count > 0)
+	{
+		fprintf(stderr, "%d simulations still use the device\n", simulation_count);
+		return 1;
+	}
+
+	if (device->backend == SIMULATION_BACKEND_OPENCL)
+	{
+		drain_pool(device);
+		clReleaseProgram(device->program);
+		clReleaseCommandQueue(device->commandQueue);
+		clReleaseContext(device->context);
+	}
+	pthread_mutex_destroy(&device->lock);
+	free(device);
+	return 0;
+}
+
+/// @brief Returns how many buffers the simulations of a device took from its pool and how many
+// had to be created
+void simulation_device_pool_statistics(SimulationDevice *device, long *hits, long *misses)
+{
+	pthread_mutex_lock(&device->lock);
+	*hits = device->pool_hits;
+	*misses = device->pool_misses;
+	pthread_mutex_unlock(&device->lock);
+}
+
+/// @brief Returns the bucket of the pool holding buffers of at least bytes, -1 if too large
+static int pool_bucket(size_t bytes)
+{
+	for (int b = 0; b < SIMULATION_POOL_BUCKETS; b++)
+	{
+		if (((size_t)SIMULATION_POOL_MIN_BYTES << b) >= bytes)
+			return b;
+	}
+	return -1;
+}
+
+/// @brief Takes a buffer of at least bytes from the pool of a device, or creates one. A failed
+// creation drains the pool and is tried once more
+/// @param bytes size asked, set to the size of the buffer
+/// @return the buffer, NULL if the device is out of memory
+static cl_mem acquire_buffer(SimulationDevice *device, size_t *bytes)
+{
+	int bucket = pool_bucket(*bytes);
+	if (bucket >= 0)
+	{
+		*bytes = (size_t)SIMULATION_POOL_MIN_BYTES << bucket;
+		pthread_mutex_lock(&device->lock);
+		if (device->pool_count[bucket] > 0)
+		{
+			cl_mem buffer = device->pool[bucket][--device->pool_count[bucket]];
+			device->pool_hits++;
+			pthread_mutex_unlock(&device->lock);
+			return buffer;
+		}
+		device->pool_misses++;
+		pthread_mutex_unlock(&device->lock);
+	}
+
+	cl_int rc;
+	cl_mem buffer = clCreateBuffer(device->context, CL_MEM_READ_WRITE, *bytes, NULL, &rc);
+	if (rc != CL_SUCCESS)
+	{
+		drain_pool(device);
+		buffer = clCreateBuffer(device->context, CL_MEM_READ_WRITE, *bytes, NULL, &rc);
+	}
+	if (rc != CL_SUCCESS)
+	{
+		fprintf(stderr, "Error creating a device buffer of %zu bytes: %d\n", *bytes, rc);
+		return NULL;
+	}
+	return buffer;
+}
+
+/// @brief Returns a buffer of acquire_buffer() to the pool, or releases it when its bucket is full
+static void release_buffer(SimulationDevice *device, cl_mem buffer, size_t bytes)
+{
+	if (buffer == NULL)
+		return;
+	int bucket = pool_bucket(bytes);
+	if (bucket >= 0 && ((size_t)SIMULATION_POOL_MIN_BYTES << bucket) == bytes)
+	{
+		pthread_mutex_lock(&device->lock);
+		if (device->pool_count[bucket] < SIMULATION_POOL_DEPTH)
+		{
+			device->pool[bucket][device->pool_count[bucket]++] = buffer;
+			pthread_mutex_unlock(&device->lock);
+			return;
+		}
+		pthread_mutex_unlock(&device->lock);
+	}
+	clReleaseMemObject(buffer);
+}
+
+/// @brief Takes an idle queue from the pool of a device, or creates one
+static cl_command_queue acquire_queue(SimulationDevice *device)
+{
+	pthread_mutex_lock(&device->lock);
+	if (device->queue_count > 0)
+	{
+		cl_command_queue commandQueue = device->queues[--device->queue_count];
+		pthread_mutex_unlock(&device->lock);
+		return commandQueue;
+	}
+	pthread_mutex_unlock(&device->lock);
+
+	int rc;
+	cl_command_queue commandQueue = clCreateCommandQueue(device->context, device->deviceid, 0, &rc);
+	handleError(rc, __LINE__, __FILE__);
+	return commandQueue;
+}
+
+/// @brief Returns an idle queue to the pool of a device, or releases it when the pool is full
+static void release_queue(SimulationDevice *device, cl_command_queue commandQueue)
+{
+	pthread_mutex_lock(&device->lock);
+	if (device->queue_count < SIMULATION_POOL_DEPTH)
+	{
+		device->queues[device->queue_count++] = commandQueue;
+		pthread_mutex_unlock(&device->lock);
+		return;
+	}
+	pthread_mutex_unlock(&device->lock);
+	clReleaseCommandQueue(commandQueue);
+}
+
+/// @brief Creates the buffers, kernel and queue of a simulation on an OpenCL device
+/// @return 1 if error, 0 if no error
+static int create_device_buffers(Simulation *self, double **temperatures, double *decay_rates)
+{
+	SimulationDevice *device = self->device;
+	size_t cell_bytes = precision_cell_bytes(device->precision);
+	size_t real_bytes = precision_real_bytes(device->precision);
+	size_t cell_count = (size_t)self->total_size * self->batch_count;
+	int rc;
+
+	self->cells = malloc(cell_bytes * cell_count);
+	if (self->cells == NULL)
+	{
+		perror("Error allocating memory for the device temperatures\n");
+		return 1;
+	}
+	for (int b = 0; b < self->batch_count; b++)
+		precision_pack(device->precision, temperatures[b], (char *)self->cells + cell_bytes * self->total_size * b,
+					   self->total_size);
+
+	// Running out of device memory is not fatal, the caller can retry with fewer simulations
+	self->matrix_bytes = cell_bytes * cell_count;
+	self->type_bytes = sizeof(uint32_t) * type_mask_words(self->total_size);
+	self->dim_bytes = sizeof(int) * 2;
+	self->decay_rates_bytes = real_bytes * self->batch_count;
+	for (int m = 0; m < 2; m++)
+		self->matrix_cl[m] = acquire_buffer(device, &self->matrix_bytes);
+	self->type_matrix_cl = acquire_buffer(device, &self->type_bytes);
+	self->dim_cl = acquire_buffer(device, &self->dim_bytes);
+	if (self->batch_count > 1)
+		self->decay_rates_cl = acquire_buffer(device, &self->decay_rates_bytes);
+	if (self->matrix_cl[0] == NULL || self->matrix_cl[1] == NULL || self->type_matrix_cl == NULL ||
+		self->dim_cl == NULL || (self->batch_count > 1 && self->decay_rates_cl == NULL))
+	{
+		return 1;
+	}
+
+	self->commandQueue = acquire_queue(device);
+	// The boundary cells are never written by a step, both matrices start with them
+	for (int m = 0; m < 2; m++)
+	{
+		rc = clEnqueueWriteBuffer(self->commandQueue, self->matrix_cl[m], CL_FALSE, 0, cell_bytes * cell_count,
+								  self->cells, 0, NULL, NULL);
+		handleError(rc, __LINE__, __FILE__);
+	}
+	rc = clEnqueueWriteBuffer(self->commandQueue, self->type_matrix_cl, CL_FALSE, 0,
+							  sizeof(uint32_t) * type_mask_words(self->total_size), self->fluid_bits, 0, NULL, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	int dim[2] = {self->X, self->Y};
+	rc = clEnqueueWriteBuffer(self->commandQueue, self->dim_cl, CL_FALSE, 0, sizeof(dim), dim, 0, NULL, NULL);
+	handleError(rc, __LINE__, __FILE__);
+
+	// Kernel arguments are not thread safe, every simulation has its own kernel on the shared program
+	self->kernel = clCreateKernel(device->program, self->batch_count > 1 ? "temperature_step_batch" : "temperature_step",
+								  &rc);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(self->kernel, 1, sizeof(cl_mem), &self->type_matrix_cl);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(self->kernel, 2, sizeof(cl_mem), &self->dim_cl);
+	handleError(rc, __LINE__, __FILE__);
+	if (self->batch_count > 1)
+	{
+		void *rates = malloc(real_bytes * self->batch_count);
+		if (rates == NULL)
+		{
+			perror("Error allocating memory for the decay rates\n");
+			return 1;
+		}
+		for (int b = 0; b < self->batch_count; b++)
+		{
+			if (real_bytes == sizeof(float))
+				((float *)rates)[b] = (float)decay_rates[b];
+			else
+				((double *)rates)[b] = decay_rates[b];
+		}
+		rc = clEnqueueWriteBuffer(self->commandQueue, self->decay_rates_cl, CL_TRUE, 0, real_bytes * self->batch_count,
+								  rates, 0, NULL, NULL);
+		handleError(rc, __LINE__, __FILE__);
+		free(rates);
+		rc = clSetKernelArg(self->kernel, 4, sizeof(cl_mem), &self->decay_rates_cl);
+		handleError(rc, __LINE__, __FILE__);
+		rc = clSetKernelArg(self->kernel, 5, sizeof(int), &self->batch_count);
+		handleError(rc, __LINE__, __FILE__);
+	}
+	else
+	{
+		float decay_rate_float = self->decay_rate;
+		void *decay_rate_arg = real_bytes == sizeof(float) ? (void *)&decay_rate_float : (void *)&self->decay_rate;
+		rc = clSetKernelArg(self->kernel, 4, real_bytes, decay_rate_arg);
+		handleError(rc, __LINE__, __FILE__);
+	}
+
+	self->local_size = SIMULATION_GROUP_SIZE;
+	self->global_size = (cell_count + self->local_size - 1) / self->local_size * self->local_size;
+	if (self->global_size > SIMULATION_MAX_WORKERS)
+		self->global_size = SIMULATION_MAX_WORKERS;
+	rc = clFinish(self->commandQueue);
+	handleError(rc, __LINE__, __FILE__);
+	return 0;
+}
+
+/// @brief Creates a simulation of a matrix, the temperatures and cell types are copied
+/// @param device device shared with the other simulations
+/// @param X number of lines of the matrix
+/// @param Y number of columns of the matrix
+/// @param temperature X * Y initial temperatures in line-major order
+/// @param type X * Y cell types
+/// @param decay_rate decay rate of the fluid cells
+/// @return the simulation, NULL if error
+Simulation *simulation_create(SimulationDevice *device, int X, int Y, double *temperature, char *type,
+							  double decay_rate)
+{
+	return simulation_create_batch(device, X, Y, 1, &temperature, type, &decay_rate);
+}
+
+/// @brief Creates a batch of simulations of matrices sharing their cell types, stepped together by
+// a single launch per step so that small grids fill the device. Only on OpenCL devices
+/// @param device device shared with the other simulations
+/// @param X number of lines of the matrices
+/// @param Y number of columns of the matrices
+/// @param batch_count number of matrices
+/// @param temperatures X * Y initial temperatures of every matrix, in line-major order
+/// @param type X * Y cell types shared by the matrices
+/// @param decay_rates decay rate of every matrix
+/// @return the simulation, NULL if error
+Simulation *simulation_create_batch(SimulationDevice *device, int X, int Y, int batch_count, double **temperatures,
+									char *type, double *decay_rates)
+{
+	if (X < 1 || Y < 1 || batch_count < 1 || (long)X * Y * batch_count > INT_MAX)
+	{
+		fprintf(stderr, "Invalid simulation of %d matrices of %dx%d cells\n", batch_count, X, Y);
+		return NULL;
+	}
+	for (int b = 0; b < batch_count; b++)
+	{
+		if (decay_rates[b] < 0 || decay_rates[b] > 1)
+		{
+			fprintf(stderr, "Invalid decay rate %g, expected a value in [0, 1]\n", decay_rates[b]);
+			return NULL;
+		}
+	}
+	if (batch_count > 1 && device->backend == SIMULATION_BACKEND_CPU)
+	{
+		fprintf(stderr, "The CPU backend only runs one matrix per simulation\n");
+		return NULL;
+	}
+	Simulation *self = (Simulation *)calloc(1, sizeof(Simulation));
+	if (self == NULL)
+	{
+		perror("Error allocating memory for 'Simulation'\n");
+		return NULL;
+	}
+	self->device = device;
+	pthread_mutex_init(&self->lock, NULL);
+	self->X = X;
+	self->Y = Y;
+	self->total_size = X * Y;
+	self->batch_count = batch_count;
+	self->decay_rate = decay_rates[0];
+	pthread_mutex_lock(&device->lock);
+	device->simulation_count++;
+	pthread_mutex_unlock(&device->lock);
+
+	self->fluid_bits = (uint32_t *)malloc(sizeof(uint32_t) * type_mask_words(self->total_size));
+	if (self->fluid_bits == NULL)
+	{
+		perror("Error allocating memory for the simulation\n");
+		simulation_destroy(self);
+		return NULL;
+	}
+	type_mask_pack_bits(type, self->total_size, self->fluid_bits);
+
+	if (device->backend == SIMULATION_BACKEND_CPU)
+	{
+		for (int m = 0; m < 2; m++)
+		{
+			self->matrix[m] = (double *)malloc(sizeof(double) * self->total_size);
+			if (self->matrix[m] != NULL)
+				memcpy(self->matrix[m], temperatures[0], sizeof(double) * self->total_size);
+		}
+		self->backend = cpu_backend_create(X, Y, self->fluid_bits, self->decay_rate, device->cpu_threads);
+		if (self->matrix[0] == NULL || self->matrix[1] == NULL || self->backend == NULL)
+		{
+			perror("Error creating the CPU backend of the simulation\n");
+			simulation_destroy(self);
+			return NULL;
+		}
+	}
+	else if (create_device_buffers(self, temperatures, decay_rates))
+	{
+		simulation_destroy(self);
+		return NULL;
+	}
+	return self;
+}
+
+/// @brief Creates a simulation from a text or binary grid file
+/// @param device device shared with the other simulations
+/// @param file_name grid file, see _GridIO.h
+/// @param decay_rate decay rate of the fluid cells, negative for the one of a binary grid or the
+// default one of a text grid
+/// @return the simulation, NULL if error
+Simulation *simulation_load(SimulationDevice *device, char *file_name, double decay_rate)
+{
+	int dim[2], iterations;
+	double *temperature = NULL;
+	char *type = NULL;
+	double file_decay_rate = SIMULATION_DEFAULT_DECAY_RATE;
+
+	if (grid_is_binary(file_name))
+	{
+		GridMapping *mapping = grid_map_binary(file_name);
+		if (mapping == NULL)
+		{
+			return NULL;
+		}
+		dim[0] = mapping->header->dim[0];
+		dim[1] = mapping->header->dim[1];
+		file_decay_rate = mapping->header->decay_rate;
+		size_t cell_count = (size_t)dim[0] * dim[1];
+		temperature = (double *)malloc(sizeof(double) * cell_count);
+		if (temperature == NULL)
+		{
+			perror("Error allocating memory for the grid\n");
+			grid_unmap(mapping);
+			return NULL;
+		}
+		precision_unpack(mapping->header->dtype, mapping->temperature, temperature, cell_count);
+		// The cell types are copied by simulation_create(), the mapping can back them until then
+		Simulation *self = simulation_create(device, dim[0], dim[1], temperature, mapping->type,
+											 decay_rate < 0 ? file_decay_rate : decay_rate);
+		free(temperature);
+		grid_unmap(mapping);
+		return self;
+	}
+
+	if (grid_read_text(file_name, dim, &iterations, &temperature, &type))
+	{
+		return NULL;
+	}
+	Simulation *self = simulation_create(device, dim[0], dim[1], temperature, type,
+										 decay_rate < 0 ? file_decay_rate : decay_rate);
+	free(temperature);
+	free(type);
+	return self;
+}
+
+/// @brief Returns the number of lines and columns of the matrix of a simulation
+void simulation_dimensions(Simulation *self, int *X, int *Y)
+{
+	*X = self->X;
+	*Y = self->Y;
+}
+
+/// @brief Returns the number of steps computed so far
+int simulation_iteration(Simulation *self)
+{
+	pthread_mutex_lock(&self->lock);
+	int iteration = self->iteration;
+	pthread_mutex_unlock(&self->lock);
+	return iteration;
+}
+
+/// @brief Computes steps iterations, returns once they are done
+void simulation_step(Simulation *self, int steps)
+{
+	pthread_mutex_lock(&self->lock);
+	if (self->device->backend == SIMULATION_BACKEND_CPU)
+	{
+		for (int s = 0; s < steps; s++)
+		{
+			cpu_backend_step(self->backend, self->matrix[self->current], self->matrix[1 - self->current]);
+			self->current = 1 - self->current;
+		}
+	}
+	else
+	{
+		int rc;
+		for (int s = 0; s < steps; s++)
+		{
+			rc = clSetKernelArg(self->kernel, 0, sizeof(cl_mem), &self->matrix_cl[self->current]);
+			handleError(rc, __LINE__, __FILE__);
+			rc = clSetKernelArg(self->kernel, 3, sizeof(cl_mem), &self->matrix_cl[1 - self->current]);
+			handleError(rc, __LINE__, __FILE__);
+			rc = clEnqueueNDRangeKernel(self->commandQueue, self->kernel, 1, NULL, &self->global_size, &self->local_size,
+										0, NULL, NULL);
+			handleError(rc, __LINE__, __FILE__);
+			self->current = 1 - self->current;
+		}
+		rc = clFinish(self->commandQueue);
+		handleError(rc, __LINE__, __FILE__);
+	}
+	self->iteration += steps;
+	pthread_mutex_unlock(&self->lock);
+}
+
+/// @brief Copies the current temperatures of a simulation, of the first matrix of a batch
+/// @param temperature X * Y values, in line-major order
+void simulation_read(Simulation *self, double *temperature)
+{
+	simulation_read_member(self, 0, temperature);
+}
+
+/// @brief Copies the current temperatures of one matrix of a batch
+/// @param member index of the matrix in the batch
+/// @param temperature X * Y values, in line-major order
+void simulation_read_member(Simulation *self, int member, double *temperature)
+{
+	pthread_mutex_lock(&self->lock);
+	if (self->device->backend == SIMULATION_BACKEND_CPU)
+		memcpy(temperature, self->matrix[self->current], sizeof(double) * self->total_size);
+	else
+	{
+		int precision = self->device->precision;
+		size_t matrix_bytes = precision_cell_bytes(precision) * self->total_size;
+		int rc = clEnqueueReadBuffer(self->commandQueue, self->matrix_cl[self->current], CL_TRUE, matrix_bytes * member,
+									 matrix_bytes, self->cells, 0, NULL, NULL);
+		handleError(rc, __LINE__, __FILE__);
+		precision_unpack(precision, self->cells, temperature, self->total_size);
+	}
+	pthread_mutex_unlock(&self->lock);
+}
+
+/// @brief Computes the statistics of the fluid cells of the current temperatures, of the first
+// matrix of a batch
+void simulation_statistics(Simulation *self, FieldStatistics *statistics)
+{
+	pthread_mutex_lock(&self->lock);
+	if (self->device->backend == SIMULATION_BACKEND_CPU)
+		cpu_backend_statistics(self->backend, self->matrix[self->current], self->iteration, statistics);
+	else
+	{
+		SimulationDevice *device = self->device;
+		if (self->statistics == NULL)
+			self->statistics = device_statistics_create(device->context, device->deviceid, device->program,
+														 device->precision, self->type_matrix_cl, self->total_size);
+		device_statistics_enqueue(self->statistics, self->commandQueue, self->matrix_cl[self->current], self->iteration);
+		device_statistics_poll(self->statistics, statistics, 1);
+	}
+	pthread_mutex_unlock(&self->lock);
+}
+
+/// @brief Destroys a simulation, no other thread may use it any more. Its device buffers and queue
+// go back to the pool of the device
+void simulation_destroy(Simulation *self)
+{
+	if (self == NULL)
+		return;
+	SimulationDevice *device = self->device;
+	if (self->backend != NULL)
+		cpu_backend_destroy(self->backend);
+	if (self->statistics != NULL)
+		device_statistics_destroy(self->statistics);
+	if (self->kernel != NULL)
+		clReleaseKernel(self->kernel);
+	for (int m = 0; m < 2; m++)
+	{
+		release_buffer(device, self->matrix_cl[m], self->matrix_bytes);
+		free(self->matrix[m]);
+	}
+	release_buffer(device, self->type_matrix_cl, self->type_bytes);
+	release_buffer(device, self->dim_cl, self->dim_bytes);
+	release_buffer(device, self->decay_rates_cl, self->decay_rates_bytes);
+	if (self->commandQueue != NULL)
+		release_queue(device, self->commandQueue);
+	free(self->cells);
+	free(self->fluid_bits);
+
+	pthread_mutex_lock(&device->lock);
+	device->simulation_count--;
+	pthread_mutex_unlock(&device->lock);
+	pthread_mutex_destroy(&self->lock);
+	free(self);
+}
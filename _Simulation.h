@@ -0,0 +1,55 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include "_Statistics.h"
+
+/* Reentrant simulation library, for programs that run many simulations in one process.
+
+A SimulationDevice holds what is shared between the simulations: the OpenCL context and the
+program compiled once for every grid size, or the thread count of the CPU backend. A Simulation
+is an opaque handle with its own temperatures, command queue, kernels and statistics, so any
+number of them can run at the same time on one device. There is no global state: two handles
+never share a mutable object, and the calls on one handle take its lock, so a handle can be
+driven from several threads and different handles run in parallel.
+
+OpenCL errors are fatal like everywhere else, see handleError(). A device must outlive its
+simulations, simulation_device_destroy() refuses to destroy a device still in use */
+#define SIMULATION_BACKEND_OPENCL 0
+#define SIMULATION_BACKEND_CPU 1
+
+#define SIMULATION_DEFAULT_DECAY_RATE 0.02
+
+// Work-group size and largest number of workers of the steps, the kernel strides over the cells
+#define SIMULATION_GROUP_SIZE 64
+#define SIMULATION_MAX_WORKERS (1 << 16)
+
+/* Device buffers and queues of destroyed simulations are pooled by their device for the next
+ones. Buffers are rounded up to a power of two from SIMULATION_POOL_MIN_BYTES, bucket b holding
+buffers of SIMULATION_POOL_MIN_BYTES << b bytes, and every bucket keeps up to
+SIMULATION_POOL_DEPTH of them; larger buffers are released. A creation that fails for lack of
+device memory releases the pool and is tried once more */
+#define SIMULATION_POOL_MIN_BYTES 4096
+#define SIMULATION_POOL_BUCKETS 24
+#define SIMULATION_POOL_DEPTH 8
+
+typedef struct SimulationDevice SimulationDevice;
+typedef struct Simulation Simulation;
+
+SimulationDevice *simulation_device_create(int backend, int precision, int cpu_threads, char *kernel_cache);
+int simulation_device_destroy(SimulationDevice *device);
+void simulation_device_pool_statistics(SimulationDevice *device, long *hits, long *misses);
+
+Simulation *simulation_create(SimulationDevice *device, int X, int Y, double *temperature, char *type,
+							  double decay_rate);
+Simulation *simulation_create_batch(SimulationDevice *device, int X, int Y, int batch_count, double **temperatures,
+									char *type, double *decay_rates);
+Simulation *simulation_load(SimulationDevice *device, char *file_name, double decay_rate);
+void simulation_dimensions(Simulation *self, int *X, int *Y);
+int simulation_iteration(Simulation *self);
+void simulation_step(Simulation *self, int steps);
+void simulation_read(Simulation *self, double *temperature);
+void simulation_read_member(Simulation *self, int member, double *temperature);
+void simulation_statistics(Simulation *self, FieldStatistics *statistics);
+void simulation_destroy(Simulation *self);
+
+#endif
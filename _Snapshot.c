@@ -0,0 +1,134 @@
+#include "_Snapshot.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "_WriterRing.h"
+
+struct SnapshotWriter
+{
+	FILE *file_fptr;
+	SnapshotFileHeader header;
+	size_t total_size;
+	// Bytes of the values of a frame, total_size values of header.dtype
+	size_t frame_bytes;
+
+	// Index of the frames written so far
+	SnapshotIndexEntry *index;
+	size_t index_capacity;
+	uint64_t write_offset;
+
+	// Buffers of X * Y values of header.dtype, written by write_frame()
+	WriterRing *ring;
+};
+
+/// @brief Appends a frame to the file and to the index, called from the thread of the ring
+/// @return 1 if error, 0 if no error
+static int write_frame(void *owner, int frame_iteration, void *values)
+{
+	SnapshotWriter *self = (SnapshotWriter *)owner;
+	if (self->header.frame_count == self->index_capacity)
+	{
+		size_t capacity = self->index_capacity ? 2 * self->index_capacity : 64;
+		SnapshotIndexEntry *index = (SnapshotIndexEntry *)realloc(self->index, sizeof(SnapshotIndexEntry) * capacity);
+		if (index == NULL)
+			return 1;
+		self->index = index;
+		self->index_capacity = capacity;
+	}
+
+	int64_t iteration = frame_iteration;
+	if (fwrite(&iteration, sizeof(iteration), 1, self->file_fptr) != 1 ||
+		fwrite(values, 1, self->frame_bytes, self->file_fptr) != self->frame_bytes)
+		return 1;
+
+	self->index[self->header.frame_count].iteration = iteration;
+	self->index[self->header.frame_count].offset = self->write_offset;
+	self->header.frame_count++;
+	self->write_offset += sizeof(iteration) + self->frame_bytes;
+	return 0;
+}
+
+/// @brief Creates the snapshot file and starts the writer thread
+/// @param file_name name of the time-series file
+/// @param dim matrix dimensions
+/// @param buffer_count number of host buffers in the ring
+/// @param dtype precision the frames are stored in, the buffers hold values of this precision
+/// @return the writer, NULL if error
+SnapshotWriter *snapshot_writer_open(char *file_name, int *dim, int buffer_count, int dtype)
+{
+	SnapshotWriter *self = (SnapshotWriter *)calloc(1, sizeof(SnapshotWriter));
+	if (self == NULL)
+	{
+		perror("Error allocating memory for 'SnapshotWriter'\n");
+		return NULL;
+	}
+	self->total_size = (size_t)dim[0] * dim[1];
+	self->frame_bytes = precision_cell_bytes(dtype) * self->total_size;
+
+	memcpy(self->header.magic, SNAPSHOT_MAGIC, sizeof(self->header.magic));
+	self->header.version = SNAPSHOT_VERSION;
+	self->header.dtype = dtype;
+	self->header.dim[0] = dim[0];
+	self->header.dim[1] = dim[1];
+	self->write_offset = sizeof(SnapshotFileHeader);
+
+	self->file_fptr = fopen(file_name, "wb");
+	if (self->file_fptr == NULL || fwrite(&self->header, sizeof(self->header), 1, self->file_fptr) != 1)
+	{
+		perror("Error opening the snapshot file!\n");
+		if (self->file_fptr != NULL)
+			fclose(self->file_fptr);
+		free(self);
+		return NULL;
+	}
+
+	self->ring = writer_ring_create(buffer_count > 0 ? buffer_count : SNAPSHOT_DEFAULT_BUFFERS, self->frame_bytes,
+									write_frame, self, "Error writing the snapshot file!\n");
+	if (self->ring == NULL)
+	{
+		fclose(self->file_fptr);
+		free(self);
+		return NULL;
+	}
+	return self;
+}
+
+/// @brief Returns the next host buffer to read a frame into, waits only if every buffer of the
+// ring is still queued for writing
+/// @param iteration iteration the frame belongs to
+/// @return a buffer of X * Y values of the dtype given to snapshot_writer_open()
+void *snapshot_acquire(SnapshotWriter *self, int iteration)
+{
+	return writer_ring_acquire(self->ring, iteration);
+}
+
+/// @brief Queues the buffer returned by the last snapshot_acquire() for writing
+/// @param read_event event of the non-blocking read filling the buffer, owned by the writer from
+// now on, or NULL if the buffer is already filled
+void snapshot_submit(SnapshotWriter *self, cl_event read_event)
+{
+	writer_ring_submit(self->ring, read_event);
+}
+
+/// @brief Waits for the queued frames, writes the index and closes the file
+/// @return 1 if error, 0 if no error
+int snapshot_writer_close(SnapshotWriter *self)
+{
+	int failed = writer_ring_close(self->ring);
+	self->header.index_offset = self->write_offset;
+	if (!failed)
+		failed = fwrite(self->index, sizeof(SnapshotIndexEntry), self->header.frame_count, self->file_fptr) != self->header.frame_count ||
+				 fseek(self->file_fptr, 0, SEEK_SET) != 0 ||
+				 fwrite(&self->header, sizeof(self->header), 1, self->file_fptr) != 1;
+	failed |= fclose(self->file_fptr) != 0;
+	if (failed)
+		perror("Error writing the snapshot file!\n");
+	else
+		printf("Wrote %lu snapshots\n", (unsigned long)self->header.frame_count);
+
+	free(self->index);
+	free(self);
+	return failed;
+}
@@ -0,0 +1,42 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+
+#include "_OpenCLUtil.h"
+#include "_Precision.h"
+
+/* Time-series file, version 2:
+- SnapshotFileHeader at offset 0, frame_count and index_offset are filled in when closing
+- frame_count frames, each an int64 iteration followed by X * Y values of type dtype, one of the
+  PRECISION_ codes
+- index at index_offset, one SnapshotIndexEntry per frame */
+#define SNAPSHOT_MAGIC "TTSNAP\r\n"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_DEFAULT_BUFFERS 3
+
+typedef struct SnapshotFileHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t dtype;
+	// Matrix dimensions, X lines of Y columns
+	int32_t dim[2];
+	uint64_t frame_count;
+	uint64_t index_offset;
+} SnapshotFileHeader;
+
+typedef struct SnapshotIndexEntry
+{
+	int64_t iteration;
+	uint64_t offset;
+} SnapshotIndexEntry;
+
+typedef struct SnapshotWriter SnapshotWriter;
+
+SnapshotWriter *snapshot_writer_open(char *file_name, int *dim, int buffer_count, int dtype);
+void *snapshot_acquire(SnapshotWriter *self, int iteration);
+void snapshot_submit(SnapshotWriter *self, cl_event read_event);
+int snapshot_writer_close(SnapshotWriter *self);
+
+#endif
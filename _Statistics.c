@@ -0,0 +1,391 @@
+#include "_Statistics.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Work groups of the first reduction pass, their partials are reduced by a single work group
+#define STATISTICS_GROUPS 64
+#define STATISTICS_GROUP_SIZE 256
+
+struct DeviceStatistics
+{
+	cl_kernel statistics_kernel;
+	// First pass over the change between two matrices instead of over a matrix
+	cl_kernel change_kernel;
+	cl_kernel finish_kernel;
+	size_t group_size;
+	// Size of the values the kernels reduce in, double if the device has cl_khr_fp64, and of a
+	// statistics_t record of homework.cl: the 4 values then the count as a cl_ulong
+	size_t value_bytes;
+	size_t record_bytes;
+	// STATISTICS_GROUPS partial records
+	cl_mem partials_cl;
+
+	// Ring of reductions in flight, each one with its own result buffer
+	cl_mem results_cl[STATISTICS_SLOTS];
+	unsigned char results[STATISTICS_SLOTS][STATISTICS_COUNT * sizeof(double) + sizeof(cl_ulong)];
+	cl_event events[STATISTICS_SLOTS];
+	int iterations[STATISTICS_SLOTS];
+	// Oldest reduction in flight and how many there are
+	int oldest;
+	int pending;
+};
+
+/// @brief Sets a partial to the statistics of no cell
+void statistics_reset(double *partial)
+{
+	partial[STATISTICS_MIN] = DBL_MAX;
+	partial[STATISTICS_MAX] = -DBL_MAX;
+	partial[STATISTICS_SUM] = 0.0;
+	partial[STATISTICS_SUM_SQUARES] = 0.0;
+	partial[STATISTICS_COUNT] = 0.0;
+}
+
+/// @brief Adds the fluid cells of the range [start, stop) of a matrix to a partial
+/// @param fluid_bits fluid mask of the matrix, see _TypeMask.h
+void statistics_accumulate(double *partial, double *values, uint32_t *fluid_bits, long start, long stop)
+{
+	for (long i = start; i < stop; i++)
+	{
+		if (!TYPE_MASK_IS_FLUID(fluid_bits, i))
+			continue;
+		double value = values[i];
+		partial[STATISTICS_MIN] = value < partial[STATISTICS_MIN] ? value : partial[STATISTICS_MIN];
+		partial[STATISTICS_MAX] = value > partial[STATISTICS_MAX] ? value : partial[STATISTICS_MAX];
+		partial[STATISTICS_SUM] += value;
+		partial[STATISTICS_SUM_SQUARES] += value * value;
+		partial[STATISTICS_COUNT] += 1.0;
+	}
+}
+
+/// @brief Adds the cells listed in cells[start, stop) to a partial, they must all be fluid
+void statistics_accumulate_cells(double *partial, double *values, int *cells, long start, long stop)
+{
+	for (long k = start; k < stop; k++)
+	{
+		double value = values[cells[k]];
+		partial[STATISTICS_MIN] = value < partial[STATISTICS_MIN] ? value : partial[STATISTICS_MIN];
+		partial[STATISTICS_MAX] = value > partial[STATISTICS_MAX] ? value : partial[STATISTICS_MAX];
+		partial[STATISTICS_SUM] += value;
+		partial[STATISTICS_SUM_SQUARES] += value * value;
+	}
+	partial[STATISTICS_COUNT] += stop - start;
+}
+
+/// @brief Adds the change from previous to values of the fluid cells of the range [start, stop)
+// to a partial, like the temperature_change kernel
+void statistics_accumulate_change(double *partial, double *values, double *previous, uint32_t *fluid_bits, long start,
+								  long stop)
+{
+	for (long i = start; i < stop; i++)
+	{
+		if (!TYPE_MASK_IS_FLUID(fluid_bits, i))
+			continue;
+		double value = values[i] - previous[i];
+		partial[STATISTICS_MIN] = value < partial[STATISTICS_MIN] ? value : partial[STATISTICS_MIN];
+		partial[STATISTICS_MAX] = value > partial[STATISTICS_MAX] ? value : partial[STATISTICS_MAX];
+		partial[STATISTICS_SUM] += value;
+		partial[STATISTICS_SUM_SQUARES] += value * value;
+		partial[STATISTICS_COUNT] += 1.0;
+	}
+}
+
+/// @brief Adds the change of the cells listed in cells[start, stop) to a partial, they must all be fluid
+void statistics_accumulate_change_cells(double *partial, double *values, double *previous, int *cells, long start,
+										long stop)
+{
+	for (long k = start; k < stop; k++)
+	{
+		double value = values[cells[k]] - previous[cells[k]];
+		partial[STATISTICS_MIN] = value < partial[STATISTICS_MIN] ? value : partial[STATISTICS_MIN];
+		partial[STATISTICS_MAX] = value > partial[STATISTICS_MAX] ? value : partial[STATISTICS_MAX];
+		partial[STATISTICS_SUM] += value;
+		partial[STATISTICS_SUM_SQUARES] += value * value;
+	}
+	partial[STATISTICS_COUNT] += stop - start;
+}
+
+/// @brief Combines other into partial
+void statistics_merge(double *partial, double *other)
+{
+	partial[STATISTICS_MIN] = other[STATISTICS_MIN] < partial[STATISTICS_MIN] ? other[STATISTICS_MIN] : partial[STATISTICS_MIN];
+	partial[STATISTICS_MAX] = other[STATISTICS_MAX] > partial[STATISTICS_MAX] ? other[STATISTICS_MAX] : partial[STATISTICS_MAX];
+	partial[STATISTICS_SUM] += other[STATISTICS_SUM];
+	partial[STATISTICS_SUM_SQUARES] += other[STATISTICS_SUM_SQUARES];
+	partial[STATISTICS_COUNT] += other[STATISTICS_COUNT];
+}
+
+/// @brief Turns a partial covering the whole matrix into statistics, all zero if there is no
+// fluid cell
+void statistics_finish(double *partial, int iteration, FieldStatistics *statistics)
+{
+	statistics->iteration = iteration;
+	statistics->fluid_count = (long)partial[STATISTICS_COUNT];
+	if (statistics->fluid_count == 0)
+	{
+		statistics->min_value = statistics->max_value = 0.0;
+		statistics->sum = statistics->mean = statistics->sum_squares = 0.0;
+		return;
+	}
+	statistics->min_value = partial[STATISTICS_MIN];
+	statistics->max_value = partial[STATISTICS_MAX];
+	statistics->sum = partial[STATISTICS_SUM];
+	statistics->mean = partial[STATISTICS_SUM] / partial[STATISTICS_COUNT];
+	statistics->sum_squares = partial[STATISTICS_SUM_SQUARES];
+}
+
+/// @brief Combines the statistics of another part of the same matrix into statistics
+void statistics_combine(FieldStatistics *statistics, FieldStatistics *other)
+{
+	if (other->fluid_count == 0)
+		return;
+	if (statistics->fluid_count == 0)
+	{
+		*statistics = *other;
+		return;
+	}
+	statistics->min_value = other->min_value < statistics->min_value ? other->min_value : statistics->min_value;
+	statistics->max_value = other->max_value > statistics->max_value ? other->max_value : statistics->max_value;
+	statistics->fluid_count += other->fluid_count;
+	statistics->sum += other->sum;
+	statistics->sum_squares += other->sum_squares;
+	statistics->mean = statistics->sum / statistics->fluid_count;
+}
+
+/// @brief Returns the norm of a change reduced like the temperature_change kernel, the largest
+// change of a cell or the L2 norm of the changes
+/// @param norm CHANGE_NORM_MAX or CHANGE_NORM_L2
+double statistics_change_norm(FieldStatistics *change, int norm)
+{
+	if (norm == CHANGE_NORM_L2)
+		return sqrt(change->sum_squares);
+	return -change->min_value > change->max_value ? -change->min_value : change->max_value;
+}
+
+/// @brief Returns 1 if the device supports cl_khr_fp64, the kernels then reduce in double
+static int device_has_fp64(cl_device_id deviceid)
+{
+	size_t size;
+	cl_int rc = clGetDeviceInfo(deviceid, CL_DEVICE_EXTENSIONS, 0, NULL, &size);
+	handleError(rc, __LINE__, __FILE__);
+	char *extensions = malloc(size);
+	rc = clGetDeviceInfo(deviceid, CL_DEVICE_EXTENSIONS, size, extensions, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	int has_fp64 = strstr(extensions, "cl_khr_fp64") != NULL;
+	free(extensions);
+	return has_fp64;
+}
+
+/// @brief Creates the reduction kernels of program and their buffers
+/// @param program program built from homework.cl
+/// @param precision precision the program was built with
+/// @param type_matrix_cl cell types of the matrices that will be reduced
+/// @param total_size number of cells of the matrices
+/// @return the reduction, NULL if error
+DeviceStatistics *device_statistics_create(cl_context context, cl_device_id deviceid, cl_program program, int precision,
+										   cl_mem type_matrix_cl, int total_size)
+{
+	cl_int rc;
+	DeviceStatistics *self = (DeviceStatistics *)calloc(1, sizeof(DeviceStatistics));
+	if (self == NULL)
+	{
+		perror("Error allocating memory for 'DeviceStatistics'\n");
+		return NULL;
+	}
+	self->value_bytes = precision == PRECISION_FP64 || device_has_fp64(deviceid) ? sizeof(double) : sizeof(float);
+	self->record_bytes = STATISTICS_COUNT * self->value_bytes + sizeof(cl_ulong);
+
+	self->statistics_kernel = clCreateKernel(program, "temperature_statistics", &rc);
+	handleError(rc, __LINE__, __FILE__);
+	self->change_kernel = clCreateKernel(program, "temperature_change", &rc);
+	handleError(rc, __LINE__, __FILE__);
+	self->finish_kernel = clCreateKernel(program, "temperature_statistics_finish", &rc);
+	handleError(rc, __LINE__, __FILE__);
+
+	size_t max_work_group_size, change_work_group_size, finish_work_group_size;
+	rc = clGetKernelWorkGroupInfo(self->statistics_kernel, deviceid, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_work_group_size), &max_work_group_size, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clGetKernelWorkGroupInfo(self->change_kernel, deviceid, CL_KERNEL_WORK_GROUP_SIZE, sizeof(change_work_group_size), &change_work_group_size, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clGetKernelWorkGroupInfo(self->finish_kernel, deviceid, CL_KERNEL_WORK_GROUP_SIZE, sizeof(finish_work_group_size), &finish_work_group_size, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	self->group_size = STATISTICS_GROUP_SIZE;
+	if (self->group_size > max_work_group_size)
+		self->group_size = max_work_group_size;
+	if (self->group_size > change_work_group_size)
+		self->group_size = change_work_group_size;
+	if (self->group_size > finish_work_group_size)
+		self->group_size = finish_work_group_size;
+
+	self->partials_cl = clCreateBuffer(context, CL_MEM_READ_WRITE, self->record_bytes * STATISTICS_GROUPS, NULL, &rc);
+	handleError(rc, __LINE__, __FILE__);
+	for (int s = 0; s < STATISTICS_SLOTS; s++)
+	{
+		self->results_cl[s] = clCreateBuffer(context, CL_MEM_WRITE_ONLY, self->record_bytes, NULL, &rc);
+		handleError(rc, __LINE__, __FILE__);
+	}
+
+	// Arguments that do not change between reductions
+	int group_count = STATISTICS_GROUPS;
+	size_t scratch_size = self->record_bytes * self->group_size;
+	rc = clSetKernelArg(self->statistics_kernel, 1, sizeof(cl_mem), &type_matrix_cl);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(self->statistics_kernel, 2, sizeof(int), &total_size);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(self->statistics_kernel, 3, sizeof(cl_mem), &self->partials_cl);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(self->statistics_kernel, 4, scratch_size, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(self->change_kernel, 2, sizeof(cl_mem), &type_matrix_cl);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(self->change_kernel, 5, sizeof(cl_mem), &self->partials_cl);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(self->change_kernel, 6, scratch_size, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(self->finish_kernel, 0, sizeof(cl_mem), &self->partials_cl);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(self->finish_kernel, 1, sizeof(int), &group_count);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(self->finish_kernel, 3, scratch_size, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	return self;
+}
+
+/// @brief Queues the first pass already set up in first_kernel, the second pass and the read of
+// the result without waiting for them
+static void enqueue_reduction(DeviceStatistics *self, cl_command_queue commandQueue, cl_kernel first_kernel, int iteration)
+{
+	cl_int rc;
+	int slot = (self->oldest + self->pending) % STATISTICS_SLOTS;
+	size_t global_size = STATISTICS_GROUPS * self->group_size;
+
+	rc = clEnqueueNDRangeKernel(commandQueue, first_kernel, 1, NULL, &global_size, &self->group_size, 0, NULL, NULL);
+	handleError(rc, __LINE__, __FILE__);
+
+	rc = clSetKernelArg(self->finish_kernel, 2, sizeof(cl_mem), &self->results_cl[slot]);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clEnqueueNDRangeKernel(commandQueue, self->finish_kernel, 1, NULL, &self->group_size, &self->group_size, 0, NULL, NULL);
+	handleError(rc, __LINE__, __FILE__);
+
+	rc = clEnqueueReadBuffer(commandQueue, self->results_cl[slot], CL_FALSE, 0, self->record_bytes, self->results[slot], 0, NULL, &self->events[slot]);
+	handleError(rc, __LINE__, __FILE__);
+	clFlush(commandQueue);
+
+	self->iterations[slot] = iteration;
+	self->pending++;
+}
+
+/// @brief Queues the reduction of a matrix and the read of its result without waiting for it,
+// the result is picked up later by device_statistics_poll(). At most STATISTICS_SLOTS reductions
+// can be in flight, the caller polls with wait set when the ring is full
+/// @param matrix_cl matrix to reduce, the reduction runs after the commands already queued
+/// @param iteration iteration the matrix belongs to
+void device_statistics_enqueue(DeviceStatistics *self, cl_command_queue commandQueue, cl_mem matrix_cl, int iteration)
+{
+	cl_int rc;
+	if (self->pending == STATISTICS_SLOTS)
+	{
+		fprintf(stderr, "No free statistics slot, poll before queueing more reductions\n");
+		return;
+	}
+	rc = clSetKernelArg(self->statistics_kernel, 0, sizeof(cl_mem), &matrix_cl);
+	handleError(rc, __LINE__, __FILE__);
+	enqueue_reduction(self, commandQueue, self->statistics_kernel, iteration);
+}
+
+/// @brief Queues the reduction of the change from previous_cl to matrix_cl over the cells
+// [first_cell, stop_cell), picked up by device_statistics_poll() like the other reductions
+/// @param iteration iteration matrix_cl belongs to
+void device_statistics_enqueue_change(DeviceStatistics *self, cl_command_queue commandQueue, cl_mem matrix_cl,
+									  cl_mem previous_cl, int first_cell, int stop_cell, int iteration)
+{
+	cl_int rc;
+	if (self->pending == STATISTICS_SLOTS)
+	{
+		fprintf(stderr, "No free statistics slot, poll before queueing more reductions\n");
+		return;
+	}
+	rc = clSetKernelArg(self->change_kernel, 0, sizeof(cl_mem), &matrix_cl);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(self->change_kernel, 1, sizeof(cl_mem), &previous_cl);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(self->change_kernel, 3, sizeof(int), &first_cell);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(self->change_kernel, 4, sizeof(int), &stop_cell);
+	handleError(rc, __LINE__, __FILE__);
+	enqueue_reduction(self, commandQueue, self->change_kernel, iteration);
+}
+
+/// @brief Returns the number of reductions in flight
+int device_statistics_pending(DeviceStatistics *self)
+{
+	return self->pending;
+}
+
+/// @brief Returns 1 if the oldest reduction in flight has been read back, without waiting
+int device_statistics_done(DeviceStatistics *self)
+{
+	cl_int rc;
+	if (self->pending == 0)
+		return 0;
+	cl_int status;
+	rc = clGetEventInfo(self->events[self->oldest], CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	handleError(status < 0 ? status : CL_SUCCESS, __LINE__, __FILE__);
+	return status == CL_COMPLETE;
+}
+
+/// @brief Returns the oldest reduction in flight once its result has been read back
+/// @param statistics filled in with the result
+/// @param wait 1 to wait for the oldest reduction, 0 to return at once if it is not done
+/// @return 1 if statistics was filled in, 0 if no reduction is done
+int device_statistics_poll(DeviceStatistics *self, FieldStatistics *statistics, int wait)
+{
+	cl_int rc;
+	if (self->pending == 0)
+		return 0;
+
+	int slot = self->oldest;
+	if (wait)
+	{
+		rc = clWaitForEvents(1, &self->events[slot]);
+		handleError(rc, __LINE__, __FILE__);
+	}
+	else if (!device_statistics_done(self))
+		return 0;
+
+	clReleaseEvent(self->events[slot]);
+	// Devices without cl_khr_fp64 reduce the values in float, the count is always exact
+	double partial[STATISTICS_FIELDS];
+	if (self->value_bytes == sizeof(float))
+		precision_unpack(PRECISION_FP32, self->results[slot], partial, STATISTICS_COUNT);
+	else
+		memcpy(partial, self->results[slot], STATISTICS_COUNT * sizeof(double));
+	cl_ulong count;
+	memcpy(&count, self->results[slot] + STATISTICS_COUNT * self->value_bytes, sizeof(count));
+	partial[STATISTICS_COUNT] = (double)count;
+	statistics_finish(partial, self->iterations[slot], statistics);
+	self->oldest = (self->oldest + 1) % STATISTICS_SLOTS;
+	self->pending--;
+	return 1;
+}
+
+/// @brief Waits for the reductions in flight and frees the kernels and buffers
+void device_statistics_destroy(DeviceStatistics *self)
+{
+	if (self == NULL)
+		return;
+	FieldStatistics statistics;
+	while (device_statistics_poll(self, &statistics, 1))
+		;
+	clReleaseMemObject(self->partials_cl);
+	for (int s = 0; s < STATISTICS_SLOTS; s++)
+		clReleaseMemObject(self->results_cl[s]);
+	clReleaseKernel(self->statistics_kernel);
+	clReleaseKernel(self->change_kernel);
+	clReleaseKernel(self->finish_kernel);
+	free(self);
+}
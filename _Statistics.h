@@ -0,0 +1,61 @@
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include "_OpenCLUtil.h"
+#include "_Precision.h"
+#include "_TypeMask.h"
+
+/* Partial statistics are arrays of STATISTICS_FIELDS doubles, in the order of the statistics_t
+records of homework.cl: minimum, maximum, sum, sum of the squares and number of fluid cells. The
+sum is the thermal energy of the fluid, with the same heat capacity for every cell, the sum of
+the squares gives the L2 norm of a change */
+#define STATISTICS_FIELDS 5
+#define STATISTICS_MIN 0
+#define STATISTICS_MAX 1
+#define STATISTICS_SUM 2
+#define STATISTICS_SUM_SQUARES 3
+#define STATISTICS_COUNT 4
+
+// Norms of the change of the fluid cells over one step, see statistics_change_norm()
+#define CHANGE_NORM_MAX 0
+#define CHANGE_NORM_L2 1
+
+// Reductions queued on the device before the oldest one has to be waited for
+#define STATISTICS_SLOTS 4
+
+/* Statistics of the fluid cells of one iteration */
+typedef struct FieldStatistics
+{
+	int iteration;
+	long fluid_count;
+	double min_value, max_value;
+	// The sum is the thermal energy of the fluid cells
+	double sum, mean;
+	double sum_squares;
+} FieldStatistics;
+
+typedef struct DeviceStatistics DeviceStatistics;
+
+void statistics_reset(double *partial);
+void statistics_accumulate(double *partial, double *values, uint32_t *fluid_bits, long start, long stop);
+void statistics_accumulate_cells(double *partial, double *values, int *cells, long start, long stop);
+void statistics_accumulate_change(double *partial, double *values, double *previous, uint32_t *fluid_bits, long start,
+								  long stop);
+void statistics_accumulate_change_cells(double *partial, double *values, double *previous, int *cells, long start,
+										long stop);
+void statistics_merge(double *partial, double *other);
+void statistics_finish(double *partial, int iteration, FieldStatistics *statistics);
+void statistics_combine(FieldStatistics *statistics, FieldStatistics *other);
+double statistics_change_norm(FieldStatistics *change, int norm);
+
+DeviceStatistics *device_statistics_create(cl_context context, cl_device_id deviceid, cl_program program, int precision,
+										   cl_mem type_matrix_cl, int total_size);
+void device_statistics_enqueue(DeviceStatistics *self, cl_command_queue commandQueue, cl_mem matrix_cl, int iteration);
+void device_statistics_enqueue_change(DeviceStatistics *self, cl_command_queue commandQueue, cl_mem matrix_cl,
+									  cl_mem previous_cl, int first_cell, int stop_cell, int iteration);
+int device_statistics_pending(DeviceStatistics *self);
+int device_statistics_done(DeviceStatistics *self);
+int device_statistics_poll(DeviceStatistics *self, FieldStatistics *statistics, int wait);
+void device_statistics_destroy(DeviceStatistics *self);
+
+#endif
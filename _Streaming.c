@@ -0,0 +1,360 @@
+#include "_Streaming.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "_Precision.h"
+#include "_TypeMask.h"
+
+/// @brief Returns a monotonic time in seconds
+static double now_seconds()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/// @brief Rounds value up to a multiple of step
+static size_t round_up(size_t value, size_t step)
+{
+	return (value + step - 1) / step * step;
+}
+
+/// @brief Returns the largest number of lines a slab can own so that the buffers of every slot
+// fit in STREAMING_MEMORY_SHARE of the device memory, each matrix fits in a single allocation
+// and the kernels can still index the stored cells with an int
+/// @param cell_bytes size of a temperature on the device
+/// @return the lines, less than 1 if even a single line does not fit
+int streaming_slab_lines(cl_device_id device, int Y, int halo, int slot_count, size_t cell_bytes)
+{
+	cl_ulong global_memory, max_allocation;
+	int rc = clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(global_memory), &global_memory, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_allocation), &max_allocation, NULL);
+	handleError(rc, __LINE__, __FILE__);
+
+	// Two matrices and the fluid mask per slot
+	double slot_line_bytes = (2.0 * cell_bytes + 1.0 / 8) * Y;
+	double stored_lines = global_memory * STREAMING_MEMORY_SHARE / slot_count / slot_line_bytes;
+	stored_lines = fmin(stored_lines, (double)max_allocation / (cell_bytes * Y));
+	stored_lines = fmin(stored_lines, (double)INT_MAX / Y);
+	return (int)stored_lines - 2 * halo;
+}
+
+/// @brief Splits the grid in slabs of slab_lines owned lines, the last one keeps the rest
+/// @return 1 if error, 0 if no error
+static int split_windows(StreamingGrid *self, int slab_lines)
+{
+	self->window_count = (self->X + slab_lines - 1) / slab_lines;
+	self->windows = (StreamWindow *)calloc(self->window_count, sizeof(StreamWindow));
+	if (self->windows == NULL)
+	{
+		perror("Error allocating memory for the slabs\n");
+		return 1;
+	}
+	for (int w = 0; w < self->window_count; w++)
+	{
+		StreamWindow *window = &self->windows[w];
+		window->first_line = w * slab_lines;
+		window->line_count = w == self->window_count - 1 ? self->X - window->first_line : slab_lines;
+		window->stored_first = window->first_line > self->halo ? window->first_line - self->halo : 0;
+		int stored_stop = window->first_line + window->line_count + self->halo;
+		window->stored_count = (stored_stop < self->X ? stored_stop : self->X) - window->stored_first;
+		window->dim[0] = window->stored_count;
+		window->dim[1] = self->Y;
+	}
+	return 0;
+}
+
+/// @brief Splits a grid in slabs and creates the slots they are streamed through
+/// @param program homework.cl built for the device without the grid size, which differs between
+// the slabs at the edges of the grid
+/// @param halo lines stored on each side of a slab, the iterations of a pass
+/// @param slab_lines lines owned by a slab, see streaming_slab_lines()
+/// @param slot_count slots the slabs go round, at least 2 to overlap the transfers with the kernels
+/// @param precision precision of the temperatures on the device and in the output file
+/// @return the streamed grid, NULL if error
+StreamingGrid *streaming_create(cl_context context, cl_device_id device, cl_program program, int X, int Y, int halo,
+								int slab_lines, int slot_count, int precision, double decay_rate)
+{
+	cl_int rc;
+	if (slab_lines < 1)
+	{
+		fprintf(stderr, "Lines of %d cells with a halo of %d lines on each side do not fit in the device memory\n", Y,
+				halo);
+		return NULL;
+	}
+	StreamingGrid *self = (StreamingGrid *)calloc(1, sizeof(StreamingGrid));
+	if (self == NULL)
+	{
+		perror("Error allocating memory for 'StreamingGrid'\n");
+		return NULL;
+	}
+	self->X = X;
+	self->Y = Y;
+	self->halo = halo;
+	self->precision = precision;
+	self->cell_bytes = precision_cell_bytes(precision);
+	self->decay_rate = decay_rate;
+	if (split_windows(self, slab_lines < X ? slab_lines : X))
+	{
+		free(self);
+		return NULL;
+	}
+
+	// More slots than slabs would never be used
+	self->slot_count = slot_count < self->window_count ? slot_count : self->window_count;
+	self->slots = (StreamSlot *)calloc(self->slot_count, sizeof(StreamSlot));
+	if (self->slots == NULL)
+	{
+		perror("Error allocating memory for the slots\n");
+		free(self->windows);
+		free(self);
+		return NULL;
+	}
+	int max_stored = 0;
+	for (int w = 0; w < self->window_count; w++)
+		if (self->windows[w].stored_count > max_stored)
+			max_stored = self->windows[w].stored_count;
+	size_t stored_cells = (size_t)max_stored * Y;
+
+	// The kernels take the decay rate in the precision they compute with
+	float decay_rate_float = (float)decay_rate;
+	size_t real_bytes = precision_real_bytes(precision);
+	void *decay_rate_arg = real_bytes == sizeof(float) ? (void *)&decay_rate_float : (void *)&self->decay_rate;
+	for (int s = 0; s < self->slot_count; s++)
+	{
+		StreamSlot *slot = &self->slots[s];
+		slot->type_window = -1;
+		slot->queue = clCreateCommandQueue(context, device, 0, &rc);
+		handleError(rc, __LINE__, __FILE__);
+		slot->kernel = clCreateKernel(program, "temperature_step", &rc);
+		handleError(rc, __LINE__, __FILE__);
+		for (int m = 0; m < 2; m++)
+		{
+			slot->matrix_cl[m] = clCreateBuffer(context, CL_MEM_READ_WRITE, self->cell_bytes * stored_cells, NULL, &rc);
+			handleError(rc, __LINE__, __FILE__);
+		}
+		slot->type_matrix_cl = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(uint32_t) * type_mask_words(stored_cells),
+										 NULL, &rc);
+		handleError(rc, __LINE__, __FILE__);
+		slot->dim_cl = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(int) * 2, NULL, &rc);
+		handleError(rc, __LINE__, __FILE__);
+
+		rc = clSetKernelArg(slot->kernel, 1, sizeof(cl_mem), &slot->type_matrix_cl);
+		handleError(rc, __LINE__, __FILE__);
+		rc = clSetKernelArg(slot->kernel, 2, sizeof(cl_mem), &slot->dim_cl);
+		handleError(rc, __LINE__, __FILE__);
+		rc = clSetKernelArg(slot->kernel, 4, real_bytes, decay_rate_arg);
+		handleError(rc, __LINE__, __FILE__);
+	}
+
+	size_t max_work_group_size;
+	rc = clGetKernelWorkGroupInfo(self->slots[0].kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_work_group_size),
+								  &max_work_group_size, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	self->worker_group_size = max_work_group_size;
+	self->worker_count = stored_cells;
+
+	printf("Streaming %d slabs of up to %d lines with a halo of %d lines through %d slots of %.1f MB\n",
+		   self->window_count, self->windows[0].line_count, halo, self->slot_count,
+		   (2 * self->cell_bytes * stored_cells + sizeof(uint32_t) * type_mask_words(stored_cells)) / 1e6);
+	return self;
+}
+
+/// @brief Copies the temperatures of a grid file into another one, converting them in chunks when
+// the files are stored in different precisions
+/// @return 1 if error, 0 if no error
+static int copy_cells(GridMapping *from, GridMapping *to, size_t count)
+{
+	int from_dtype = from->header->dtype, to_dtype = to->header->dtype;
+	if (from_dtype == to_dtype)
+	{
+		memcpy(to->temperature, from->temperature, precision_cell_bytes(to_dtype) * count);
+		return 0;
+	}
+	double *values = (double *)malloc(sizeof(double) * STREAMING_CONVERT_CHUNK);
+	if (values == NULL)
+	{
+		perror("Error allocating memory for the converted temperatures\n");
+		return 1;
+	}
+	for (size_t first = 0; first < count; first += STREAMING_CONVERT_CHUNK)
+	{
+		size_t chunk = count - first < STREAMING_CONVERT_CHUNK ? count - first : STREAMING_CONVERT_CHUNK;
+		precision_unpack(from_dtype, (char *)from->temperature + precision_cell_bytes(from_dtype) * first, values, chunk);
+		precision_pack(to_dtype, values, (char *)to->temperature + precision_cell_bytes(to_dtype) * first, chunk);
+	}
+	free(values);
+	return 0;
+}
+
+/// @brief Queues a slab on a slot without waiting: upload of its stored lines, steps iterations
+// and download of its owned lines. The queue of the slot runs them in order, the other slots
+// overlap with them
+static void enqueue_window(StreamingGrid *self, StreamSlot *slot, int w, GridMapping *source, GridMapping *target,
+						   int steps)
+{
+	int rc;
+	StreamWindow *window = &self->windows[w];
+	size_t line_bytes = self->cell_bytes * self->Y;
+	size_t stored_cells = (size_t)window->stored_count * self->Y;
+
+	rc = clEnqueueWriteBuffer(slot->queue, slot->matrix_cl[0], CL_FALSE, 0, line_bytes * window->stored_count,
+							  (char *)source->temperature + line_bytes * window->stored_first, 0, NULL, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	// With as many slots as slabs, every slot keeps the fluid mask of its slab between passes
+	if (slot->type_window != w)
+	{
+		size_t mask_bytes = sizeof(uint32_t) * type_mask_words(stored_cells);
+		rc = clEnqueueWriteBuffer(slot->queue, slot->type_matrix_cl, CL_FALSE, 0, mask_bytes, window->fluid_bits, 0,
+								  NULL, NULL);
+		handleError(rc, __LINE__, __FILE__);
+		rc = clEnqueueWriteBuffer(slot->queue, slot->dim_cl, CL_FALSE, 0, sizeof(int) * 2, window->dim, 0, NULL, NULL);
+		handleError(rc, __LINE__, __FILE__);
+		slot->type_window = w;
+		self->bytes_uploaded += mask_bytes;
+	}
+	// Non-fluid cells are never written by the kernel, start them equal in both matrices
+	rc = clEnqueueCopyBuffer(slot->queue, slot->matrix_cl[0], slot->matrix_cl[1], 0, 0, line_bytes * window->stored_count,
+							 0, NULL, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	self->bytes_uploaded += line_bytes * window->stored_count;
+
+	size_t local_size = self->worker_group_size;
+	size_t global_size = round_up(self->worker_count < stored_cells ? self->worker_count : stored_cells, local_size);
+	int current = 0;
+	for (int step = 0; step < steps; step++)
+	{
+		rc = clSetKernelArg(slot->kernel, 0, sizeof(cl_mem), &slot->matrix_cl[current]);
+		handleError(rc, __LINE__, __FILE__);
+		rc = clSetKernelArg(slot->kernel, 3, sizeof(cl_mem), &slot->matrix_cl[1 - current]);
+		handleError(rc, __LINE__, __FILE__);
+		rc = clEnqueueNDRangeKernel(slot->queue, slot->kernel, 1, NULL, &global_size, &local_size, 0, NULL, NULL);
+		handleError(rc, __LINE__, __FILE__);
+		current = 1 - current;
+	}
+
+	// The halo lines went stale from the outer edges by one line per step, the owned lines did not
+	rc = clEnqueueReadBuffer(slot->queue, slot->matrix_cl[current], CL_FALSE,
+							 line_bytes * (window->first_line - window->stored_first), line_bytes * window->line_count,
+							 (char *)target->temperature + line_bytes * window->first_line, 0, NULL, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clFlush(slot->queue);
+	handleError(rc, __LINE__, __FILE__);
+	self->bytes_downloaded += line_bytes * window->line_count;
+}
+
+/// @brief Runs iterations over a binary grid file and writes the result in the binary format,
+// without ever holding the grid in memory. Every pass streams the slabs from one file to the other
+// and advances the grid by up to halo iterations, the last pass writes the output file
+/// @param input mapping of the input grid, its temperatures are converted to the precision of the
+// run if needed
+/// @param output_file written in the binary format, with a swap file of the same size beside it
+// during the run
+/// @return 1 if error, 0 if no error
+int streaming_run(StreamingGrid *self, GridMapping *input, char *output_file, int iterations)
+{
+	int dim[2] = {self->X, self->Y};
+	size_t total_cells = (size_t)self->X * self->Y;
+	int passes = (iterations + self->halo - 1) / self->halo;
+	int convert = input->header->dtype != (uint32_t)self->precision;
+	double start = now_seconds();
+	self->passes = passes;
+	self->bytes_uploaded = 0;
+	self->bytes_downloaded = 0;
+
+	for (int w = 0; w < self->window_count; w++)
+	{
+		StreamWindow *window = &self->windows[w];
+		size_t stored_cells = (size_t)window->stored_count * self->Y;
+		if (window->fluid_bits != NULL)
+			continue;
+		window->fluid_bits = (uint32_t *)malloc(sizeof(uint32_t) * type_mask_words(stored_cells));
+		if (window->fluid_bits == NULL)
+		{
+			perror("Error allocating memory for the fluid mask of a slab\n");
+			return 1;
+		}
+		type_mask_pack_bits(input->type + (size_t)window->stored_first * self->Y, stored_cells, window->fluid_bits);
+	}
+
+	// Pass p writes files[(passes - 1 - p) % 2] so that the last pass ends in the output file
+	GridMapping *files[2] = {NULL, NULL};
+	char swap_file[4096];
+	snprintf(swap_file, sizeof(swap_file), "%s%s", output_file, STREAMING_SWAP_SUFFIX);
+	files[0] = grid_create_binary(output_file, dim, iterations, self->decay_rate, self->precision);
+	if (files[0] == NULL)
+	{
+		return 1;
+	}
+	if (passes >= 2 || (passes == 1 && convert))
+	{
+		files[1] = grid_create_binary(swap_file, dim, iterations, self->decay_rate, self->precision);
+		if (files[1] == NULL)
+		{
+			grid_unmap(files[0]);
+			return 1;
+		}
+	}
+	memcpy(files[0]->type, input->type, total_cells);
+
+	// The first pass reads the input as it is unless it has to be converted first
+	GridMapping *source = input;
+	int rc = 0;
+	if (passes == 0 || convert)
+	{
+		source = files[passes % 2];
+		rc = copy_cells(input, source, total_cells);
+	}
+
+	for (int pass = 0; pass < passes && rc == 0; pass++)
+	{
+		GridMapping *target = files[(passes - 1 - pass) % 2];
+		int steps = iterations - pass * self->halo < self->halo ? iterations - pass * self->halo : self->halo;
+		for (int w = 0; w < self->window_count; w++)
+			enqueue_window(self, &self->slots[w % self->slot_count], w, source, target, steps);
+		// The next pass reads lines written by the neighbours of every slab
+		for (int s = 0; s < self->slot_count; s++)
+		{
+			int finish_rc = clFinish(self->slots[s].queue);
+			handleError(finish_rc, __LINE__, __FILE__);
+		}
+		source = target;
+	}
+
+	grid_unmap(files[0]);
+	if (files[1] != NULL)
+	{
+		grid_unmap(files[1]);
+		remove(swap_file);
+	}
+	self->seconds = now_seconds() - start;
+	return rc;
+}
+
+/// @brief Releases the slots and frees the streamed grid
+void streaming_destroy(StreamingGrid *self)
+{
+	if (self == NULL)
+		return;
+	for (int s = 0; s < self->slot_count; s++)
+	{
+		StreamSlot *slot = &self->slots[s];
+		clReleaseMemObject(slot->matrix_cl[0]);
+		clReleaseMemObject(slot->matrix_cl[1]);
+		clReleaseMemObject(slot->type_matrix_cl);
+		clReleaseMemObject(slot->dim_cl);
+		clReleaseKernel(slot->kernel);
+		clReleaseCommandQueue(slot->queue);
+	}
+	free(self->slots);
+	for (int w = 0; w < self->window_count; w++)
+		free(self->windows[w].fluid_bits);
+	free(self->windows);
+	free(self);
+}
@@ -0,0 +1,80 @@
+#ifndef STREAMING_H
+#define STREAMING_H
+
+#include "_GridIO.h"
+#include "_OpenCLUtil.h"
+
+/* Out-of-core runs for grids larger than the memory of the device or of the host. The grid stays
+in memory-mapped binary files and every pass streams it through the device in row slabs, each one
+with halo lines of its neighbours on both sides, like the slabs of _Decomposition.h. A slab runs
+up to halo iterations on the device and only its owned lines are written back, so a pass advances
+the whole grid by halo iterations while reading and writing it once.
+
+A pass reads one file and writes the other one, the output file and a swap file beside it, so
+that a slab never reads lines a neighbour already advanced. The slabs go round a fixed set of
+slots, each one with its own command queue and buffers: while a slot computes, the next slot
+uploads its slab and the previous one downloads its result. */
+#define STREAMING_DEFAULT_HALO 8
+#define STREAMING_DEFAULT_SLOTS 2
+// Share of the global memory of the device the buffers of the slots may take
+#define STREAMING_MEMORY_SHARE 0.5
+// Cells converted at a time when the input is stored in another precision than the run
+#define STREAMING_CONVERT_CHUNK (1 << 20)
+#define STREAMING_SWAP_SUFFIX ".swap"
+
+/* Row slab of a streamed grid. It owns the lines [first_line, first_line + line_count) and is
+computed over the stored_count lines from stored_first */
+typedef struct StreamWindow
+{
+	int first_line, line_count;
+	int stored_first, stored_count;
+	// Dimensions of the stored lines, the matrix the kernel sees
+	int dim[2];
+	// Fluid mask of the stored lines, see _TypeMask.h, packed once from the input types since
+	// the slabs seldom start on a word of the mask of the whole grid
+	uint32_t *fluid_bits;
+} StreamWindow;
+
+/* Device buffers one slab at a time goes through */
+typedef struct StreamSlot
+{
+	cl_command_queue queue;
+	cl_kernel kernel;
+	// The matrices swap roles between launches like in the resident mode
+	cl_mem matrix_cl[2];
+	cl_mem type_matrix_cl;
+	cl_mem dim_cl;
+	// Window whose fluid mask and dimensions are on the device, -1 for none
+	int type_window;
+} StreamSlot;
+
+typedef struct StreamingGrid
+{
+	int X, Y;
+	// Lines stored on each side of a slab, and so iterations per pass
+	int halo;
+	int precision;
+	size_t cell_bytes;
+	double decay_rate;
+	int window_count;
+	StreamWindow *windows;
+	int slot_count;
+	StreamSlot *slots;
+
+	// Launch geometry of the linear kernel over a slab, one worker per cell in the largest groups
+	// by default, the worker count is capped by the cells of each slab
+	size_t worker_count, worker_group_size;
+
+	// Totals of the last run
+	int passes;
+	double bytes_uploaded, bytes_downloaded;
+	double seconds;
+} StreamingGrid;
+
+int streaming_slab_lines(cl_device_id device, int Y, int halo, int slot_count, size_t cell_bytes);
+StreamingGrid *streaming_create(cl_context context, cl_device_id device, cl_program program, int X, int Y, int halo,
+								int slab_lines, int slot_count, int precision, double decay_rate);
+int streaming_run(StreamingGrid *self, GridMapping *input, char *output_file, int iterations);
+void streaming_destroy(StreamingGrid *self);
+
+#endif
@@ -0,0 +1,144 @@
+#include "_TypeMask.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/// @brief Returns the number of words of the fluid mask of count cells
+size_t type_mask_words(size_t count)
+{
+	return (count + TYPE_MASK_WORD_BITS - 1) / TYPE_MASK_WORD_BITS;
+}
+
+/// @brief Packs the fluid cells of count cell types in type_mask_words(count) words
+void type_mask_pack_bits(char *type, size_t count, uint32_t *bits)
+{
+	for (size_t w = 0; w < type_mask_words(count); w++)
+	{
+		uint32_t word = 0;
+		size_t first = w * TYPE_MASK_WORD_BITS;
+		size_t stop = first + TYPE_MASK_WORD_BITS < count ? first + TYPE_MASK_WORD_BITS : count;
+		for (size_t c = first; c < stop; c++)
+			word |= (uint32_t)(type[c] == TYPE_MASK_FLUID) << (c - first);
+		bits[w] = word;
+	}
+}
+
+/// @brief Copies the bits of the cells [first, first + count) of a fluid mask to the start of
+// another one, for the slabs of a matrix that do not start on a word
+/// @param extracted type_mask_words(count) words
+void type_mask_extract(uint32_t *bits, size_t first, size_t count, uint32_t *extracted)
+{
+	size_t base = first / TYPE_MASK_WORD_BITS;
+	size_t shift = first % TYPE_MASK_WORD_BITS;
+	size_t words = type_mask_words(count);
+	for (size_t w = 0; w < words; w++)
+	{
+		uint32_t word = bits[base + w] >> shift;
+		// The next source word is only read if cells of this word lie in it
+		if (shift > 0 && w * TYPE_MASK_WORD_BITS + TYPE_MASK_WORD_BITS - shift < count)
+			word |= bits[base + w + 1] << (TYPE_MASK_WORD_BITS - shift);
+		extracted[w] = word;
+	}
+	if (count % TYPE_MASK_WORD_BITS != 0)
+		extracted[words - 1] &= ((uint32_t)1 << (count % TYPE_MASK_WORD_BITS)) - 1;
+}
+
+/// @brief Returns the number of fluid cells of the first count cells of a fluid mask
+long type_mask_count(uint32_t *bits, size_t count)
+{
+	long fluid_count = 0;
+	for (size_t w = 0; w < type_mask_words(count); w++)
+		for (uint32_t word = bits[w]; word != 0; word &= word - 1)
+			fluid_count++;
+	return fluid_count;
+}
+
+/// @brief Packs the cell types of a matrix, the characters of the solid cells go to the enum
+// plane when there are several of them
+/// @param type count cell types, not kept
+/// @return the packed types, NULL if error or if there are more than TYPE_MASK_MAX_SOLID_TYPES
+// solid characters
+TypeMask *type_mask_pack(char *type, size_t count)
+{
+	TypeMask *self = (TypeMask *)calloc(1, sizeof(TypeMask));
+	if (self == NULL)
+	{
+		perror("Error allocating memory for 'TypeMask'\n");
+		return NULL;
+	}
+	self->cell_count = count;
+	self->fluid_bits = (uint32_t *)malloc(sizeof(uint32_t) * type_mask_words(count));
+	if (self->fluid_bits == NULL)
+	{
+		perror("Error allocating memory for the fluid mask\n");
+		free(self);
+		return NULL;
+	}
+	type_mask_pack_bits(type, count, self->fluid_bits);
+	self->fluid_count = type_mask_count(self->fluid_bits, count);
+
+	int code = 0;
+	for (size_t c = 0; c < count; c++)
+	{
+		if (type[c] == TYPE_MASK_FLUID)
+			continue;
+		// Solid cells mostly come in runs of the same character
+		if (self->solid_type_count == 0 || self->solid_types[code] != type[c])
+		{
+			for (code = 0; code < self->solid_type_count && self->solid_types[code] != type[c]; code++)
+				;
+			if (code == self->solid_type_count)
+			{
+				if (self->solid_type_count == TYPE_MASK_MAX_SOLID_TYPES)
+				{
+					fprintf(stderr, "More than %d kinds of solid cells\n", TYPE_MASK_MAX_SOLID_TYPES);
+					type_mask_free(self);
+					return NULL;
+				}
+				self->solid_types[self->solid_type_count++] = type[c];
+			}
+		}
+		// The cells before the second solid character all have the code 0 of the first one
+		if (self->solid_type_count > 1 && self->solid_plane == NULL)
+		{
+			self->solid_plane = (uint8_t *)calloc((count + 1) / 2, sizeof(uint8_t));
+			if (self->solid_plane == NULL)
+			{
+				perror("Error allocating memory for the solid cell types\n");
+				type_mask_free(self);
+				return NULL;
+			}
+		}
+		if (self->solid_plane != NULL)
+			self->solid_plane[c / 2] |= code << (c % 2 * TYPE_MASK_PLANE_BITS);
+	}
+	return self;
+}
+
+/// @brief Writes back the characters of the cells [first, first + count), for the grid files
+void type_mask_unpack(TypeMask *self, size_t first, size_t count, char *type)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		size_t c = first + i;
+		if (TYPE_MASK_IS_FLUID(self->fluid_bits, c))
+		{
+			type[i] = TYPE_MASK_FLUID;
+			continue;
+		}
+		int code = 0;
+		if (self->solid_plane != NULL)
+			code = (self->solid_plane[c / 2] >> (c % 2 * TYPE_MASK_PLANE_BITS)) & (TYPE_MASK_MAX_SOLID_TYPES - 1);
+		type[i] = self->solid_types[code];
+	}
+}
+
+/// @brief Frees the packed types
+void type_mask_free(TypeMask *self)
+{
+	if (self == NULL)
+		return;
+	free(self->fluid_bits);
+	free(self->solid_plane);
+	free(self);
+}
@@ -0,0 +1,40 @@
+#ifndef TYPE_MASK_H
+#define TYPE_MASK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Cell types packed in a fluid mask of one bit per cell, which is all the kernels, the CPU backend
+and the reductions read. Bit c % 32 of word c / 32 is set when cell c, in the line-major order of
+the matrices, is a fluid cell, the bits past the last cell are zero.
+
+The solid cells only differ by the character the grid files give them. A single solid character
+is kept aside; grids with several also get an enum plane of TYPE_MASK_PLANE_BITS per cell,
+indexing solid_types, so that their output files keep them */
+#define TYPE_MASK_FLUID 'f'
+#define TYPE_MASK_WORD_BITS 32
+#define TYPE_MASK_PLANE_BITS 4
+#define TYPE_MASK_MAX_SOLID_TYPES (1 << TYPE_MASK_PLANE_BITS)
+
+#define TYPE_MASK_IS_FLUID(bits, cell) (((bits)[(cell) / TYPE_MASK_WORD_BITS] >> ((cell) % TYPE_MASK_WORD_BITS)) & 1u)
+
+typedef struct TypeMask
+{
+	size_t cell_count;
+	uint32_t *fluid_bits;
+	long fluid_count;
+	int solid_type_count;
+	char solid_types[TYPE_MASK_MAX_SOLID_TYPES];
+	// Two cells per byte, the low bits first, NULL while there is at most one solid character
+	uint8_t *solid_plane;
+} TypeMask;
+
+size_t type_mask_words(size_t count);
+void type_mask_pack_bits(char *type, size_t count, uint32_t *bits);
+void type_mask_extract(uint32_t *bits, size_t first, size_t count, uint32_t *extracted);
+long type_mask_count(uint32_t *bits, size_t count);
+TypeMask *type_mask_pack(char *type, size_t count);
+void type_mask_unpack(TypeMask *self, size_t first, size_t count, char *type);
+void type_mask_free(TypeMask *self);
+
+#endif
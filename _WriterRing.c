@@ -0,0 +1,186 @@
+#include "_WriterRing.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SLOT_FREE 0	   // can be acquired by the simulation
+#define SLOT_FILLING 1 // acquired, the simulation is reading the matrix into it
+#define SLOT_QUEUED 2  // submitted, waiting for the writer thread
+
+/* One host buffer of the ring */
+typedef struct WriterSlot
+{
+	int state;
+	int iteration;
+	void *buffer;
+	// Completes when the device has copied the matrix into buffer, NULL if already copied
+	cl_event read_event;
+} WriterSlot;
+
+struct WriterRing
+{
+	WriterRingWrite write;
+	void *owner;
+	// Printed when the first write fails, the later buffers are dropped
+	char *error_message;
+	int write_failed;
+
+	// Acquired in order by the simulation and written in order by the thread
+	int buffer_count;
+	WriterSlot *slots;
+	int acquire_position;
+	int write_position;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t slot_freed;
+	pthread_cond_t slot_queued;
+	int closing;
+};
+
+/// @brief Writer thread: waits for the queued buffers in order and hands them to the owner
+static void *writer_main(void *arg)
+{
+	WriterRing *self = (WriterRing *)arg;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&self->lock);
+		WriterSlot *slot = &self->slots[self->write_position];
+		while (slot->state != SLOT_QUEUED && !self->closing)
+			pthread_cond_wait(&self->slot_queued, &self->lock);
+		if (slot->state != SLOT_QUEUED)
+		{
+			// Closing and nothing left to write
+			pthread_mutex_unlock(&self->lock);
+			return NULL;
+		}
+		pthread_mutex_unlock(&self->lock);
+
+		// The simulation keeps going while the device copies and the buffer is written
+		if (slot->read_event != NULL)
+		{
+			handleError(clWaitForEvents(1, &slot->read_event), __LINE__, __FILE__);
+			clReleaseEvent(slot->read_event);
+			slot->read_event = NULL;
+		}
+		if (!self->write_failed && self->write(self->owner, slot->iteration, slot->buffer))
+		{
+			perror(self->error_message);
+			self->write_failed = 1;
+		}
+
+		pthread_mutex_lock(&self->lock);
+		slot->state = SLOT_FREE;
+		self->write_position = (self->write_position + 1) % self->buffer_count;
+		pthread_cond_signal(&self->slot_freed);
+		pthread_mutex_unlock(&self->lock);
+	}
+}
+
+/// @brief Frees the buffers of a ring, the thread is handled by the caller
+static void free_ring(WriterRing *self)
+{
+	if (self->slots != NULL)
+		for (int b = 0; b < self->buffer_count; b++)
+			free(self->slots[b].buffer);
+	free(self->slots);
+	free(self);
+}
+
+/// @brief Allocates the buffers of the ring and starts its thread
+/// @param buffer_count number of host buffers
+/// @param buffer_bytes size of a buffer
+/// @param write called by the thread for every submitted buffer, in order
+/// @param owner passed to write
+/// @param error_message printed with perror() when a write fails
+/// @return the ring, NULL if error
+WriterRing *writer_ring_create(int buffer_count, size_t buffer_bytes, WriterRingWrite write, void *owner,
+							   char *error_message)
+{
+	WriterRing *self = (WriterRing *)calloc(1, sizeof(WriterRing));
+	if (self == NULL)
+	{
+		perror("Error allocating memory for 'WriterRing'\n");
+		return NULL;
+	}
+	self->write = write;
+	self->owner = owner;
+	self->error_message = error_message;
+	self->buffer_count = buffer_count;
+	self->slots = (WriterSlot *)calloc(buffer_count, sizeof(WriterSlot));
+	int failed = self->slots == NULL;
+	for (int b = 0; b < buffer_count && !failed; b++)
+	{
+		self->slots[b].buffer = malloc(buffer_bytes);
+		failed = self->slots[b].buffer == NULL;
+	}
+	if (failed)
+	{
+		perror("Error allocating memory for the writer buffers\n");
+		free_ring(self);
+		return NULL;
+	}
+
+	pthread_mutex_init(&self->lock, NULL);
+	pthread_cond_init(&self->slot_freed, NULL);
+	pthread_cond_init(&self->slot_queued, NULL);
+	if (pthread_create(&self->thread, NULL, writer_main, self) != 0)
+	{
+		perror("Error creating the writer thread\n");
+		pthread_mutex_destroy(&self->lock);
+		pthread_cond_destroy(&self->slot_freed);
+		pthread_cond_destroy(&self->slot_queued);
+		free_ring(self);
+		return NULL;
+	}
+	return self;
+}
+
+/// @brief Returns the next host buffer to read a matrix into, waits only if every buffer of the
+// ring is still queued for writing
+/// @param iteration iteration the matrix belongs to, passed to the write function
+void *writer_ring_acquire(WriterRing *self, int iteration)
+{
+	pthread_mutex_lock(&self->lock);
+	WriterSlot *slot = &self->slots[self->acquire_position];
+	while (slot->state != SLOT_FREE)
+		pthread_cond_wait(&self->slot_freed, &self->lock);
+	slot->state = SLOT_FILLING;
+	slot->iteration = iteration;
+	pthread_mutex_unlock(&self->lock);
+	return slot->buffer;
+}
+
+/// @brief Queues the buffer returned by the last writer_ring_acquire() for writing
+/// @param read_event event of the non-blocking read filling the buffer, owned by the ring from
+// now on, or NULL if the buffer is already filled
+void writer_ring_submit(WriterRing *self, cl_event read_event)
+{
+	pthread_mutex_lock(&self->lock);
+	WriterSlot *slot = &self->slots[self->acquire_position];
+	slot->read_event = read_event;
+	slot->state = SLOT_QUEUED;
+	self->acquire_position = (self->acquire_position + 1) % self->buffer_count;
+	pthread_cond_signal(&self->slot_queued);
+	pthread_mutex_unlock(&self->lock);
+}
+
+/// @brief Waits for the queued buffers to be written, stops the thread and frees the ring
+/// @return 1 if a write failed, 0 if no error
+int writer_ring_close(WriterRing *self)
+{
+	pthread_mutex_lock(&self->lock);
+	self->closing = 1;
+	pthread_cond_signal(&self->slot_queued);
+	pthread_mutex_unlock(&self->lock);
+	pthread_join(self->thread, NULL);
+
+	int failed = self->write_failed;
+	pthread_mutex_destroy(&self->lock);
+	pthread_cond_destroy(&self->slot_freed);
+	pthread_cond_destroy(&self->slot_queued);
+	free_ring(self);
+	return failed;
+}
@@ -0,0 +1,24 @@
+#ifndef WRITER_RING_H
+#define WRITER_RING_H
+
+#include "_OpenCLUtil.h"
+
+/* Ring of host buffers between a simulation and a background thread writing them to a file, used
+by the snapshot and checkpoint writers. The simulation acquires the buffers in order, reads a
+matrix into one without blocking and submits it with the event of the read. The thread waits for
+the reads in the same order and hands every buffer to the write function of the owner, so the
+simulation only waits when every buffer is still queued. */
+
+/// @brief Writes a filled buffer, called from the thread of the ring, one buffer at a time
+/// @return 1 if error, 0 if no error
+typedef int (*WriterRingWrite)(void *owner, int iteration, void *buffer);
+
+typedef struct WriterRing WriterRing;
+
+WriterRing *writer_ring_create(int buffer_count, size_t buffer_bytes, WriterRingWrite write, void *owner,
+							   char *error_message);
+void *writer_ring_acquire(WriterRing *self, int iteration);
+void writer_ring_submit(WriterRing *self, cl_event read_event);
+int writer_ring_close(WriterRing *self);
+
+#endif
@@ -0,0 +1,1028 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "_Autotune.h"
+#include "_CPUBackend.h"
+#include "_FluidIndex.h"
+#include "_GridIO.h"
+#include "_OpenCLUtil.h"
+
+#define DEFAULT_DECAY_RATE 0.02
+
+#define BACKEND_OPENCL 0
+#define BACKEND_CPU 1
+
+#define KERNEL_STAGED 0	  // temperature_calculations, uploaded and read back every iteration
+#define KERNEL_LINEAR 1	  // temperature_step
+#define KERNEL_TILED 2	  // temperature_step_tiled
+#define KERNEL_TEMPORAL 3 // temperature_step_temporal
+#define KERNEL_SPARSE 4	  // temperature_step_sparse
+
+#define OBSTACLES_RANDOM 0
+#define OBSTACLES_STRUCTURED 1
+// Period of the square pillars of the structured obstacles
+#define PILLAR_PERIOD 8
+
+// Smallest amount of memory traffic of a cell update: source value, bit of the fluid mask, destination value
+#define BYTES_PER_CELL_UPDATE(cell_bytes) (2 * (cell_bytes) + 1.0 / TYPE_MASK_WORD_BITS * sizeof(uint32_t))
+
+// Phases shorter than this are too noisy to flag as regressions
+#define MIN_COMPARED_SECONDS 1e-3
+
+static const char *kernel_names[] = {"staged", "linear", "tiled", "temporal", "sparse"};
+static const char *kernel_functions[] = {"temperature_calculations", "temperature_step", "temperature_step_tiled",
+										 "temperature_step_temporal", "temperature_step_sparse"};
+// Kernel of each AUTOTUNE_KERNEL_ variant
+static const int autotune_kernels[] = {KERNEL_LINEAR, KERNEL_TILED, KERNEL_TEMPORAL};
+
+/* Benchmark configuration, parsed from the command line */
+typedef struct BenchmarkOptions
+{
+	int X, Y;
+	double fluid_fraction;
+	int obstacles;
+	unsigned int seed;
+	int iterations;
+	int repeat;
+	int backend;
+	int kernel_variant;
+	int cpu_threads;
+	size_t worker_count, worker_group_size;
+	size_t tile_width, tile_height;
+	int steps_per_launch;
+	// Prefix of the temporary grid files of the I/O phase, NULL to skip it
+	char *io_prefix;
+	char *report_file;
+	char *baseline_file;
+	// Relative slowdown accepted against the baseline
+	double tolerance;
+	// Directory of the compiled kernels, NULL to compile homework.cl every time
+	char *kernel_cache;
+	// Compile the grid size, the decay rate and the tile size into the kernels like homework
+	int specialize;
+	// Precision of the matrices on the device, PRECISION_FP64, PRECISION_FP32 or PRECISION_FP16
+	int precision;
+	// Sweep the launch geometries instead of timing one, and store the fastest in profile_file
+	int autotune;
+	char *profile_file;
+} BenchmarkOptions;
+
+/* Seconds spent in every phase of a run, device phases come from profiling events */
+typedef struct BenchmarkPhases
+{
+	double generate;
+	double compile;
+	double text_write, text_read, binary_write, binary_read;
+	double setup;
+	double host_to_device, kernel, device_to_host, update;
+	double total;
+	double bytes_transferred;
+} BenchmarkPhases;
+
+BenchmarkOptions options;
+
+/* Synthetic grid */
+int dim[2];
+int total_size;
+double *initial_matrix;
+char *type_matrix;
+// Fluid mask of type_matrix, see _TypeMask.h
+uint32_t *fluid_bits;
+// Result of a double precision run on the CPU backend, only computed for reduced precisions
+double *reference_matrix;
+PrecisionError accuracy;
+
+/* OpenCL stuff */
+cl_context context;
+cl_command_queue commandQueue;
+cl_device_id deviceid;
+cl_program program;
+cl_kernel kernel;
+
+/// @brief Returns a monotonic time in seconds
+double now_seconds()
+{
+#ifdef _WIN32
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (double)counter.QuadPart / frequency.QuadPart;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+#endif
+}
+
+/// @brief Returns the time a profiled command spent on the device, in seconds, and releases its event
+double event_seconds(cl_event event)
+{
+	cl_ulong start, end;
+	int rc = clWaitForEvents(1, &event);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	clReleaseEvent(event);
+	return (end - start) * 1e-9;
+}
+
+/// @brief xorshift32, the grids must not depend on the rand() of the platform
+unsigned int next_random(unsigned int *state)
+{
+	unsigned int x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+double uniform_random(unsigned int *state)
+{
+	return next_random(state) / 4294967296.0;
+}
+
+/// @brief Generates the synthetic grid: random temperatures, and obstacles that are either random
+// cells or square pillars laid out on a regular lattice, both covering about 1 - fluid_fraction
+// of the matrix
+/// @return 1 if error, 0 if no error
+int generate_grid()
+{
+	unsigned int state = options.seed ? options.seed : 1;
+	dim[0] = options.X;
+	dim[1] = options.Y;
+	total_size = options.X * options.Y;
+	initial_matrix = (double *)malloc(sizeof(double) * total_size);
+	type_matrix = (char *)malloc(sizeof(char) * total_size);
+	fluid_bits = (uint32_t *)malloc(sizeof(uint32_t) * type_mask_words(total_size));
+	if (initial_matrix == NULL || type_matrix == NULL || fluid_bits == NULL)
+	{
+		perror("Error allocating memory for the synthetic grid\n");
+		return 1;
+	}
+
+	int pillar = (int)lround(PILLAR_PERIOD * sqrt(1.0 - options.fluid_fraction));
+	for (int i = 0; i < options.X; i++)
+	{
+		for (int j = 0; j < options.Y; j++)
+		{
+			int temp_index = i * options.Y + j;
+			int solid;
+			if (options.obstacles == OBSTACLES_STRUCTURED)
+				solid = i % PILLAR_PERIOD < pillar && j % PILLAR_PERIOD < pillar;
+			else
+				solid = uniform_random(&state) >= options.fluid_fraction;
+			type_matrix[temp_index] = solid ? 's' : 'f';
+			initial_matrix[temp_index] = uniform_random(&state) * 60.0 - 30.0;
+		}
+	}
+	type_mask_pack_bits(type_matrix, total_size, fluid_bits);
+	return 0;
+}
+
+/// @brief Writes the grid in both formats and loads it back, like homework does with its input
+// and output files
+void time_io(BenchmarkPhases *phases)
+{
+	char text_file[512], binary_file[512];
+	snprintf(text_file, sizeof(text_file), "%s.txt", options.io_prefix);
+	snprintf(binary_file, sizeof(binary_file), "%s%s", options.io_prefix, GRID_EXTENSION);
+
+	double start = now_seconds();
+	grid_write_text(text_file, dim, initial_matrix, type_matrix, options.iterations);
+	phases->text_write = now_seconds() - start;
+
+	int read_dim[2], read_iterations;
+	double *read_matrix;
+	char *read_type;
+	start = now_seconds();
+	if (grid_read_text(text_file, read_dim, &read_iterations, &read_matrix, &read_type) == 0)
+	{
+		free(read_matrix);
+		free(read_type);
+	}
+	phases->text_read = now_seconds() - start;
+
+	start = now_seconds();
+	grid_write_binary(binary_file, dim, options.iterations, DEFAULT_DECAY_RATE, initial_matrix, type_matrix, options.precision);
+	phases->binary_write = now_seconds() - start;
+
+	// Mapping is lazy, copying the temperatures out is what actually reads the file
+	double *copy = (double *)malloc(sizeof(double) * total_size);
+	start = now_seconds();
+	GridMapping *mapping = grid_map_binary(binary_file);
+	if (mapping != NULL && copy != NULL)
+	{
+		precision_unpack(mapping->header->dtype, mapping->temperature, copy, total_size);
+		grid_unmap(mapping);
+	}
+	phases->binary_read = now_seconds() - start;
+	free(copy);
+
+	remove(text_file);
+	remove(binary_file);
+}
+
+/// @brief Computes the result in double precision on the CPU backend, the reduced precision runs
+// are measured against it
+/// @return 1 if error, 0 if no error
+int compute_reference()
+{
+	reference_matrix = (double *)malloc(sizeof(double) * total_size);
+	double *work_matrix = (double *)malloc(sizeof(double) * total_size);
+	CPUBackend *backend = cpu_backend_create(dim[0], dim[1], fluid_bits, DEFAULT_DECAY_RATE, options.cpu_threads);
+	if (reference_matrix == NULL || work_matrix == NULL || backend == NULL)
+	{
+		perror("Error setting up the reference run\n");
+		return 1;
+	}
+	memcpy(reference_matrix, initial_matrix, sizeof(double) * total_size);
+	memcpy(work_matrix, initial_matrix, sizeof(double) * total_size);
+	double *src_matrix = reference_matrix;
+	double *dst_matrix = work_matrix;
+	for (int iteration = 0; iteration < options.iterations; iteration++)
+	{
+		cpu_backend_step(backend, src_matrix, dst_matrix);
+		double *swap_matrix = src_matrix;
+		src_matrix = dst_matrix;
+		dst_matrix = swap_matrix;
+	}
+	memcpy(reference_matrix, src_matrix, sizeof(double) * total_size);
+	cpu_backend_destroy(backend);
+	free(work_matrix);
+	return 0;
+}
+
+/// @brief Runs the iterations on the CPU backend, the kernel phase is the wall time of the steps
+/// @return 1 if error, 0 if no error
+int run_cpu(BenchmarkPhases *phases)
+{
+	double start = now_seconds();
+	double *src_matrix = (double *)malloc(sizeof(double) * total_size);
+	double *dst_matrix = (double *)malloc(sizeof(double) * total_size);
+	CPUBackend *backend = cpu_backend_create(dim[0], dim[1], fluid_bits, DEFAULT_DECAY_RATE, options.cpu_threads);
+	FluidIndex *fluid_index = NULL;
+	if (src_matrix == NULL || dst_matrix == NULL || backend == NULL)
+	{
+		perror("Error setting up the CPU backend\n");
+		return 1;
+	}
+	if (options.kernel_variant == KERNEL_SPARSE)
+	{
+		fluid_index = fluid_index_build(dim[0], dim[1], fluid_bits);
+		if (fluid_index == NULL)
+		{
+			return 1;
+		}
+		cpu_backend_use_fluid_index(backend, fluid_index);
+	}
+	memcpy(src_matrix, initial_matrix, sizeof(double) * total_size);
+	memcpy(dst_matrix, initial_matrix, sizeof(double) * total_size);
+	phases->setup = now_seconds() - start;
+
+	start = now_seconds();
+	for (int iteration = 0; iteration < options.iterations; iteration++)
+	{
+		cpu_backend_step(backend, src_matrix, dst_matrix);
+		double *swap_matrix = src_matrix;
+		src_matrix = dst_matrix;
+		dst_matrix = swap_matrix;
+	}
+	phases->kernel = now_seconds() - start;
+
+	cpu_backend_destroy(backend);
+	fluid_index_free(fluid_index);
+	free(src_matrix);
+	free(dst_matrix);
+	return 0;
+}
+
+/// @brief Rounds value up to a multiple of step
+size_t round_up(size_t value, size_t step)
+{
+	return (value + step - 1) / step * step;
+}
+
+/// @brief Runs the iterations on the OpenCL device like homework does in the selected mode, with
+// every transfer and launch profiled
+/// @return 1 if error, 0 if no error
+int run_opencl(BenchmarkPhases *phases)
+{
+	int rc;
+	cl_event event;
+	size_t cell_bytes = precision_cell_bytes(options.precision);
+	size_t real_bytes = precision_real_bytes(options.precision);
+	size_t matrix_bytes = cell_bytes * total_size;
+	double start = now_seconds();
+
+	double *curr_matrix = (double *)malloc(sizeof(double) * total_size);
+	double *next_matrix = (double *)malloc(sizeof(double) * total_size);
+	// Matrix in the device precision, the host matrices themselves in double precision
+	void *cells = options.precision == PRECISION_FP64 ? (void *)curr_matrix : malloc(matrix_bytes);
+	if (curr_matrix == NULL || next_matrix == NULL || cells == NULL)
+	{
+		perror("Error allocating memory for the matrices\n");
+		return 1;
+	}
+	memcpy(curr_matrix, initial_matrix, sizeof(double) * total_size);
+	memcpy(next_matrix, initial_matrix, sizeof(double) * total_size);
+	precision_pack(options.precision, curr_matrix, cells, total_size);
+
+	cl_mem curr_matrix_cl = clCreateBuffer(context, CL_MEM_READ_WRITE, matrix_bytes, NULL, &rc);
+	handleError(rc, __LINE__, __FILE__);
+	cl_mem next_matrix_cl = clCreateBuffer(context, CL_MEM_READ_WRITE, matrix_bytes, NULL, &rc);
+	handleError(rc, __LINE__, __FILE__);
+	cl_mem type_matrix_cl = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(uint32_t) * type_mask_words(total_size), NULL, &rc);
+	handleError(rc, __LINE__, __FILE__);
+	cl_mem dim_cl = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(int) * 2, NULL, &rc);
+	handleError(rc, __LINE__, __FILE__);
+
+	FluidIndex *fluid_index = NULL;
+	cl_mem fluid_cells_cl = NULL, neighbour_offsets_cl = NULL, neighbour_cells_cl = NULL;
+	if (options.kernel_variant == KERNEL_SPARSE)
+	{
+		fluid_index = fluid_index_build(dim[0], dim[1], fluid_bits);
+		if (fluid_index == NULL)
+		{
+			return 1;
+		}
+		int neighbour_count = fluid_index->neighbour_offsets[fluid_index->fluid_count];
+		fluid_cells_cl = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(int) * (fluid_index->fluid_count + 1), fluid_index->fluid_cells, &rc);
+		handleError(rc, __LINE__, __FILE__);
+		neighbour_offsets_cl = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(int) * (fluid_index->fluid_count + 1), fluid_index->neighbour_offsets, &rc);
+		handleError(rc, __LINE__, __FILE__);
+		neighbour_cells_cl = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(int) * (neighbour_count + 1), fluid_index->neighbour_cells, &rc);
+		handleError(rc, __LINE__, __FILE__);
+	}
+	phases->setup = now_seconds() - start;
+
+	size_t max_work_group_size;
+	rc = clGetKernelWorkGroupInfo(kernel, deviceid, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_work_group_size), &max_work_group_size, NULL);
+	handleError(rc, __LINE__, __FILE__);
+
+	// Same launch geometry as homework
+	cl_uint work_dim = 1;
+	size_t global_size[2] = {options.worker_count, 1};
+	size_t local_size[2] = {fmin(options.worker_group_size, max_work_group_size), 1};
+	if (options.kernel_variant == KERNEL_TILED || options.kernel_variant == KERNEL_TEMPORAL)
+	{
+		if (options.tile_width * options.tile_height > max_work_group_size)
+		{
+			fprintf(stderr, "Tile %zux%zu exceeds the maximum work group size %zu\n",
+					options.tile_width, options.tile_height, max_work_group_size);
+			return 1;
+		}
+		work_dim = 2;
+		local_size[0] = options.tile_width;
+		local_size[1] = options.tile_height;
+		global_size[0] = round_up(dim[1], options.tile_width);
+		global_size[1] = round_up(dim[0], options.tile_height);
+	}
+
+	double decay_rate = DEFAULT_DECAY_RATE;
+	float decay_rate_float = DEFAULT_DECAY_RATE;
+	if (options.kernel_variant == KERNEL_SPARSE)
+	{
+		rc = clSetKernelArg(kernel, 1, sizeof(cl_mem), &fluid_cells_cl);
+		handleError(rc, __LINE__, __FILE__);
+		rc = clSetKernelArg(kernel, 2, sizeof(cl_mem), &neighbour_offsets_cl);
+		handleError(rc, __LINE__, __FILE__);
+		rc = clSetKernelArg(kernel, 5, sizeof(cl_mem), &neighbour_cells_cl);
+		handleError(rc, __LINE__, __FILE__);
+		rc = clSetKernelArg(kernel, 6, sizeof(int), &fluid_index->fluid_count);
+		handleError(rc, __LINE__, __FILE__);
+	}
+	else
+	{
+		rc = clSetKernelArg(kernel, 1, sizeof(cl_mem), &type_matrix_cl);
+		handleError(rc, __LINE__, __FILE__);
+		rc = clSetKernelArg(kernel, 2, sizeof(cl_mem), &dim_cl);
+		handleError(rc, __LINE__, __FILE__);
+	}
+	if (options.kernel_variant != KERNEL_STAGED)
+	{
+		rc = clSetKernelArg(kernel, 4, real_bytes, real_bytes == sizeof(float) ? (void *)&decay_rate_float : (void *)&decay_rate);
+		handleError(rc, __LINE__, __FILE__);
+	}
+	if (options.kernel_variant == KERNEL_TILED)
+	{
+		size_t tile_cells = (options.tile_width + 2) * (options.tile_height + 2);
+		rc = clSetKernelArg(kernel, 5, real_bytes * tile_cells, NULL);
+		handleError(rc, __LINE__, __FILE__);
+		rc = clSetKernelArg(kernel, 6, sizeof(char) * tile_cells, NULL);
+		handleError(rc, __LINE__, __FILE__);
+	}
+
+	// Constant inputs go up once in every mode
+	rc = clEnqueueWriteBuffer(commandQueue, type_matrix_cl, CL_FALSE, 0, sizeof(uint32_t) * type_mask_words(total_size), fluid_bits, 0, NULL, &event);
+	handleError(rc, __LINE__, __FILE__);
+	phases->host_to_device += event_seconds(event);
+	rc = clEnqueueWriteBuffer(commandQueue, dim_cl, CL_FALSE, 0, sizeof(int) * 2, dim, 0, NULL, &event);
+	handleError(rc, __LINE__, __FILE__);
+	phases->host_to_device += event_seconds(event);
+	phases->bytes_transferred += sizeof(char) * total_size;
+
+	if (options.kernel_variant == KERNEL_STAGED)
+	{
+		rc = clSetKernelArg(kernel, 0, sizeof(cl_mem), &curr_matrix_cl);
+		handleError(rc, __LINE__, __FILE__);
+		rc = clSetKernelArg(kernel, 3, sizeof(cl_mem), &next_matrix_cl);
+		handleError(rc, __LINE__, __FILE__);
+
+		for (int iteration = 0; iteration < options.iterations; iteration++)
+		{
+			rc = clEnqueueWriteBuffer(commandQueue, curr_matrix_cl, CL_FALSE, 0, matrix_bytes, curr_matrix, 0, NULL, &event);
+			handleError(rc, __LINE__, __FILE__);
+			phases->host_to_device += event_seconds(event);
+			rc = clEnqueueWriteBuffer(commandQueue, next_matrix_cl, CL_FALSE, 0, matrix_bytes, next_matrix, 0, NULL, &event);
+			handleError(rc, __LINE__, __FILE__);
+			phases->host_to_device += event_seconds(event);
+
+			rc = clEnqueueNDRangeKernel(commandQueue, kernel, 1, NULL, global_size, local_size, 0, NULL, &event);
+			handleError(rc, __LINE__, __FILE__);
+			phases->kernel += event_seconds(event);
+
+			rc = clEnqueueReadBuffer(commandQueue, next_matrix_cl, CL_FALSE, 0, matrix_bytes, next_matrix, 0, NULL, &event);
+			handleError(rc, __LINE__, __FILE__);
+			phases->device_to_host += event_seconds(event);
+			phases->bytes_transferred += 3.0 * matrix_bytes;
+
+			// update_matrix() and decay_temperature() of homework
+			double update_start = now_seconds();
+			for (int i = 0; i < total_size; i++)
+				curr_matrix[i] = next_matrix[i];
+			for (int i = 0; i < total_size; i++)
+				curr_matrix[i] -= curr_matrix[i] * decay_rate;
+			phases->update += now_seconds() - update_start;
+		}
+	}
+	else
+	{
+		cl_mem src_cl = curr_matrix_cl;
+		cl_mem dst_cl = next_matrix_cl;
+		rc = clEnqueueWriteBuffer(commandQueue, curr_matrix_cl, CL_FALSE, 0, matrix_bytes, cells, 0, NULL, &event);
+		handleError(rc, __LINE__, __FILE__);
+		phases->host_to_device += event_seconds(event);
+		rc = clEnqueueWriteBuffer(commandQueue, next_matrix_cl, CL_FALSE, 0, matrix_bytes, cells, 0, NULL, &event);
+		handleError(rc, __LINE__, __FILE__);
+		phases->host_to_device += event_seconds(event);
+
+		// Launches are queued back to back, their events are only read at the end
+		int launch_count = 0;
+		cl_event *launch_events = (cl_event *)malloc(sizeof(cl_event) * (options.iterations + 1));
+		if (launch_events == NULL)
+		{
+			perror("Error allocating memory for the launch events\n");
+			return 1;
+		}
+		int steps = 1;
+		for (int iteration = 0; iteration < options.iterations; iteration += steps)
+		{
+			rc = clSetKernelArg(kernel, 0, sizeof(cl_mem), &src_cl);
+			handleError(rc, __LINE__, __FILE__);
+			rc = clSetKernelArg(kernel, 3, sizeof(cl_mem), &dst_cl);
+			handleError(rc, __LINE__, __FILE__);
+			if (options.kernel_variant == KERNEL_TEMPORAL)
+			{
+				steps = fmin(options.steps_per_launch, options.iterations - iteration);
+				size_t tile_cells = (options.tile_width + 2 * steps) * (options.tile_height + 2 * steps);
+				rc = clSetKernelArg(kernel, 5, sizeof(int), &steps);
+				handleError(rc, __LINE__, __FILE__);
+				rc = clSetKernelArg(kernel, 6, real_bytes * tile_cells, NULL);
+				handleError(rc, __LINE__, __FILE__);
+				rc = clSetKernelArg(kernel, 7, real_bytes * tile_cells, NULL);
+				handleError(rc, __LINE__, __FILE__);
+				rc = clSetKernelArg(kernel, 8, sizeof(char) * tile_cells, NULL);
+				handleError(rc, __LINE__, __FILE__);
+			}
+			rc = clEnqueueNDRangeKernel(commandQueue, kernel, work_dim, NULL, global_size, local_size, 0, NULL, &launch_events[launch_count++]);
+			handleError(rc, __LINE__, __FILE__);
+
+			cl_mem swap_cl = src_cl;
+			src_cl = dst_cl;
+			dst_cl = swap_cl;
+		}
+		for (int l = 0; l < launch_count; l++)
+			phases->kernel += event_seconds(launch_events[l]);
+		free(launch_events);
+
+		rc = clEnqueueReadBuffer(commandQueue, src_cl, CL_FALSE, 0, matrix_bytes, cells, 0, NULL, &event);
+		handleError(rc, __LINE__, __FILE__);
+		phases->device_to_host += event_seconds(event);
+		precision_unpack(options.precision, cells, curr_matrix, total_size);
+		phases->bytes_transferred += 3.0 * matrix_bytes;
+	}
+
+	clReleaseMemObject(curr_matrix_cl);
+	clReleaseMemObject(next_matrix_cl);
+	clReleaseMemObject(type_matrix_cl);
+	clReleaseMemObject(dim_cl);
+	if (fluid_index != NULL)
+	{
+		clReleaseMemObject(fluid_cells_cl);
+		clReleaseMemObject(neighbour_offsets_cl);
+		clReleaseMemObject(neighbour_cells_cl);
+		fluid_index_free(fluid_index);
+	}
+	if (reference_matrix != NULL)
+		precision_compare(reference_matrix, curr_matrix, fluid_bits, total_size, &accuracy);
+	if (cells != (void *)curr_matrix)
+		free(cells);
+	free(curr_matrix);
+	free(next_matrix);
+	return 0;
+}
+
+/// @brief Writes the compiler options of homework.cl, the same ones homework uses unless
+// --no-specialize is given to it
+void program_build_options(char *build_options, size_t size)
+{
+	int length = snprintf(build_options, size, "%s", precision_build_option(options.precision));
+	if (!options.specialize)
+		return;
+	char decay_rate[32];
+	precision_real_literal(options.precision, DEFAULT_DECAY_RATE, decay_rate, sizeof(decay_rate));
+	length += snprintf(build_options + length, size - length, " -D GRID_X=%d -D GRID_Y=%d -D DECAY_RATE=%s",
+					   dim[0], dim[1], decay_rate);
+	if (options.kernel_variant == KERNEL_TILED || options.kernel_variant == KERNEL_TEMPORAL)
+		snprintf(build_options + length, size - length, " -D TILE_WIDTH=%zu -D TILE_HEIGHT=%zu",
+				 options.tile_width, options.tile_height);
+}
+
+/// @brief Sweeps the launch geometries the device can run on the synthetic grid, times each with
+// profiling events, keeping the fastest kernel time of the repeated runs, and stores the fastest
+// geometry in the profile file for the device, the precision and the size class of the grid
+/// @return 1 if error, 0 if no error
+int autotune()
+{
+	LaunchProfile *candidates;
+	int count = autotune_candidates(deviceid, dim[0], dim[1], precision_real_bytes(options.precision), &candidates);
+	if (count <= 0)
+	{
+		fprintf(stderr, "No launch geometry to try on this device\n");
+		return 1;
+	}
+
+	int rc;
+	int best = -1;
+	char built_options[256] = "";
+	program = NULL;
+	for (int c = 0; c < count; c++)
+	{
+		LaunchProfile *candidate = &candidates[c];
+		options.kernel_variant = autotune_kernels[candidate->kernel_variant];
+		options.worker_count = candidate->worker_count;
+		options.worker_group_size = candidate->worker_group_size;
+		options.tile_width = candidate->tile_width;
+		options.tile_height = candidate->tile_height;
+		options.steps_per_launch = candidate->steps_per_launch;
+
+		// Only the specialized tile sizes need another program, the kernel cache keeps them all
+		char build_options[256];
+		program_build_options(build_options, sizeof(build_options));
+		if (program == NULL || strcmp(build_options, built_options) != 0)
+		{
+			if (program != NULL)
+				clReleaseProgram(program);
+			program = getCachedProgram("homework.cl", build_options, options.kernel_cache, context, deviceid);
+			strcpy(built_options, build_options);
+		}
+		kernel = clCreateKernel(program, kernel_functions[options.kernel_variant], &rc);
+		handleError(rc, __LINE__, __FILE__);
+
+		// The kernel may run smaller groups than the device
+		size_t max_work_group_size;
+		rc = clGetKernelWorkGroupInfo(kernel, deviceid, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_work_group_size), &max_work_group_size, NULL);
+		handleError(rc, __LINE__, __FILE__);
+		size_t group_size = options.kernel_variant == KERNEL_LINEAR ? options.worker_group_size : options.tile_width * options.tile_height;
+		candidate->cells_per_second = 0;
+		if (group_size <= max_work_group_size)
+		{
+			double kernel_seconds = 0;
+			for (int r = 0; r < options.repeat; r++)
+			{
+				BenchmarkPhases phases;
+				memset(&phases, 0, sizeof(phases));
+				if (run_opencl(&phases))
+				{
+					return 1;
+				}
+				if (r == 0 || phases.kernel < kernel_seconds)
+					kernel_seconds = phases.kernel;
+			}
+			candidate->cells_per_second = kernel_seconds > 0 ? (double)total_size * options.iterations / kernel_seconds : 0;
+		}
+		clReleaseKernel(kernel);
+
+		printf("%-8s workers %8zu group %4zu tile %2zux%-2zu steps %d: %.3e cells per second\n",
+			   autotune_kernel_name(candidate->kernel_variant), candidate->worker_count, candidate->worker_group_size,
+			   candidate->tile_width, candidate->tile_height, candidate->steps_per_launch, candidate->cells_per_second);
+		if (candidate->cells_per_second > 0 && (best < 0 || candidate->cells_per_second > candidates[best].cells_per_second))
+			best = c;
+	}
+	if (program != NULL)
+		clReleaseProgram(program);
+	program = NULL;
+	if (best < 0)
+	{
+		fprintf(stderr, "No launch geometry could be timed\n");
+		free(candidates);
+		return 1;
+	}
+
+	char device_key[AUTOTUNE_LINE_LENGTH / 2];
+	autotune_device_key(deviceid, device_key, sizeof(device_key));
+	int size_class = autotune_size_class(dim[0], dim[1]);
+	LaunchProfile *profile = &candidates[best];
+	printf("Fastest for %s, %s, grids of 2^%d cells: %s kernel, workers %zu group %zu tile %zux%zu steps %d, %.3e cells per second\n",
+		   device_key, precision_name(options.precision), size_class, autotune_kernel_name(profile->kernel_variant),
+		   profile->worker_count, profile->worker_group_size, profile->tile_width, profile->tile_height,
+		   profile->steps_per_launch, profile->cells_per_second);
+	rc = autotune_store(options.profile_file, device_key, options.precision, size_class, profile);
+	if (rc == 0)
+		printf("Stored in %s\n", options.profile_file);
+	free(candidates);
+	return rc;
+}
+
+/// @brief Writes the report as a flat JSON object, one member per line
+/// @return 1 if error, 0 if no error
+int write_report(FILE *report_fptr, BenchmarkPhases *phases)
+{
+	double updates = (double)total_size * options.iterations;
+	double cells_per_second = phases->kernel > 0 ? updates / phases->kernel : 0.0;
+	double kernel_gbps = phases->kernel > 0 ? updates * BYTES_PER_CELL_UPDATE(precision_cell_bytes(options.precision)) / phases->kernel * 1e-9 : 0.0;
+	double transfer_seconds = phases->host_to_device + phases->device_to_host;
+	double transfer_gbps = transfer_seconds > 0 ? phases->bytes_transferred / transfer_seconds * 1e-9 : 0.0;
+
+	fprintf(report_fptr, "{\n");
+	fprintf(report_fptr, "  \"backend\": \"%s\",\n", options.backend == BACKEND_CPU ? "cpu" : "opencl");
+	fprintf(report_fptr, "  \"kernel\": \"%s\",\n", kernel_names[options.kernel_variant]);
+	fprintf(report_fptr, "  \"obstacles\": \"%s\",\n", options.obstacles == OBSTACLES_STRUCTURED ? "structured" : "random");
+	fprintf(report_fptr, "  \"lines\": %d,\n", dim[0]);
+	fprintf(report_fptr, "  \"columns\": %d,\n", dim[1]);
+	fprintf(report_fptr, "  \"fluid_fraction\": %g,\n", options.fluid_fraction);
+	fprintf(report_fptr, "  \"iterations\": %d,\n", options.iterations);
+	fprintf(report_fptr, "  \"specialized\": %d,\n", options.specialize);
+	fprintf(report_fptr, "  \"precision\": \"%s\",\n", precision_name(options.precision));
+	fprintf(report_fptr, "  \"generate_s\": %.9f,\n", phases->generate);
+	fprintf(report_fptr, "  \"compile_s\": %.9f,\n", phases->compile);
+	fprintf(report_fptr, "  \"text_write_s\": %.9f,\n", phases->text_write);
+	fprintf(report_fptr, "  \"text_read_s\": %.9f,\n", phases->text_read);
+	fprintf(report_fptr, "  \"binary_write_s\": %.9f,\n", phases->binary_write);
+	fprintf(report_fptr, "  \"binary_read_s\": %.9f,\n", phases->binary_read);
+	fprintf(report_fptr, "  \"setup_s\": %.9f,\n", phases->setup);
+	fprintf(report_fptr, "  \"host_to_device_s\": %.9f,\n", phases->host_to_device);
+	fprintf(report_fptr, "  \"kernel_s\": %.9f,\n", phases->kernel);
+	fprintf(report_fptr, "  \"device_to_host_s\": %.9f,\n", phases->device_to_host);
+	fprintf(report_fptr, "  \"update_s\": %.9f,\n", phases->update);
+	fprintf(report_fptr, "  \"total_s\": %.9f,\n", phases->total);
+	fprintf(report_fptr, "  \"cells_per_second\": %.6e,\n", cells_per_second);
+	fprintf(report_fptr, "  \"kernel_gbps\": %.6f,\n", kernel_gbps);
+	fprintf(report_fptr, "  \"transfer_gbps\": %.6f,\n", transfer_gbps);
+	// Errors of the fluid cells against a double precision run relative to the largest temperature,
+	// zero in double precision
+	double scale = accuracy.scale > 0 ? accuracy.scale : 1.0;
+	fprintf(report_fptr, "  \"max_error\": %.6e,\n", accuracy.max_error / scale);
+	fprintf(report_fptr, "  \"rms_error\": %.6e\n", accuracy.rms_error / scale);
+	fprintf(report_fptr, "}\n");
+	return ferror(report_fptr) != 0;
+}
+
+/// @brief Looks a numeric member up in a report written by write_report()
+/// @return 1 if found, 0 otherwise
+int read_report_value(char *report, const char *key, double *value)
+{
+	char pattern[128];
+	snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+	char *found = strstr(report, pattern);
+	if (found == NULL)
+		return 0;
+	return sscanf(found + strlen(pattern), "%lf", value) == 1;
+}
+
+/// @brief Compares the report with a baseline report. Times may grow and rates may drop by at
+// most the tolerance, phases shorter than MIN_COMPARED_SECONDS in both are ignored
+/// @return 1 if a metric regressed or the baseline could not be read, 0 otherwise
+int compare_with_baseline(char *report)
+{
+	static const char *time_keys[] = {"compile_s", "text_write_s", "text_read_s", "binary_write_s", "binary_read_s", "setup_s",
+									  "host_to_device_s", "kernel_s", "device_to_host_s", "update_s", "total_s"};
+	static const char *rate_keys[] = {"cells_per_second", "kernel_gbps", "transfer_gbps"};
+
+	FILE *baseline_fptr = fopen(options.baseline_file, "rb");
+	if (baseline_fptr == NULL)
+	{
+		perror("Error opening the baseline file!\n");
+		return 1;
+	}
+	char baseline[8192];
+	size_t length = fread(baseline, 1, sizeof(baseline) - 1, baseline_fptr);
+	baseline[length] = '\0';
+	fclose(baseline_fptr);
+
+	static const char *configuration_keys[] = {"lines", "columns", "fluid_fraction", "iterations"};
+	for (int k = 0; k < (int)(sizeof(configuration_keys) / sizeof(configuration_keys[0])); k++)
+	{
+		double old_value, new_value;
+		if (read_report_value(baseline, configuration_keys[k], &old_value) && read_report_value(report, configuration_keys[k], &new_value) &&
+			old_value != new_value)
+			fprintf(stderr, "Warning: the baseline was run with %s %g, this run with %g\n", configuration_keys[k], old_value, new_value);
+	}
+
+	int regressions = 0;
+	printf("%-18s %14s %14s %9s\n", "metric", "baseline", "current", "change");
+	for (int k = 0; k < (int)(sizeof(time_keys) / sizeof(time_keys[0])); k++)
+	{
+		double old_value, new_value;
+		if (!read_report_value(baseline, time_keys[k], &old_value) || !read_report_value(report, time_keys[k], &new_value))
+			continue;
+		if (old_value < MIN_COMPARED_SECONDS && new_value < MIN_COMPARED_SECONDS)
+			continue;
+		int regressed = new_value > old_value * (1.0 + options.tolerance);
+		regressions += regressed;
+		printf("%-18s %14.6f %14.6f %+8.1f%%%s\n", time_keys[k], old_value, new_value,
+			   old_value > 0 ? (new_value / old_value - 1.0) * 100.0 : 0.0, regressed ? "  REGRESSION" : "");
+	}
+	for (int k = 0; k < (int)(sizeof(rate_keys) / sizeof(rate_keys[0])); k++)
+	{
+		double old_value, new_value;
+		if (!read_report_value(baseline, rate_keys[k], &old_value) || !read_report_value(report, rate_keys[k], &new_value))
+			continue;
+		if (old_value == 0.0)
+			continue;
+		int regressed = new_value < old_value * (1.0 - options.tolerance);
+		regressions += regressed;
+		printf("%-18s %14.6g %14.6g %+8.1f%%%s\n", rate_keys[k], old_value, new_value,
+			   (new_value / old_value - 1.0) * 100.0, regressed ? "  REGRESSION" : "");
+	}
+	printf("%d regression%s against %s (tolerance %.0f%%)\n", regressions, regressions == 1 ? "" : "s",
+		   options.baseline_file, options.tolerance * 100.0);
+	return regressions > 0;
+}
+
+/// @brief Parses the options
+/// @return 1 if error, 0 if no error
+int get_args(int argc, char **argv)
+{
+	options.X = 1024;
+	options.Y = 1024;
+	options.fluid_fraction = 0.8;
+	options.obstacles = OBSTACLES_RANDOM;
+	options.seed = 1;
+	options.iterations = 100;
+	options.repeat = 3;
+	options.backend = BACKEND_OPENCL;
+	options.kernel_variant = KERNEL_LINEAR;
+	options.cpu_threads = 0;
+	options.worker_count = 1024;
+	options.worker_group_size = 64;
+	options.tile_width = 16;
+	options.tile_height = 16;
+	options.steps_per_launch = 4;
+	options.io_prefix = "benchmark_grid";
+	options.report_file = NULL;
+	options.baseline_file = NULL;
+	options.tolerance = 0.1;
+	options.kernel_cache = NULL;
+	options.specialize = 0;
+	options.precision = PRECISION_FP64;
+	options.autotune = 0;
+	options.profile_file = AUTOTUNE_DEFAULT_PROFILE;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strncmp(argv[i], "--size=", 7) == 0)
+		{
+			if (sscanf(argv[i] + 7, "%dx%d", &options.X, &options.Y) != 2 || options.X <= 0 || options.Y <= 0)
+			{
+				fprintf(stderr, "Invalid size '%s', expected XxY\n", argv[i] + 7);
+				return 1;
+			}
+		}
+		else if (strncmp(argv[i], "--fluid=", 8) == 0)
+			options.fluid_fraction = atof(argv[i] + 8);
+		else if (strcmp(argv[i], "--obstacles=random") == 0)
+			options.obstacles = OBSTACLES_RANDOM;
+		else if (strcmp(argv[i], "--obstacles=structured") == 0)
+			options.obstacles = OBSTACLES_STRUCTURED;
+		else if (strncmp(argv[i], "--seed=", 7) == 0)
+			options.seed = (unsigned int)strtoul(argv[i] + 7, NULL, 10);
+		else if (strncmp(argv[i], "--iterations=", 13) == 0)
+			options.iterations = atoi(argv[i] + 13);
+		else if (strncmp(argv[i], "--repeat=", 9) == 0)
+			options.repeat = atoi(argv[i] + 9);
+		else if (strcmp(argv[i], "--backend=opencl") == 0)
+			options.backend = BACKEND_OPENCL;
+		else if (strcmp(argv[i], "--backend=cpu") == 0)
+			options.backend = BACKEND_CPU;
+		else if (strncmp(argv[i], "--kernel=", 9) == 0)
+		{
+			int found = 0;
+			for (int k = 0; k < (int)(sizeof(kernel_names) / sizeof(kernel_names[0])); k++)
+				if (strcmp(argv[i] + 9, kernel_names[k]) == 0)
+				{
+					options.kernel_variant = k;
+					found = 1;
+				}
+			if (!found)
+			{
+				fprintf(stderr, "Unknown kernel '%s'\n", argv[i] + 9);
+				return 1;
+			}
+		}
+		else if (strncmp(argv[i], "--threads=", 10) == 0)
+			options.cpu_threads = atoi(argv[i] + 10);
+		else if (strncmp(argv[i], "--workers=", 10) == 0)
+			options.worker_count = atoi(argv[i] + 10);
+		else if (strncmp(argv[i], "--group=", 8) == 0)
+			options.worker_group_size = atoi(argv[i] + 8);
+		else if (strncmp(argv[i], "--tile=", 7) == 0)
+		{
+			if (sscanf(argv[i] + 7, "%zux%zu", &options.tile_width, &options.tile_height) != 2 ||
+				options.tile_width == 0 || options.tile_height == 0)
+			{
+				fprintf(stderr, "Invalid tile size '%s', expected WxH\n", argv[i] + 7);
+				return 1;
+			}
+		}
+		else if (strncmp(argv[i], "--steps-per-launch=", 19) == 0)
+			options.steps_per_launch = atoi(argv[i] + 19);
+		else if (strncmp(argv[i], "--io=", 5) == 0)
+			options.io_prefix = argv[i] + 5;
+		else if (strcmp(argv[i], "--no-io") == 0)
+			options.io_prefix = NULL;
+		else if (strncmp(argv[i], "--report=", 9) == 0)
+			options.report_file = argv[i] + 9;
+		else if (strncmp(argv[i], "--baseline=", 11) == 0)
+			options.baseline_file = argv[i] + 11;
+		else if (strncmp(argv[i], "--tolerance=", 12) == 0)
+			options.tolerance = atof(argv[i] + 12);
+		else if (strncmp(argv[i], "--kernel-cache=", 15) == 0)
+			options.kernel_cache = argv[i] + 15;
+		else if (strcmp(argv[i], "--specialize") == 0)
+			options.specialize = 1;
+		else if (strncmp(argv[i], "--precision=", 12) == 0)
+		{
+			options.precision = precision_parse(argv[i] + 12);
+			if (options.precision < 0)
+			{
+				fprintf(stderr, "Unknown precision '%s', expected fp64, fp32 or fp16\n", argv[i] + 12);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--autotune") == 0)
+			options.autotune = 1;
+		else if (strncmp(argv[i], "--profile=", 10) == 0)
+			options.profile_file = argv[i] + 10;
+		else
+		{
+			fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+			fprintf(stderr, "Usage: ./benchmark [--size=XxY] [--fluid=F] [--obstacles=random|structured] [--seed=S] "
+							"[--iterations=N] [--repeat=N] [--backend=opencl|cpu] "
+							"[--kernel=staged|linear|tiled|temporal|sparse] [--threads=N] [--workers=N] [--group=N] "
+							"[--tile=WxH] [--steps-per-launch=K] [--io=prefix] [--no-io] [--report=file] "
+							"[--baseline=file] [--tolerance=F] [--kernel-cache=dir] [--specialize] [--precision=fp64|fp32|fp16] "
+							"[--autotune] [--profile=file]\n");
+			return 1;
+		}
+	}
+	if (options.iterations < 1 || options.repeat < 1 || options.steps_per_launch < 1 ||
+		options.fluid_fraction < 0.0 || options.fluid_fraction > 1.0)
+	{
+		fprintf(stderr, "Iterations, repeats and steps per launch must be positive, the fluid fraction within [0, 1]\n");
+		return 1;
+	}
+	if (options.precision != PRECISION_FP64 && (options.backend == BACKEND_CPU || options.kernel_variant == KERNEL_STAGED))
+	{
+		fprintf(stderr, "Reduced precisions only exist for the resident OpenCL kernels\n");
+		return 1;
+	}
+	if (options.autotune && options.backend == BACKEND_CPU)
+	{
+		fprintf(stderr, "--autotune tunes the OpenCL kernels\n");
+		return 1;
+	}
+	if (options.kernel_variant == KERNEL_TEMPORAL && options.backend == BACKEND_CPU)
+		fprintf(stderr, "The CPU backend has no temporal blocking, running one step at a time\n");
+	return 0;
+}
+
+/// @brief Generates a synthetic grid, times every phase of a run with the chosen backend and
+// kernel, and writes a machine readable report that can be compared with a baseline
+int main(int argc, char **argv)
+{
+	BenchmarkPhases best;
+
+	if (get_args(argc, argv))
+	{
+		return -1;
+	}
+
+	double start = now_seconds();
+	if (generate_grid())
+	{
+		return -1;
+	}
+	double generate_seconds = now_seconds() - start;
+	double compile_seconds = 0.0;
+	if (options.autotune)
+	{
+		deviceid = initOpenCL(&context, &commandQueue);
+		int rc = autotune();
+		clReleaseCommandQueue(commandQueue);
+		clReleaseContext(context);
+		free(initial_matrix);
+		free(type_matrix);
+		free(fluid_bits);
+		return rc ? 1 : 0;
+	}
+	if (options.precision != PRECISION_FP64 && compute_reference())
+	{
+		return -1;
+	}
+
+	if (options.backend == BACKEND_OPENCL)
+	{
+		deviceid = initOpenCL(&context, &commandQueue);
+		char build_options[256];
+		program_build_options(build_options, sizeof(build_options));
+		start = now_seconds();
+		program = getCachedProgram("homework.cl", build_options, options.kernel_cache, context, deviceid);
+		compile_seconds = now_seconds() - start;
+		int rc;
+		kernel = clCreateKernel(program, kernel_functions[options.kernel_variant], &rc);
+		handleError(rc, __LINE__, __FILE__);
+	}
+
+	// Every phase is reported from the fastest of the repeated runs
+	for (int r = 0; r < options.repeat; r++)
+	{
+		BenchmarkPhases phases;
+		memset(&phases, 0, sizeof(phases));
+		phases.generate = generate_seconds;
+		phases.compile = compile_seconds;
+		if (options.io_prefix != NULL)
+			time_io(&phases);
+
+		start = now_seconds();
+		int rc = options.backend == BACKEND_CPU ? run_cpu(&phases) : run_opencl(&phases);
+		if (rc)
+		{
+			return -1;
+		}
+		phases.total = now_seconds() - start;
+		if (r == 0 || phases.total < best.total)
+			best = phases;
+	}
+
+	char report[8192];
+	FILE *report_fptr = tmpfile();
+	if (report_fptr == NULL || write_report(report_fptr, &best))
+	{
+		perror("Error writing the report\n");
+		return -1;
+	}
+	rewind(report_fptr);
+	size_t length = fread(report, 1, sizeof(report) - 1, report_fptr);
+	report[length] = '\0';
+	fclose(report_fptr);
+
+	printf("%s", report);
+	if (options.report_file != NULL)
+	{
+		report_fptr = fopen(options.report_file, "w");
+		if (report_fptr == NULL || fputs(report, report_fptr) == EOF || fclose(report_fptr) != 0)
+		{
+			perror("Error writing the report file!\n");
+			return -1;
+		}
+	}
+
+	int rc = 0;
+	if (options.baseline_file != NULL)
+		rc = compare_with_baseline(report);
+
+	if (options.backend == BACKEND_OPENCL)
+	{
+		clReleaseKernel(kernel);
+		clReleaseProgram(program);
+		clReleaseCommandQueue(commandQueue);
+		clReleaseContext(context);
+	}
+	free(initial_matrix);
+	free(type_matrix);
+	free(fluid_bits);
+	free(reference_matrix);
+	return rc ? 1 : 0;
+}
@@ -0,0 +1,312 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "_JobProtocol.h"
+
+/* Client configuration, parsed from the command line */
+typedef struct ClientOptions
+{
+	char *socket_file;
+	char *input_file;
+	// Written by the server, NULL to receive the result over the socket
+	char *output_file;
+	// Iterations of the jobs, 0 for those of the input file
+	int iterations;
+	// Negative for the decay rate of the input file
+	double decay_rate;
+	// Job n gets priority + n % priorities
+	int priority, priorities;
+	// More than one job runs a load test over connections concurrent connections
+	int jobs;
+	int connections;
+	int shutdown;
+} ClientOptions;
+
+/* Outcome of the jobs of one connection of a load test */
+typedef struct ClientThread
+{
+	int index;
+	pthread_t thread;
+	// Latency of every job sent by the connection, in ms
+	double *latencies;
+	int count;
+	int errors;
+	long batched;
+} ClientThread;
+
+ClientOptions options;
+
+/// @brief Returns a monotonic time in seconds
+double now_seconds()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/// @brief Sends a job and waits for its reply, the temperatures of a RESULT are read into result
+// and reallocated as needed
+/// @param batch_count filled in with the number of jobs computed with this one
+/// @return 1 if the job failed, 0 if no error, -1 if the connection is lost
+int run_job(int fd, char *tag, int priority, double **result, size_t *result_capacity, int *dim, int *batch_count,
+			int verbose)
+{
+	char line[JOB_LINE_LENGTH];
+	snprintf(line, sizeof(line), "JOB %s %d %d %g %s%s%s\n", tag, priority, options.iterations, options.decay_rate,
+			 options.input_file, options.output_file ? " " : "", options.output_file ? options.output_file : "");
+	if (job_write_all(fd, line, strlen(line)) || job_read_line(fd, line, sizeof(line)))
+	{
+		fprintf(stderr, "Connection to the server lost\n");
+		return -1;
+	}
+
+	char reply_tag[JOB_TAG_LENGTH];
+	double queue_ms, run_ms;
+	if (sscanf(line, "RESULT %63s %d %d %lf %lf %d", reply_tag, &dim[0], &dim[1], &queue_ms, &run_ms, batch_count) == 6)
+	{
+		size_t cell_count = (size_t)dim[0] * dim[1];
+		if (cell_count > *result_capacity)
+		{
+			free(*result);
+			*result = (double *)malloc(sizeof(double) * cell_count);
+			*result_capacity = *result == NULL ? 0 : cell_count;
+			if (*result == NULL)
+			{
+				perror("Error allocating memory for the result\n");
+				return -1;
+			}
+		}
+		if (job_read_all(fd, *result, sizeof(double) * cell_count))
+		{
+			fprintf(stderr, "Connection to the server lost\n");
+			return -1;
+		}
+	}
+	else if (sscanf(line, "DONE %63s %lf %lf %d", reply_tag, &queue_ms, &run_ms, batch_count) != 4)
+	{
+		fprintf(stderr, "%s\n", line);
+		return 1;
+	}
+	if (verbose)
+		printf("Job %s: %.3f ms queued, %.3f ms running in a batch of %d\n", reply_tag, queue_ms, run_ms, *batch_count);
+	return 0;
+}
+
+/// @brief Sends the jobs of one connection of a load test, one at a time
+void *client_main(void *arg)
+{
+	ClientThread *self = (ClientThread *)arg;
+	int fd = job_connect(options.socket_file);
+	if (fd < 0)
+	{
+		self->errors = 1;
+		return NULL;
+	}
+	double *result = NULL;
+	size_t result_capacity = 0;
+	for (int n = self->index; n < options.jobs; n += options.connections)
+	{
+		char tag[JOB_TAG_LENGTH];
+		snprintf(tag, sizeof(tag), "%d", n);
+		int dim[2], batch_count = 0;
+		double start = now_seconds();
+		int rc = run_job(fd, tag, options.priority + n % options.priorities, &result, &result_capacity, dim,
+						 &batch_count, 0);
+		if (rc < 0)
+		{
+			self->errors++;
+			break;
+		}
+		self->latencies[self->count++] = (now_seconds() - start) * 1e3;
+		self->errors += rc;
+		self->batched += batch_count;
+	}
+	free(result);
+	close(fd);
+	return NULL;
+}
+
+/// @brief Compares two latencies for qsort()
+int compare_latencies(const void *a, const void *b)
+{
+	double difference = *(const double *)a - *(const double *)b;
+	return (difference > 0) - (difference < 0);
+}
+
+/// @brief Returns the p quantile of sorted latencies
+double percentile(double *latencies, int count, double p)
+{
+	int index = (int)ceil(p * count) - 1;
+	return latencies[index < 0 ? 0 : index];
+}
+
+/// @brief Sends options.jobs jobs over options.connections connections and reports the throughput
+// and the latency percentiles
+/// @return 1 if error, 0 if no error
+int load_test()
+{
+	ClientThread *threads = (ClientThread *)calloc(options.connections, sizeof(ClientThread));
+	double *latencies = (double *)malloc(sizeof(double) * options.jobs);
+	if (threads == NULL || latencies == NULL)
+	{
+		perror("Error allocating memory for the load test\n");
+		return 1;
+	}
+	double start = now_seconds();
+	for (int t = 0; t < options.connections; t++)
+	{
+		threads[t].index = t;
+		threads[t].latencies = latencies + t * (options.jobs / options.connections) +
+							   (t < options.jobs % options.connections ? t : options.jobs % options.connections);
+		pthread_create(&threads[t].thread, NULL, client_main, &threads[t]);
+	}
+	int count = 0, errors = 0;
+	long batched = 0;
+	for (int t = 0; t < options.connections; t++)
+	{
+		pthread_join(threads[t].thread, NULL);
+		// The latencies of every thread are contiguous, they are packed behind each other
+		memmove(latencies + count, threads[t].latencies, sizeof(double) * threads[t].count);
+		count += threads[t].count;
+		errors += threads[t].errors;
+		batched += threads[t].batched;
+	}
+	double seconds = now_seconds() - start;
+
+	if (count > 0)
+	{
+		qsort(latencies, count, sizeof(double), compare_latencies);
+		printf("%d jobs over %d connections in %.3f s: %.1f jobs per second, latency p50 %.3f ms, p99 %.3f ms, max %.3f "
+			   "ms, %.2f jobs per simulation\n",
+			   count, options.connections, seconds, count / seconds, percentile(latencies, count, 0.5),
+			   percentile(latencies, count, 0.99), latencies[count - 1], (double)batched / count);
+	}
+	if (errors > 0 || count < options.jobs)
+		printf("%d jobs failed, %d not sent\n", errors, options.jobs - count);
+	free(threads);
+	free(latencies);
+	return errors > 0 || count < options.jobs;
+}
+
+/// @brief Parses the command line
+/// @return 1 if error, 0 if no error
+int get_args(int argc, char **argv)
+{
+	options.socket_file = NULL;
+	options.input_file = NULL;
+	options.output_file = NULL;
+	options.iterations = 0;
+	options.decay_rate = -1;
+	options.priority = 0;
+	options.priorities = 1;
+	options.jobs = 1;
+	options.connections = 1;
+	options.shutdown = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strncmp(argv[i], "--output=", 9) == 0)
+			options.output_file = argv[i] + 9;
+		else if (strncmp(argv[i], "--iterations=", 13) == 0)
+			options.iterations = atoi(argv[i] + 13);
+		else if (strncmp(argv[i], "--decay-rate=", 13) == 0)
+			options.decay_rate = atof(argv[i] + 13);
+		else if (strncmp(argv[i], "--priority=", 11) == 0)
+			options.priority = atoi(argv[i] + 11);
+		else if (strncmp(argv[i], "--priorities=", 13) == 0)
+			options.priorities = atoi(argv[i] + 13);
+		else if (strncmp(argv[i], "--jobs=", 7) == 0)
+			options.jobs = atoi(argv[i] + 7);
+		else if (strncmp(argv[i], "--connections=", 14) == 0)
+			options.connections = atoi(argv[i] + 14);
+		else if (strcmp(argv[i], "--shutdown") == 0)
+			options.shutdown = 1;
+		else if (argv[i][0] != '-' && options.socket_file == NULL)
+			options.socket_file = argv[i];
+		else if (argv[i][0] != '-' && options.input_file == NULL)
+			options.input_file = argv[i];
+		else
+		{
+			fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+			fprintf(stderr, "Usage: ./client socket_file [input_file] [--output=file] [--iterations=N] [--decay-rate=R] "
+							"[--priority=P] [--priorities=K] [--jobs=N] [--connections=C] [--shutdown]\n");
+			return 1;
+		}
+	}
+	if (options.socket_file == NULL || (options.input_file == NULL && !options.shutdown))
+	{
+		fprintf(stderr, "Usage: ./client socket_file input_file [options]\n");
+		return 1;
+	}
+	if (options.iterations < 0 || options.jobs < 1 || options.connections < 1 || options.priorities < 1)
+	{
+		fprintf(stderr, "Iterations cannot be negative, the jobs, connections and priorities must be positive\n");
+		return 1;
+	}
+	if (options.jobs > 1 && options.output_file != NULL)
+	{
+		fprintf(stderr, "A load test receives the results, it cannot have them written to a file\n");
+		return 1;
+	}
+	if (options.connections > options.jobs)
+		options.connections = options.jobs;
+	return 0;
+}
+
+/// @brief Sends a job to the simulation server and prints its outcome, runs a load test or stops
+// the server
+int main(int argc, char **argv)
+{
+	if (get_args(argc, argv))
+	{
+		return -1;
+	}
+
+	int rc = 0;
+	if (options.input_file != NULL && options.jobs > 1)
+		rc = load_test();
+	else if (options.input_file != NULL)
+	{
+		int fd = job_connect(options.socket_file);
+		if (fd < 0)
+		{
+			return -1;
+		}
+		double *result = NULL;
+		size_t result_capacity = 0;
+		int dim[2], batch_count;
+		rc = run_job(fd, "1", options.priority, &result, &result_capacity, dim, &batch_count, 1);
+		if (rc == 0 && options.output_file == NULL)
+		{
+			double min_value = result[0], max_value = result[0], sum = 0;
+			for (size_t i = 0; i < result_capacity; i++)
+			{
+				min_value = fmin(min_value, result[i]);
+				max_value = fmax(max_value, result[i]);
+				sum += result[i];
+			}
+			printf("Received %dx%d temperatures: min %g, max %g, mean %g\n", dim[0], dim[1], min_value, max_value,
+				   sum / result_capacity);
+		}
+		free(result);
+		close(fd);
+	}
+
+	if (options.shutdown)
+	{
+		char line[JOB_LINE_LENGTH];
+		int fd = job_connect(options.socket_file);
+		if (fd < 0 || job_write_all(fd, "SHUTDOWN\n", 9) || job_read_line(fd, line, sizeof(line)))
+		{
+			fprintf(stderr, "Cannot stop the server\n");
+			return -1;
+		}
+		close(fd);
+	}
+	return rc ? 1 : 0;
+}
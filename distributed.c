@@ -0,0 +1,566 @@
+#include <math.h>
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "_CPUBackend.h"
+#include "_Distributed.h"
+#include "_OpenCLUtil.h"
+
+#define BACKEND_OPENCL 0
+#define BACKEND_CPU 1
+
+// Largest number of rank counts in a scaling series, powers of two up to the size of the run
+#define MAX_SCALING_RUNS 32
+
+/* Distributed run configuration, parsed from the command line */
+typedef struct DistributedOptions
+{
+	char *input_file;
+	// NULL to skip writing the result
+	char *output_file;
+	// Iterations to run, 0 for those of the grid file
+	int iterations;
+	int backend;
+	// Threads of the CPU backend of each rank, 0 to share the cores between the local ranks
+	int cpu_threads;
+	size_t worker_count, worker_group_size;
+	// Ghost lines on each side of a slab, also the iterations run between two exchanges
+	int halo;
+	// Directory of the compiled kernels, NULL to compile homework.cl every time
+	char *kernel_cache;
+	// Run the strong and weak scaling series instead of a single run
+	int scaling;
+	int repeat;
+	char *report_file;
+} DistributedOptions;
+
+/* Times of a scaling series, the weak runs stack one copy of the grid per rank */
+typedef struct ScalingSeries
+{
+	int run_count;
+	int rank_counts[MAX_SCALING_RUNS];
+	double strong_seconds[MAX_SCALING_RUNS];
+	double weak_seconds[MAX_SCALING_RUNS];
+	// Size of the input grid and iterations of every run
+	int dim[2];
+	int iterations;
+} ScalingSeries;
+
+DistributedOptions options;
+int world_rank, world_size;
+// Ranks sharing this host, they share its cores and devices
+int local_rank, local_size;
+
+/* Backend of the slab of this rank */
+CPUBackend *cpu_backend;
+
+/* OpenCL stuff */
+cl_context context;
+cl_command_queue commandQueue;
+cl_device_id deviceid;
+cl_program program;
+cl_kernel kernel;
+cl_mem matrix_cl[2];
+cl_mem type_matrix_cl;
+cl_mem dim_cl;
+size_t global_size, local_size_cl;
+
+/// @brief Stops every rank, the others may be waiting in a collective call
+void fail()
+{
+	MPI_Abort(MPI_COMM_WORLD, 1);
+	exit(1);
+}
+
+/// @brief Rounds value up to a multiple of step
+size_t round_up(size_t value, size_t step)
+{
+	return (value + step - 1) / step * step;
+}
+
+/// @brief Picks the device of this rank, the local ranks go round the devices of the platform
+void init_device()
+{
+	int device_count;
+	cl_device_id *devices = initOpenCLDevices(&context, 0, 0, &device_count);
+	deviceid = devices[local_rank % device_count];
+	free(devices);
+
+	int rc;
+	commandQueue = clCreateCommandQueue(context, deviceid, 0, &rc);
+	handleError(rc, __LINE__, __FILE__);
+}
+
+/// @brief Creates the backend of a slab and uploads it for OpenCL. The program is compiled for
+// the stored lines of the slab, like homework does for the whole matrix
+/// @return 1 if error, 0 if no error
+int setup_backend(RankSlab *slab)
+{
+	if (options.backend == BACKEND_CPU)
+	{
+		cpu_backend = cpu_backend_create(slab->stored_count, slab->Y, slab->fluid_bits, slab->decay_rate,
+										 options.cpu_threads);
+		return cpu_backend == NULL;
+	}
+
+	int rc;
+	char build_options[256];
+	snprintf(build_options, sizeof(build_options), "-D GRID_X=%d -D GRID_Y=%d -D DECAY_RATE=%.17g", slab->stored_count,
+			 slab->Y, slab->decay_rate);
+	program = getCachedProgram("homework.cl", build_options, options.kernel_cache, context, deviceid);
+	kernel = clCreateKernel(program, "temperature_step_lines", &rc);
+	handleError(rc, __LINE__, __FILE__);
+
+	size_t stored_cells = (size_t)slab->stored_count * slab->Y;
+	for (int m = 0; m < 2; m++)
+	{
+		matrix_cl[m] = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(double) * stored_cells, NULL, &rc);
+		handleError(rc, __LINE__, __FILE__);
+		rc = clEnqueueWriteBuffer(commandQueue, matrix_cl[m], CL_FALSE, 0, sizeof(double) * stored_cells,
+								  slab->matrix[m], 0, NULL, NULL);
+		handleError(rc, __LINE__, __FILE__);
+	}
+	size_t mask_bytes = sizeof(uint32_t) * type_mask_words(stored_cells);
+	type_matrix_cl = clCreateBuffer(context, CL_MEM_READ_ONLY, mask_bytes, NULL, &rc);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clEnqueueWriteBuffer(commandQueue, type_matrix_cl, CL_FALSE, 0, mask_bytes, slab->fluid_bits, 0, NULL, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	int dim[2] = {slab->stored_count, slab->Y};
+	dim_cl = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(int) * 2, NULL, &rc);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clEnqueueWriteBuffer(commandQueue, dim_cl, CL_FALSE, 0, sizeof(int) * 2, dim, 0, NULL, NULL);
+	handleError(rc, __LINE__, __FILE__);
+
+	rc = clSetKernelArg(kernel, 1, sizeof(cl_mem), &type_matrix_cl);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(kernel, 2, sizeof(cl_mem), &dim_cl);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(kernel, 4, sizeof(double), &slab->decay_rate);
+	handleError(rc, __LINE__, __FILE__);
+
+	size_t max_work_group_size;
+	rc = clGetKernelWorkGroupInfo(kernel, deviceid, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_work_group_size),
+								  &max_work_group_size, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	local_size_cl = fmin(options.worker_group_size, max_work_group_size);
+	global_size = round_up(options.worker_count, local_size_cl);
+
+	// The host copies of the slab are only used for the ghost lines and the result from now on
+	rc = clFinish(commandQueue);
+	handleError(rc, __LINE__, __FILE__);
+	return 0;
+}
+
+/// @brief Releases the backend of a slab
+void teardown_backend()
+{
+	if (options.backend == BACKEND_CPU)
+	{
+		cpu_backend_destroy(cpu_backend);
+		cpu_backend = NULL;
+		return;
+	}
+	clReleaseMemObject(matrix_cl[0]);
+	clReleaseMemObject(matrix_cl[1]);
+	clReleaseMemObject(type_matrix_cl);
+	clReleaseMemObject(dim_cl);
+	clReleaseKernel(kernel);
+	clReleaseProgram(program);
+}
+
+/// @brief Computes the stored lines [first_line, stop_line) of one iteration from matrix current
+// into the other one, asynchronously for OpenCL
+void step_lines(RankSlab *slab, int current, int first_line, int stop_line)
+{
+	if (stop_line <= first_line)
+		return;
+	if (options.backend == BACKEND_CPU)
+	{
+		cpu_backend_step_lines(cpu_backend, slab->matrix[current], slab->matrix[1 - current], first_line, stop_line);
+		return;
+	}
+
+	int rc;
+	int line_count = stop_line - first_line;
+	rc = clSetKernelArg(kernel, 0, sizeof(cl_mem), &matrix_cl[current]);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(kernel, 3, sizeof(cl_mem), &matrix_cl[1 - current]);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(kernel, 5, sizeof(int), &first_line);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(kernel, 6, sizeof(int), &line_count);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clEnqueueNDRangeKernel(commandQueue, kernel, 1, NULL, &global_size, &local_size_cl, 0, NULL, NULL);
+	handleError(rc, __LINE__, __FILE__);
+}
+
+/// @brief Starts the exchange of the ghost lines of matrix current. OpenCL reads the boundary
+// lines into the host copy of the matrix first, the ghost lines arrive there too
+void begin_exchange(RankSlab *slab, int current)
+{
+	if (options.backend == BACKEND_OPENCL)
+	{
+		int rc;
+		size_t line_bytes = sizeof(double) * slab->Y;
+		size_t halo_bytes = line_bytes * slab->halo;
+		if (slab->above != MPI_PROC_NULL)
+		{
+			size_t offset = line_bytes * slab->ghosts_above;
+			rc = clEnqueueReadBuffer(commandQueue, matrix_cl[current], CL_FALSE, offset, halo_bytes,
+									 (char *)slab->matrix[current] + offset, 0, NULL, NULL);
+			handleError(rc, __LINE__, __FILE__);
+		}
+		if (slab->below != MPI_PROC_NULL)
+		{
+			size_t offset = line_bytes * (slab->ghosts_above + slab->line_count - slab->halo);
+			rc = clEnqueueReadBuffer(commandQueue, matrix_cl[current], CL_FALSE, offset, halo_bytes,
+									 (char *)slab->matrix[current] + offset, 0, NULL, NULL);
+			handleError(rc, __LINE__, __FILE__);
+		}
+		rc = clFinish(commandQueue);
+		handleError(rc, __LINE__, __FILE__);
+	}
+	rank_slab_begin_exchange(slab, slab->matrix[current]);
+}
+
+/// @brief Waits for the ghost lines of matrix current, OpenCL then writes them to the device
+// ahead of the next launches of the queue
+void finish_exchange(RankSlab *slab, int current)
+{
+	rank_slab_finish_exchange(slab);
+	if (options.backend == BACKEND_CPU)
+		return;
+
+	int rc;
+	size_t line_bytes = sizeof(double) * slab->Y;
+	if (slab->ghosts_above > 0)
+	{
+		rc = clEnqueueWriteBuffer(commandQueue, matrix_cl[current], CL_FALSE, 0, line_bytes * slab->ghosts_above,
+								  slab->matrix[current], 0, NULL, NULL);
+		handleError(rc, __LINE__, __FILE__);
+	}
+	if (slab->ghosts_below > 0)
+	{
+		size_t offset = line_bytes * (slab->ghosts_above + slab->line_count);
+		rc = clEnqueueWriteBuffer(commandQueue, matrix_cl[current], CL_FALSE, offset, line_bytes * slab->ghosts_below,
+								  (char *)slab->matrix[current] + offset, 0, NULL, NULL);
+		handleError(rc, __LINE__, __FILE__);
+	}
+}
+
+/// @brief Runs the iterations on the slab. Every halo iterations the ghost lines are exchanged
+// while the first iteration computes the owned lines that do not touch them, the lines next to
+// the ghost lines and the ghost lines themselves follow once they arrived
+/// @param exchange_seconds filled in with the time spent waiting for the ghost lines
+/// @return the matrix holding the result, copied back to the host for OpenCL
+int run_slab(RankSlab *slab, int iterations, double *exchange_seconds)
+{
+	int current = 0;
+	// Stored lines that only depend on owned lines
+	int interior_first = slab->ghosts_above + 1;
+	int interior_stop = fmax(interior_first, slab->ghosts_above + slab->line_count - 1);
+	*exchange_seconds = 0.0;
+
+	for (int done = 0; done < iterations;)
+	{
+		int steps = fmin(slab->halo, iterations - done);
+		// The ghost lines of the input are fresh
+		if (done > 0)
+			begin_exchange(slab, current);
+		step_lines(slab, current, interior_first, interior_stop);
+		if (done > 0)
+		{
+			if (options.backend == BACKEND_OPENCL)
+				clFlush(commandQueue);
+			double start = MPI_Wtime();
+			finish_exchange(slab, current);
+			*exchange_seconds += MPI_Wtime() - start;
+		}
+		step_lines(slab, current, 0, interior_first);
+		step_lines(slab, current, interior_stop, slab->stored_count);
+		current = 1 - current;
+
+		for (int k = 1; k < steps; k++)
+		{
+			step_lines(slab, current, 0, slab->stored_count);
+			current = 1 - current;
+		}
+		done += steps;
+	}
+
+	if (options.backend == BACKEND_OPENCL)
+	{
+		int rc = clEnqueueReadBuffer(commandQueue, matrix_cl[current], CL_TRUE, 0,
+									 sizeof(double) * slab->stored_count * slab->Y, slab->matrix[current], 0, NULL, NULL);
+		handleError(rc, __LINE__, __FILE__);
+	}
+	return current;
+}
+
+/// @brief Loads the input on the ranks of comm and times its iterations, best of the repeated runs
+/// @param replicas copies of the grid stacked over the lines
+/// @param slab_out if not NULL, filled in with the slab and its result matrix in *current_out,
+// to destroy by the caller
+/// @return the slowest rank time of the best run, on every rank
+double timed_run(MPI_Comm comm, int replicas, int repeat, double *exchange_out, RankSlab **slab_out,
+				 int *current_out)
+{
+	double best = 0.0, best_exchange = 0.0;
+	RankSlab *slab = NULL;
+	int current = 0;
+
+	for (int r = 0; r < repeat; r++)
+	{
+		rank_slab_destroy(slab);
+		slab = rank_slab_load(comm, options.input_file, options.halo, replicas);
+		if (slab == NULL || setup_backend(slab))
+		{
+			fail();
+		}
+		int iterations = options.iterations > 0 ? options.iterations : slab->iterations;
+
+		double exchange_seconds;
+		MPI_Barrier(comm);
+		double start = MPI_Wtime();
+		current = run_slab(slab, iterations, &exchange_seconds);
+		double seconds[2] = {MPI_Wtime() - start, exchange_seconds};
+		teardown_backend();
+
+		double slowest[2];
+		MPI_Allreduce(seconds, slowest, 2, MPI_DOUBLE, MPI_MAX, comm);
+		if (r == 0 || slowest[0] < best)
+		{
+			best = slowest[0];
+			best_exchange = slowest[1];
+		}
+	}
+	if (exchange_out != NULL)
+		*exchange_out = best_exchange;
+	if (slab_out != NULL)
+	{
+		*slab_out = slab;
+		*current_out = current;
+	}
+	else
+		rank_slab_destroy(slab);
+	return best;
+}
+
+/// @brief Writes the scaling series as a flat JSON object, one member per line
+/// @return 1 if error, 0 if no error
+int write_report(FILE *report_fptr, ScalingSeries *series)
+{
+	double updates = (double)series->dim[0] * series->dim[1] * series->iterations;
+
+	fprintf(report_fptr, "{\n");
+	fprintf(report_fptr, "  \"backend\": \"%s\",\n", options.backend == BACKEND_CPU ? "cpu" : "opencl");
+	fprintf(report_fptr, "  \"lines\": %d,\n", series->dim[0]);
+	fprintf(report_fptr, "  \"columns\": %d,\n", series->dim[1]);
+	fprintf(report_fptr, "  \"iterations\": %d,\n", series->iterations);
+	fprintf(report_fptr, "  \"halo\": %d,\n", options.halo);
+	for (int s = 0; s < series->run_count; s++)
+	{
+		int ranks = series->rank_counts[s];
+		// Strong scaling: the same grid over more ranks, weak scaling: one grid per rank
+		double speedup = series->strong_seconds[0] / series->strong_seconds[s];
+		double weak_efficiency = series->weak_seconds[0] / series->weak_seconds[s];
+		fprintf(report_fptr, "  \"strong_%d_s\": %.9f,\n", ranks, series->strong_seconds[s]);
+		fprintf(report_fptr, "  \"strong_%d_speedup\": %.6f,\n", ranks, speedup);
+		fprintf(report_fptr, "  \"strong_%d_efficiency\": %.6f,\n", ranks, speedup / ranks);
+		fprintf(report_fptr, "  \"weak_%d_s\": %.9f,\n", ranks, series->weak_seconds[s]);
+		fprintf(report_fptr, "  \"weak_%d_cells_per_second\": %.6e,\n", ranks, updates * ranks / series->weak_seconds[s]);
+		fprintf(report_fptr, "  \"weak_%d_efficiency\": %.6f%s\n", ranks, weak_efficiency,
+				s == series->run_count - 1 ? "" : ",");
+	}
+	fprintf(report_fptr, "}\n");
+	return ferror(report_fptr) != 0;
+}
+
+/// @brief Times the grid on 1, 2, 4... ranks up to all of them, as it is (strong scaling) and
+// stacked once per rank (weak scaling). The ranks left out of a run wait for it
+/// @return 1 if error, 0 if no error
+int run_scaling()
+{
+	ScalingSeries series;
+	memset(&series, 0, sizeof(series));
+	for (int ranks = 1; series.run_count < MAX_SCALING_RUNS; ranks *= 2)
+	{
+		if (ranks > world_size)
+			ranks = world_size;
+		series.rank_counts[series.run_count++] = ranks;
+		if (ranks == world_size)
+			break;
+	}
+
+	for (int s = 0; s < series.run_count; s++)
+	{
+		MPI_Comm comm;
+		MPI_Comm_split(MPI_COMM_WORLD, world_rank < series.rank_counts[s] ? 0 : MPI_UNDEFINED, world_rank, &comm);
+		if (comm != MPI_COMM_NULL)
+		{
+			RankSlab *slab;
+			int current;
+			series.strong_seconds[s] = timed_run(comm, 1, options.repeat, NULL, &slab, &current);
+			series.dim[0] = slab->X;
+			series.dim[1] = slab->Y;
+			series.iterations = options.iterations > 0 ? options.iterations : slab->iterations;
+			rank_slab_destroy(slab);
+			series.weak_seconds[s] = timed_run(comm, series.rank_counts[s], options.repeat, NULL, NULL, NULL);
+			MPI_Comm_free(&comm);
+		}
+		MPI_Barrier(MPI_COMM_WORLD);
+	}
+
+	// Rank 0 takes part in every run
+	if (world_rank != 0)
+		return 0;
+	if (write_report(stdout, &series))
+	{
+		perror("Error writing the report\n");
+		return 1;
+	}
+	if (options.report_file != NULL)
+	{
+		FILE *report_fptr = fopen(options.report_file, "w");
+		if (report_fptr == NULL || write_report(report_fptr, &series) || fclose(report_fptr) != 0)
+		{
+			perror("Error writing the report file!\n");
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/// @brief Runs the grid once over all the ranks and stores the result
+/// @return 1 if error, 0 if no error
+int run_once()
+{
+	RankSlab *slab;
+	int current;
+	double exchange_seconds;
+	double seconds = timed_run(MPI_COMM_WORLD, 1, 1, &exchange_seconds, &slab, &current);
+	int iterations = options.iterations > 0 ? options.iterations : slab->iterations;
+
+	if (world_rank == 0)
+		printf("%d ranks, %d iterations of %dx%d in %.6f s, %.6e cells per second, up to %.6f s waiting for ghost lines\n",
+			   world_size, iterations, slab->X, slab->Y, seconds, (double)slab->X * slab->Y * iterations / seconds,
+			   exchange_seconds);
+
+	int rc = 0;
+	if (options.output_file != NULL)
+		rc = rank_slab_write(slab, slab->matrix[current], options.output_file);
+	rank_slab_destroy(slab);
+	return rc;
+}
+
+/// @brief Parses the command line, every rank gets the same options and only rank 0 complains
+/// @return 1 if error, 0 if no error
+int get_args(int argc, char **argv)
+{
+	options.input_file = NULL;
+	options.output_file = NULL;
+	options.iterations = 0;
+	options.backend = BACKEND_CPU;
+	options.cpu_threads = 0;
+	options.worker_count = 1024;
+	options.worker_group_size = 64;
+	options.halo = 1;
+	options.kernel_cache = ".kernel_cache";
+	options.scaling = 0;
+	options.repeat = 3;
+	options.report_file = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strncmp(argv[i], "--iterations=", 13) == 0)
+			options.iterations = atoi(argv[i] + 13);
+		else if (strcmp(argv[i], "--backend=opencl") == 0)
+			options.backend = BACKEND_OPENCL;
+		else if (strcmp(argv[i], "--backend=cpu") == 0)
+			options.backend = BACKEND_CPU;
+		else if (strncmp(argv[i], "--threads=", 10) == 0)
+			options.cpu_threads = atoi(argv[i] + 10);
+		else if (strncmp(argv[i], "--workers=", 10) == 0)
+			options.worker_count = atoi(argv[i] + 10);
+		else if (strncmp(argv[i], "--group=", 8) == 0)
+			options.worker_group_size = atoi(argv[i] + 8);
+		else if (strncmp(argv[i], "--halo=", 7) == 0)
+			options.halo = atoi(argv[i] + 7);
+		else if (strncmp(argv[i], "--kernel-cache=", 15) == 0)
+			options.kernel_cache = argv[i] + 15;
+		else if (strcmp(argv[i], "--no-kernel-cache") == 0)
+			options.kernel_cache = NULL;
+		else if (strcmp(argv[i], "--scaling") == 0)
+			options.scaling = 1;
+		else if (strncmp(argv[i], "--repeat=", 9) == 0)
+			options.repeat = atoi(argv[i] + 9);
+		else if (strncmp(argv[i], "--report=", 9) == 0)
+			options.report_file = argv[i] + 9;
+		else if (argv[i][0] != '-' && options.input_file == NULL)
+			options.input_file = argv[i];
+		else if (argv[i][0] != '-' && options.output_file == NULL)
+			options.output_file = argv[i];
+		else
+		{
+			if (world_rank == 0)
+			{
+				fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+				fprintf(stderr, "Usage: mpirun -np N ./distributed input_file [output_file] [--iterations=N] "
+								"[--backend=cpu|opencl] [--threads=N] [--workers=N] [--group=N] [--halo=H] "
+								"[--kernel-cache=dir] [--no-kernel-cache] [--scaling] [--repeat=N] [--report=file]\n");
+			}
+			return 1;
+		}
+	}
+	if (options.input_file == NULL)
+	{
+		if (world_rank == 0)
+			fprintf(stderr, "Usage: mpirun -np N ./distributed input_file [output_file] [options]\n");
+		return 1;
+	}
+	if (options.iterations < 0 || options.halo < 1 || options.repeat < 1 || options.worker_count < 1 ||
+		options.worker_group_size < 1)
+	{
+		if (world_rank == 0)
+			fprintf(stderr, "Iterations cannot be negative, the halo, repeats and worker sizes must be positive\n");
+		return 1;
+	}
+	// The local ranks share the cores of the host
+	if (options.cpu_threads == 0)
+		options.cpu_threads = fmax(1, cpu_core_count() / local_size);
+	return 0;
+}
+
+/// @brief Runs the simulation over the ranks of an MPI job, each rank computing a row slab of the
+// grid with the CPU backend or an OpenCL device, or measures how it scales with the rank count
+int main(int argc, char **argv)
+{
+	MPI_Init(&argc, &argv);
+	MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+	MPI_Comm local_comm;
+	MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, world_rank, MPI_INFO_NULL, &local_comm);
+	MPI_Comm_rank(local_comm, &local_rank);
+	MPI_Comm_size(local_comm, &local_size);
+	MPI_Comm_free(&local_comm);
+
+	if (get_args(argc, argv))
+	{
+		MPI_Finalize();
+		return -1;
+	}
+	if (options.backend == BACKEND_OPENCL)
+		init_device();
+
+	int rc = options.scaling ? run_scaling() : run_once();
+
+	if (options.backend == BACKEND_OPENCL)
+	{
+		clReleaseCommandQueue(commandQueue);
+		clReleaseContext(context);
+	}
+	MPI_Finalize();
+	return rc ? 1 : 0;
+}
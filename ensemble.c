@@ -0,0 +1,607 @@
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "_CPUBackend.h"
+#include "_GridIO.h"
+#include "_OpenCLUtil.h"
+#include "_Precision.h"
+#include "_TypeMask.h"
+
+#define DEFAULT_DECAY_RATE 0.02
+
+#define BACKEND_OPENCL 0
+#define BACKEND_CPU 1
+
+// Longest line of the scenario file
+#define SCENARIO_LINE_LENGTH 4096
+
+/* Ensemble configuration, parsed from the command line */
+typedef struct EnsembleOptions
+{
+	// Grid whose cell types every scenario shares, also the default initial temperatures
+	char *geometry_file;
+	char *scenario_file;
+	// Iterations to run, 0 for those of the geometry file
+	int iterations;
+	int backend;
+	int cpu_threads;
+	size_t worker_count, worker_group_size;
+	// Scenarios computed by a single launch, 0 for as many as the device memory holds
+	int batch;
+	// Directory of the compiled kernels, NULL to compile homework.cl every time
+	char *kernel_cache;
+	// Precision of the matrices on the device, PRECISION_FP64, PRECISION_FP32 or PRECISION_FP16
+	int precision;
+	// Check every scenario against the CPU backend
+	int validate;
+} EnsembleOptions;
+
+/* One run of the ensemble, a line of the scenario file */
+typedef struct Scenario
+{
+	char *output_file;
+	double decay_rate;
+	// Initial temperatures, those of the geometry file unless the scenario names its own grid
+	double *initial_matrix;
+} Scenario;
+
+EnsembleOptions options;
+
+/* Shared geometry */
+int dim[2];
+int total_size;
+int iterations;
+char *type_matrix;
+// Fluid mask of type_matrix, see _TypeMask.h
+uint32_t *fluid_bits;
+double *geometry_matrix;
+
+int scenario_count;
+Scenario *scenarios;
+
+/* OpenCL stuff */
+cl_context context;
+cl_command_queue commandQueue;
+cl_device_id deviceid;
+cl_program program;
+cl_kernel kernel;
+
+/// @brief Returns a monotonic time in seconds
+double now_seconds()
+{
+#ifdef _WIN32
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (double)counter.QuadPart / frequency.QuadPart;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+#endif
+}
+
+/// @brief Rounds value up to a multiple of step
+size_t round_up(size_t value, size_t step)
+{
+	return (value + step - 1) / step * step;
+}
+
+/// @brief Loads a grid file in either format into host memory, binary files are copied out of
+// their mapping and converted to double
+/// @param grid_dim filled in with the dimensions
+/// @param grid_iterations filled in with the iterations of the file
+/// @param decay_rate filled in with the decay rate of the file, DEFAULT_DECAY_RATE for text files
+/// @param temperature allocated and filled in with the temperatures
+/// @param type allocated and filled in with the cell types
+/// @return 1 if error, 0 if no error
+int load_grid(char *file_name, int *grid_dim, int *grid_iterations, double *decay_rate, double **temperature,
+			  char **type)
+{
+	if (!grid_is_binary(file_name))
+	{
+		*decay_rate = DEFAULT_DECAY_RATE;
+		return grid_read_text(file_name, grid_dim, grid_iterations, temperature, type);
+	}
+
+	GridMapping *mapping = grid_map_binary(file_name);
+	if (mapping == NULL)
+	{
+		return 1;
+	}
+	grid_dim[0] = mapping->header->dim[0];
+	grid_dim[1] = mapping->header->dim[1];
+	*grid_iterations = mapping->header->iterations;
+	*decay_rate = mapping->header->decay_rate;
+	size_t cell_count = (size_t)grid_dim[0] * grid_dim[1];
+	*temperature = (double *)malloc(sizeof(double) * cell_count);
+	*type = (char *)malloc(sizeof(char) * cell_count);
+	if (*temperature == NULL || *type == NULL)
+	{
+		perror("Error allocating memory for the grid\n");
+		grid_unmap(mapping);
+		return 1;
+	}
+	precision_unpack(mapping->header->dtype, mapping->temperature, *temperature, cell_count);
+	memcpy(*type, mapping->type, sizeof(char) * cell_count);
+	grid_unmap(mapping);
+	return 0;
+}
+
+/// @brief Reads the scenario file: one scenario per line, its output file, its decay rate and
+// optionally a grid holding its initial temperatures, with the cell types of the geometry.
+// Blank lines and lines starting with '#' are skipped
+/// @return 1 if error, 0 if no error
+int load_scenarios()
+{
+	FILE *fptr = fopen(options.scenario_file, "r");
+	if (fptr == NULL)
+	{
+		perror("Error opening the scenario file!\n");
+		return 1;
+	}
+
+	int capacity = 16;
+	scenarios = (Scenario *)malloc(sizeof(Scenario) * capacity);
+	if (scenarios == NULL)
+	{
+		perror("Error allocating memory for 'scenarios'\n");
+		fclose(fptr);
+		return 1;
+	}
+
+	char line[SCENARIO_LINE_LENGTH];
+	int line_number = 0;
+	while (fgets(line, sizeof(line), fptr) != NULL)
+	{
+		line_number++;
+		char output_file[SCENARIO_LINE_LENGTH], initial_file[SCENARIO_LINE_LENGTH];
+		double decay_rate;
+		int fields = sscanf(line, "%s %lf %s", output_file, &decay_rate, initial_file);
+		if (fields <= 0 || output_file[0] == '#')
+			continue;
+		if (fields < 2 || decay_rate < 0 || decay_rate > 1)
+		{
+			fprintf(stderr, "Line %d of %s: expected 'output_file decay_rate [initial_file]' with a decay rate in [0, 1]\n",
+					line_number, options.scenario_file);
+			fclose(fptr);
+			return 1;
+		}
+
+		if (scenario_count == capacity)
+		{
+			capacity *= 2;
+			Scenario *grown = (Scenario *)realloc(scenarios, sizeof(Scenario) * capacity);
+			if (grown == NULL)
+			{
+				perror("Error allocating memory for 'scenarios'\n");
+				fclose(fptr);
+				return 1;
+			}
+			scenarios = grown;
+		}
+		Scenario *scenario = &scenarios[scenario_count];
+		scenario->output_file = strdup(output_file);
+		scenario->decay_rate = decay_rate;
+		scenario->initial_matrix = geometry_matrix;
+		if (fields == 3)
+		{
+			int initial_dim[2], initial_iterations;
+			double initial_decay_rate;
+			char *initial_type;
+			if (load_grid(initial_file, initial_dim, &initial_iterations, &initial_decay_rate,
+						  &scenario->initial_matrix, &initial_type))
+			{
+				fclose(fptr);
+				return 1;
+			}
+			int mismatch = initial_dim[0] != dim[0] || initial_dim[1] != dim[1] ||
+						   memcmp(initial_type, type_matrix, sizeof(char) * total_size) != 0;
+			free(initial_type);
+			if (mismatch)
+			{
+				fprintf(stderr, "Line %d of %s: %s does not have the geometry of %s\n", line_number,
+						options.scenario_file, initial_file, options.geometry_file);
+				fclose(fptr);
+				return 1;
+			}
+		}
+		scenario_count++;
+	}
+	fclose(fptr);
+
+	if (scenario_count == 0)
+	{
+		fprintf(stderr, "No scenario in %s\n", options.scenario_file);
+		return 1;
+	}
+	return 0;
+}
+
+/// @brief Writes the result of a scenario, in the binary format if its name ends with
+// GRID_EXTENSION like homework does
+/// @return 1 if error, 0 if no error
+int write_scenario(Scenario *scenario, double *result)
+{
+	if (grid_has_binary_extension(scenario->output_file))
+		return grid_write_binary(scenario->output_file, dim, iterations, scenario->decay_rate, result, type_matrix,
+								 options.precision);
+	return grid_write_text(scenario->output_file, dim, result, type_matrix, -1);
+}
+
+/// @brief Runs the iterations of one scenario with the CPU backend
+/// @param result filled in with the final temperatures
+/// @return 1 if error, 0 if no error
+int run_cpu_scenario(Scenario *scenario, double *result)
+{
+	CPUBackend *backend = cpu_backend_create(dim[0], dim[1], fluid_bits, scenario->decay_rate, options.cpu_threads);
+	double *other_matrix = (double *)malloc(sizeof(double) * total_size);
+	if (backend == NULL || other_matrix == NULL)
+	{
+		perror("Error creating the CPU backend of a scenario\n");
+		cpu_backend_destroy(backend);
+		free(other_matrix);
+		return 1;
+	}
+	memcpy(result, scenario->initial_matrix, sizeof(double) * total_size);
+	memcpy(other_matrix, scenario->initial_matrix, sizeof(double) * total_size);
+
+	double *src_matrix = result;
+	double *dst_matrix = other_matrix;
+	for (int iteration = 0; iteration < iterations; iteration++)
+	{
+		cpu_backend_step(backend, src_matrix, dst_matrix);
+		double *swap_matrix = src_matrix;
+		src_matrix = dst_matrix;
+		dst_matrix = swap_matrix;
+	}
+	if (src_matrix != result)
+		memcpy(result, src_matrix, sizeof(double) * total_size);
+	cpu_backend_destroy(backend);
+	free(other_matrix);
+	return 0;
+}
+
+/// @brief Runs the scenarios one after the other with the CPU backend
+/// @return 1 if error, 0 if no error
+int run_cpu()
+{
+	double *result = (double *)malloc(sizeof(double) * total_size);
+	if (result == NULL)
+	{
+		perror("Error allocating memory for 'result'\n");
+		return 1;
+	}
+	double start = now_seconds();
+	for (int s = 0; s < scenario_count; s++)
+	{
+		if (run_cpu_scenario(&scenarios[s], result) || write_scenario(&scenarios[s], result))
+		{
+			free(result);
+			return 1;
+		}
+	}
+	double seconds = now_seconds() - start;
+	printf("%d scenarios of %dx%d, %d iterations on the CPU backend in %.6f s, %.6e cell updates per second\n",
+		   scenario_count, dim[0], dim[1], iterations, seconds, (double)scenario_count * total_size * iterations / seconds);
+	free(result);
+	return 0;
+}
+
+/// @brief Compares the result of a scenario with the CPU backend in fp64
+/// @return 1 if they differ by more than the tolerance of the precision, 0 if they match
+int validate_scenario(Scenario *scenario, double *result, double *reference)
+{
+	if (run_cpu_scenario(scenario, reference))
+	{
+		return 1;
+	}
+	PrecisionError error;
+	precision_compare(reference, result, fluid_bits, total_size, &error);
+	double tolerance = CPU_BACKEND_TOLERANCE;
+	if (options.precision == PRECISION_FP32)
+		tolerance = PRECISION_FP32_TOLERANCE;
+	else if (options.precision == PRECISION_FP16)
+		tolerance = PRECISION_FP16_TOLERANCE;
+
+	int mismatch = error.max_error > tolerance * error.scale;
+	if (mismatch)
+		fprintf(stderr, "Scenario %s differs from the CPU backend: max error %e, tolerance %e\n", scenario->output_file,
+				error.max_error, tolerance * error.scale);
+	return mismatch;
+}
+
+/// @brief Returns the number of scenarios a launch covers: the requested batch, bounded by the
+// largest buffer the device allocates and by the int indices of the kernel
+int batch_capacity(size_t cell_bytes)
+{
+	int rc;
+	cl_ulong max_alloc_size;
+	rc = clGetDeviceInfo(deviceid, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc_size), &max_alloc_size, NULL);
+	handleError(rc, __LINE__, __FILE__);
+
+	long capacity = options.batch > 0 ? options.batch : scenario_count;
+	capacity = fmin(capacity, scenario_count);
+	capacity = fmin(capacity, max_alloc_size / (cell_bytes * total_size));
+	capacity = fmin(capacity, INT_MAX / total_size);
+	return capacity > 0 ? (int)capacity : 1;
+}
+
+/// @brief Runs the scenarios in batches on the OpenCL device: the matrices of a batch are
+// stacked in a single pair of buffers and every step is a single launch over all of them
+/// @return 1 if error, 0 if no error
+int run_opencl()
+{
+	int rc;
+	size_t cell_bytes = precision_cell_bytes(options.precision);
+	size_t real_bytes = precision_real_bytes(options.precision);
+	int capacity = batch_capacity(cell_bytes);
+	size_t batch_bytes = cell_bytes * total_size * capacity;
+
+	// Stacked matrices of a batch in double and in the device precision, decay rates as reals
+	double *batch_matrix = (double *)malloc(sizeof(double) * total_size * capacity);
+	void *batch_cells = options.precision == PRECISION_FP64 ? (void *)batch_matrix : malloc(batch_bytes);
+	void *decay_rates = malloc(real_bytes * capacity);
+	double *reference = options.validate ? (double *)malloc(sizeof(double) * total_size) : NULL;
+	if (batch_matrix == NULL || batch_cells == NULL || decay_rates == NULL || (options.validate && reference == NULL))
+	{
+		perror("Error allocating memory for the batch\n");
+		return 1;
+	}
+
+	cl_mem matrix_cl[2];
+	for (int m = 0; m < 2; m++)
+	{
+		matrix_cl[m] = clCreateBuffer(context, CL_MEM_READ_WRITE, batch_bytes, NULL, &rc);
+		handleError(rc, __LINE__, __FILE__);
+	}
+	cl_mem type_matrix_cl = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(uint32_t) * type_mask_words(total_size), NULL, &rc);
+	handleError(rc, __LINE__, __FILE__);
+	cl_mem dim_cl = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(int) * 2, NULL, &rc);
+	handleError(rc, __LINE__, __FILE__);
+	cl_mem decay_rates_cl = clCreateBuffer(context, CL_MEM_READ_ONLY, real_bytes * capacity, NULL, &rc);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clEnqueueWriteBuffer(commandQueue, type_matrix_cl, CL_FALSE, 0, sizeof(uint32_t) * type_mask_words(total_size), fluid_bits, 0, NULL, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clEnqueueWriteBuffer(commandQueue, dim_cl, CL_FALSE, 0, sizeof(int) * 2, dim, 0, NULL, NULL);
+	handleError(rc, __LINE__, __FILE__);
+
+	rc = clSetKernelArg(kernel, 1, sizeof(cl_mem), &type_matrix_cl);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(kernel, 2, sizeof(cl_mem), &dim_cl);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(kernel, 4, sizeof(cl_mem), &decay_rates_cl);
+	handleError(rc, __LINE__, __FILE__);
+
+	size_t max_work_group_size;
+	rc = clGetKernelWorkGroupInfo(kernel, deviceid, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_work_group_size), &max_work_group_size, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	size_t local_size = fmin(options.worker_group_size, max_work_group_size);
+
+	int mismatches = 0;
+	double start = now_seconds();
+	for (int first = 0; first < scenario_count; first += capacity)
+	{
+		int batch_count = fmin(capacity, scenario_count - first);
+		size_t cell_count = (size_t)total_size * batch_count;
+		for (int b = 0; b < batch_count; b++)
+		{
+			Scenario *scenario = &scenarios[first + b];
+			memcpy(batch_matrix + (size_t)b * total_size, scenario->initial_matrix, sizeof(double) * total_size);
+			if (real_bytes == sizeof(float))
+				((float *)decay_rates)[b] = (float)scenario->decay_rate;
+			else
+				((double *)decay_rates)[b] = scenario->decay_rate;
+		}
+		precision_pack(options.precision, batch_matrix, batch_cells, cell_count);
+
+		// Both matrices start equal, the kernel never writes the non-fluid cells
+		for (int m = 0; m < 2; m++)
+		{
+			rc = clEnqueueWriteBuffer(commandQueue, matrix_cl[m], CL_FALSE, 0, cell_bytes * cell_count, batch_cells, 0, NULL, NULL);
+			handleError(rc, __LINE__, __FILE__);
+		}
+		rc = clEnqueueWriteBuffer(commandQueue, decay_rates_cl, CL_FALSE, 0, real_bytes * batch_count, decay_rates, 0, NULL, NULL);
+		handleError(rc, __LINE__, __FILE__);
+		rc = clSetKernelArg(kernel, 5, sizeof(int), &batch_count);
+		handleError(rc, __LINE__, __FILE__);
+
+		// The worker count is per scenario, the batch gets as many per scenario
+		size_t global_size = round_up(fmin(options.worker_count * batch_count, cell_count), local_size);
+		int current = 0;
+		for (int iteration = 0; iteration < iterations; iteration++)
+		{
+			rc = clSetKernelArg(kernel, 0, sizeof(cl_mem), &matrix_cl[current]);
+			handleError(rc, __LINE__, __FILE__);
+			rc = clSetKernelArg(kernel, 3, sizeof(cl_mem), &matrix_cl[1 - current]);
+			handleError(rc, __LINE__, __FILE__);
+			rc = clEnqueueNDRangeKernel(commandQueue, kernel, 1, NULL, &global_size, &local_size, 0, NULL, NULL);
+			handleError(rc, __LINE__, __FILE__);
+			current = 1 - current;
+		}
+
+		rc = clEnqueueReadBuffer(commandQueue, matrix_cl[current], CL_TRUE, 0, cell_bytes * cell_count, batch_cells, 0, NULL, NULL);
+		handleError(rc, __LINE__, __FILE__);
+		precision_unpack(options.precision, batch_cells, batch_matrix, cell_count);
+		for (int b = 0; b < batch_count; b++)
+		{
+			double *result = batch_matrix + (size_t)b * total_size;
+			if (write_scenario(&scenarios[first + b], result))
+			{
+				return 1;
+			}
+			if (options.validate)
+				mismatches += validate_scenario(&scenarios[first + b], result, reference);
+		}
+	}
+	double seconds = now_seconds() - start;
+	printf("%d scenarios of %dx%d in batches of %d, %d iterations in %.6f s, %.6e cell updates per second\n",
+		   scenario_count, dim[0], dim[1], capacity, iterations, seconds,
+		   (double)scenario_count * total_size * iterations / seconds);
+	if (options.validate)
+		printf("Validation against the CPU backend in fp64: %d of %d scenarios passed%s\n", scenario_count - mismatches,
+			   scenario_count, mismatches ? ", FAILED" : "");
+
+	clReleaseMemObject(matrix_cl[0]);
+	clReleaseMemObject(matrix_cl[1]);
+	clReleaseMemObject(type_matrix_cl);
+	clReleaseMemObject(dim_cl);
+	clReleaseMemObject(decay_rates_cl);
+	if (batch_cells != batch_matrix)
+		free(batch_cells);
+	free(batch_matrix);
+	free(decay_rates);
+	free(reference);
+	return mismatches > 0;
+}
+
+/// @brief Parses the command line
+/// @return 1 if error, 0 if no error
+int get_args(int argc, char **argv)
+{
+	options.geometry_file = NULL;
+	options.scenario_file = NULL;
+	options.iterations = 0;
+	options.backend = BACKEND_OPENCL;
+	options.cpu_threads = 0;
+	options.worker_count = 1024;
+	options.worker_group_size = 64;
+	options.batch = 0;
+	options.kernel_cache = ".kernel_cache";
+	options.precision = PRECISION_FP64;
+	options.validate = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strncmp(argv[i], "--iterations=", 13) == 0)
+			options.iterations = atoi(argv[i] + 13);
+		else if (strcmp(argv[i], "--backend=opencl") == 0)
+			options.backend = BACKEND_OPENCL;
+		else if (strcmp(argv[i], "--backend=cpu") == 0)
+			options.backend = BACKEND_CPU;
+		else if (strncmp(argv[i], "--threads=", 10) == 0)
+			options.cpu_threads = atoi(argv[i] + 10);
+		else if (strncmp(argv[i], "--workers=", 10) == 0)
+			options.worker_count = atoi(argv[i] + 10);
+		else if (strncmp(argv[i], "--group=", 8) == 0)
+			options.worker_group_size = atoi(argv[i] + 8);
+		else if (strncmp(argv[i], "--batch=", 8) == 0)
+			options.batch = atoi(argv[i] + 8);
+		else if (strncmp(argv[i], "--kernel-cache=", 15) == 0)
+			options.kernel_cache = argv[i] + 15;
+		else if (strcmp(argv[i], "--no-kernel-cache") == 0)
+			options.kernel_cache = NULL;
+		else if (strncmp(argv[i], "--precision=", 12) == 0)
+		{
+			options.precision = precision_parse(argv[i] + 12);
+			if (options.precision < 0)
+			{
+				fprintf(stderr, "Unknown precision '%s', expected fp64, fp32 or fp16\n", argv[i] + 12);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--validate") == 0)
+			options.validate = 1;
+		else if (argv[i][0] != '-' && options.geometry_file == NULL)
+			options.geometry_file = argv[i];
+		else if (argv[i][0] != '-' && options.scenario_file == NULL)
+			options.scenario_file = argv[i];
+		else
+		{
+			fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+			fprintf(stderr, "Usage: ./ensemble geometry_file scenario_file [--iterations=N] [--backend=opencl|cpu] "
+							"[--threads=N] [--workers=N] [--group=N] [--batch=N] [--kernel-cache=dir] [--no-kernel-cache] "
+							"[--precision=fp64|fp32|fp16] [--validate]\n");
+			return 1;
+		}
+	}
+	if (options.scenario_file == NULL)
+	{
+		fprintf(stderr, "Usage: ./ensemble geometry_file scenario_file [options]\n");
+		return 1;
+	}
+	if (options.iterations < 0 || options.batch < 0 || options.worker_count < 1 || options.worker_group_size < 1)
+	{
+		fprintf(stderr, "Iterations and batch sizes cannot be negative, the worker sizes must be positive\n");
+		return 1;
+	}
+	if (options.backend == BACKEND_CPU && options.precision != PRECISION_FP64)
+	{
+		fprintf(stderr, "The CPU backend only runs in fp64\n");
+		return 1;
+	}
+	return 0;
+}
+
+/// @brief Runs a batch of scenarios sharing the cell types of one grid, each with its own decay
+// rate and initial temperatures, in a single process and with a single launch per step
+int main(int argc, char **argv)
+{
+	if (get_args(argc, argv))
+	{
+		return -1;
+	}
+
+	double decay_rate;
+	if (load_grid(options.geometry_file, dim, &iterations, &decay_rate, &geometry_matrix, &type_matrix))
+	{
+		return -1;
+	}
+	total_size = dim[0] * dim[1];
+	fluid_bits = (uint32_t *)malloc(sizeof(uint32_t) * type_mask_words(total_size));
+	if (fluid_bits == NULL)
+	{
+		perror("Error allocating memory for the fluid mask\n");
+		return -1;
+	}
+	type_mask_pack_bits(type_matrix, total_size, fluid_bits);
+	if (options.iterations > 0)
+		iterations = options.iterations;
+	if (load_scenarios())
+	{
+		return -1;
+	}
+
+	int rc;
+	if (options.backend == BACKEND_CPU)
+		rc = run_cpu();
+	else
+	{
+		// The decay rates vary between the scenarios, only the grid size is compiled in
+		deviceid = initOpenCL(&context, &commandQueue);
+		char build_options[256];
+		snprintf(build_options, sizeof(build_options), "%s -D GRID_X=%d -D GRID_Y=%d",
+				 precision_build_option(options.precision), dim[0], dim[1]);
+		program = getCachedProgram("homework.cl", build_options, options.kernel_cache, context, deviceid);
+		kernel = clCreateKernel(program, "temperature_step_batch", &rc);
+		handleError(rc, __LINE__, __FILE__);
+
+		rc = run_opencl();
+
+		clReleaseKernel(kernel);
+		clReleaseProgram(program);
+		clReleaseCommandQueue(commandQueue);
+		clReleaseContext(context);
+	}
+
+	for (int s = 0; s < scenario_count; s++)
+	{
+		free(scenarios[s].output_file);
+		if (scenarios[s].initial_matrix != geometry_matrix)
+			free(scenarios[s].initial_matrix);
+	}
+	free(scenarios);
+	free(geometry_matrix);
+	free(type_matrix);
+	free(fluid_bits);
+	return rc ? 1 : 0;
+}
@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "_GridIO.h"
+
+#define DEFAULT_DECAY_RATE 0.02
+
+/// @brief Converts a text grid to the binary format or a binary grid back to text, the
+// direction is given by the format of the input
+int main(int argc, char **argv)
+{
+	double decay_rate = DEFAULT_DECAY_RATE;
+	int dtype = GRID_DTYPE_F64;
+
+	int usage_error = argc < 3;
+	for (int i = 3; i < argc && !usage_error; i++)
+	{
+		if (strncmp(argv[i], "--decay=", 8) == 0)
+			decay_rate = atof(argv[i] + 8);
+		else if (strncmp(argv[i], "--precision=", 12) == 0)
+		{
+			dtype = precision_parse(argv[i] + 12);
+			usage_error = dtype < 0;
+		}
+		else
+			usage_error = 1;
+	}
+	if (usage_error)
+	{
+		fprintf(stderr, "Usage: ./gridconvert input_file output_file [--decay=rate] [--precision=fp64|fp32|fp16]\n");
+		fprintf(stderr, "Text inputs are written in the binary format with the given decay rate (%g by default) and "
+						"precision (fp64 by default), binary inputs are written as text\n",
+				DEFAULT_DECAY_RATE);
+		return -1;
+	}
+
+	if (grid_is_binary(argv[1]))
+	{
+		GridMapping *mapping = grid_map_binary(argv[1]);
+		if (mapping == NULL)
+		{
+			return -1;
+		}
+		int dim[2] = {mapping->header->dim[0], mapping->header->dim[1]};
+		size_t cells = (size_t)dim[0] * dim[1];
+		double *temperature = (double *)malloc(sizeof(double) * cells);
+		if (temperature == NULL)
+		{
+			perror("Error allocating memory for the temperatures\n");
+			grid_unmap(mapping);
+			return -1;
+		}
+		precision_unpack(mapping->header->dtype, mapping->temperature, temperature, cells);
+		int rc = grid_write_text(argv[2], dim, temperature, mapping->type, mapping->header->iterations);
+		free(temperature);
+		grid_unmap(mapping);
+		return rc ? -1 : 0;
+	}
+
+	int dim[2], iterations = 0;
+	double *temperature;
+	char *type;
+	if (grid_read_text(argv[1], dim, &iterations, &temperature, &type))
+	{
+		return -1;
+	}
+	int rc = grid_write_binary(argv[2], dim, iterations, decay_rate, temperature, type, dtype);
+	free(temperature);
+	free(type);
+	return rc ? -1 : 0;
+}
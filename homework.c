@@ -4,7 +4,20 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "_ActiveTiles.h"
+#include "_Autotune.h"
+#include "_CPUBackend.h"
+#include "_Checkpoint.h"
+#include "_Decomposition.h"
+#include "_FluidIndex.h"
+#include "_GridIO.h"
 #include "_OpenCLUtil.h"
+#include "_Precision.h"
+#include "_Renderer.h"
+#include "_Snapshot.h"
+#include "_Statistics.h"
+#include "_Streaming.h"
+#include "_TypeMask.h"
 
 static unsigned int dbg_counter = 0;
 #define DEBUG_PRINT(dbg_message)                                                   \
@@ -13,13 +26,17 @@ static unsigned int dbg_counter = 0;
 		dbg_counter++;                                                             \
 	}
 
-#define VERY_HOT 3	 // RED
-#define HOT 2		 // ORANGE
-#define WARM 1		 // YELLOW
-#define NEUTRAL 0	 // GRAY
-#define CHILLY -1	 // CYAN
-#define COLD -2		 // BLUE
-#define VERY_COLD -3 // PURPLE
+// Decay rate of text inputs, binary inputs store their own
+#define DEFAULT_DECAY_RATE 0.02
+
+#define BACKEND_OPENCL 0
+#define BACKEND_CPU 1
+
+#define KERNEL_LINEAR 0 // temperature_step, 1D range striding over the cells
+#define KERNEL_TILED 1	// temperature_step_tiled, 2D range with local memory tiles
+#define KERNEL_TEMPORAL 2 // temperature_step_temporal, several iterations per launch
+#define KERNEL_SPARSE 3	  // temperature_step_sparse, over the list of fluid cells only
+#define KERNEL_ACTIVE 4	  // temperature_step_active, over the tiles that still change only
 
 /* Matrix struct for program */
 typedef struct FluidComputingMatrix
@@ -34,26 +51,118 @@ typedef struct FluidComputingMatrix
 	double *curr_matrix;
 	// Next iteration matrix
 	double *next_matrix;
-	// Cell type matrix - fluid, non-fluid, etc
-	char *type_matrix;
+	// Cell types - fluid, non-fluid, etc - packed in a fluid mask, see _TypeMask.h
+	TypeMask *type_mask;
 	// Decay rate - percent at which the temperature decays per iteration
 	double decay_rate;
+	// Binary input file the matrices point into, NULL for text inputs
+	GridMapping *mapping;
 } FluidComputingMatrix;
 
-typedef struct TemperatureColorArray
+/* Runtime options parsed after the positional arguments */
+typedef struct RunOptions
 {
-	double min_value, max_value;
-	// Color thresholding
-	double orange_th, yellow_th, cyan_th, blue_th;
-} TemperatureColorArray;
+	// Keep both matrices on the device and swap them between launches
+	int resident;
+	// Only offer the renderer the iterations that are a multiple of N, 0 for all of them
+	int display_every;
+	// No rendering and no matrix dumps on the terminal
+	int headless;
+	// Maximum frames per second of the renderer
+	double fps;
+	// Print the statistics of the fluid cells every N iterations, 0 to disable
+	int statistics_every;
+	// BACKEND_OPENCL or BACKEND_CPU
+	int backend;
+	// Threads of the CPU backend, 0 for all cores
+	int cpu_threads;
+	// Check the final matrix against the CPU backend
+	int validate;
+	// Resident kernel, KERNEL_LINEAR, KERNEL_TILED, KERNEL_TEMPORAL, KERNEL_SPARSE or KERNEL_ACTIVE
+	int kernel_variant;
+	// Fluid fraction below which KERNEL_LINEAR is replaced by KERNEL_SPARSE
+	double sparse_threshold;
+	// Work group size of the tiled kernels, over the columns and over the lines
+	size_t tile_width, tile_height;
+	// Iterations advanced by each launch of the temporal kernel
+	int steps_per_launch;
+	// Append the matrix to snapshot_file every N iterations, 0 to disable
+	int snapshot_every;
+	char *snapshot_file;
+	// Host buffers queued between the simulation and the snapshot writer
+	int snapshot_buffers;
+	// Append a record of the matrix to checkpoint_file every N iterations, 0 to disable, every
+	// checkpoint_full_every-th record is a full one and the others only hold the changed tiles
+	int checkpoint_every;
+	char *checkpoint_file;
+	int checkpoint_full_every;
+	int checkpoint_buffers;
+	// Start from the last valid record of checkpoint_file instead of the input matrix
+	int resume;
+	// Directory of the compiled kernels, NULL to compile homework.cl on every run
+	char *kernel_cache;
+	// Compile the grid size, the decay rate and the tile size into the kernels
+	int specialize;
+	// Precision of the matrices on the device, PRECISION_FP64, PRECISION_FP32 or PRECISION_FP16
+	int precision;
+	// Devices the matrix is split over in row slabs, 0 for all of them
+	int devices;
+	// Sub-devices each device is split in, 0 to use the devices as they are
+	int sub_devices;
+	// Lines exchanged between neighbouring slabs, and so iterations between two exchanges
+	int halo;
+	// Check the change of the fluid cells over one step every N iterations, 0 to always run all
+	// the iterations
+	int converge_every;
+	// Norm of the change below which the run stops, CHANGE_NORM_MAX or CHANGE_NORM_L2
+	double tolerance;
+	int norm;
+	// Side of the tiles skipped while they and their neighbours change by less than active_epsilon,
+	// 0 to compute every cell
+	int active_tile;
+	double active_epsilon;
+	// Launch profiles of `benchmark --autotune`, NULL to ignore them
+	char *profile_file;
+	// The kernel, the tile or the steps per launch are given on the command line, a profile only
+	// supplies the worker geometry then
+	int kernel_given;
+	// Stream the grid through the device in row slabs of slab_lines lines instead of loading it, 0
+	// lines to fit the slabs to the device memory
+	int out_of_core;
+	int slab_lines;
+	// Slots the slabs go round, each with its own device buffers and queue
+	int stream_buffers;
+} RunOptions;
 
 FluidComputingMatrix *matrix;
 TemperatureColorArray color_array;
+RunOptions options;
+// Fluid cells and their neighbours, only built for KERNEL_SPARSE
+FluidIndex *fluid_index;
+// Background writer of the time-series file, only opened with --snapshot-every
+SnapshotWriter *snapshot_writer;
+// Background writer of the checkpoint file, only opened with --checkpoint-every
+CheckpointWriter *checkpoint_writer;
+// Iteration the run starts from, the one of the checkpoint it resumed from or 0
+int start_iteration = 0;
+// Bytes of the checkpoint file the resumed run keeps, its writer appends after them
+uint64_t checkpoint_valid_bytes = 0;
+// Terminal renderer thread, NULL when headless
+Renderer *renderer;
+// Row slabs of the multi-device mode, NULL on a single device
+Decomposition *decomposition;
+// Tiles still changing, only created with --active-tiles
+ActiveTiles *active_tiles;
+// First checked iteration whose change fell below the tolerance, -1 while none did
+int converged_iteration = -1;
+// Norm of the change of the last checked iteration up to converged_iteration, -1 before the first check
+double last_change_norm = -1;
 
 /* OpenCL stuff*/
 cl_context context;
 cl_command_queue commandQueue;
 cl_device_id deviceid;
+cl_program program;
 cl_kernel kernel;
 
 /* OpenCL memory */
@@ -61,6 +170,43 @@ cl_mem curr_matrix_cl;
 cl_mem next_matrix_cl;
 cl_mem type_matrix_cl;
 cl_mem dim_cl;
+cl_mem fluid_cells_cl;
+cl_mem neighbour_offsets_cl;
+cl_mem neighbour_cells_cl;
+// Lists of the active and retired tiles, their counts and the changes of the tiles, see
+// temperature_step_active()
+cl_mem active_tiles_cl;
+cl_mem active_counts_cl;
+cl_mem tile_changes_cl;
+cl_kernel active_list_kernel;
+// curr_matrix_cl uses the mapped input file as its storage
+int zero_copy;
+// Bytes of a temperature on the device and of the values the kernels compute with
+size_t cell_bytes;
+size_t real_bytes;
+// Host copy of a matrix in the device precision, NULL in double precision
+void *device_cells;
+
+/// @brief Writes the compiler options of homework.cl: the values that do not change during a run
+// become constants the compiler can fold, each combination gets its own cached binary
+/// @param build_options only the precision when specialization is disabled
+/// @param lines lines of the matrix the program runs over, those of its slab in the multi-device
+// mode, 0 to keep the grid size a kernel argument
+void program_build_options(char *build_options, size_t size, int lines)
+{
+	int length = snprintf(build_options, size, "%s", precision_build_option(options.precision));
+	if (!options.specialize)
+		return;
+	char decay_rate[32];
+	precision_real_literal(options.precision, matrix->decay_rate, decay_rate, sizeof(decay_rate));
+	if (lines > 0)
+		length += snprintf(build_options + length, size - length, " -D GRID_X=%d -D GRID_Y=%d", lines, matrix->dim[1]);
+	length += snprintf(build_options + length, size - length, " -D DECAY_RATE=%s", decay_rate);
+	// The other kernels run with the work group size the driver picks
+	if (options.resident && (options.kernel_variant == KERNEL_TILED || options.kernel_variant == KERNEL_TEMPORAL))
+		snprintf(build_options + length, size - length, " -D TILE_WIDTH=%zu -D TILE_HEIGHT=%zu",
+				 options.tile_width, options.tile_height);
+}
 
 /// @brief Updates the current matrix to the next matrix status
 /// @param self
@@ -76,15 +222,17 @@ void update_matrix(FluidComputingMatrix *self)
 	}
 }
 
-/// @brief Applies decay to the matrix
+/// @brief Applies decay to the fluid cells of the matrix, the solid cells keep their values like
+// in the kernels that fold the decay in
 /// @param self
-decay_temperature(FluidComputingMatrix *self)
+void decay_temperature(FluidComputingMatrix *self)
 {
 	for (int i = 0; i < self->dim[0]; i++)
 		for (int j = 0; j < self->dim[1]; j++)
 		{
 			int temp_index = self->dim[1] * i + j;
-			self->curr_matrix[temp_index] -= self->curr_matrix[temp_index] * self->decay_rate;
+			if (TYPE_MASK_IS_FLUID(self->type_mask->fluid_bits, temp_index))
+				self->curr_matrix[temp_index] -= self->curr_matrix[temp_index] * self->decay_rate;
 		}
 }
 
@@ -94,7 +242,7 @@ decay_temperature(FluidComputingMatrix *self)
 int pre_allocate_matrix_memory()
 {
 	/* Allocating memory for the fluid computing matrix*/
-	matrix = (FluidComputingMatrix *)malloc(sizeof(FluidComputingMatrix));
+	matrix = (FluidComputingMatrix *)calloc(1, sizeof(FluidComputingMatrix));
 	if (matrix == NULL)
 	{
 		perror("Error allocating memory for 'FluidComputingMatrix'\n");
@@ -110,20 +258,13 @@ int pre_allocate_matrix_memory()
 	return 0;
 }
 
-/// @brief Allocates memory for the rest of the FluidComputingMatrix,
-// including current, next iteration and type of matrix
+/// @brief Allocates memory for the rest of the FluidComputingMatrix, the current iteration and
+// type matrices come from the input file
 /// @return 1 if error, 0 if no error
 int allocate_matrix_memory()
 {
 	matrix->total_size = matrix->dim[0] * matrix->dim[1];
 
-	/* Allocating memory for the current iteration matrix*/
-	matrix->curr_matrix = (double *)malloc(sizeof(double) * matrix->total_size);
-	if (matrix->curr_matrix == NULL)
-	{
-		perror("Error allocating memory for 'curr_matrix'\n");
-		return 1;
-	}
 	/* Allocating memory for the next iteration matrix*/
 	matrix->next_matrix = (double *)malloc(sizeof(double) * matrix->total_size);
 	if (matrix->next_matrix == NULL)
@@ -131,13 +272,6 @@ int allocate_matrix_memory()
 		perror("Error allocating memory for 'next_matrix'\n");
 		return 1;
 	}
-	/* Allocating memory for the cell type matrix*/
-	matrix->type_matrix = (char *)malloc(sizeof(int) * matrix->total_size);
-	if (matrix->type_matrix == NULL)
-	{
-		perror("Error allocating memory for 'type_matrix'\n");
-		return 1;
-	}
 	return 0;
 }
 
@@ -146,101 +280,200 @@ int allocate_matrix_memory()
 int allocate_device_memory()
 {
 	int rc;
-	/* Allocate device memory */
-	curr_matrix_cl = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(double) * matrix->total_size, NULL, &rc);
+	cell_bytes = precision_cell_bytes(options.precision);
+	real_bytes = precision_real_bytes(options.precision);
+	if (options.precision != PRECISION_FP64)
+	{
+		device_cells = malloc(cell_bytes * matrix->total_size);
+		if (device_cells == NULL)
+		{
+			perror("Error allocating memory for 'device_cells'\n");
+			return 1;
+		}
+	}
+
+	/* A mapped binary input stored in the device precision is handed to the device as it is, the
+	resident mode never uploads it again. A resumed run starts from the checkpoint instead */
+	zero_copy = options.resident && matrix->mapping != NULL && matrix->mapping->header->dtype == options.precision &&
+				start_iteration == 0;
+	void *curr_host_ptr = zero_copy ? matrix->mapping->temperature : NULL;
+	cl_mem_flags host_flags = zero_copy ? CL_MEM_USE_HOST_PTR : 0;
+
+	/* Allocate device memory, both matrices are read-write so they can swap roles */
+	curr_matrix_cl = clCreateBuffer(context, CL_MEM_READ_WRITE | host_flags, cell_bytes * matrix->total_size, curr_host_ptr, &rc);
 	handleError(rc, __LINE__, __FILE__);
-	next_matrix_cl = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(double) * matrix->total_size, NULL, &rc);
+	next_matrix_cl = clCreateBuffer(context, CL_MEM_READ_WRITE, cell_bytes * matrix->total_size, NULL, &rc);
 	handleError(rc, __LINE__, __FILE__);
-	type_matrix_cl = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(char) * matrix->total_size, NULL, &rc);
+	type_matrix_cl = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(uint32_t) * type_mask_words(matrix->total_size), NULL, &rc);
 	handleError(rc, __LINE__, __FILE__);
 	dim_cl = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(int) * 2, NULL, &rc);
 	handleError(rc, __LINE__, __FILE__);
+
+	if (fluid_index != NULL)
+	{
+		int neighbour_count = fluid_index->neighbour_offsets[fluid_index->fluid_count];
+		fluid_cells_cl = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(int) * (fluid_index->fluid_count + 1), NULL, &rc);
+		handleError(rc, __LINE__, __FILE__);
+		neighbour_offsets_cl = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(int) * (fluid_index->fluid_count + 1), NULL, &rc);
+		handleError(rc, __LINE__, __FILE__);
+		neighbour_cells_cl = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(int) * (neighbour_count + 1), NULL, &rc);
+		handleError(rc, __LINE__, __FILE__);
+	}
+	if (options.kernel_variant == KERNEL_ACTIVE)
+	{
+		active_tiles_cl = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(int) * active_tiles->tile_count, NULL, &rc);
+		handleError(rc, __LINE__, __FILE__);
+		active_counts_cl = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(int) * 5, NULL, &rc);
+		handleError(rc, __LINE__, __FILE__);
+		tile_changes_cl = clCreateBuffer(context, CL_MEM_READ_WRITE, real_bytes * 2 * active_tiles->tile_count, NULL, &rc);
+		handleError(rc, __LINE__, __FILE__);
+	}
+	return 0;
 }
 
 /// @brief Frees memory of the host
 void cleanup()
 {
-	/* Frees up host memory */
-	free(matrix->curr_matrix);
-	free(matrix->next_matrix);
-	free(matrix->type_matrix);
+	/* Frees up host memory, matrices inside a mapped input are released with the mapping */
+	if (!grid_is_mapped(matrix->mapping, matrix->curr_matrix))
+		free(matrix->curr_matrix);
+	if (matrix->next_matrix != matrix->curr_matrix && !grid_is_mapped(matrix->mapping, matrix->next_matrix))
+		free(matrix->next_matrix);
+	type_mask_free(matrix->type_mask);
+	grid_unmap(matrix->mapping);
 	free(matrix->dim);
 	free(matrix);
+	fluid_index_free(fluid_index);
+	active_tiles_free(active_tiles);
 }
 
 /// @brief Frees memory of the device
 void cleanup_device()
 {
+	if (decomposition != NULL)
+	{
+		decomposition_destroy(decomposition);
+		free(device_cells);
+		clReleaseContext(context);
+		return;
+	}
+
 	/* Frees up device memory */
 	clReleaseMemObject(curr_matrix_cl);
 	clReleaseMemObject(next_matrix_cl);
 	clReleaseMemObject(type_matrix_cl);
 	clReleaseMemObject(dim_cl);
+	if (fluid_index != NULL)
+	{
+		clReleaseMemObject(fluid_cells_cl);
+		clReleaseMemObject(neighbour_offsets_cl);
+		clReleaseMemObject(neighbour_cells_cl);
+	}
+	if (options.kernel_variant == KERNEL_ACTIVE)
+	{
+		clReleaseMemObject(active_tiles_cl);
+		clReleaseMemObject(active_counts_cl);
+		clReleaseMemObject(tile_changes_cl);
+		clReleaseKernel(active_list_kernel);
+	}
+	free(device_cells);
 	clReleaseKernel(kernel);
+	clReleaseProgram(program);
 	clReleaseCommandQueue(commandQueue);
 	clReleaseContext(context);
 }
 
-/// @brief Loads the data from a file formatted correctly inside the data structures
+/// @brief Loads the data from a file formatted correctly inside the data structures. Binary grid
+// files are mapped and used in place, text files are parsed
 /// @param input_file_name name of the input file
 /// @return 1 if error, 0 if no error
 int load_matrix(char *input_file_name)
 {
-	FILE *file_fptr = fopen(input_file_name, "r");
-	if (file_fptr == NULL)
+	if (grid_is_binary(input_file_name))
 	{
-		perror("Error opening the input file!\n");
-		return 1;
+		matrix->mapping = grid_map_binary(input_file_name);
+		if (matrix->mapping == NULL)
+		{
+			return 1;
+		}
+		matrix->dim[0] = matrix->mapping->header->dim[0];
+		matrix->dim[1] = matrix->mapping->header->dim[1];
+		matrix->iterations = matrix->mapping->header->iterations;
+		matrix->decay_rate = matrix->mapping->header->decay_rate;
+		matrix->type_mask = type_mask_pack(matrix->mapping->type, (size_t)matrix->dim[0] * matrix->dim[1]);
+		if (matrix->type_mask == NULL)
+		{
+			return 1;
+		}
+		if (matrix->mapping->header->dtype == GRID_DTYPE_F64)
+			matrix->curr_matrix = (double *)matrix->mapping->temperature;
+		else
+		{
+			// The host always computes in double, narrower files are converted
+			size_t total_size = (size_t)matrix->dim[0] * matrix->dim[1];
+			matrix->curr_matrix = (double *)malloc(sizeof(double) * total_size);
+			if (matrix->curr_matrix == NULL)
+			{
+				perror("Error allocating memory for 'curr_matrix'\n");
+				return 1;
+			}
+			precision_unpack(matrix->mapping->header->dtype, matrix->mapping->temperature, matrix->curr_matrix, total_size);
+		}
 	}
-
-	fscanf(file_fptr, "%d %d\n", &matrix->dim[0], &matrix->dim[1]);
-
-	if (allocate_matrix_memory())
+	else
 	{
-		return 1;
+		char *type_matrix = NULL;
+		if (grid_read_text(input_file_name, matrix->dim, &matrix->iterations, &matrix->curr_matrix, &type_matrix))
+		{
+			return 1;
+		}
+		matrix->type_mask = type_mask_pack(type_matrix, (size_t)matrix->dim[0] * matrix->dim[1]);
+		free(type_matrix);
+		if (matrix->type_mask == NULL)
+		{
+			return 1;
+		}
+		matrix->decay_rate = DEFAULT_DECAY_RATE;
 	}
 
-	for (int j = 0; j < matrix->dim[1]; j++)
+	if (allocate_matrix_memory())
 	{
-		for (int i = 0; i < matrix->dim[0]; i++)
-		{
-			int temp_index = i * matrix->dim[1] + j;
-			fscanf(file_fptr, "%c %lf\n", &matrix->type_matrix[temp_index],
-				   &matrix->curr_matrix[temp_index]);
-		}
+		return 1;
 	}
 
-	fscanf(file_fptr, "%d", &matrix->iterations);
-	fclose(file_fptr);
+	/* Non-fluid cells are never written by the kernel, start them equal in both matrices */
+	memcpy(matrix->next_matrix, matrix->curr_matrix, sizeof(double) * matrix->total_size);
 	return 0;
 }
 
-/// @brief Stores the data to a file
+/// @brief Stores the data to a file, in the binary format if its name ends with GRID_EXTENSION,
+// with the temperatures in the precision of the run
 /// @param output_file_name name of the output file
 /// @return 1 if error, 0 if no error
 int store_results(char *output_file_name)
 {
-	FILE *file_fptr = fopen(output_file_name, "w");
-
-	if (file_fptr == NULL)
+	// The grid files keep the characters of the cell types
+	char *type_matrix = (char *)malloc(sizeof(char) * matrix->total_size);
+	if (type_matrix == NULL)
 	{
-		perror("Error opening the output file!\n");
+		perror("Error allocating memory for 'type_matrix'\n");
 		return 1;
 	}
+	type_mask_unpack(matrix->type_mask, 0, matrix->total_size, type_matrix);
+	int rc;
+	if (grid_has_binary_extension(output_file_name))
+		rc = grid_write_binary(output_file_name, matrix->dim, matrix->iterations, matrix->decay_rate,
+							   matrix->next_matrix, type_matrix, options.precision);
+	else
+		rc = grid_write_text(output_file_name, matrix->dim, matrix->next_matrix, type_matrix, -1);
+	free(type_matrix);
+	return rc;
+}
 
-	fprintf(file_fptr, "%d %d\n", matrix->dim[0], matrix->dim[1]);
-
-	for (int j = 0; j < matrix->dim[1]; j++)
-	{
-		for (int i = 0; i < matrix->dim[0]; i++)
-		{
-			int temp_index = i * matrix->dim[1] + j;
-			fprintf(file_fptr, "%c %lf\n", matrix->type_matrix[temp_index],
-					matrix->next_matrix[temp_index]);
-		}
-	}
-	fclose(file_fptr);
-	return 0;
+/// @brief Returns 1 if the matrix is split over several devices or sub-devices
+int is_multi_device()
+{
+	return options.devices != 1 || options.sub_devices > 0;
 }
 
 /// @brief Loads the runtime arguments inside data structures
@@ -248,22 +481,377 @@ int store_results(char *output_file_name)
 /// @param argv
 /// @param input_file_name name of the input file
 /// @param output_file_name name of the output file
-/// @param worker_count how many worker items/GPU threads to use
-/// @param worker_group_size how many worker items are inside a group
+/// @param worker_count how many worker items/GPU threads to use, 0 when not given
+/// @param worker_group_size how many worker items are inside a group, 0 when not given
 /// @return 1 if error, 0 if no error
 int get_args(int argc, char **argv, char *input_file_name, char *output_file_name,
 			 size_t *worker_count, size_t *worker_group_size)
 {
-	if (argc != 5)
+	if (argc < 3)
 	{
-		perror("Usage: ./homework input_file.txt output_file.txt worker_count worker_group_size\n");
+		perror("Usage: ./homework input_file.txt output_file.txt [worker_count worker_group_size] "
+			   "[--resident] [--display-every=N] [--fps=F] [--headless] [--statistics-every=N] [--backend=opencl|cpu] [--threads=N] [--validate] "
+			   "[--kernel=linear|tiled|sparse] [--tile=WxH] [--steps-per-launch=K] [--sparse-threshold=F] "
+			   "[--snapshot-every=N] [--snapshot-file=file] [--snapshot-buffers=N] [--kernel-cache=dir] [--no-kernel-cache] [--no-specialize] [--precision=fp64|fp32|fp16] "
+			   "[--devices=N|all] [--sub-devices=N] [--halo=H] [--converge-every=N] [--tolerance=T] [--norm=max|l2] "
+			   "[--active-tiles=N] [--active-epsilon=E] [--profile=file] [--no-profile] "
+			   "[--out-of-core[=N]] [--stream-buffers=N] "
+			   "[--checkpoint-every=N] [--checkpoint-file=file] [--checkpoint-full-every=N] [--checkpoint-buffers=N] [--resume]\n");
 		return 1;
 	}
 
 	input_file_name = strdup(argv[1]);
 	output_file_name = strdup(argv[2]);
-	*worker_count = atoi(argv[3]);
-	*worker_group_size = atoi(argv[4]);
+	// Without the worker geometry the launch profile or the defaults supply it, see choose_launch_geometry()
+	int first_option = 3;
+	*worker_count = 0;
+	*worker_group_size = 0;
+	if (argc >= 5 && argv[3][0] != '-' && argv[4][0] != '-')
+	{
+		*worker_count = atoi(argv[3]);
+		*worker_group_size = atoi(argv[4]);
+		first_option = 5;
+		if (*worker_count == 0 || *worker_group_size == 0)
+		{
+			fprintf(stderr, "The worker count and group size must be positive\n");
+			return 1;
+		}
+	}
+
+	options.resident = 0;
+	options.display_every = 0;
+	options.headless = 0;
+	options.fps = RENDERER_DEFAULT_FPS;
+	options.statistics_every = 0;
+	options.backend = BACKEND_OPENCL;
+	options.cpu_threads = 0;
+	options.validate = 0;
+	options.kernel_variant = KERNEL_LINEAR;
+	options.tile_width = 16;
+	options.tile_height = 16;
+	options.steps_per_launch = 1;
+	options.sparse_threshold = FLUID_INDEX_DEFAULT_THRESHOLD;
+	options.snapshot_every = 0;
+	options.snapshot_file = "snapshots.tts";
+	options.snapshot_buffers = SNAPSHOT_DEFAULT_BUFFERS;
+	options.checkpoint_every = 0;
+	options.checkpoint_file = "checkpoint.ttc";
+	options.checkpoint_full_every = CHECKPOINT_DEFAULT_FULL_EVERY;
+	options.checkpoint_buffers = CHECKPOINT_DEFAULT_BUFFERS;
+	options.resume = 0;
+	options.kernel_cache = ".kernel_cache";
+	options.specialize = 1;
+	options.precision = PRECISION_FP64;
+	options.devices = 1;
+	options.sub_devices = 0;
+	options.halo = 0;
+	options.converge_every = 0;
+	options.tolerance = 1e-6;
+	options.norm = CHANGE_NORM_MAX;
+	options.active_tile = 0;
+	options.active_epsilon = ACTIVE_TILES_DEFAULT_EPSILON;
+	options.profile_file = AUTOTUNE_DEFAULT_PROFILE;
+	options.kernel_given = 0;
+	options.out_of_core = 0;
+	options.slab_lines = 0;
+	options.stream_buffers = STREAMING_DEFAULT_SLOTS;
+
+	for (int i = first_option; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--resident") == 0)
+			options.resident = 1;
+		else if (strncmp(argv[i], "--display-every=", 16) == 0)
+			options.display_every = atoi(argv[i] + 16);
+		else if (strncmp(argv[i], "--fps=", 6) == 0)
+		{
+			options.fps = atof(argv[i] + 6);
+			if (options.fps <= 0)
+			{
+				fprintf(stderr, "Invalid frame rate '%s'\n", argv[i] + 6);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--headless") == 0)
+			options.headless = 1;
+		else if (strncmp(argv[i], "--statistics-every=", 19) == 0)
+			options.statistics_every = atoi(argv[i] + 19);
+		else if (strcmp(argv[i], "--backend=opencl") == 0)
+			options.backend = BACKEND_OPENCL;
+		else if (strcmp(argv[i], "--backend=cpu") == 0)
+			options.backend = BACKEND_CPU;
+		else if (strncmp(argv[i], "--threads=", 10) == 0)
+			options.cpu_threads = atoi(argv[i] + 10);
+		else if (strcmp(argv[i], "--validate") == 0)
+			options.validate = 1;
+		else if (strcmp(argv[i], "--kernel=linear") == 0)
+		{
+			options.kernel_variant = KERNEL_LINEAR;
+			options.kernel_given = 1;
+		}
+		else if (strcmp(argv[i], "--kernel=tiled") == 0)
+		{
+			// The tiled kernel only exists in the resident form
+			options.kernel_variant = KERNEL_TILED;
+			options.resident = 1;
+			options.kernel_given = 1;
+		}
+		else if (strcmp(argv[i], "--kernel=sparse") == 0)
+		{
+			options.kernel_variant = KERNEL_SPARSE;
+			options.resident = 1;
+			options.kernel_given = 1;
+		}
+		else if (strncmp(argv[i], "--sparse-threshold=", 19) == 0)
+			options.sparse_threshold = atof(argv[i] + 19);
+		else if (strncmp(argv[i], "--tile=", 7) == 0)
+		{
+			if (sscanf(argv[i] + 7, "%zux%zu", &options.tile_width, &options.tile_height) != 2 ||
+				options.tile_width == 0 || options.tile_height == 0)
+			{
+				fprintf(stderr, "Invalid tile size '%s', expected WxH\n", argv[i] + 7);
+				return 1;
+			}
+			options.kernel_given = 1;
+		}
+		else if (strncmp(argv[i], "--steps-per-launch=", 19) == 0)
+		{
+			options.steps_per_launch = atoi(argv[i] + 19);
+			if (options.steps_per_launch < 1)
+			{
+				fprintf(stderr, "Invalid steps per launch '%s'\n", argv[i] + 19);
+				return 1;
+			}
+			options.kernel_given = 1;
+		}
+		else if (strncmp(argv[i], "--snapshot-every=", 17) == 0)
+			options.snapshot_every = atoi(argv[i] + 17);
+		else if (strncmp(argv[i], "--snapshot-file=", 16) == 0)
+			options.snapshot_file = argv[i] + 16;
+		else if (strncmp(argv[i], "--snapshot-buffers=", 19) == 0)
+		{
+			options.snapshot_buffers = atoi(argv[i] + 19);
+			if (options.snapshot_buffers < 1)
+			{
+				fprintf(stderr, "Invalid snapshot buffer count '%s'\n", argv[i] + 19);
+				return 1;
+			}
+		}
+		else if (strncmp(argv[i], "--checkpoint-every=", 19) == 0)
+			options.checkpoint_every = atoi(argv[i] + 19);
+		else if (strncmp(argv[i], "--checkpoint-file=", 18) == 0)
+			options.checkpoint_file = argv[i] + 18;
+		else if (strncmp(argv[i], "--checkpoint-full-every=", 24) == 0)
+		{
+			options.checkpoint_full_every = atoi(argv[i] + 24);
+			if (options.checkpoint_full_every < 1)
+			{
+				fprintf(stderr, "Invalid full checkpoint interval '%s'\n", argv[i] + 24);
+				return 1;
+			}
+		}
+		else if (strncmp(argv[i], "--checkpoint-buffers=", 21) == 0)
+		{
+			options.checkpoint_buffers = atoi(argv[i] + 21);
+			if (options.checkpoint_buffers < 1)
+			{
+				fprintf(stderr, "Invalid checkpoint buffer count '%s'\n", argv[i] + 21);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--resume") == 0)
+			options.resume = 1;
+		else if (strncmp(argv[i], "--kernel-cache=", 15) == 0)
+			options.kernel_cache = argv[i] + 15;
+		else if (strcmp(argv[i], "--no-kernel-cache") == 0)
+			options.kernel_cache = NULL;
+		else if (strcmp(argv[i], "--no-specialize") == 0)
+			options.specialize = 0;
+		else if (strncmp(argv[i], "--precision=", 12) == 0)
+		{
+			options.precision = precision_parse(argv[i] + 12);
+			if (options.precision < 0)
+			{
+				fprintf(stderr, "Unknown precision '%s', expected fp64, fp32 or fp16\n", argv[i] + 12);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--devices=all") == 0)
+			options.devices = 0;
+		else if (strncmp(argv[i], "--devices=", 10) == 0)
+		{
+			options.devices = atoi(argv[i] + 10);
+			if (options.devices < 1)
+			{
+				fprintf(stderr, "Invalid device count '%s'\n", argv[i] + 10);
+				return 1;
+			}
+		}
+		else if (strncmp(argv[i], "--sub-devices=", 14) == 0)
+		{
+			options.sub_devices = atoi(argv[i] + 14);
+			if (options.sub_devices < 1)
+			{
+				fprintf(stderr, "Invalid sub-device count '%s'\n", argv[i] + 14);
+				return 1;
+			}
+		}
+		else if (strncmp(argv[i], "--halo=", 7) == 0)
+		{
+			options.halo = atoi(argv[i] + 7);
+			if (options.halo < 1)
+			{
+				fprintf(stderr, "Invalid halo '%s'\n", argv[i] + 7);
+				return 1;
+			}
+		}
+		else if (strncmp(argv[i], "--converge-every=", 17) == 0)
+			options.converge_every = atoi(argv[i] + 17);
+		else if (strncmp(argv[i], "--tolerance=", 12) == 0)
+		{
+			options.tolerance = atof(argv[i] + 12);
+			if (options.tolerance < 0)
+			{
+				fprintf(stderr, "Invalid tolerance '%s'\n", argv[i] + 12);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--norm=max") == 0)
+			options.norm = CHANGE_NORM_MAX;
+		else if (strcmp(argv[i], "--norm=l2") == 0)
+			options.norm = CHANGE_NORM_L2;
+		else if (strcmp(argv[i], "--active-tiles") == 0)
+			options.active_tile = ACTIVE_TILES_DEFAULT_SIZE;
+		else if (strncmp(argv[i], "--active-tiles=", 15) == 0)
+		{
+			options.active_tile = atoi(argv[i] + 15);
+			if (options.active_tile < 1)
+			{
+				fprintf(stderr, "Invalid active tile size '%s'\n", argv[i] + 15);
+				return 1;
+			}
+		}
+		else if (strncmp(argv[i], "--active-epsilon=", 17) == 0)
+		{
+			options.active_epsilon = atof(argv[i] + 17);
+			if (options.active_epsilon < 0)
+			{
+				fprintf(stderr, "Invalid active epsilon '%s'\n", argv[i] + 17);
+				return 1;
+			}
+		}
+		else if (strncmp(argv[i], "--profile=", 10) == 0)
+			options.profile_file = argv[i] + 10;
+		else if (strcmp(argv[i], "--no-profile") == 0)
+			options.profile_file = NULL;
+		else if (strcmp(argv[i], "--out-of-core") == 0)
+			options.out_of_core = 1;
+		else if (strncmp(argv[i], "--out-of-core=", 14) == 0)
+		{
+			options.out_of_core = 1;
+			options.slab_lines = atoi(argv[i] + 14);
+			if (options.slab_lines < 1)
+			{
+				fprintf(stderr, "Invalid slab line count '%s'\n", argv[i] + 14);
+				return 1;
+			}
+		}
+		else if (strncmp(argv[i], "--stream-buffers=", 17) == 0)
+		{
+			options.stream_buffers = atoi(argv[i] + 17);
+			if (options.stream_buffers < 1)
+			{
+				fprintf(stderr, "Invalid stream buffer count '%s'\n", argv[i] + 17);
+				return 1;
+			}
+		}
+		else
+		{
+			fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+			return 1;
+		}
+	}
+
+	// More than one step per launch needs the temporally blocked kernel
+	if (options.steps_per_launch > 1)
+	{
+		options.kernel_variant = KERNEL_TEMPORAL;
+		options.resident = 1;
+	}
+
+	// The host, and so the staged mode and the CPU backend, always compute in double
+	if (options.precision != PRECISION_FP64)
+	{
+		if (options.backend == BACKEND_CPU)
+		{
+			fprintf(stderr, "The CPU backend only runs in fp64\n");
+			return 1;
+		}
+		options.resident = 1;
+	}
+
+	// Slabs keep their matrices on their device like the resident mode, and a launch cannot run
+	// more iterations than the halo covers
+	if (is_multi_device())
+	{
+		if (options.backend == BACKEND_CPU)
+		{
+			fprintf(stderr, "The CPU backend runs on a single host, --devices and --sub-devices need OpenCL\n");
+			return 1;
+		}
+		if (options.halo == 0)
+			options.halo = options.steps_per_launch;
+		if (options.halo < options.steps_per_launch)
+		{
+			fprintf(stderr, "A halo of %d lines is too narrow for %d steps per launch\n", options.halo, options.steps_per_launch);
+			return 1;
+		}
+		options.resident = 1;
+	}
+
+	// The streamed grid is never held in memory, only the linear kernel runs over its slabs between
+	// two binary files, and a pass runs as many iterations as the halo covers
+	if (options.out_of_core)
+	{
+		if (options.backend == BACKEND_CPU || is_multi_device() || options.kernel_variant != KERNEL_LINEAR ||
+			options.active_tile > 0 || options.validate || options.snapshot_every > 0 || options.statistics_every > 0 ||
+			options.converge_every > 0 || options.checkpoint_every > 0 || options.resume)
+		{
+			fprintf(stderr, "--out-of-core runs the linear kernel on a single OpenCL device, without --validate, "
+							"snapshots, statistics, convergence checks, active tiles or checkpoints\n");
+			return 1;
+		}
+		if (!grid_is_binary(argv[1]) || !grid_has_binary_extension(argv[2]))
+		{
+			fprintf(stderr, "--out-of-core needs a binary input and a %s output, convert text grids with gridconvert\n",
+					GRID_EXTENSION);
+			return 1;
+		}
+		if (options.halo == 0)
+			options.halo = STREAMING_DEFAULT_HALO;
+		options.headless = 1;
+		// A launch profile only supplies the worker geometry
+		options.kernel_given = 1;
+	}
+
+	// The active tiles are computed one step per launch by their own resident kernel
+	if (options.active_tile > 0 && options.backend == BACKEND_OPENCL)
+	{
+		if (options.kernel_variant != KERNEL_LINEAR || is_multi_device())
+		{
+			fprintf(stderr, "--active-tiles only runs with the linear kernel on a single device\n");
+			return 1;
+		}
+		options.kernel_variant = KERNEL_ACTIVE;
+		options.resident = 1;
+	}
+
+	// A checkpoint only holds the matrix: the iteration a converging run stops at depends on when
+	// the devices report their changes, and the lag of the skipped tiles is not saved
+	if ((options.checkpoint_every > 0 || options.resume) && (options.converge_every > 0 || options.active_tile > 0))
+	{
+		fprintf(stderr, "--checkpoint-every and --resume run without convergence checks or active tiles\n");
+		return 1;
+	}
 
 	return 0;
 }
@@ -281,7 +869,7 @@ int setup_iteration(size_t *worker_group_size)
 	handleError(rc, __LINE__, __FILE__);
 	rc = clEnqueueWriteBuffer(commandQueue, next_matrix_cl, CL_TRUE, 0, sizeof(double) * matrix->total_size, matrix->next_matrix, 0, NULL, NULL);
 	handleError(rc, __LINE__, __FILE__);
-	rc = clEnqueueWriteBuffer(commandQueue, type_matrix_cl, CL_TRUE, 0, sizeof(char) * matrix->total_size, matrix->type_matrix, 0, NULL, NULL);
+	rc = clEnqueueWriteBuffer(commandQueue, type_matrix_cl, CL_TRUE, 0, sizeof(uint32_t) * type_mask_words(matrix->total_size), matrix->type_mask->fluid_bits, 0, NULL, NULL);
 	handleError(rc, __LINE__, __FILE__);
 	rc = clEnqueueWriteBuffer(commandQueue, dim_cl, CL_TRUE, 0, sizeof(int) * 2, matrix->dim, 0, NULL, NULL);
 	handleError(rc, __LINE__, __FILE__);
@@ -328,131 +916,156 @@ void print_color_thresholds()
 		   color_array.cyan_th, color_array.blue_th, color_array.min_value);
 }
 
-/// @brief Colors the matrix and prints it
-/// @param self
-void color_matrix(FluidComputingMatrix *self)
-{
-	for (int j = 0; j < self->dim[1]; j++)
-	{
-		for (int i = 0; i < self->dim[0]; i++)
-		{
-			int temp_index = i * self->dim[1] + j;
-			if (self->curr_matrix[temp_index] >= -0.000001 && self->curr_matrix[temp_index] <= 0.000001)
-				print_colored_cell(NEUTRAL);
-			else if (self->curr_matrix[temp_index] > color_array.orange_th)
-				print_colored_cell(VERY_HOT);
-			else if (self->curr_matrix[temp_index] > color_array.yellow_th)
-				print_colored_cell(HOT);
-			else if (self->curr_matrix[temp_index] > 0)
-				print_colored_cell(WARM);
-			else if (self->curr_matrix[temp_index] > color_array.cyan_th)
-				print_colored_cell(CHILLY);
-			else if (self->curr_matrix[temp_index] > color_array.blue_th)
-				print_colored_cell(COLD);
-			else
-				print_colored_cell(VERY_COLD);
-		}
-		printf("\n\n");
-	}
-	printf("\n");
-}
-
-/// @brief Prints out the color of a cell
-/// @param color
-void print_colored_cell(int color)
-{
-	switch (color)
-	{
-	case VERY_HOT:
-		printf("\033[1;31m#\t\033[0m");
-		break;
-	case HOT:
-		printf("\033[38;2;216;128;0m#\t\033[0m");
-		break;
-	case WARM:
-		printf("\033[1;33m#\t\033[0m");
-		break;
-	case NEUTRAL:
-		printf("\033[38;5;7m#\t\033[0m");
-		break;
-	case CHILLY:
-		printf("\033[1;36m#\t\033[0m");
-		break;
-	case COLD:
-		printf("\033[1;34m#\t\033[0m");
-		break;
-	case VERY_COLD:
-		printf("\033[38;5;92m#\t\033[0m");
-		break;
-	default:
-		break;
-	}
-}
-
 /// @brief Initialises color values for the current maxima and minima
 /// @param self_matrix
 /// @param self_color
 void init_color(FluidComputingMatrix *self_matrix, TemperatureColorArray *self_color)
 {
+	double partial[STATISTICS_FIELDS];
+	FieldStatistics statistics;
 
-	double min = self_matrix->curr_matrix[0];
-	double max = self_matrix->curr_matrix[0];
-	for (int i = 1; i < self_matrix->dim[0] * self_matrix->dim[1]; i++)
-	{
-		if (self_matrix->curr_matrix[i] < min)
-		{
-			min = self_matrix->curr_matrix[i];
-		}
-		if (self_matrix->curr_matrix[i] > max)
-		{
-			max = self_matrix->curr_matrix[i];
-		}
-	}
-	self_color->orange_th = max * 2 / 3;
-	self_color->yellow_th = max * 1 / 3;
-	self_color->cyan_th = min * 1 / 3;
-	self_color->blue_th = min * 2 / 3;
-	self_color->min_value = min;
-	self_color->max_value = max;
+	statistics_reset(partial);
+	statistics_accumulate(partial, self_matrix->curr_matrix, self_matrix->type_mask->fluid_bits, 0, self_matrix->total_size);
+	statistics_finish(partial, 0, &statistics);
+	color_thresholds(&statistics, self_color);
 }
 
-int main(int argc, char **argv)
+/// @brief Returns 1 if the statistics of the matrix reached after iteration steps are needed,
+// the renderer refreshes its thresholds on every iteration
+int is_statistics_iteration(int iteration)
 {
-	int rc;
-	char *input_file_name, *output_file_name;
-	size_t worker_count, worker_group_size;
+	return renderer != NULL || (options.statistics_every > 0 && iteration % options.statistics_every == 0);
+}
 
-	if (get_args(argc, argv, input_file_name, output_file_name,
-				 &worker_count, &worker_group_size))
-	{
-		return -1;
-	}
-	if (pre_allocate_matrix_memory())
-	{
-		return -1;
-	}
+/// @brief Hands new statistics to the renderer and prints the requested ones
+void apply_statistics(FieldStatistics *statistics)
+{
+	if (renderer != NULL)
+		renderer_set_statistics(renderer, statistics);
+	if (options.statistics_every > 0 && statistics->iteration % options.statistics_every == 0)
+		printf("Iteration %d: %ld fluid cells, min %g, max %g, mean %g, energy %g\n", statistics->iteration,
+			   statistics->fluid_count, statistics->min_value, statistics->max_value, statistics->mean, statistics->sum);
+}
 
-	if (load_matrix(argv[1]))
-	{
-		return -1;
-	}
+/// @brief Returns 1 if the matrix reached after iteration steps goes to the snapshot file
+int is_snapshot_iteration(int iteration)
+{
+	return snapshot_writer != NULL && iteration % options.snapshot_every == 0;
+}
 
-	deviceid = initOpenCL(&context, &commandQueue);
-	kernel = getAndCompileKernel("homework.cl", "temperature_calculations", context, deviceid);
+/// @brief Returns 1 if the matrix reached after iteration steps goes to the checkpoint file
+int is_checkpoint_iteration(int iteration)
+{
+	return checkpoint_writer != NULL && iteration % options.checkpoint_every == 0;
+}
+
+/// @brief Returns how many iterations can run from iteration before the matrix has to be
+// displayed, saved or checked
+int iterations_until_output(int iteration)
+{
+	int count = matrix->iterations - iteration;
+	if (renderer != NULL && options.display_every > 0)
+		count = fmin(count, options.display_every - iteration % options.display_every);
+	if (snapshot_writer != NULL)
+		count = fmin(count, options.snapshot_every - iteration % options.snapshot_every);
+	if (checkpoint_writer != NULL)
+		count = fmin(count, options.checkpoint_every - iteration % options.checkpoint_every);
+	if (options.statistics_every > 0)
+		count = fmin(count, options.statistics_every - iteration % options.statistics_every);
+	if (options.converge_every > 0)
+		count = fmin(count, options.converge_every - iteration % options.converge_every);
+	return count;
+}
+
+/// @brief Returns 1 if the matrix reached after iteration steps is offered to the renderer
+int is_display_iteration(int iteration)
+{
+	return renderer != NULL && (options.display_every <= 0 || iteration % options.display_every == 0);
+}
+
+/// @brief Returns 1 if the change from the matrix of the previous iteration to the one reached
+// after iteration steps is checked against the tolerance
+int is_convergence_iteration(int iteration)
+{
+	return options.converge_every > 0 && iteration % options.converge_every == 0;
+}
+
+/// @brief Records the norm of a change reduced from two consecutive iterations, the changes
+// checked after the converged iteration are left out
+void apply_change(FieldStatistics *change)
+{
+	if (converged_iteration >= 0)
+		return;
+	last_change_norm = statistics_change_norm(change, options.norm);
+	if (last_change_norm <= options.tolerance)
+		converged_iteration = change->iteration;
+}
+
+/// @brief Ends the run after iteration steps once a change fell below the tolerance, the devices
+// report the change a few iterations late so the run can stop after the converged iteration
+/// @return 1 if the run stops, 0 if it goes on
+int stop_if_converged(int iteration)
+{
+	if (converged_iteration < 0)
+		return 0;
+	matrix->iterations = iteration;
+	return 1;
+}
+
+/// @brief Hands a copy of a host matrix to the renderer if it is waiting for a frame, the
+// simulation never waits for the renderer
+void render_host_matrix(int iteration, double *values)
+{
+	if (!is_display_iteration(iteration))
+		return;
+	double *sample = renderer_begin_publish(renderer);
+	if (sample == NULL)
+		return;
+	memcpy(sample, values, sizeof(double) * matrix->total_size);
+	renderer_end_publish(renderer, iteration);
+}
+
+/// @brief Queues a copy of a host matrix for the snapshot writer
+void snapshot_host_matrix(int iteration, double *values)
+{
+	void *buffer = snapshot_acquire(snapshot_writer, iteration);
+	precision_pack(options.precision, values, buffer, matrix->total_size);
+	snapshot_submit(snapshot_writer, NULL);
+}
 
-	allocate_device_memory();
-	matrix->decay_rate = 0.02;
-	init_color(matrix, &color_array);
+/// @brief Queues a copy of a host matrix for the checkpoint writer
+void checkpoint_host_matrix(int iteration, double *values)
+{
+	void *buffer = checkpoint_acquire(checkpoint_writer, iteration);
+	precision_pack(options.precision, values, buffer, matrix->total_size);
+	checkpoint_submit(checkpoint_writer, NULL);
+}
 
-	printf("\n\nInitial Temperature Matrix:\n\n");
+/// @brief Runs the simulation uploading the matrices before and reading them back after every
+// iteration, the decay and the swap of the matrices are done on the host
+/// @param worker_count how many worker items/GPU threads to use
+/// @param worker_group_size how many worker items are inside a group
+/// @return 1 if error, 0 if no error
+int run_staged(size_t worker_count, size_t worker_group_size)
+{
+	int rc;
+	// Matrix of the previous iteration, only kept for the convergence checks
+	double *previous_matrix = NULL;
+	if (options.converge_every > 0)
+	{
+		previous_matrix = (double *)malloc(sizeof(double) * matrix->total_size);
+		if (previous_matrix == NULL)
+		{
+			perror("Error allocating memory for 'previous_matrix'\n");
+			return 1;
+		}
+	}
 
-	color_matrix(matrix);
-	print_current_matrix(matrix);
-	for (int iteration = 0; iteration < matrix->iterations; iteration++)
+	for (int iteration = start_iteration; iteration < matrix->iterations; iteration++)
 	{
 		if (setup_iteration(&worker_group_size))
 		{
-			return -1;
+			return 1;
 		}
 
 		// Execute kernel
@@ -466,12 +1079,1140 @@ int main(int argc, char **argv)
 		rc = clEnqueueReadBuffer(commandQueue, next_matrix_cl, CL_TRUE, 0, sizeof(double) * matrix->total_size, matrix->next_matrix, 0, NULL, NULL);
 		handleError(rc, __LINE__, __FILE__);
 
+		if (is_convergence_iteration(iteration + 1))
+			memcpy(previous_matrix, matrix->curr_matrix, sizeof(double) * matrix->total_size);
 		update_matrix(matrix);
 		decay_temperature(matrix);
 
-		_sleep(1000);
-		printf("\n\nIteration %d:\n\n", iteration + 1);
-		color_matrix(matrix);
+		if (is_snapshot_iteration(iteration + 1))
+			snapshot_host_matrix(iteration + 1, matrix->curr_matrix);
+		if (is_checkpoint_iteration(iteration + 1))
+			checkpoint_host_matrix(iteration + 1, matrix->curr_matrix);
+		if (is_statistics_iteration(iteration + 1))
+		{
+			// The matrix is on the host anyway in this mode
+			double partial[STATISTICS_FIELDS];
+			FieldStatistics statistics;
+			statistics_reset(partial);
+			statistics_accumulate(partial, matrix->curr_matrix, matrix->type_mask->fluid_bits, 0, matrix->total_size);
+			statistics_finish(partial, iteration + 1, &statistics);
+			apply_statistics(&statistics);
+		}
+		render_host_matrix(iteration + 1, matrix->curr_matrix);
+		if (is_convergence_iteration(iteration + 1))
+		{
+			double partial[STATISTICS_FIELDS];
+			FieldStatistics change;
+			statistics_reset(partial);
+			statistics_accumulate_change(partial, matrix->curr_matrix, previous_matrix, matrix->type_mask->fluid_bits, 0,
+										 matrix->total_size);
+			statistics_finish(partial, iteration + 1, &change);
+			apply_change(&change);
+			if (stop_if_converged(iteration + 1))
+				break;
+		}
+	}
+	free(previous_matrix);
+
+	// The result of an iteration is the decayed matrix, like in the other modes
+	memcpy(matrix->next_matrix, matrix->curr_matrix, sizeof(double) * matrix->total_size);
+	return 0;
+}
+
+/// @brief Returns the name of the kernel to compile for the selected options
+char *kernel_name()
+{
+	if (!options.resident)
+		return "temperature_calculations";
+	if (options.kernel_variant == KERNEL_TILED)
+		return "temperature_step_tiled";
+	if (options.kernel_variant == KERNEL_TEMPORAL)
+		return "temperature_step_temporal";
+	if (options.kernel_variant == KERNEL_SPARSE)
+		return "temperature_step_sparse";
+	if (options.kernel_variant == KERNEL_ACTIVE)
+		return "temperature_step_active";
+	return "temperature_step";
+}
+
+/// @brief Rounds value up to a multiple of step
+size_t round_up(size_t value, size_t step)
+{
+	return (value + step - 1) / step * step;
+}
+
+/// @brief Picks the launch geometry when the worker arguments are not given: the profile stored by
+// `benchmark --autotune` for the device, the precision and the closest grid size class, or one
+// worker per cell in groups of AUTOTUNE_DEFAULT_GROUP. A profile of the tiled or temporal kernel
+// also selects that kernel in resident runs, unless a kernel, tile or steps per launch is given;
+// the staged mode only takes the geometry of the linear kernel
+/// @param device device of the run, NULL over several devices where only the defaults apply
+void choose_launch_geometry(cl_device_id device, size_t *worker_count, size_t *worker_group_size)
+{
+	if (*worker_count > 0)
+		return;
+
+	LaunchProfile profile;
+	size_t max_work_group_size = AUTOTUNE_DEFAULT_GROUP;
+	int found = 0;
+	if (device != NULL)
+	{
+		int rc = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(max_work_group_size), &max_work_group_size, NULL);
+		handleError(rc, __LINE__, __FILE__);
+		char device_key[AUTOTUNE_LINE_LENGTH / 2];
+		autotune_device_key(device, device_key, sizeof(device_key));
+		found = options.profile_file != NULL &&
+				autotune_load(options.profile_file, device_key, options.precision,
+							  autotune_size_class(matrix->dim[0], matrix->dim[1]), &profile) == 0;
+		if (found)
+		{
+			// The profile may come from another size class, its workers are counted for this grid
+			cl_uint compute_units;
+			rc = clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(compute_units), &compute_units, NULL);
+			handleError(rc, __LINE__, __FILE__);
+			profile.worker_count = autotune_worker_count(&profile, matrix->dim[0], matrix->dim[1], compute_units);
+		}
+	}
+	if (!found)
+	{
+		autotune_default_profile(matrix->dim[0], matrix->dim[1], max_work_group_size, &profile);
+		printf("No launch profile for this device and grid size, %zu workers in groups of %zu\n",
+			   profile.worker_count, profile.worker_group_size);
+	}
+	*worker_count = profile.worker_count;
+	*worker_group_size = profile.worker_group_size;
+	if (!found)
+		return;
+
+	if (profile.kernel_variant != AUTOTUNE_KERNEL_LINEAR && options.kernel_variant == KERNEL_LINEAR && !options.kernel_given &&
+		options.resident)
+	{
+		options.kernel_variant = profile.kernel_variant == AUTOTUNE_KERNEL_TILED ? KERNEL_TILED : KERNEL_TEMPORAL;
+		options.tile_width = profile.tile_width;
+		options.tile_height = profile.tile_height;
+		options.steps_per_launch = profile.kernel_variant == AUTOTUNE_KERNEL_TEMPORAL ? profile.steps_per_launch : 1;
+		printf("Launch profile of %s: %s kernel, %zux%zu tiles, %d steps per launch\n", options.profile_file,
+			   autotune_kernel_name(profile.kernel_variant), options.tile_width, options.tile_height,
+			   options.steps_per_launch);
+	}
+	else
+		printf("Launch profile of %s: %zu workers in groups of %zu\n", options.profile_file, *worker_count,
+			   *worker_group_size);
+}
+
+/// @brief Sets the arguments of the resident kernel of a slab that do not change between launches
+// and computes its launch geometry, the resident mode runs the whole matrix as a single slab
+/// @param worker_count how many worker items/GPU threads to use over the whole matrix
+/// @param worker_group_size how many worker items are inside a group
+/// @return 1 if error, 0 if no error
+int setup_slab_kernel(DeviceSlab *slab, size_t worker_count, size_t worker_group_size)
+{
+	int rc;
+	size_t max_work_group_size;
+
+	if (options.kernel_variant == KERNEL_SPARSE)
+	{
+		rc = clSetKernelArg(slab->kernel, 1, sizeof(cl_mem), &slab->fluid_cells_cl);
+		handleError(rc, __LINE__, __FILE__);
+		rc = clSetKernelArg(slab->kernel, 2, sizeof(cl_mem), &slab->neighbour_offsets_cl);
+		handleError(rc, __LINE__, __FILE__);
+		rc = clSetKernelArg(slab->kernel, 5, sizeof(cl_mem), &slab->neighbour_cells_cl);
+		handleError(rc, __LINE__, __FILE__);
+		rc = clSetKernelArg(slab->kernel, 6, sizeof(int), &slab->fluid_index->fluid_count);
+		handleError(rc, __LINE__, __FILE__);
+	}
+	else
+	{
+		rc = clSetKernelArg(slab->kernel, 1, sizeof(cl_mem), &slab->type_matrix_cl);
+		handleError(rc, __LINE__, __FILE__);
+		rc = clSetKernelArg(slab->kernel, 2, sizeof(cl_mem), &slab->dim_cl);
+		handleError(rc, __LINE__, __FILE__);
+	}
+	// The kernels take the decay rate in the precision they compute with
+	float decay_rate_float = (float)matrix->decay_rate;
+	void *decay_rate_arg = real_bytes == sizeof(float) ? (void *)&decay_rate_float : (void *)&matrix->decay_rate;
+	rc = clSetKernelArg(slab->kernel, 4, real_bytes, decay_rate_arg);
+	handleError(rc, __LINE__, __FILE__);
+
+	rc = clGetKernelWorkGroupInfo(slab->kernel, slab->device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_work_group_size), &max_work_group_size, NULL);
+	handleError(rc, __LINE__, __FILE__);
+
+	// Launch geometry, the linear kernel uses the worker arguments as they are, shared between the
+	// slabs in proportion to their lines
+	slab->work_dim = 1;
+	slab->local_size[0] = fmin(worker_group_size, max_work_group_size);
+	slab->local_size[1] = 1;
+	slab->global_size[0] = worker_count;
+	slab->global_size[1] = 1;
+	if (slab->stored_count < matrix->dim[0])
+		slab->global_size[0] = round_up(fmax(1, worker_count * slab->stored_count / matrix->dim[0]), slab->local_size[0]);
+
+	if (options.kernel_variant == KERNEL_TILED || options.kernel_variant == KERNEL_TEMPORAL)
+	{
+		if (options.tile_width * options.tile_height > max_work_group_size)
+		{
+			fprintf(stderr, "Tile %zux%zu exceeds the maximum work group size %zu\n",
+					options.tile_width, options.tile_height, max_work_group_size);
+			return 1;
+		}
+		// Dimension 0 runs over the columns, which are contiguous in memory
+		slab->work_dim = 2;
+		slab->local_size[0] = options.tile_width;
+		slab->local_size[1] = options.tile_height;
+		slab->global_size[0] = round_up(matrix->dim[1], options.tile_width);
+		slab->global_size[1] = round_up(slab->stored_count, options.tile_height);
+	}
+	if (options.kernel_variant == KERNEL_TILED)
+	{
+		size_t tile_cells = (options.tile_width + 2) * (options.tile_height + 2);
+		rc = clSetKernelArg(slab->kernel, 5, real_bytes * tile_cells, NULL);
+		handleError(rc, __LINE__, __FILE__);
+		rc = clSetKernelArg(slab->kernel, 6, sizeof(char) * tile_cells, NULL);
+		handleError(rc, __LINE__, __FILE__);
+	}
+	if (options.kernel_variant == KERNEL_TEMPORAL)
+	{
+		cl_ulong local_mem_size;
+		rc = clGetDeviceInfo(slab->device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(local_mem_size), &local_mem_size, NULL);
+		handleError(rc, __LINE__, __FILE__);
+		size_t halo = 2 * options.steps_per_launch;
+		size_t tile_bytes = (2 * real_bytes + sizeof(char)) * (options.tile_width + halo) * (options.tile_height + halo);
+		if (tile_bytes > local_mem_size)
+		{
+			fprintf(stderr, "Tile %zux%zu with a halo of %d cells needs %zu bytes of local memory, the device has %lu\n",
+					options.tile_width, options.tile_height, options.steps_per_launch, tile_bytes,
+					(unsigned long)local_mem_size);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/// @brief Sets the arguments of the temporal kernel that depend on the iterations of a launch, the
+// halo and so the local buffers shrink with the last launches
+void set_launch_steps(cl_kernel step_kernel, int steps)
+{
+	int rc;
+	size_t tile_cells = (options.tile_width + 2 * steps) * (options.tile_height + 2 * steps);
+	rc = clSetKernelArg(step_kernel, 5, sizeof(int), &steps);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(step_kernel, 6, real_bytes * tile_cells, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(step_kernel, 7, real_bytes * tile_cells, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(step_kernel, 8, sizeof(char) * tile_cells, NULL);
+	handleError(rc, __LINE__, __FILE__);
+}
+
+/// @brief Uploads the first list of active tiles, every tile, and sets the arguments of the
+// active kernel and of the kernel listing the tiles. The active kernel runs one work group per
+// tile of the matrix
+/// @return 1 if error, 0 if no error
+int setup_active_kernels(DeviceSlab *whole)
+{
+	int rc;
+	int counts[5] = {active_tiles->tile_count, 0, active_tiles->tile_count, 0, 0};
+	rc = clEnqueueWriteBuffer(commandQueue, active_tiles_cl, CL_FALSE, 0, sizeof(int) * active_tiles->tile_count, active_tiles->active, 0, NULL, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clEnqueueWriteBuffer(commandQueue, active_counts_cl, CL_TRUE, 0, sizeof(counts), counts, 0, NULL, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	void *zero_changes = calloc(2 * active_tiles->tile_count, real_bytes);
+	if (zero_changes == NULL)
+	{
+		perror("Error allocating memory for 'zero_changes'\n");
+		return 1;
+	}
+	rc = clEnqueueWriteBuffer(commandQueue, tile_changes_cl, CL_TRUE, 0, real_bytes * 2 * active_tiles->tile_count, zero_changes, 0, NULL, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	free(zero_changes);
+
+	rc = clSetKernelArg(kernel, 5, sizeof(cl_mem), &active_tiles_cl);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(kernel, 6, sizeof(cl_mem), &active_counts_cl);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(kernel, 7, sizeof(cl_mem), &tile_changes_cl);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(kernel, 9, sizeof(int), &active_tiles->tile_size);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(kernel, 10, real_bytes * whole->local_size[0], NULL);
+	handleError(rc, __LINE__, __FILE__);
+	whole->global_size[0] = whole->local_size[0] * active_tiles->tile_count;
+
+	// The kernels take epsilon in the precision they compute with, like the decay rate
+	float epsilon_float = (float)active_tiles->epsilon;
+	void *epsilon_arg = real_bytes == sizeof(float) ? (void *)&epsilon_float : (void *)&active_tiles->epsilon;
+	active_list_kernel = clCreateKernel(program, "temperature_active_tiles", &rc);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(active_list_kernel, 0, sizeof(cl_mem), &dim_cl);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(active_list_kernel, 1, sizeof(cl_mem), &tile_changes_cl);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(active_list_kernel, 3, sizeof(int), &active_tiles->tile_size);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(active_list_kernel, 4, real_bytes, epsilon_arg);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(active_list_kernel, 5, sizeof(cl_mem), &active_tiles_cl);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(active_list_kernel, 6, sizeof(cl_mem), &active_counts_cl);
+	handleError(rc, __LINE__, __FILE__);
+	return 0;
+}
+
+/// @brief Queues the launch of the active kernel of one step and the listing of the tiles of the
+// next one, the two lists and changes alternate between the steps
+void enqueue_active_step(DeviceSlab *whole, int iteration)
+{
+	int rc;
+	int parity = iteration % 2;
+	size_t tile_items = round_up(active_tiles->tile_count, 64);
+	rc = clSetKernelArg(kernel, 8, sizeof(int), &parity);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clEnqueueNDRangeKernel(commandQueue, kernel, 1, NULL, whole->global_size, whole->local_size, 0, NULL, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clSetKernelArg(active_list_kernel, 2, sizeof(int), &parity);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clEnqueueNDRangeKernel(commandQueue, active_list_kernel, 1, NULL, &tile_items, NULL, 0, NULL, NULL);
+	handleError(rc, __LINE__, __FILE__);
+}
+
+/// @brief Reads back how many tiles the device computed over the iterations of the run
+void finish_active_tiles(int iterations)
+{
+	int rc;
+	int counts[5];
+	rc = clEnqueueReadBuffer(commandQueue, active_counts_cl, CL_TRUE, 0, sizeof(counts), counts, 0, NULL, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	// The last listing prepared a step that never ran
+	active_tiles->computed_tiles = counts[2] - counts[iterations % 2];
+	active_tiles->steps = iterations;
+}
+
+/// @brief Runs the simulation with both matrices resident on the device. The matrices are
+// uploaded once, swap roles between launches and the decay is applied by the kernel, so the host
+// only reads data back for the requested snapshots and for the final result
+/// @param worker_count how many worker items/GPU threads to use
+/// @param worker_group_size how many worker items are inside a group
+/// @return 1 if error, 0 if no error
+int run_resident(size_t worker_count, size_t worker_group_size)
+{
+	int rc;
+	cl_mem src_cl = curr_matrix_cl;
+	cl_mem dst_cl = next_matrix_cl;
+	size_t matrix_bytes = cell_bytes * matrix->total_size;
+
+	// Both matrices start equal, converted once to the device precision
+	void *initial_cells = matrix->curr_matrix;
+	if (device_cells != NULL)
+	{
+		precision_pack(options.precision, matrix->curr_matrix, device_cells, matrix->total_size);
+		initial_cells = device_cells;
+	}
+
+	// Move data from host to device, once for the whole run
+	int mapped_result = zero_copy && grid_is_mapped(matrix->mapping, matrix->curr_matrix);
+	if (mapped_result)
+	{
+		// The mapped matrix now belongs to curr_matrix_cl, the host reads results into its own memory
+		double *host_matrix = matrix->next_matrix;
+		matrix->next_matrix = matrix->curr_matrix;
+		matrix->curr_matrix = host_matrix;
+	}
+	if (!zero_copy)
+	{
+		rc = clEnqueueWriteBuffer(commandQueue, curr_matrix_cl, CL_FALSE, 0, matrix_bytes, initial_cells, 0, NULL, NULL);
+		handleError(rc, __LINE__, __FILE__);
+	}
+	rc = clEnqueueWriteBuffer(commandQueue, type_matrix_cl, CL_FALSE, 0, sizeof(uint32_t) * type_mask_words(matrix->total_size), matrix->type_mask->fluid_bits, 0, NULL, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clEnqueueWriteBuffer(commandQueue, next_matrix_cl, CL_FALSE, 0, matrix_bytes, initial_cells, 0, NULL, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	rc = clEnqueueWriteBuffer(commandQueue, dim_cl, CL_TRUE, 0, sizeof(int) * 2, matrix->dim, 0, NULL, NULL);
+	handleError(rc, __LINE__, __FILE__);
+
+	if (options.kernel_variant == KERNEL_SPARSE)
+	{
+		int neighbour_count = fluid_index->neighbour_offsets[fluid_index->fluid_count];
+		rc = clEnqueueWriteBuffer(commandQueue, fluid_cells_cl, CL_FALSE, 0, sizeof(int) * (fluid_index->fluid_count + 1), fluid_index->fluid_cells, 0, NULL, NULL);
+		handleError(rc, __LINE__, __FILE__);
+		rc = clEnqueueWriteBuffer(commandQueue, neighbour_offsets_cl, CL_FALSE, 0, sizeof(int) * (fluid_index->fluid_count + 1), fluid_index->neighbour_offsets, 0, NULL, NULL);
+		handleError(rc, __LINE__, __FILE__);
+		rc = clEnqueueWriteBuffer(commandQueue, neighbour_cells_cl, CL_TRUE, 0, sizeof(int) * (neighbour_count + 1), fluid_index->neighbour_cells, 0, NULL, NULL);
+		handleError(rc, __LINE__, __FILE__);
+	}
+
+	// The whole matrix is the only slab
+	DeviceSlab whole = {deviceid, commandQueue, program, kernel};
+	whole.line_count = whole.stored_count = matrix->dim[0];
+	whole.matrix_cl[0] = curr_matrix_cl;
+	whole.matrix_cl[1] = next_matrix_cl;
+	whole.type_matrix_cl = type_matrix_cl;
+	whole.dim_cl = dim_cl;
+	whole.fluid_index = fluid_index;
+	whole.fluid_cells_cl = fluid_cells_cl;
+	whole.neighbour_offsets_cl = neighbour_offsets_cl;
+	whole.neighbour_cells_cl = neighbour_cells_cl;
+	if (setup_slab_kernel(&whole, worker_count, worker_group_size))
+	{
+		return 1;
+	}
+	if (options.kernel_variant == KERNEL_ACTIVE && setup_active_kernels(&whole))
+	{
+		return 1;
+	}
+
+	// Statistics are reduced on the device and read back a few iterations later
+	DeviceStatistics *device_statistics = NULL;
+	FieldStatistics statistics;
+	if (renderer != NULL || options.statistics_every > 0)
+	{
+		device_statistics = device_statistics_create(context, deviceid, program, options.precision, type_matrix_cl,
+													 matrix->total_size);
+		if (device_statistics == NULL)
+		{
+			return 1;
+		}
+	}
+	// Changes are reduced in their own ring, so the checks never wait behind the statistics
+	DeviceStatistics *device_change = NULL;
+	FieldStatistics change;
+	if (options.converge_every > 0)
+	{
+		device_change = device_statistics_create(context, deviceid, program, options.precision, type_matrix_cl,
+												 matrix->total_size);
+		if (device_change == NULL)
+		{
+			return 1;
+		}
+	}
+
+	cl_event render_event = NULL;
+	double *render_sample = NULL;
+	int render_iteration = 0;
+	int steps = 1;
+	for (int iteration = start_iteration; iteration < matrix->iterations; iteration += steps)
+	{
+		rc = clSetKernelArg(kernel, 0, sizeof(cl_mem), &src_cl);
+		handleError(rc, __LINE__, __FILE__);
+		rc = clSetKernelArg(kernel, 3, sizeof(cl_mem), &dst_cl);
+		handleError(rc, __LINE__, __FILE__);
+
+		if (options.kernel_variant == KERNEL_TEMPORAL)
+		{
+			// Do not run past the end or past the next display or snapshot
+			steps = fmin(options.steps_per_launch, iterations_until_output(iteration));
+			// The other matrix only holds the iteration before the last of a single step launch
+			if (steps > 1 && is_convergence_iteration(iteration + steps))
+				steps--;
+			set_launch_steps(kernel, steps);
+		}
+
+		// Launches are queued back to back, the in-order queue serialises them
+		if (options.kernel_variant == KERNEL_ACTIVE)
+			enqueue_active_step(&whole, iteration);
+		else
+		{
+			rc = clEnqueueNDRangeKernel(commandQueue, kernel, whole.work_dim, NULL, whole.global_size, whole.local_size, 0, NULL, NULL);
+			handleError(rc, __LINE__, __FILE__);
+		}
+
+		cl_mem swap_cl = src_cl;
+		src_cl = dst_cl;
+		dst_cl = swap_cl;
+
+		if (is_snapshot_iteration(iteration + steps))
+		{
+			// The read is queued behind the launch and the writer thread waits for it, the next
+			// launches only write the other buffer so they can be queued right away. Frames are
+			// stored in the device precision, so nothing is converted
+			cl_event read_event;
+			void *buffer = snapshot_acquire(snapshot_writer, iteration + steps);
+			rc = clEnqueueReadBuffer(commandQueue, src_cl, CL_FALSE, 0, matrix_bytes, buffer, 0, NULL, &read_event);
+			handleError(rc, __LINE__, __FILE__);
+			clFlush(commandQueue);
+			snapshot_submit(snapshot_writer, read_event);
+		}
+		if (is_checkpoint_iteration(iteration + steps))
+		{
+			// Same as the snapshots, the writer thread waits for the read and diffs the tiles
+			cl_event read_event;
+			void *buffer = checkpoint_acquire(checkpoint_writer, iteration + steps);
+			rc = clEnqueueReadBuffer(commandQueue, src_cl, CL_FALSE, 0, matrix_bytes, buffer, 0, NULL, &read_event);
+			handleError(rc, __LINE__, __FILE__);
+			clFlush(commandQueue);
+			checkpoint_submit(checkpoint_writer, read_event);
+		}
+		if (device_statistics != NULL && is_statistics_iteration(iteration + steps))
+		{
+			// Only wait when every slot is in flight, which means the device is far behind
+			while (device_statistics_poll(device_statistics, &statistics, device_statistics_pending(device_statistics) == STATISTICS_SLOTS))
+				apply_statistics(&statistics);
+			device_statistics_enqueue(device_statistics, commandQueue, src_cl, iteration + steps);
+		}
+		if (device_statistics != NULL)
+			while (device_statistics_poll(device_statistics, &statistics, 0))
+				apply_statistics(&statistics);
+		if (device_change != NULL && is_convergence_iteration(iteration + steps))
+		{
+			while (device_statistics_poll(device_change, &change, device_statistics_pending(device_change) == STATISTICS_SLOTS))
+				apply_change(&change);
+			device_statistics_enqueue_change(device_change, commandQueue, src_cl, dst_cl, 0, matrix->total_size,
+											 iteration + steps);
+		}
+		if (device_change != NULL)
+			while (device_statistics_poll(device_change, &change, 0))
+				apply_change(&change);
+
+		// Frames for the renderer are read without blocking and handed over once the read completed
+		if (render_event != NULL)
+		{
+			cl_int status;
+			rc = clGetEventInfo(render_event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL);
+			handleError(rc, __LINE__, __FILE__);
+			handleError(status < 0 ? status : CL_SUCCESS, __LINE__, __FILE__);
+			if (status == CL_COMPLETE)
+			{
+				clReleaseEvent(render_event);
+				render_event = NULL;
+				if (device_cells != NULL)
+					precision_unpack(options.precision, device_cells, render_sample, matrix->total_size);
+				renderer_end_publish(renderer, render_iteration);
+			}
+		}
+		if (render_event == NULL && is_display_iteration(iteration + steps))
+		{
+			render_sample = renderer_begin_publish(renderer);
+			if (render_sample != NULL)
+			{
+				// Reduced precision frames go through device_cells and are converted once read
+				render_iteration = iteration + steps;
+				void *frame = device_cells != NULL ? device_cells : (void *)render_sample;
+				rc = clEnqueueReadBuffer(commandQueue, src_cl, CL_FALSE, 0, matrix_bytes, frame, 0, NULL, &render_event);
+				handleError(rc, __LINE__, __FILE__);
+				clFlush(commandQueue);
+			}
+		}
+		if (stop_if_converged(iteration + steps))
+			break;
+	}
+	if (render_event != NULL)
+	{
+		rc = clWaitForEvents(1, &render_event);
+		handleError(rc, __LINE__, __FILE__);
+		clReleaseEvent(render_event);
+		if (device_cells != NULL)
+			precision_unpack(options.precision, device_cells, render_sample, matrix->total_size);
+		renderer_end_publish(renderer, render_iteration);
+	}
+	if (device_statistics != NULL)
+	{
+		while (device_statistics_poll(device_statistics, &statistics, 1))
+			apply_statistics(&statistics);
+		device_statistics_destroy(device_statistics);
+	}
+	if (device_change != NULL)
+	{
+		while (device_statistics_poll(device_change, &change, 1))
+			apply_change(&change);
+		device_statistics_destroy(device_change);
+	}
+	if (options.kernel_variant == KERNEL_ACTIVE)
+		finish_active_tiles(matrix->iterations);
+
+	// The last written matrix is the result
+	void *result_cells = device_cells != NULL ? device_cells : (void *)matrix->curr_matrix;
+	rc = clEnqueueReadBuffer(commandQueue, src_cl, CL_TRUE, 0, matrix_bytes, result_cells, 0, NULL, NULL);
+	handleError(rc, __LINE__, __FILE__);
+	precision_unpack(options.precision, result_cells, matrix->curr_matrix, matrix->total_size);
+	if (mapped_result)
+		matrix->next_matrix = matrix->curr_matrix;
+	else
+		memcpy(matrix->next_matrix, matrix->curr_matrix, sizeof(double) * matrix->total_size);
+	return 0;
+}
+
+/// @brief Splits the matrix in row slabs over the selected devices and builds the kernel of
+// every slab for its size, all the devices share a single context
+/// @return 1 if error, 0 if no error
+int setup_multi_device()
+{
+	int rc;
+	int device_count;
+	cl_device_id *devices = initOpenCLDevices(&context, options.devices, options.sub_devices, &device_count);
+	cell_bytes = precision_cell_bytes(options.precision);
+	real_bytes = precision_real_bytes(options.precision);
+	if (options.precision != PRECISION_FP64)
+	{
+		device_cells = malloc(cell_bytes * matrix->total_size);
+		if (device_cells == NULL)
+		{
+			perror("Error allocating memory for 'device_cells'\n");
+			free(devices);
+			return 1;
+		}
+	}
+
+	decomposition = decomposition_create(context, devices, device_count, matrix->dim[0], matrix->dim[1], options.halo,
+										 cell_bytes);
+	free(devices);
+	if (decomposition == NULL)
+	{
+		return 1;
+	}
+	if (options.kernel_variant == KERNEL_SPARSE && decomposition_use_fluid_index(decomposition, context, matrix->type_mask->fluid_bits))
+	{
+		return 1;
+	}
+
+	for (int s = 0; s < decomposition->slab_count; s++)
+	{
+		DeviceSlab *slab = &decomposition->slabs[s];
+		char build_options[256];
+		program_build_options(build_options, sizeof(build_options), slab->stored_count);
+		slab->program = getCachedProgram("homework.cl", build_options, options.kernel_cache, context, slab->device);
+		slab->kernel = clCreateKernel(slab->program, kernel_name(), &rc);
+		handleError(rc, __LINE__, __FILE__);
+	}
+	return 0;
+}
+
+/// @brief Combines the oldest change reduced by every slab over its owned lines, the slabs queue
+// their reductions in step so their rings hold the same iterations
+/// @param slab_changes reductions of the slabs, in the order of the slabs
+/// @param wait 1 to wait for the slabs, 0 to return at once if one of them is not done
+/// @return 1 if a change was applied, 0 if none is pending or done
+int poll_slab_changes(DeviceStatistics **slab_changes, int wait)
+{
+	if (device_statistics_pending(slab_changes[0]) == 0)
+		return 0;
+	for (int s = 0; s < decomposition->slab_count && !wait; s++)
+		if (!device_statistics_done(slab_changes[s]))
+			return 0;
+
+	FieldStatistics change, slab_change;
+	change.fluid_count = 0;
+	for (int s = 0; s < decomposition->slab_count; s++)
+	{
+		device_statistics_poll(slab_changes[s], &slab_change, 1);
+		statistics_combine(&change, &slab_change);
+	}
+	change.iteration = slab_change.iteration;
+	apply_change(&change);
+	return 1;
+}
+
+/// @brief Runs the simulation over the row slabs of several devices. Every slab runs like the
+// resident mode on its own queue for up to halo iterations, then the slabs exchange the lines
+// around their boundaries through the host. Snapshots, statistics and frames gather the slabs on
+// the host, which waits for the devices at those iterations only
+/// @param worker_count how many worker items/GPU threads to use over the whole matrix
+/// @param worker_group_size how many worker items are inside a group
+/// @return 1 if error, 0 if no error
+int run_multi_device(size_t worker_count, size_t worker_group_size)
+{
+	int rc;
+	void *host_cells = matrix->curr_matrix;
+	if (device_cells != NULL)
+	{
+		precision_pack(options.precision, matrix->curr_matrix, device_cells, matrix->total_size);
+		host_cells = device_cells;
+	}
+	decomposition_upload(decomposition, host_cells, matrix->type_mask->fluid_bits);
+	for (int s = 0; s < decomposition->slab_count; s++)
+	{
+		if (setup_slab_kernel(&decomposition->slabs[s], worker_count, worker_group_size))
+		{
+			return 1;
+		}
+	}
+
+	// Every slab reduces the change of its owned lines on its own device
+	DeviceStatistics **slab_changes = NULL;
+	if (options.converge_every > 0)
+	{
+		slab_changes = (DeviceStatistics **)calloc(decomposition->slab_count, sizeof(DeviceStatistics *));
+		if (slab_changes == NULL)
+		{
+			perror("Error allocating memory for 'slab_changes'\n");
+			return 1;
+		}
+		for (int s = 0; s < decomposition->slab_count; s++)
+		{
+			DeviceSlab *slab = &decomposition->slabs[s];
+			slab_changes[s] = device_statistics_create(context, slab->device, slab->program, options.precision,
+													   slab->type_matrix_cl, slab->stored_count * matrix->dim[1]);
+			if (slab_changes[s] == NULL)
+			{
+				return 1;
+			}
+		}
+	}
+
+	// Matrix of every slab holding the latest iteration, the slabs swap in step
+	int current = 0;
+	int steps;
+	for (int iteration = start_iteration; iteration < matrix->iterations; iteration += steps)
+	{
+		// The slabs run apart until the halos are used up or the matrix has to be output
+		steps = fmin(decomposition->halo, iterations_until_output(iteration));
+		int launch_steps = 1;
+		for (int step = 0; step < steps; step += launch_steps)
+		{
+			if (options.kernel_variant == KERNEL_TEMPORAL)
+			{
+				launch_steps = fmin(options.steps_per_launch, steps - step);
+				// A checked iteration is reached by a single step launch, see run_resident()
+				if (launch_steps > 1 && step + launch_steps == steps && is_convergence_iteration(iteration + steps))
+					launch_steps--;
+			}
+			for (int s = 0; s < decomposition->slab_count; s++)
+			{
+				DeviceSlab *slab = &decomposition->slabs[s];
+				rc = clSetKernelArg(slab->kernel, 0, sizeof(cl_mem), &slab->matrix_cl[current]);
+				handleError(rc, __LINE__, __FILE__);
+				rc = clSetKernelArg(slab->kernel, 3, sizeof(cl_mem), &slab->matrix_cl[1 - current]);
+				handleError(rc, __LINE__, __FILE__);
+				if (options.kernel_variant == KERNEL_TEMPORAL)
+					set_launch_steps(slab->kernel, launch_steps);
+				rc = clEnqueueNDRangeKernel(slab->queue, slab->kernel, slab->work_dim, NULL, slab->global_size, slab->local_size, 0, NULL, NULL);
+				handleError(rc, __LINE__, __FILE__);
+			}
+			current = 1 - current;
+		}
+		int reached = iteration + steps;
+		if (slab_changes != NULL && is_convergence_iteration(reached))
+		{
+			while (poll_slab_changes(slab_changes, device_statistics_pending(slab_changes[0]) == STATISTICS_SLOTS))
+				;
+			// Queued before the exchange, which only rewrites the halo lines the reduction leaves out
+			for (int s = 0; s < decomposition->slab_count; s++)
+			{
+				DeviceSlab *slab = &decomposition->slabs[s];
+				int first_cell = (slab->first_line - slab->stored_first) * matrix->dim[1];
+				device_statistics_enqueue_change(slab_changes[s], slab->queue, slab->matrix_cl[current],
+												 slab->matrix_cl[1 - current], first_cell,
+												 first_cell + slab->line_count * matrix->dim[1], reached);
+			}
+		}
+		if (slab_changes != NULL)
+			while (poll_slab_changes(slab_changes, 0))
+				;
+		if (reached < matrix->iterations)
+			decomposition_exchange(decomposition, current);
+
+		if (is_snapshot_iteration(reached) || is_checkpoint_iteration(reached) || is_statistics_iteration(reached) ||
+			is_display_iteration(reached))
+		{
+			decomposition_gather(decomposition, current, host_cells);
+			precision_unpack(options.precision, host_cells, matrix->curr_matrix, matrix->total_size);
+			if (is_snapshot_iteration(reached))
+				snapshot_host_matrix(reached, matrix->curr_matrix);
+			if (is_checkpoint_iteration(reached))
+				checkpoint_host_matrix(reached, matrix->curr_matrix);
+			if (is_statistics_iteration(reached))
+			{
+				double partial[STATISTICS_FIELDS];
+				FieldStatistics statistics;
+				statistics_reset(partial);
+				statistics_accumulate(partial, matrix->curr_matrix, matrix->type_mask->fluid_bits, 0, matrix->total_size);
+				statistics_finish(partial, reached, &statistics);
+				apply_statistics(&statistics);
+			}
+			render_host_matrix(reached, matrix->curr_matrix);
+		}
+		if (stop_if_converged(reached))
+			break;
+	}
+	if (slab_changes != NULL)
+	{
+		while (poll_slab_changes(slab_changes, 1))
+			;
+		for (int s = 0; s < decomposition->slab_count; s++)
+			device_statistics_destroy(slab_changes[s]);
+		free(slab_changes);
+	}
+
+	decomposition_gather(decomposition, current, host_cells);
+	precision_unpack(options.precision, host_cells, matrix->curr_matrix, matrix->total_size);
+	memcpy(matrix->next_matrix, matrix->curr_matrix, sizeof(double) * matrix->total_size);
+	return 0;
+}
+
+/// @brief Runs the simulation on the host with the multithreaded CPU backend, the matrices
+// swap roles between iterations like in the resident OpenCL mode
+/// @return 1 if error, 0 if no error
+int run_cpu()
+{
+	CPUBackend *backend = cpu_backend_create(matrix->dim[0], matrix->dim[1], matrix->type_mask->fluid_bits,
+											 matrix->decay_rate, options.cpu_threads);
+	if (backend == NULL)
+	{
+		return 1;
+	}
+	if (fluid_index != NULL)
+		cpu_backend_use_fluid_index(backend, fluid_index);
+	if (active_tiles != NULL)
+		cpu_backend_use_active_tiles(backend, active_tiles);
+	printf("CPU backend running on %d threads (%s)\n", cpu_backend_thread_count(backend),
+		   cpu_backend_simd_name(backend));
+
+	for (int iteration = start_iteration; iteration < matrix->iterations; iteration++)
+	{
+		cpu_backend_step(backend, matrix->curr_matrix, matrix->next_matrix);
+
+		double *swap_matrix = matrix->curr_matrix;
+		matrix->curr_matrix = matrix->next_matrix;
+		matrix->next_matrix = swap_matrix;
+
+		if (is_snapshot_iteration(iteration + 1))
+			snapshot_host_matrix(iteration + 1, matrix->curr_matrix);
+		if (is_checkpoint_iteration(iteration + 1))
+			checkpoint_host_matrix(iteration + 1, matrix->curr_matrix);
+		if (is_statistics_iteration(iteration + 1))
+		{
+			FieldStatistics statistics;
+			cpu_backend_statistics(backend, matrix->curr_matrix, iteration + 1, &statistics);
+			apply_statistics(&statistics);
+		}
+		render_host_matrix(iteration + 1, matrix->curr_matrix);
+		if (is_convergence_iteration(iteration + 1))
+		{
+			// next_matrix still holds the previous iteration
+			FieldStatistics change;
+			cpu_backend_change(backend, matrix->curr_matrix, matrix->next_matrix, iteration + 1, &change);
+			apply_change(&change);
+			if (stop_if_converged(iteration + 1))
+				break;
+		}
+	}
+
+	memcpy(matrix->next_matrix, matrix->curr_matrix, sizeof(double) * matrix->total_size);
+	cpu_backend_destroy(backend);
+	return 0;
+}
+
+/// @brief Runs the simulation over a binary grid file without loading it: the slabs of the grid
+// are streamed from the mapped input through the device, see _Streaming.h, and the result is
+// written to the output file pass after pass
+/// @param worker_count how many worker items/GPU threads to use over a slab, 0 when not given
+/// @param worker_group_size how many worker items are inside a group, 0 when not given
+/// @return 1 if error, 0 if no error
+int run_out_of_core(char *input_file_name, char *output_file_name, size_t worker_count, size_t worker_group_size)
+{
+	int rc;
+	matrix->mapping = grid_map_binary(input_file_name);
+	if (matrix->mapping == NULL)
+	{
+		return 1;
+	}
+	matrix->dim[0] = matrix->mapping->header->dim[0];
+	matrix->dim[1] = matrix->mapping->header->dim[1];
+	matrix->iterations = matrix->mapping->header->iterations;
+	matrix->decay_rate = matrix->mapping->header->decay_rate;
+
+	deviceid = initOpenCL(&context, &commandQueue);
+	choose_launch_geometry(deviceid, &worker_count, &worker_group_size);
+	// The slabs at the edges of the grid store fewer lines, the grid size stays a kernel argument
+	char build_options[256];
+	program_build_options(build_options, sizeof(build_options), 0);
+	program = getCachedProgram("homework.cl", build_options, options.kernel_cache, context, deviceid);
+
+	int slab_lines = options.slab_lines;
+	if (slab_lines == 0)
+		slab_lines = streaming_slab_lines(deviceid, matrix->dim[1], options.halo, options.stream_buffers,
+										  precision_cell_bytes(options.precision));
+	StreamingGrid *stream = streaming_create(context, deviceid, program, matrix->dim[0], matrix->dim[1], options.halo,
+											 slab_lines, options.stream_buffers, options.precision, matrix->decay_rate);
+	if (stream == NULL)
+	{
+		return 1;
+	}
+	stream->worker_count = worker_count;
+	stream->worker_group_size = fmin(worker_group_size, stream->worker_group_size);
+
+	rc = streaming_run(stream, matrix->mapping, output_file_name, matrix->iterations);
+	if (rc == 0)
+		printf("Out-of-core run: %d iterations in %d passes of %d slabs, %.1f MB uploaded and %.1f MB downloaded in "
+			   "%.3f s (%.1f MB/s)\n",
+			   matrix->iterations, stream->passes, stream->window_count, stream->bytes_uploaded / 1e6,
+			   stream->bytes_downloaded / 1e6, stream->seconds,
+			   (stream->bytes_uploaded + stream->bytes_downloaded) / 1e6 / fmax(stream->seconds, 1e-9));
+
+	streaming_destroy(stream);
+	clReleaseProgram(program);
+	clReleaseCommandQueue(commandQueue);
+	clReleaseContext(context);
+	return rc;
+}
+
+/// @brief Recomputes the run with the CPU backend from the initial matrix and compares the fluid
+// cells of the result with the current matrix
+/// @param initial_matrix the current iteration matrix before the run
+/// @return 1 if the matrices differ by more than the tolerance of the precision, 0 if they match
+int validate_against_cpu(double *initial_matrix)
+{
+	double *reference_matrix = (double *)malloc(sizeof(double) * matrix->total_size);
+	if (reference_matrix == NULL)
+	{
+		perror("Error allocating memory for 'reference_matrix'\n");
+		return 1;
+	}
+	CPUBackend *backend = cpu_backend_create(matrix->dim[0], matrix->dim[1], matrix->type_mask->fluid_bits,
+											 matrix->decay_rate, options.cpu_threads);
+	if (backend == NULL)
+	{
+		free(reference_matrix);
+		return 1;
+	}
+
+	double *src_matrix = initial_matrix;
+	double *dst_matrix = reference_matrix;
+	memcpy(reference_matrix, initial_matrix, sizeof(double) * matrix->total_size);
+	for (int iteration = start_iteration; iteration < matrix->iterations; iteration++)
+	{
+		cpu_backend_step(backend, src_matrix, dst_matrix);
+		double *swap_matrix = src_matrix;
+		src_matrix = dst_matrix;
+		dst_matrix = swap_matrix;
+	}
+	cpu_backend_destroy(backend);
+
+	PrecisionError error;
+	precision_compare(src_matrix, matrix->curr_matrix, matrix->type_mask->fluid_bits, matrix->total_size, &error);
+	free(reference_matrix);
+
+	// Reduced precisions are compared with the double precision reference as well
+	double tolerance = CPU_BACKEND_TOLERANCE;
+	if (options.precision == PRECISION_FP32)
+		tolerance = PRECISION_FP32_TOLERANCE;
+	else if (options.precision == PRECISION_FP16)
+		tolerance = PRECISION_FP16_TOLERANCE;
+
+	// Skipped tiles may lag the full computation by up to the bound of _ActiveTiles.h
+	double allowed_error = tolerance * error.scale;
+	if (options.active_tile > 0)
+		allowed_error += active_tiles_error_bound(options.active_epsilon, matrix->iterations);
+
+	int mismatch = error.max_error > allowed_error;
+	printf("Validation of the %s run against the CPU backend in fp64: max error %e (%e relative), rms error %e, "
+		   "tolerance %e, %s\n",
+		   precision_name(options.precision), error.max_error, error.max_error / error.scale, error.rms_error,
+		   allowed_error, mismatch ? "FAILED" : "passed");
+	return mismatch;
+}
+
+/// @brief Replaces the input matrix by the last valid record of the checkpoint file and starts
+// the run from its iteration, the run starts from the input if there is no record yet
+/// @return 1 if error, 0 if no error
+int resume_from_checkpoint()
+{
+	void *cells = malloc(precision_cell_bytes(options.precision) * matrix->total_size);
+	if (cells == NULL)
+	{
+		perror("Error allocating memory for the checkpoint\n");
+		return 1;
+	}
+	CheckpointInfo info;
+	if (checkpoint_load(options.checkpoint_file, matrix->dim, options.precision, matrix->decay_rate, cells, &info))
+	{
+		free(cells);
+		return 1;
+	}
+	if (info.iteration < 0)
+	{
+		printf("No valid checkpoint in %s, starting from the input\n", options.checkpoint_file);
+		free(cells);
+		return 0;
+	}
+	if (info.iteration > matrix->iterations)
+	{
+		fprintf(stderr, "The checkpoint of iteration %d is past the %d iterations of the run\n", info.iteration,
+				matrix->iterations);
+		free(cells);
+		return 1;
+	}
+
+	// A record holds the decayed matrix of its iteration, which every mode keeps in both matrices
+	// between two iterations and writes as its result, so a run resumed at its last iteration
+	// writes the checkpoint as it is
+	precision_unpack(options.precision, cells, matrix->curr_matrix, matrix->total_size);
+	memcpy(matrix->next_matrix, matrix->curr_matrix, sizeof(double) * matrix->total_size);
+	free(cells);
+
+	start_iteration = info.iteration;
+	color_array = info.colors;
+	checkpoint_valid_bytes = info.valid_bytes;
+	printf("Resuming from the checkpoint of iteration %d, %d records replayed from %s\n", info.iteration,
+		   info.record_count, options.checkpoint_file);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int rc;
+	char *input_file_name, *output_file_name;
+	size_t worker_count, worker_group_size;
+
+	if (get_args(argc, argv, input_file_name, output_file_name,
+				 &worker_count, &worker_group_size))
+	{
+		return -1;
+	}
+	if (pre_allocate_matrix_memory())
+	{
+		return -1;
+	}
+
+	// Grids streamed from their file are never loaded
+	if (options.out_of_core)
+	{
+		rc = run_out_of_core(argv[1], argv[2], worker_count, worker_group_size);
+		cleanup();
+		return rc ? -1 : 0;
+	}
+
+	if (load_matrix(argv[1]))
+	{
+		return -1;
+	}
+	if (options.resume && resume_from_checkpoint())
+	{
+		return -1;
+	}
+
+	// Mostly solid matrices are computed over the list of fluid cells
+	if (options.kernel_variant == KERNEL_LINEAR && options.active_tile == 0 && (options.resident || options.backend == BACKEND_CPU))
+	{
+		double fraction = fluid_fraction(matrix->dim[0], matrix->dim[1], matrix->type_mask->fluid_bits);
+		if (fraction < options.sparse_threshold)
+		{
+			printf("Fluid fraction %.3f is below %.3f, using the sparse kernel\n", fraction, options.sparse_threshold);
+			options.kernel_variant = KERNEL_SPARSE;
+		}
+	}
+	// The slabs of the multi-device mode build their own fluid index
+	if (options.kernel_variant == KERNEL_SPARSE && !is_multi_device())
+	{
+		fluid_index = fluid_index_build(matrix->dim[0], matrix->dim[1], matrix->type_mask->fluid_bits);
+		if (fluid_index == NULL)
+		{
+			return -1;
+		}
+	}
+
+	if (options.active_tile > 0)
+	{
+		active_tiles = active_tiles_create(matrix->dim[0], matrix->dim[1], options.active_tile, options.active_epsilon);
+		if (active_tiles == NULL)
+		{
+			return -1;
+		}
+	}
+
+	if (options.backend == BACKEND_OPENCL && is_multi_device())
+	{
+		choose_launch_geometry(NULL, &worker_count, &worker_group_size);
+		if (setup_multi_device())
+		{
+			return -1;
+		}
+	}
+	else if (options.backend == BACKEND_OPENCL)
+	{
+		deviceid = initOpenCL(&context, &commandQueue);
+		choose_launch_geometry(deviceid, &worker_count, &worker_group_size);
+		char build_options[256];
+		program_build_options(build_options, sizeof(build_options), matrix->dim[0]);
+		program = getCachedProgram("homework.cl", build_options, options.kernel_cache, context, deviceid);
+		kernel = clCreateKernel(program, kernel_name(), &rc);
+		handleError(rc, __LINE__, __FILE__);
+		allocate_device_memory();
+	}
+
+	// A resumed run keeps the thresholds saved with its checkpoint
+	if (start_iteration == 0)
+		init_color(matrix, &color_array);
+
+	if (!options.headless)
+	{
+		renderer = renderer_create(matrix->dim[0], matrix->dim[1], &color_array, options.fps);
+		if (renderer == NULL)
+		{
+			return -1;
+		}
+		render_host_matrix(start_iteration, matrix->curr_matrix);
+	}
+
+	double *initial_matrix = NULL;
+	if (options.validate)
+	{
+		initial_matrix = (double *)malloc(sizeof(double) * matrix->total_size);
+		if (initial_matrix == NULL)
+		{
+			perror("Error allocating memory for 'initial_matrix'\n");
+			return -1;
+		}
+		memcpy(initial_matrix, matrix->curr_matrix, sizeof(double) * matrix->total_size);
+	}
+
+	if (options.snapshot_every > 0)
+	{
+		snapshot_writer = snapshot_writer_open(options.snapshot_file, matrix->dim, options.snapshot_buffers, options.precision);
+		if (snapshot_writer == NULL)
+		{
+			return -1;
+		}
+	}
+	if (options.checkpoint_every > 0)
+	{
+		checkpoint_writer = checkpoint_writer_open(options.checkpoint_file, matrix->dim, options.precision,
+												   matrix->decay_rate, matrix->type_mask->fluid_bits,
+												   options.checkpoint_full_every, options.checkpoint_buffers,
+												   checkpoint_valid_bytes);
+		if (checkpoint_writer == NULL)
+		{
+			return -1;
+		}
+	}
+
+	if (options.backend == BACKEND_CPU)
+		rc = run_cpu();
+	else if (decomposition != NULL)
+		rc = run_multi_device(worker_count, worker_group_size);
+	else if (options.resident)
+		rc = run_resident(worker_count, worker_group_size);
+	else
+		rc = run_staged(worker_count, worker_group_size);
+	if (snapshot_writer != NULL)
+		rc |= snapshot_writer_close(snapshot_writer);
+	if (checkpoint_writer != NULL)
+		rc |= checkpoint_writer_close(checkpoint_writer);
+	if (rc)
+	{
+		return -1;
+	}
+	if (options.converge_every > 0 && converged_iteration >= 0)
+		printf("Converged at iteration %d, %s norm of the change %g, stopped after %d iterations\n",
+			   converged_iteration, options.norm == CHANGE_NORM_L2 ? "L2" : "max", last_change_norm, matrix->iterations);
+	else if (options.converge_every > 0)
+		printf("Not converged after %d iterations, %s norm of the last change %g\n", matrix->iterations,
+			   options.norm == CHANGE_NORM_L2 ? "L2" : "max", last_change_norm);
+	if (active_tiles != NULL)
+		printf("Active tiles: %ld of %ld tile steps computed (%.1f%%), %dx%d cells per tile\n", active_tiles->computed_tiles,
+			   (long)active_tiles->tile_count * active_tiles->steps,
+			   100.0 * active_tiles->computed_tiles / fmax(1.0, (double)active_tiles->tile_count * active_tiles->steps),
+			   active_tiles->tile_size, active_tiles->tile_size);
+	if (renderer != NULL)
+		renderer_finish(renderer, matrix->iterations, matrix->next_matrix);
+
+	if (options.validate)
+	{
+		rc = validate_against_cpu(initial_matrix);
+		free(initial_matrix);
+		if (rc)
+		{
+			return -1;
+		}
 	}
 
 	if (store_results(argv[2]))
@@ -479,9 +2220,11 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
-	print_current_matrix(matrix);
+	if (!options.headless)
+		print_current_matrix(matrix);
 
-	cleanup_device();
+	if (options.backend == BACKEND_OPENCL)
+		cleanup_device();
 	cleanup();
 	return 0;
 }
\ No newline at end of file
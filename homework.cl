@@ -1,12 +1,70 @@
 /*
- *The valid_cell() function checks if the given cell_index is valid by checking
- *if its type is 'f' in type_matrix_cl. If it is, it returns true, otherwise
- * false.
+ *Compile time specialization. The host may build the program with
+ *-D GRID_X=, -D GRID_Y=, -D DECAY_RATE= and, for the tiled kernels,
+ *-D TILE_WIDTH=, -D TILE_HEIGHT= so the compiler folds them as constants
+ *instead of reading dim_cl from global memory. Without them the values come
+ *from the kernel arguments and the launch geometry.
  */
-bool valid_cell(int cell_index, __global char *type_matrix_cl) {
-  if (type_matrix_cl[cell_index] == 'f')
-    return true;
-  return false;
+#ifdef GRID_X
+#define MATRIX_X(dim_cl) GRID_X
+#define MATRIX_Y(dim_cl) GRID_Y
+#else
+#define MATRIX_X(dim_cl) ((dim_cl)[0])
+#define MATRIX_Y(dim_cl) ((dim_cl)[1])
+#endif
+
+#ifdef DECAY_RATE
+#define DECAY(decay_rate) DECAY_RATE
+#else
+#define DECAY(decay_rate) (decay_rate)
+#endif
+
+/*
+ *Precision of the temperatures, selected with -D STORAGE_FP32 or
+ *-D STORAGE_FP16 (double by default). cell_t is the type stored in global
+ *memory and real the type computed with: fp16 only stores half floats, read
+ *and written with vload_half()/vstore_half_rte() so cl_khr_fp16 is not
+ *needed, and computes in float.
+ */
+#if defined(STORAGE_FP16)
+typedef half cell_t;
+typedef float real;
+#define LOAD_CELL(cells, index) vload_half((index), (cells))
+#define STORE_CELL(cells, index, value) vstore_half_rte((value), (index), (cells))
+#define REAL_MAX FLT_MAX
+#elif defined(STORAGE_FP32)
+typedef float cell_t;
+typedef float real;
+#define LOAD_CELL(cells, index) ((cells)[index])
+#define STORE_CELL(cells, index, value) ((cells)[index] = (value))
+#define REAL_MAX FLT_MAX
+#else
+typedef double cell_t;
+typedef double real;
+#define LOAD_CELL(cells, index) ((cells)[index])
+#define STORE_CELL(cells, index, value) ((cells)[index] = (value))
+#define REAL_MAX DBL_MAX
+#endif
+
+#ifdef TILE_WIDTH
+#define LOCAL_WIDTH TILE_WIDTH
+#define LOCAL_HEIGHT TILE_HEIGHT
+#define TILE_ATTRIBUTES                                                        \
+  __attribute__((reqd_work_group_size(TILE_WIDTH, TILE_HEIGHT, 1)))
+#else
+#define LOCAL_WIDTH get_local_size(0)
+#define LOCAL_HEIGHT get_local_size(1)
+#define TILE_ATTRIBUTES
+#endif
+
+/*
+ *The valid_cell() function checks if the given cell_index is a fluid cell.
+ *The cell types are a fluid mask of one bit per cell packed in 32 bit words
+ *(see _TypeMask.h): bit cell_index % 32 of word cell_index / 32 is set for the
+ *fluid cells, so a work group reads its whole neighbourhood in a few words.
+ */
+bool valid_cell(int cell_index, __global uint *type_matrix_cl) {
+  return (type_matrix_cl[cell_index >> 5] >> (cell_index & 31)) & 1;
 }
 
 /*
@@ -16,27 +74,27 @@ bool valid_cell(int cell_index, __global char *type_matrix_cl) {
  *neighboring cells and checking if they are valid (using valid_cell()) before
  *adding their temperatures to temp_sum.
  */
-double calculate_temperature(int cell_index, int X, int Y,
-                             __global double *curr_matrix_cl,
-                             __global char *type_matrix_cl) {
+real calculate_temperature(int cell_index, int X, int Y,
+                           __global cell_t *curr_matrix_cl,
+                           __global uint *type_matrix_cl) {
 
   int line_index, column_index;
   line_index = cell_index / Y;
   column_index = cell_index - line_index * Y;
 
-  double temp_sum = 0.0;
+  real temp_sum = 0;
   int sum_counter = 0;
 
   for (int i = line_index - 1; i <= line_index + 1; i++) {
     for (int j = column_index - 1; j <= column_index + 1; j++) {
-      int temp_index = i * Y + j;
-      if (!valid_cell(temp_index, type_matrix_cl))
-        continue;
       if (i >= X || i < 0)
         continue;
       if (j >= Y || j < 0)
         continue;
-      temp_sum += curr_matrix_cl[temp_index];
+      int temp_index = i * Y + j;
+      if (!valid_cell(temp_index, type_matrix_cl))
+        continue;
+      temp_sum += LOAD_CELL(curr_matrix_cl, temp_index);
       sum_counter++;
     }
   }
@@ -45,33 +103,33 @@ double calculate_temperature(int cell_index, int X, int Y,
 }
 
 /*
- *Replaces old value with new one
+ *Replaces the value of a cell with a new one
  */
-void assign_value(double new_value, __global double *old_value) {
-  *old_value = new_value;
+void assign_value(real new_value, __global cell_t *matrix_cl, int cell_index) {
+  STORE_CELL(matrix_cl, cell_index, new_value);
 }
 
 /*
  *This code is a kernel function for temperature calculations.
- *- curr_matrix_cl: a global double array that stores the current temperature
+ *- curr_matrix_cl: a global cell_t array that stores the current temperature
  *values
- *- type_matrix_cl: a global char array that stores the type of cell (f for
- *fixed, v for variable)
+ *- type_matrix_cl: a global fluid mask of one bit per cell, set for the
+ *fluid cells
  *- dim_cl: a global int array that stores the dimensions of the matrix (X and
  *Y)
- *- next_matrix_cl: a global double array that stores the next temperature
+ *- next_matrix_cl: a global cell_t array that stores the next temperature
  *values
  */
-__kernel void temperature_calculations(__global double *curr_matrix_cl,
-                                       __global char *type_matrix_cl,
+__kernel void temperature_calculations(__global cell_t *curr_matrix_cl,
+                                       __global uint *type_matrix_cl,
                                        __global int *dim_cl,
-                                       __global double *next_matrix_cl) {
+                                       __global cell_t *next_matrix_cl) {
 
   int worker_id = get_global_id(0);
   int workers_count = get_global_size(0);
 
-  int X = dim_cl[0];
-  int Y = dim_cl[1];
+  int X = MATRIX_X(dim_cl);
+  int Y = MATRIX_Y(dim_cl);
   int total_size = X * Y;
 
   // In case the number of worker items exceeds the total size of work, ommit
@@ -100,7 +158,603 @@ __kernel void temperature_calculations(__global double *curr_matrix_cl,
 
       assign_value(calculate_temperature(cell_index, X, Y, curr_matrix_cl,
                                          type_matrix_cl),
-                   &(next_matrix_cl[cell_index]));
+                   next_matrix_cl, cell_index);
+    }
+  }
+}
+
+/*
+ *Device-resident variant of temperature_calculations(). The host keeps both
+ *matrices on the device and swaps src_matrix_cl/dst_matrix_cl between
+ *launches, so the decay that decay_temperature() applies on the host is
+ *folded in here. Work items stride over the grid by the global size, which
+ *keeps neighbouring work items on neighbouring cells.
+ *- src_matrix_cl: temperatures of the current iteration
+ *- type_matrix_cl: fluid mask, only the fluid cells are updated
+ *- dim_cl: dimensions of the matrix (X and Y)
+ *- dst_matrix_cl: temperatures of the next iteration
+ *- decay_rate: fraction of the temperature lost per iteration
+ */
+__kernel void temperature_step(__global cell_t *src_matrix_cl,
+                               __global uint *type_matrix_cl,
+                               __global int *dim_cl,
+                               __global cell_t *dst_matrix_cl,
+                               real decay_rate) {
+
+  int X = MATRIX_X(dim_cl);
+  int Y = MATRIX_Y(dim_cl);
+  int total_size = X * Y;
+
+  for (int cell_index = get_global_id(0); cell_index < total_size;
+       cell_index += get_global_size(0)) {
+
+    if (!valid_cell(cell_index, type_matrix_cl)) {
+      continue;
+    }
+
+    real new_value =
+        calculate_temperature(cell_index, X, Y, src_matrix_cl, type_matrix_cl);
+    assign_value(new_value - new_value * DECAY(decay_rate), dst_matrix_cl,
+                 cell_index);
+  }
+}
+
+/*
+ *Variant of temperature_step() restricted to the lines [first_line,
+ *first_line + line_count) of the matrix, the other lines of dst_matrix_cl are
+ *not written. A distributed rank computes the lines that do not depend on its
+ *ghost lines with it while they are being exchanged, then the rest.
+ */
+__kernel void temperature_step_lines(__global cell_t *src_matrix_cl,
+                                     __global uint *type_matrix_cl,
+                                     __global int *dim_cl,
+                                     __global cell_t *dst_matrix_cl,
+                                     real decay_rate, int first_line,
+                                     int line_count) {
+
+  int X = MATRIX_X(dim_cl);
+  int Y = MATRIX_Y(dim_cl);
+  int first_cell = first_line * Y;
+  int stop_cell = first_cell + line_count * Y;
+
+  for (int cell_index = first_cell + get_global_id(0); cell_index < stop_cell;
+       cell_index += get_global_size(0)) {
+
+    if (!valid_cell(cell_index, type_matrix_cl)) {
+      continue;
+    }
+
+    real new_value =
+        calculate_temperature(cell_index, X, Y, src_matrix_cl, type_matrix_cl);
+    assign_value(new_value - new_value * DECAY(decay_rate), dst_matrix_cl,
+                 cell_index);
+  }
+}
+
+/*
+ *Batched variant of temperature_step() for ensembles of scenarios sharing the
+ *cell types of one matrix. The matrices of the scenarios are stacked one after
+ *the other and a single launch strides over all their cells, so small grids
+ *still fill the device.
+ *- src_matrix_cl, dst_matrix_cl: batch_count matrices of X * Y cells
+ *- type_matrix_cl: fluid mask of one matrix, shared by the scenarios
+ *- decay_rates_cl: decay rate of every scenario
+ */
+__kernel void temperature_step_batch(__global cell_t *src_matrix_cl,
+                                     __global uint *type_matrix_cl,
+                                     __global int *dim_cl,
+                                     __global cell_t *dst_matrix_cl,
+                                     __global real *decay_rates_cl,
+                                     int batch_count) {
+
+  int X = MATRIX_X(dim_cl);
+  int Y = MATRIX_Y(dim_cl);
+  int total_size = X * Y;
+
+  for (int batch_index = get_global_id(0);
+       batch_index < batch_count * total_size;
+       batch_index += get_global_size(0)) {
+    int scenario = batch_index / total_size;
+    int cell_index = batch_index - scenario * total_size;
+
+    if (!valid_cell(cell_index, type_matrix_cl)) {
+      continue;
+    }
+
+    __global cell_t *src_cells = src_matrix_cl + scenario * total_size;
+    real new_value =
+        calculate_temperature(cell_index, X, Y, src_cells, type_matrix_cl);
+    assign_value(new_value - new_value * decay_rates_cl[scenario],
+                 dst_matrix_cl + scenario * total_size, cell_index);
+  }
+}
+
+/*
+ *Tiled variant of temperature_step() launched on a 2D NDRange, dimension 0
+ *over the columns and dimension 1 over the lines so that neighbouring work
+ *items read neighbouring addresses. Each work group loads its tile plus a
+ *one cell halo into local memory once, then every work item averages its
+ *3x3 neighbourhood from there instead of reading global memory 9 times.
+ *- tile_values_cl, tile_fluid_cl: local buffers of (width + 2) * (height + 2)
+ *elements, where width and height are the local work size
+ */
+__kernel TILE_ATTRIBUTES void temperature_step_tiled(__global cell_t *src_matrix_cl,
+                                     __global uint *type_matrix_cl,
+                                     __global int *dim_cl,
+                                     __global cell_t *dst_matrix_cl,
+                                     real decay_rate,
+                                     __local real *tile_values_cl,
+                                     __local char *tile_fluid_cl) {
+
+  int X = MATRIX_X(dim_cl);
+  int Y = MATRIX_Y(dim_cl);
+
+  int local_width = LOCAL_WIDTH;
+  int local_height = LOCAL_HEIGHT;
+  int tile_width = local_width + 2;
+  int tile_size = tile_width * (local_height + 2);
+
+  // Top left cell of the tile, halo included
+  int tile_line = get_group_id(1) * local_height - 1;
+  int tile_column = get_group_id(0) * local_width - 1;
+
+  // Load the tile cooperatively, cells outside the matrix count as non-fluid
+  for (int k = get_local_id(1) * local_width + get_local_id(0); k < tile_size;
+       k += local_width * local_height) {
+    int i = tile_line + k / tile_width;
+    int j = tile_column + k % tile_width;
+    if (i >= 0 && i < X && j >= 0 && j < Y &&
+        valid_cell(i * Y + j, type_matrix_cl)) {
+      tile_values_cl[k] = LOAD_CELL(src_matrix_cl, i * Y + j);
+      tile_fluid_cl[k] = 1;
+    } else {
+      tile_values_cl[k] = 0;
+      tile_fluid_cl[k] = 0;
+    }
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  int line_index = get_global_id(1);
+  int column_index = get_global_id(0);
+  if (line_index >= X || column_index >= Y)
+    return;
+
+  int center = (get_local_id(1) + 1) * tile_width + get_local_id(0) + 1;
+  if (!tile_fluid_cl[center])
+    return;
+
+  real temp_sum = 0;
+  int sum_counter = 0;
+  for (int di = -1; di <= 1; di++) {
+    for (int dj = -1; dj <= 1; dj++) {
+      int k = center + di * tile_width + dj;
+      temp_sum += tile_values_cl[k];
+      sum_counter += tile_fluid_cl[k];
+    }
+  }
+
+  real new_value = temp_sum / sum_counter;
+  assign_value(new_value - new_value * DECAY(decay_rate), dst_matrix_cl,
+               line_index * Y + column_index);
+}
+
+/*
+ *Temporally blocked variant of temperature_step_tiled(): advances the matrix
+ *by steps iterations per launch. Each work group loads its tile plus a halo
+ *of steps cells, iterates in local memory with the region of valid cells
+ *shrinking by one cell per iteration, and writes back only the interior, so
+ *global memory is read and written once every steps iterations.
+ *- steps: iterations computed by this launch, also the width of the halo
+ *- tile_a_cl, tile_b_cl, tile_fluid_cl: local buffers of
+ *(width + 2 * steps) * (height + 2 * steps) elements, where width and height
+ *are the local work size
+ */
+__kernel TILE_ATTRIBUTES void temperature_step_temporal(__global cell_t *src_matrix_cl,
+                                        __global uint *type_matrix_cl,
+                                        __global int *dim_cl,
+                                        __global cell_t *dst_matrix_cl,
+                                        real decay_rate, int steps,
+                                        __local real *tile_a_cl,
+                                        __local real *tile_b_cl,
+                                        __local char *tile_fluid_cl) {
+
+  int X = MATRIX_X(dim_cl);
+  int Y = MATRIX_Y(dim_cl);
+
+  int local_width = LOCAL_WIDTH;
+  int local_height = LOCAL_HEIGHT;
+  int local_count = local_width * local_height;
+  int local_index = get_local_id(1) * local_width + get_local_id(0);
+  int tile_width = local_width + 2 * steps;
+  int tile_height = local_height + 2 * steps;
+  int tile_size = tile_width * tile_height;
+
+  // Top left cell of the tile, halo included
+  int tile_line = get_group_id(1) * local_height - steps;
+  int tile_column = get_group_id(0) * local_width - steps;
+
+  // Load the tile cooperatively, cells outside the matrix count as non-fluid
+  for (int k = local_index; k < tile_size; k += local_count) {
+    int i = tile_line + k / tile_width;
+    int j = tile_column + k % tile_width;
+    if (i >= 0 && i < X && j >= 0 && j < Y &&
+        valid_cell(i * Y + j, type_matrix_cl)) {
+      tile_a_cl[k] = LOAD_CELL(src_matrix_cl, i * Y + j);
+      tile_fluid_cl[k] = 1;
+    } else {
+      tile_a_cl[k] = 0;
+      tile_fluid_cl[k] = 0;
+    }
+    tile_b_cl[k] = tile_a_cl[k];
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  __local real *src_tile = tile_a_cl;
+  __local real *dst_tile = tile_b_cl;
+
+  for (int step = 1; step <= steps; step++) {
+    // Cells closer than step to the border of the tile are no longer valid
+    int region_width = tile_width - 2 * step;
+    int region_size = region_width * (tile_height - 2 * step);
+
+    for (int k = local_index; k < region_size; k += local_count) {
+      int center = (step + k / region_width) * tile_width + step +
+                   k % region_width;
+      if (!tile_fluid_cl[center])
+        continue;
+
+      real temp_sum = 0;
+      int sum_counter = 0;
+      for (int di = -1; di <= 1; di++) {
+        for (int dj = -1; dj <= 1; dj++) {
+          int n = center + di * tile_width + dj;
+          temp_sum += src_tile[n];
+          sum_counter += tile_fluid_cl[n];
+        }
+      }
+      real new_value = temp_sum / sum_counter;
+      dst_tile[center] = new_value - new_value * DECAY(decay_rate);
     }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    __local real *swap_tile = src_tile;
+    src_tile = dst_tile;
+    dst_tile = swap_tile;
+  }
+
+  int line_index = get_global_id(1);
+  int column_index = get_global_id(0);
+  if (line_index >= X || column_index >= Y)
+    return;
+
+  int center = (get_local_id(1) + steps) * tile_width + get_local_id(0) + steps;
+  if (!tile_fluid_cl[center])
+    return;
+
+  assign_value(src_tile[center], dst_matrix_cl, line_index * Y + column_index);
+}
+
+/*
+ *Sparse variant of temperature_step() for matrices with few fluid cells.
+ *It iterates over the list of fluid cells built by the host instead of the
+ *whole matrix, with the fluid neighbours of every cell precomputed in CSR
+ *form, so no cell type is checked while computing.
+ *- fluid_cells_cl: indices of the fluid cells
+ *- neighbour_offsets_cl: fluid_count + 1 offsets inside neighbour_cells_cl
+ *- neighbour_cells_cl: indices of the fluid neighbours, the cell included
+ *- fluid_count: number of fluid cells
+ */
+__kernel void temperature_step_sparse(__global cell_t *src_matrix_cl,
+                                      __global int *fluid_cells_cl,
+                                      __global int *neighbour_offsets_cl,
+                                      __global cell_t *dst_matrix_cl,
+                                      real decay_rate,
+                                      __global int *neighbour_cells_cl,
+                                      int fluid_count) {
+
+  for (int k = get_global_id(0); k < fluid_count; k += get_global_size(0)) {
+    int start = neighbour_offsets_cl[k];
+    int stop = neighbour_offsets_cl[k + 1];
+
+    real temp_sum = 0;
+    for (int n = start; n < stop; n++)
+      temp_sum += LOAD_CELL(src_matrix_cl, neighbour_cells_cl[n]);
+
+    real new_value = temp_sum / (stop - start);
+    assign_value(new_value - new_value * DECAY(decay_rate), dst_matrix_cl,
+                 fluid_cells_cl[k]);
+  }
+}
+
+/*
+ *Variant of temperature_step() that only computes the active square tiles of
+ *the matrix, listed by temperature_active_tiles(). It is launched with one
+ *work group per tile of the matrix, the groups past the number of active
+ *tiles copy the retired tiles and the others return at once. Every group
+ *records the largest change of a fluid cell of its tile, the skipped tiles
+ *keep a change of -1. A retired tile was computed by the previous step and is
+ *skipped from this one: its source holds its last values and its
+ *destination those of the step before, so it is copied once and then keeps
+ *its values in both matrices while it is skipped.
+ *- active_tiles_cl: active tiles, active_counts_cl[parity] of them from the
+ *start, and retired tiles, active_counts_cl[3 + parity] of them from the end
+ *- active_counts_cl: active tiles listed for this step and for the next one,
+ *the number of tiles computed so far, then the retired tiles listed for this
+ *step and for the next one
+ *- tile_changes_cl: largest changes of the tiles, tile_count for this step
+ *then tile_count for the next one, swapped by parity
+ *- scratch_cl: local buffer of one real per work item
+ */
+__kernel void temperature_step_active(__global cell_t *src_matrix_cl,
+                                      __global uint *type_matrix_cl,
+                                      __global int *dim_cl,
+                                      __global cell_t *dst_matrix_cl,
+                                      real decay_rate,
+                                      __global int *active_tiles_cl,
+                                      __global int *active_counts_cl,
+                                      __global real *tile_changes_cl,
+                                      int parity, int tile_size,
+                                      __local real *scratch_cl) {
+
+  int X = MATRIX_X(dim_cl);
+  int Y = MATRIX_Y(dim_cl);
+  int tile_columns = (Y + tile_size - 1) / tile_size;
+  int tile_count = (X + tile_size - 1) / tile_size * tile_columns;
+  int local_id = get_local_id(0);
+
+  // The next lists are built by temperature_active_tiles() behind this launch
+  if (get_global_id(0) == 0) {
+    active_counts_cl[1 - parity] = 0;
+    active_counts_cl[4 - parity] = 0;
+  }
+  int active_count = active_counts_cl[parity];
+  int retired = get_group_id(0) - active_count;
+  if (retired >= active_counts_cl[3 + parity])
+    return;
+
+  int tile = retired < 0 ? active_tiles_cl[get_group_id(0)]
+                         : active_tiles_cl[tile_count - 1 - retired];
+  int first_line = tile / tile_columns * tile_size;
+  int first_column = tile % tile_columns * tile_size;
+  int tile_height = min(tile_size, X - first_line);
+  int tile_width = min(tile_size, Y - first_column);
+
+  if (retired >= 0) {
+    for (int k = local_id; k < tile_height * tile_width;
+         k += get_local_size(0)) {
+      int cell_index = (first_line + k / tile_width) * Y + first_column +
+                       k % tile_width;
+      if (valid_cell(cell_index, type_matrix_cl))
+        STORE_CELL(dst_matrix_cl, cell_index,
+                   LOAD_CELL(src_matrix_cl, cell_index));
+    }
+    return;
+  }
+
+  real change = 0;
+  for (int k = local_id; k < tile_height * tile_width;
+       k += get_local_size(0)) {
+    int cell_index = (first_line + k / tile_width) * Y + first_column +
+                     k % tile_width;
+    if (!valid_cell(cell_index, type_matrix_cl))
+      continue;
+
+    real new_value =
+        calculate_temperature(cell_index, X, Y, src_matrix_cl, type_matrix_cl);
+    new_value -= new_value * DECAY(decay_rate);
+    change =
+        fmax(change, fabs(new_value - LOAD_CELL(src_matrix_cl, cell_index)));
+    assign_value(new_value, dst_matrix_cl, cell_index);
+  }
+
+  scratch_cl[local_id] = change;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for (int active = get_local_size(0); active > 1;) {
+    int half = (active + 1) / 2;
+    if (local_id < active - half)
+      scratch_cl[local_id] =
+          fmax(scratch_cl[local_id], scratch_cl[local_id + half]);
+    barrier(CLK_LOCAL_MEM_FENCE);
+    active = half;
+  }
+  if (local_id == 0)
+    tile_changes_cl[parity * tile_count + tile] = scratch_cl[0];
+}
+
+/*
+ *Lists the tiles computed by the next temperature_step_active() launch, one
+ *work item per tile: a tile stays active if the largest change of its own
+ *fluid cells or of those of one of its 8 neighbour tiles is at least
+ *epsilon. A tile computed by this step that is not active for the next one
+ *is listed as retired instead. The order of the lists does not matter, every
+ *tile is computed independently. The change of the tile for the next step is
+ *cleared.
+ */
+__kernel void temperature_active_tiles(__global int *dim_cl,
+                                       __global real *tile_changes_cl,
+                                       int parity, int tile_size,
+                                       real epsilon,
+                                       __global int *active_tiles_cl,
+                                       __global int *active_counts_cl) {
+
+  int tile_lines = (MATRIX_X(dim_cl) + tile_size - 1) / tile_size;
+  int tile_columns = (MATRIX_Y(dim_cl) + tile_size - 1) / tile_size;
+  int tile_count = tile_lines * tile_columns;
+  int tile = get_global_id(0);
+  if (tile >= tile_count)
+    return;
+
+  int tile_line = tile / tile_columns;
+  int tile_column = tile - tile_line * tile_columns;
+  __global real *changes = tile_changes_cl + parity * tile_count;
+  real change = 0;
+  for (int i = max(tile_line - 1, 0); i <= min(tile_line + 1, tile_lines - 1);
+       i++)
+    for (int j = max(tile_column - 1, 0);
+         j <= min(tile_column + 1, tile_columns - 1); j++)
+      change = fmax(change, changes[i * tile_columns + j]);
+
+  tile_changes_cl[(1 - parity) * tile_count + tile] = -1;
+  if (change >= epsilon) {
+    active_tiles_cl[atomic_inc(&active_counts_cl[1 - parity])] = tile;
+    atomic_inc(&active_counts_cl[2]);
+  } else if (changes[tile] >= 0)
+    active_tiles_cl[tile_count - 1 -
+                    atomic_inc(&active_counts_cl[4 - parity])] = tile;
+}
+
+/*
+ *Statistics of the fluid cells: minimum, maximum, sum and sum of the squared
+ *temperatures, then the number of cells, the same fields as the host side in
+ *_Statistics.h. The values are reduced in stat_real, double whenever the
+ *device has cl_khr_fp64 so that the sums of the reduced precisions keep the
+ *small contributions of big grids, and the cells are counted exactly in a
+ *ulong. device_statistics_create() reads the same layout.
+ */
+#if defined(cl_khr_fp64)
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+typedef double stat_real;
+#define STAT_REAL_MAX DBL_MAX
+#else
+typedef float stat_real;
+#define STAT_REAL_MAX FLT_MAX
+#endif
+
+typedef struct {
+  stat_real min_value, max_value, sum, sum_squares;
+  ulong count;
+} statistics_t;
+
+statistics_t no_statistics() {
+  statistics_t statistics;
+  statistics.min_value = STAT_REAL_MAX;
+  statistics.max_value = -STAT_REAL_MAX;
+  statistics.sum = 0;
+  statistics.sum_squares = 0;
+  statistics.count = 0;
+  return statistics;
+}
+
+void merge_statistics(__local statistics_t *into, __local statistics_t *other) {
+  into->min_value = fmin(into->min_value, other->min_value);
+  into->max_value = fmax(into->max_value, other->max_value);
+  into->sum += other->sum;
+  into->sum_squares += other->sum_squares;
+  into->count += other->count;
+}
+
+/*
+ *Tree reduction of the statistics of a work group, one entry of scratch_cl
+ *per work item. Works for any local size, the first work item ends up with
+ *the statistics of the whole group.
+ */
+void reduce_statistics(__local statistics_t *scratch_cl) {
+  int local_id = get_local_id(0);
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for (int active = get_local_size(0); active > 1;) {
+    int half = (active + 1) / 2;
+    if (local_id < active - half)
+      merge_statistics(scratch_cl + local_id, scratch_cl + local_id + half);
+    barrier(CLK_LOCAL_MEM_FENCE);
+    active = half;
   }
 }
+
+/*
+ *Adds a value to the statistics of a work item, kept in private memory until
+ *the work group reduces them.
+ */
+void add_statistics(statistics_t *own, stat_real value) {
+  own->min_value = fmin(own->min_value, value);
+  own->max_value = fmax(own->max_value, value);
+  own->sum += value;
+  own->sum_squares += value * value;
+  own->count += 1;
+}
+
+/*
+ *First pass of the statistics of a matrix: work items stride over the grid
+ *and every work group writes its partial statistics to partials_cl, so only
+ *a few values leave the device.
+ *- matrix_cl: temperatures to reduce
+ *- type_matrix_cl: fluid mask, only the fluid cells are counted
+ *- total_size: number of cells
+ *- partials_cl: statistics of every work group
+ *- scratch_cl: local buffer of statistics per work item
+ */
+__kernel void temperature_statistics(__global cell_t *matrix_cl,
+                                     __global uint *type_matrix_cl,
+                                     int total_size,
+                                     __global statistics_t *partials_cl,
+                                     __local statistics_t *scratch_cl) {
+
+  statistics_t own = no_statistics();
+  for (int cell_index = get_global_id(0); cell_index < total_size;
+       cell_index += get_global_size(0)) {
+    if (!valid_cell(cell_index, type_matrix_cl))
+      continue;
+    add_statistics(&own, LOAD_CELL(matrix_cl, cell_index));
+  }
+  scratch_cl[get_local_id(0)] = own;
+  reduce_statistics(scratch_cl);
+
+  if (get_local_id(0) == 0)
+    partials_cl[get_group_id(0)] = scratch_cl[0];
+}
+
+/*
+ *First pass of the change of a matrix over one step, reduced like
+ *temperature_statistics() so that temperature_statistics_finish() completes
+ *it: the minimum and maximum of matrix_cl - previous_cl over the fluid cells
+ *give the max norm of the change and its sum of squares the square of the L2
+ *norm.
+ *- matrix_cl, previous_cl: temperatures of two consecutive iterations
+ *- first_cell, stop_cell: range of cells reduced, a slab leaves its halo out
+ */
+__kernel void temperature_change(__global cell_t *matrix_cl,
+                                 __global cell_t *previous_cl,
+                                 __global uint *type_matrix_cl,
+                                 int first_cell, int stop_cell,
+                                 __global statistics_t *partials_cl,
+                                 __local statistics_t *scratch_cl) {
+
+  statistics_t own = no_statistics();
+  for (int cell_index = first_cell + get_global_id(0); cell_index < stop_cell;
+       cell_index += get_global_size(0)) {
+    if (!valid_cell(cell_index, type_matrix_cl))
+      continue;
+    add_statistics(&own, (stat_real)LOAD_CELL(matrix_cl, cell_index) -
+                             (stat_real)LOAD_CELL(previous_cl, cell_index));
+  }
+  scratch_cl[get_local_id(0)] = own;
+  reduce_statistics(scratch_cl);
+
+  if (get_local_id(0) == 0)
+    partials_cl[get_group_id(0)] = scratch_cl[0];
+}
+
+/*
+ *Second pass of the statistics, launched with a single work group that
+ *combines the partials of temperature_statistics() into statistics_cl.
+ */
+__kernel void temperature_statistics_finish(__global statistics_t *partials_cl,
+                                            int group_count,
+                                            __global statistics_t *statistics_cl,
+                                            __local statistics_t *scratch_cl) {
+
+  statistics_t own = no_statistics();
+  for (int group = get_local_id(0); group < group_count;
+       group += get_local_size(0)) {
+    statistics_t partial = partials_cl[group];
+    own.min_value = fmin(own.min_value, partial.min_value);
+    own.max_value = fmax(own.max_value, partial.max_value);
+    own.sum += partial.sum;
+    own.sum_squares += partial.sum_squares;
+    own.count += partial.count;
+  }
+  scratch_cl[get_local_id(0)] = own;
+  reduce_statistics(scratch_cl);
+
+  if (get_local_id(0) == 0)
+    statistics_cl[0] = scratch_cl[0];
+}
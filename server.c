@@ -0,0 +1,605 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "_GridIO.h"
+#include "_JobProtocol.h"
+#include "_Precision.h"
+#include "_Simulation.h"
+
+/* Server configuration, parsed from the command line */
+typedef struct ServerOptions
+{
+	char *socket_file;
+	int backend;
+	int cpu_threads;
+	// Threads taking jobs from the queue, each one runs a job or a batch at a time
+	int workers;
+	// Largest number of jobs run by a single simulation, and largest grid that is batched
+	int batch;
+	int batch_cells;
+	// Directory of the compiled kernels, NULL to compile homework.cl on start
+	char *kernel_cache;
+	// Precision of the matrices on the device and of the binary outputs
+	int precision;
+} ServerOptions;
+
+/* A client connection, shared by its reader thread and its jobs in flight */
+typedef struct Connection
+{
+	int fd;
+	// Serializes the replies of the workers
+	pthread_mutex_t lock;
+	// Reader thread plus jobs not replied yet, the connection is closed by the last one
+	int references;
+} Connection;
+
+/* A job waiting in the queue or running */
+typedef struct Job
+{
+	char tag[JOB_TAG_LENGTH];
+	int priority;
+	// Order of arrival, between jobs of the same priority
+	long sequence;
+	int iterations;
+	double decay_rate;
+	// NULL to send the result back over the connection
+	char *output_file;
+	int dim[2];
+	double *temperature;
+	char *type;
+	// Hash of the cell types, jobs of equal dimensions, iterations and cell types run as a batch
+	unsigned long type_hash;
+	Connection *connection;
+	double queued_at;
+} Job;
+
+ServerOptions options;
+SimulationDevice *device;
+int listen_fd;
+
+/* Priority queue of the jobs, a binary heap with the next job at index 0 */
+pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t queue_ready = PTHREAD_COND_INITIALIZER;
+Job **queue;
+int queue_count, queue_capacity;
+long next_sequence;
+// Set by SHUTDOWN, the workers exit once the queue is empty
+int stopping;
+
+long jobs_done, jobs_failed, batches_run;
+
+/// @brief Returns a monotonic time in seconds
+double now_seconds()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/// @brief Releases a reference to a connection, closing it with the last one
+void connection_release(Connection *connection)
+{
+	pthread_mutex_lock(&connection->lock);
+	int references = --connection->references;
+	pthread_mutex_unlock(&connection->lock);
+	if (references > 0)
+		return;
+	close(connection->fd);
+	pthread_mutex_destroy(&connection->lock);
+	free(connection);
+}
+
+/// @brief Sends a reply line and optionally the temperatures following it, the client may be gone
+void connection_reply(Connection *connection, char *line, double *temperature, size_t cell_count)
+{
+	pthread_mutex_lock(&connection->lock);
+	if (job_write_all(connection->fd, line, strlen(line)) == 0 && temperature != NULL)
+		job_write_all(connection->fd, temperature, sizeof(double) * cell_count);
+	pthread_mutex_unlock(&connection->lock);
+}
+
+/// @brief Frees a job and releases its connection
+void job_free(Job *job)
+{
+	connection_release(job->connection);
+	free(job->output_file);
+	free(job->temperature);
+	free(job->type);
+	free(job);
+}
+
+/// @brief Returns whether job a runs before job b: higher priority first, then first come
+int job_before(Job *a, Job *b)
+{
+	if (a->priority != b->priority)
+		return a->priority > b->priority;
+	return a->sequence < b->sequence;
+}
+
+/// @brief Moves the job at index down or up the heap to its place
+void queue_sift(int index)
+{
+	while (index > 0 && job_before(queue[index], queue[(index - 1) / 2]))
+	{
+		Job *parent = queue[(index - 1) / 2];
+		queue[(index - 1) / 2] = queue[index];
+		queue[index] = parent;
+		index = (index - 1) / 2;
+	}
+	for (;;)
+	{
+		int first = index;
+		for (int child = 2 * index + 1; child <= 2 * index + 2 && child < queue_count; child++)
+		{
+			if (job_before(queue[child], queue[first]))
+				first = child;
+		}
+		if (first == index)
+			return;
+		Job *swapped = queue[first];
+		queue[first] = queue[index];
+		queue[index] = swapped;
+		index = first;
+	}
+}
+
+/// @brief Adds a job to the queue, queue_lock must be held
+/// @return 1 if error, 0 if no error
+int queue_push(Job *job)
+{
+	if (queue_count == queue_capacity)
+	{
+		int capacity = queue_capacity ? 2 * queue_capacity : 64;
+		Job **grown = (Job **)realloc(queue, sizeof(Job *) * capacity);
+		if (grown == NULL)
+		{
+			perror("Error allocating memory for the queue\n");
+			return 1;
+		}
+		queue = grown;
+		queue_capacity = capacity;
+	}
+	job->sequence = next_sequence++;
+	queue[queue_count++] = job;
+	queue_sift(queue_count - 1);
+	return 0;
+}
+
+/// @brief Removes the job at index from the queue, queue_lock must be held
+Job *queue_remove(int index)
+{
+	Job *job = queue[index];
+	queue[index] = queue[--queue_count];
+	if (index < queue_count)
+		queue_sift(index);
+	return job;
+}
+
+/// @brief Returns a hash of the cell types of a grid
+unsigned long hash_types(char *type, size_t count)
+{
+	unsigned long hash = 5381;
+	for (size_t i = 0; i < count; i++)
+		hash = hash * 33 + (unsigned char)type[i];
+	return hash;
+}
+
+/// @brief Returns whether two jobs can run as a single batch
+int jobs_compatible(Job *a, Job *b)
+{
+	return a->dim[0] == b->dim[0] && a->dim[1] == b->dim[1] && a->iterations == b->iterations &&
+		   a->type_hash == b->type_hash && memcmp(a->type, b->type, (size_t)a->dim[0] * a->dim[1]) == 0;
+}
+
+/// @brief Returns whether a job is small enough to be batched with others
+int job_batchable(Job *job)
+{
+	return options.backend == SIMULATION_BACKEND_OPENCL && options.batch > 1 &&
+		   (long)job->dim[0] * job->dim[1] <= options.batch_cells;
+}
+
+/// @brief Loads a grid file in either format into host memory, binary files are copied out of
+// their mapping and converted to double
+/// @param decay_rate filled in with the decay rate of the file, SIMULATION_DEFAULT_DECAY_RATE for text files
+/// @return 1 if error, 0 if no error
+int load_grid(char *file_name, int *grid_dim, int *grid_iterations, double *decay_rate, double **temperature,
+			  char **type)
+{
+	if (!grid_is_binary(file_name))
+	{
+		*decay_rate = SIMULATION_DEFAULT_DECAY_RATE;
+		return grid_read_text(file_name, grid_dim, grid_iterations, temperature, type);
+	}
+
+	GridMapping *mapping = grid_map_binary(file_name);
+	if (mapping == NULL)
+	{
+		return 1;
+	}
+	grid_dim[0] = mapping->header->dim[0];
+	grid_dim[1] = mapping->header->dim[1];
+	*grid_iterations = mapping->header->iterations;
+	*decay_rate = mapping->header->decay_rate;
+	size_t cell_count = (size_t)grid_dim[0] * grid_dim[1];
+	*temperature = (double *)malloc(sizeof(double) * cell_count);
+	*type = (char *)malloc(sizeof(char) * cell_count);
+	if (*temperature == NULL || *type == NULL)
+	{
+		perror("Error allocating memory for the grid\n");
+		grid_unmap(mapping);
+		return 1;
+	}
+	precision_unpack(mapping->header->dtype, mapping->temperature, *temperature, cell_count);
+	memcpy(*type, mapping->type, sizeof(char) * cell_count);
+	grid_unmap(mapping);
+	return 0;
+}
+
+/// @brief Replies an error to the request of a connection
+void reply_error(Connection *connection, char *tag, char *message)
+{
+	char line[JOB_LINE_LENGTH];
+	snprintf(line, sizeof(line), "ERROR %s %s\n", tag, message);
+	connection_reply(connection, line, NULL, 0);
+}
+
+/// @brief Parses a JOB request, loads its grid and queues it
+void accept_job(Connection *connection, char *request)
+{
+	char tag[JOB_TAG_LENGTH] = "-", input_file[JOB_LINE_LENGTH], output_file[JOB_LINE_LENGTH];
+	int priority, iterations;
+	double decay_rate;
+	int fields = sscanf(request, "JOB %63s %d %d %lf %4095s %4095s", tag, &priority, &iterations, &decay_rate,
+						input_file, output_file);
+	if (fields < 5 || iterations < 0 || decay_rate > 1)
+	{
+		reply_error(connection, tag,
+					"expected 'JOB tag priority iterations decay_rate input_file [output_file]' with a decay rate of at "
+					"most 1");
+		return;
+	}
+
+	Job *job = (Job *)calloc(1, sizeof(Job));
+	if (job == NULL)
+	{
+		reply_error(connection, tag, "out of memory");
+		return;
+	}
+	int file_iterations;
+	double file_decay_rate;
+	if (load_grid(input_file, job->dim, &file_iterations, &file_decay_rate, &job->temperature, &job->type))
+	{
+		reply_error(connection, tag, "cannot read the input grid");
+		free(job->temperature);
+		free(job->type);
+		free(job);
+		return;
+	}
+	strcpy(job->tag, tag);
+	job->priority = priority;
+	job->iterations = iterations > 0 ? iterations : file_iterations;
+	job->decay_rate = decay_rate >= 0 ? decay_rate : file_decay_rate;
+	job->output_file = fields == 6 ? strdup(output_file) : NULL;
+	job->type_hash = hash_types(job->type, (size_t)job->dim[0] * job->dim[1]);
+	job->connection = connection;
+	job->queued_at = now_seconds();
+
+	pthread_mutex_lock(&connection->lock);
+	connection->references++;
+	pthread_mutex_unlock(&connection->lock);
+
+	pthread_mutex_lock(&queue_lock);
+	int rejected = stopping || queue_push(job);
+	if (!rejected)
+		pthread_cond_signal(&queue_ready);
+	pthread_mutex_unlock(&queue_lock);
+	if (rejected)
+	{
+		reply_error(connection, tag, "the server is shutting down");
+		job_free(job);
+	}
+}
+
+/// @brief Reads the requests of a connection until the client closes it
+void *connection_main(void *arg)
+{
+	Connection *connection = (Connection *)arg;
+	char request[JOB_LINE_LENGTH];
+	while (job_read_line(connection->fd, request, sizeof(request)) == 0)
+	{
+		if (strncmp(request, "JOB ", 4) == 0)
+			accept_job(connection, request);
+		else if (strcmp(request, "SHUTDOWN") == 0)
+		{
+			pthread_mutex_lock(&queue_lock);
+			stopping = 1;
+			pthread_cond_broadcast(&queue_ready);
+			pthread_mutex_unlock(&queue_lock);
+			// Wakes the accept() of the main thread
+			shutdown(listen_fd, SHUT_RDWR);
+			connection_reply(connection, "BYE\n", NULL, 0);
+		}
+		else
+			reply_error(connection, "-", "unknown request");
+	}
+	connection_release(connection);
+	return NULL;
+}
+
+/// @brief Runs jobs sharing their dimensions, iterations and cell types as a single simulation and
+// replies to each of them. A batch the device has no room for is split in halves, down to single
+// jobs, before its jobs fail
+void run_batch(Job **jobs, int count)
+{
+	double start = now_seconds();
+	Job *first = jobs[0];
+	size_t cell_count = (size_t)first->dim[0] * first->dim[1];
+	double **temperatures = (double **)malloc(sizeof(double *) * count);
+	double *decay_rates = (double *)malloc(sizeof(double) * count);
+	double *result = (double *)malloc(sizeof(double) * cell_count);
+	Simulation *simulation = NULL;
+	if (temperatures != NULL && decay_rates != NULL && result != NULL)
+	{
+		for (int j = 0; j < count; j++)
+		{
+			temperatures[j] = jobs[j]->temperature;
+			decay_rates[j] = jobs[j]->decay_rate;
+		}
+		simulation = simulation_create_batch(device, first->dim[0], first->dim[1], count, temperatures, first->type,
+											 decay_rates);
+	}
+	if (simulation == NULL && count > 1)
+	{
+		free(temperatures);
+		free(decay_rates);
+		free(result);
+		printf("No room for a batch of %d jobs of %dx%d cells, splitting it\n", count, first->dim[0], first->dim[1]);
+		run_batch(jobs, count / 2);
+		run_batch(jobs + count / 2, count - count / 2);
+		return;
+	}
+	if (simulation != NULL)
+		simulation_step(simulation, first->iterations);
+	double run_ms = (now_seconds() - start) * 1e3;
+
+	int failed = 0;
+	char line[JOB_LINE_LENGTH];
+	for (int j = 0; j < count; j++)
+	{
+		Job *job = jobs[j];
+		double queue_ms = (start - job->queued_at) * 1e3;
+		if (simulation == NULL)
+		{
+			reply_error(job->connection, job->tag, "cannot create the simulation");
+			failed++;
+			job_free(job);
+			continue;
+		}
+		simulation_read_member(simulation, j, result);
+		if (job->output_file == NULL)
+		{
+			snprintf(line, sizeof(line), "RESULT %s %d %d %.3f %.3f %d\n", job->tag, job->dim[0], job->dim[1], queue_ms,
+					 run_ms, count);
+			connection_reply(job->connection, line, result, cell_count);
+		}
+		else
+		{
+			int rc = grid_has_binary_extension(job->output_file)
+						 ? grid_write_binary(job->output_file, job->dim, job->iterations, job->decay_rate, result,
+											 job->type, options.precision)
+						 : grid_write_text(job->output_file, job->dim, result, job->type, job->iterations);
+			if (rc)
+			{
+				reply_error(job->connection, job->tag, "cannot write the output file");
+				failed++;
+			}
+			else
+			{
+				snprintf(line, sizeof(line), "DONE %s %.3f %.3f %d\n", job->tag, queue_ms, run_ms, count);
+				connection_reply(job->connection, line, NULL, 0);
+			}
+		}
+		job_free(job);
+	}
+	simulation_destroy(simulation);
+	free(temperatures);
+	free(decay_rates);
+	free(result);
+
+	pthread_mutex_lock(&queue_lock);
+	jobs_done += count - failed;
+	jobs_failed += failed;
+	batches_run++;
+	pthread_mutex_unlock(&queue_lock);
+}
+
+/// @brief Takes the next job and the queued jobs it can be batched with until the server stops
+void *worker_main(void *arg)
+{
+	Job **jobs = (Job **)malloc(sizeof(Job *) * options.batch);
+	if (jobs == NULL)
+	{
+		perror("Error allocating memory for the batch\n");
+		return NULL;
+	}
+	for (;;)
+	{
+		pthread_mutex_lock(&queue_lock);
+		while (queue_count == 0 && !stopping)
+			pthread_cond_wait(&queue_ready, &queue_lock);
+		if (queue_count == 0)
+		{
+			pthread_mutex_unlock(&queue_lock);
+			break;
+		}
+		int count = 0;
+		jobs[count++] = queue_remove(0);
+		if (job_batchable(jobs[0]))
+		{
+			// A removal moves the last job to the index, which is checked again
+			for (int i = 0; i < queue_count && count < options.batch;)
+			{
+				if (jobs_compatible(jobs[0], queue[i]))
+					jobs[count++] = queue_remove(i);
+				else
+					i++;
+			}
+		}
+		pthread_mutex_unlock(&queue_lock);
+		run_batch(jobs, count);
+	}
+	free(jobs);
+	return NULL;
+}
+
+/// @brief Parses the command line
+/// @return 1 if error, 0 if no error
+int get_args(int argc, char **argv)
+{
+	options.socket_file = NULL;
+	options.backend = SIMULATION_BACKEND_OPENCL;
+	options.cpu_threads = 0;
+	options.workers = 2;
+	options.batch = 16;
+	options.batch_cells = 1 << 16;
+	options.kernel_cache = ".kernel_cache";
+	options.precision = PRECISION_FP64;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--backend=opencl") == 0)
+			options.backend = SIMULATION_BACKEND_OPENCL;
+		else if (strcmp(argv[i], "--backend=cpu") == 0)
+			options.backend = SIMULATION_BACKEND_CPU;
+		else if (strncmp(argv[i], "--threads=", 10) == 0)
+			options.cpu_threads = atoi(argv[i] + 10);
+		else if (strncmp(argv[i], "--workers=", 10) == 0)
+			options.workers = atoi(argv[i] + 10);
+		else if (strncmp(argv[i], "--batch=", 8) == 0)
+			options.batch = atoi(argv[i] + 8);
+		else if (strncmp(argv[i], "--batch-cells=", 14) == 0)
+			options.batch_cells = atoi(argv[i] + 14);
+		else if (strncmp(argv[i], "--kernel-cache=", 15) == 0)
+			options.kernel_cache = argv[i] + 15;
+		else if (strcmp(argv[i], "--no-kernel-cache") == 0)
+			options.kernel_cache = NULL;
+		else if (strncmp(argv[i], "--precision=", 12) == 0)
+		{
+			options.precision = precision_parse(argv[i] + 12);
+			if (options.precision < 0)
+			{
+				fprintf(stderr, "Unknown precision '%s', expected fp64, fp32 or fp16\n", argv[i] + 12);
+				return 1;
+			}
+		}
+		else if (argv[i][0] != '-' && options.socket_file == NULL)
+			options.socket_file = argv[i];
+		else
+		{
+			fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+			fprintf(stderr, "Usage: ./server socket_file [--backend=opencl|cpu] [--threads=N] [--workers=N] [--batch=N] "
+							"[--batch-cells=N] [--kernel-cache=dir] [--no-kernel-cache] [--precision=fp64|fp32|fp16]\n");
+			return 1;
+		}
+	}
+	if (options.socket_file == NULL)
+	{
+		fprintf(stderr, "Usage: ./server socket_file [options]\n");
+		return 1;
+	}
+	if (options.workers < 1 || options.batch < 1 || options.batch_cells < 0)
+	{
+		fprintf(stderr, "The workers and the batch size must be positive\n");
+		return 1;
+	}
+	if (options.backend == SIMULATION_BACKEND_CPU && options.precision != PRECISION_FP64)
+	{
+		fprintf(stderr, "The CPU backend only runs in fp64\n");
+		return 1;
+	}
+	return 0;
+}
+
+/// @brief Serves simulation jobs over a Unix domain socket with the device set up once, until a
+// client sends SHUTDOWN
+int main(int argc, char **argv)
+{
+	if (get_args(argc, argv))
+	{
+		return -1;
+	}
+
+	device = simulation_device_create(options.backend, options.precision, options.cpu_threads, options.kernel_cache);
+	if (device == NULL)
+	{
+		return -1;
+	}
+	listen_fd = job_listen(options.socket_file, 64);
+	if (listen_fd < 0)
+	{
+		simulation_device_destroy(device);
+		return -1;
+	}
+
+	pthread_t *workers = (pthread_t *)malloc(sizeof(pthread_t) * options.workers);
+	if (workers == NULL)
+	{
+		perror("Error allocating memory for the workers\n");
+		return -1;
+	}
+	for (int w = 0; w < options.workers; w++)
+		pthread_create(&workers[w], NULL, worker_main, NULL);
+	printf("Listening on %s with %d workers\n", options.socket_file, options.workers);
+	fflush(stdout);
+
+	for (;;)
+	{
+		int fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0)
+		{
+			pthread_mutex_lock(&queue_lock);
+			int stop = stopping;
+			pthread_mutex_unlock(&queue_lock);
+			if (stop)
+				break;
+			continue;
+		}
+		Connection *connection = (Connection *)calloc(1, sizeof(Connection));
+		if (connection == NULL)
+		{
+			perror("Error allocating memory for 'Connection'\n");
+			close(fd);
+			continue;
+		}
+		connection->fd = fd;
+		connection->references = 1;
+		pthread_mutex_init(&connection->lock, NULL);
+		pthread_t reader;
+		if (pthread_create(&reader, NULL, connection_main, connection) != 0)
+		{
+			perror("Error starting a connection thread\n");
+			connection_release(connection);
+			continue;
+		}
+		pthread_detach(reader);
+	}
+
+	for (int w = 0; w < options.workers; w++)
+		pthread_join(workers[w], NULL);
+	close(listen_fd);
+	unlink(options.socket_file);
+
+	long hits, misses;
+	simulation_device_pool_statistics(device, &hits, &misses);
+	printf("Served %ld jobs, %ld failed, in %ld simulations; %ld of %ld device buffers reused from the pool\n",
+		   jobs_done, jobs_failed, batches_run, hits, hits + misses);
+	simulation_device_destroy(device);
+	free(workers);
+	free(queue);
+	return 0;
+}